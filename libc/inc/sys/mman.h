@@ -0,0 +1,34 @@
+/// @file mman.h
+/// @brief Memory management hints and locking.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+#include "stddef.h"
+
+#define MADV_NORMAL     0 ///< No special treatment.
+#define MADV_RANDOM     1 ///< Expect random page references.
+#define MADV_SEQUENTIAL 2 ///< Expect sequential page references.
+#define MADV_WILLNEED   3 ///< Will need these pages.
+#define MADV_DONTNEED   4 ///< Do not need these pages.
+
+/// @brief Gives advice about the use of memory.
+/// @param addr   The starting address of the range, aligned to a page.
+/// @param length The length of the range.
+/// @param advice The advice (e.g., MADV_WILLNEED).
+/// @return 0 on success, -1 on failure and errno is set.
+int madvise(void *addr, size_t length, int advice);
+
+/// @brief Locks the pages of the range in memory, they are populated and
+/// they will not be swapped out.
+/// @param addr   The starting address of the range.
+/// @param length The length of the range.
+/// @return 0 on success, -1 on failure and errno is set.
+int mlock(const void *addr, size_t length);
+
+/// @brief Unlocks the pages of the range.
+/// @param addr   The starting address of the range.
+/// @param length The length of the range.
+/// @return 0 on success, -1 on failure and errno is set.
+int munlock(const void *addr, size_t length);
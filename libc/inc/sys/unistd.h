@@ -49,6 +49,20 @@ int close(int fd);
 /// indicate the error.
 off_t lseek(int fd, off_t offset, int whence);
 
+/// @brief Writes back the modified content of all the filesystems.
+void sync(void);
+
+/// @brief Writes back the modified data and metadata of a file.
+/// @param fd The file descriptor of the file.
+/// @return 0 on success, -1 on failure and errno is set to indicate the error.
+int fsync(int fd);
+
+/// @brief Writes back the modified data of a file, and the metadata needed
+/// to read it back.
+/// @param fd The file descriptor of the file.
+/// @return 0 on success, -1 on failure and errno is set to indicate the error.
+int fdatasync(int fd);
+
 /// @brief Delete a name and possibly the file it refers to.
 /// @param path The path to the file.
 /// @return
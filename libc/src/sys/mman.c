@@ -0,0 +1,14 @@
+/// @file mman.c
+/// @brief Memory management hints and locking functions implementation.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#include "sys/mman.h"
+#include "sys/errno.h"
+#include "system/syscall_types.h"
+
+_syscall3(int, madvise, void *, addr, size_t, length, int, advice)
+
+_syscall2(int, mlock, const void *, addr, size_t, length)
+
+_syscall2(int, munlock, const void *, addr, size_t, length)
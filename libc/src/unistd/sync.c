@@ -0,0 +1,19 @@
+/// @file sync.c
+/// @brief
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#include "sys/unistd.h"
+#include "system/syscall_types.h"
+#include "sys/errno.h"
+
+void sync(void)
+{
+    long __res;
+    __inline_syscall0(__res, sync);
+    (void)__res;
+}
+
+_syscall1(int, fsync, int, fd)
+
+_syscall1(int, fdatasync, int, fd)
@@ -229,6 +229,21 @@ typedef enum {
 #define PCI_VALUE_PORT   0xCFC  ///< TODO: Document.
 #define PCI_NONE         0xFFFF ///< TODO: Document.
 
+/// Maximum number of functions kept in the table filled at boot.
+#define PCI_MAX_DEVICES 64
+
+/// @brief A function found while enumerating the buses.
+typedef struct pci_device_t {
+    /// The device number (bus, slot and function).
+    uint32_t device;
+    /// The vendor ID.
+    uint16_t vendor_id;
+    /// The device ID.
+    uint16_t device_id;
+    /// The class, subclass and programming interface.
+    uint32_t type;
+} pci_device_t;
+
 /// @brief PIC scan function.
 typedef void (*pci_scan_func_t)(uint32_t device, uint16_t vendor_id, uint16_t device_id, void *extra);
 
@@ -328,12 +343,31 @@ void pci_scan_slot(pci_scan_func_t f, int type, int bus, int slot, void *extra);
 /// @param extra the extra arguemnts.
 void pci_scan_bus(pci_scan_func_t f, int type, int bus, void *extra);
 
-/// @brief Scans for the given type of device.
+/// @brief Scans for the given type of device, among the devices found by the
+/// enumeration. The configuration space is not walked again.
 /// @param f the function to call once we have found the device.
-/// @param type the type of device we are searching for.
+/// @param type the type of device we are searching for, -1 for any.
 /// @param extra the extra arguemnts.
 void pci_scan(pci_scan_func_t f, int type, void *extra);
 
+/// @brief Enumerates the buses once, and stores the devices in a table.
+/// Later calls return right away.
+/// @return the number of devices found.
+int pci_initialize(void);
+
+/// @brief Searches the table for the next device with the given IDs.
+/// @param vendor_id the vendor ID.
+/// @param device_id the device ID.
+/// @param prev the previous match, NULL to start from the first device.
+/// @return the device, NULL if there are no more.
+const pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id, const pci_device_t *prev);
+
+/// @brief Searches the table for the next device of the given type.
+/// @param type the class, subclass and programming interface (e.g., 0x010601).
+/// @param prev the previous match, NULL to start from the first device.
+/// @return the device, NULL if there are no more.
+const pci_device_t *pci_find_class(uint32_t type, const pci_device_t *prev);
+
 /// @brief PCI-to-ISA remapping.
 void pci_remap(void);
 
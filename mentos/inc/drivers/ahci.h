@@ -0,0 +1,28 @@
+/// @file ahci.h
+/// @brief Driver for the Serial ATA disks behind an AHCI controller.
+/// @details
+/// The Advanced Host Controller Interface (AHCI) exposes each SATA port with
+/// a list of 32 command slots in memory. With Native Command Queuing (NCQ) the
+/// disk accepts a command for each slot and completes them in any order, so
+/// the driver keeps many requests in flight, rather than one per channel.
+/// Disks are named like the IDE ones (e.g., /dev/hdb), after them.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+/// @addtogroup drivers Device Drivers
+/// @{
+/// @addtogroup ahci Advanced Host Controller Interface (AHCI)
+/// @brief Driver for the Serial ATA disks behind an AHCI controller.
+/// @{
+
+#pragma once
+
+/// @brief Initializes the AHCI driver.
+/// @return 0 on success, 1 on error.
+int ahci_initialize(void);
+
+/// @brief De-initializes the AHCI driver.
+/// @return 0 on success, 1 on error.
+int ahci_finalize(void);
+
+/// @}
+/// @}
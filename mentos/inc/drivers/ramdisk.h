@@ -0,0 +1,31 @@
+/// @file ramdisk.h
+/// @brief Block devices backed by memory (e.g., /dev/ram0).
+/// @details
+/// Each RAM disk is an array of pages, allocated from the buddy system the
+/// first time a sector inside them is written, so unused parts of the disk take
+/// no memory and read back as zeros. The content is lost on reboot.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+/// @addtogroup drivers Device Drivers
+/// @{
+/// @addtogroup ramdisk RAM Disk
+/// @brief Block devices backed by memory.
+/// @{
+
+#pragma once
+
+/// Number of RAM disks.
+#define RAMDISK_COUNT 1
+/// The size of each RAM disk.
+#define RAMDISK_SIZE (8U * 1024U * 1024U)
+
+/// @brief Initializes the RAM disks.
+/// @return 0 on success, 1 on error.
+int ramdisk_initialize(void);
+
+/// @brief De-initializes the RAM disks, freeing their pages.
+/// @return 0 on success, 1 on error.
+int ramdisk_finalize(void);
+
+/// @}
+/// @}
@@ -0,0 +1,29 @@
+/// @file virtio_blk.h
+/// @brief Driver for the paravirtual virtio block devices (legacy PCI).
+/// @details
+/// Under an hypervisor (e.g., QEMU), the virtio block device replaces the
+/// emulated registers of an IDE disk with a ring of descriptors in memory, the
+/// virtqueue: each request is described by a single descriptor, which points to
+/// a table listing its header, its buffers and its status (an indirect
+/// descriptor), and is notified to the hypervisor with a single port write.
+/// Disks are named like the IDE ones (e.g., /dev/hdb), after them.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+/// @addtogroup drivers Device Drivers
+/// @{
+/// @addtogroup virtio_blk Virtio Block Device
+/// @brief Driver for the paravirtual virtio block devices (legacy PCI).
+/// @{
+
+#pragma once
+
+/// @brief Initializes the virtio block driver.
+/// @return 0 on success, 1 on error.
+int virtio_blk_initialize(void);
+
+/// @brief De-initializes the virtio block driver.
+/// @return 0 on success, 1 on error.
+int virtio_blk_finalize(void);
+
+/// @}
+/// @}
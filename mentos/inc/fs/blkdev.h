@@ -0,0 +1,335 @@
+/// @file blkdev.h
+/// @brief Block devices, and the queues of their I/O requests.
+/// @details
+/// Users describe each transfer with a block_bio_t, a run of sectors and the
+/// memory they come from or go to, and submit it to the queue of the device.
+/// Bios which continue, or precede, a queued request of the same direction are
+/// merged into it, so that the driver can transfer them with a single command.
+/// Queues are plugged: requests are handed to the driver only once the queue is
+/// unplugged, in the order chosen by the I/O scheduler of the queue, up to
+/// queue_depth of them at a time, and then as the driver completes them. The
+/// end_io callback of each bio is called once its sectors have been
+/// transferred, possibly from the interrupt handler of the device. Drivers
+/// copy bounced data from that handler too, so the buffers of the bios living
+/// in the memory of a process must be faulted in, with block_fault_in_buffer,
+/// before they are queued: a page fault cannot be served from an interrupt.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+#include "fs/vfs_types.h"
+#include "klib/list_head.h"
+#include "hardware/timer.h"
+
+/// Name of the I/O scheduler used by new queues.
+#define BLOCK_DEFAULT_SCHEDULER "deadline"
+/// Ticks after which the deadline scheduler serves a queued read first.
+#define BLOCK_READ_EXPIRE (TICKS_PER_SECOND / 2)
+/// Ticks after which the deadline scheduler serves a queued write first.
+#define BLOCK_WRITE_EXPIRE (5 * TICKS_PER_SECOND)
+/// Ticks after which a waiter asks the drivers to check their devices, in
+/// case an interrupt got lost.
+#define BLOCK_POLL_INTERVAL (TICKS_PER_SECOND / 10)
+
+/// Maximum number of slots of a device, one bit for each of them.
+#define BLOCK_MAX_SLOTS 32U
+
+/// The bio, or request, reads from the device.
+#define BLOCK_READ 0
+/// The bio, or request, writes on the device.
+#define BLOCK_WRITE 1
+
+typedef struct block_bio_t block_bio_t;
+typedef struct block_request_t block_request_t;
+typedef struct block_device_t block_device_t;
+
+/// @brief Function called once the sectors of a bio have been transferred.
+/// @param bio The bio.
+/// @param error 0 on success, a negative error code on failure.
+typedef void (*block_end_io_t)(block_bio_t *bio, int error);
+
+/// @brief A transfer between a run of sectors and a buffer.
+struct block_bio_t {
+    /// The first sector.
+    uint32_t sector;
+    /// The number of sectors.
+    uint32_t count;
+    /// The buffer, with room for all the sectors.
+    uint8_t *buffer;
+    /// BLOCK_READ or BLOCK_WRITE.
+    int direction;
+    /// Called once the transfer is done.
+    block_end_io_t end_io;
+    /// Data of the submitter.
+    void *private;
+    /// Set when the bio writes back cached data, which was charged to the
+    /// processes which dirtied it.
+    int writeback;
+    /// List of bios of the same request, in the order of their sectors.
+    list_head list;
+};
+
+/// @brief A run of sectors transferred by the driver with a single command.
+struct block_request_t {
+    /// The first sector.
+    uint32_t sector;
+    /// The number of sectors.
+    uint32_t count;
+    /// BLOCK_READ or BLOCK_WRITE.
+    int direction;
+    /// The bios of the request, in the order of their sectors.
+    list_head bios;
+    /// Number of bios of the request.
+    uint32_t nr_bios;
+    /// When the request was queued, in timer ticks.
+    unsigned long start_time;
+    /// When the request should be served, in timer ticks.
+    unsigned long deadline;
+    /// List of requests in the order chosen by the I/O scheduler.
+    list_head queuelist;
+    /// List of requests in the order they were queued, one for each direction.
+    list_head fifo;
+};
+
+/// @brief An I/O scheduler, which decides the order of the requests.
+typedef struct block_scheduler_t {
+    /// Name of the scheduler.
+    const char *name;
+    /// Adds a new request to the queue.
+    void (*add)(block_device_t *dev, block_request_t *request);
+    /// Repositions a request whose first sector changed after a merge, NULL
+    /// if the position does not depend on it.
+    void (*merged)(block_device_t *dev, block_request_t *request);
+    /// Returns the next request to serve, NULL if there is none. The queue
+    /// removes it from its lists.
+    block_request_t *(*next)(block_device_t *dev);
+} block_scheduler_t;
+
+/// @brief Operations implemented by the driver of a block device.
+typedef struct block_device_operations_t {
+    /// Starts the transfer of a request. It returns 0 if the transfer started,
+    /// -EBUSY if the device cannot accept it now, another negative error code
+    /// if it failed. Once a started transfer is done, the driver calls
+    /// block_end_request.
+    int (*submit)(block_device_t *dev, block_request_t *request);
+    /// Checks if the device completed the requests in flight, in case the
+    /// interrupt got lost. It can be NULL.
+    void (*poll)(block_device_t *dev);
+} block_device_operations_t;
+
+/// @brief The queue of the requests of a block device.
+typedef struct block_queue_t {
+    /// The I/O scheduler.
+    const block_scheduler_t *scheduler;
+    /// Requests, in the order chosen by the scheduler.
+    list_head sorted;
+    /// Requests, in the order they were queued, for each direction.
+    list_head fifo[2];
+    /// Number of requests handed to the driver, and not completed yet.
+    uint32_t nr_active;
+    /// The request chosen by the scheduler, which the driver could not accept.
+    block_request_t *pending;
+    /// The sector following the last request handed to the driver.
+    uint32_t last_sector;
+    /// Number of queued requests, the ones in flight excluded.
+    uint32_t nr_requests;
+    /// Set while requests are handed to the driver.
+    int dispatching;
+} block_queue_t;
+
+/// @brief The I/O statistics of a block device, shown in `/proc/diskstats`.
+typedef struct block_stats_t {
+    /// Requests completed, for each direction.
+    unsigned long ios[2];
+    /// Bios merged into a queued request, for each direction.
+    unsigned long merges[2];
+    /// Sectors transferred, for each direction.
+    unsigned long sectors[2];
+    /// Ticks spent by the completed requests from queueing to completion, for
+    /// each direction.
+    unsigned long ticks[2];
+    /// Requests queued or handed to the driver, and not completed yet.
+    unsigned long in_flight;
+    /// Ticks during which the device had requests in flight.
+    unsigned long io_ticks;
+    /// Sum of the ticks spent in flight by each request.
+    unsigned long time_in_queue;
+    /// When io_ticks and time_in_queue were last updated, in timer ticks.
+    unsigned long stamp;
+} block_stats_t;
+
+/// @brief The requests a driver keeps in flight, one for each command slot of
+/// the device, with the bounce buffers they use.
+typedef struct block_slots_t {
+    /// The slots in flight, one bit for each of them.
+    uint32_t busy;
+    /// The request of each slot in flight.
+    block_request_t *requests[BLOCK_MAX_SLOTS];
+    /// The bounce buffer of each slot in flight, if any.
+    uint8_t *bounce[BLOCK_MAX_SLOTS];
+} block_slots_t;
+
+/// @brief A block device.
+struct block_device_t {
+    /// Name of the device.
+    char name[NAME_MAX];
+    /// The file of the device.
+    vfs_file_t *file;
+    /// The size of a sector.
+    uint32_t sector_size;
+    /// Maximum number of sectors of a request.
+    uint32_t max_sectors;
+    /// Maximum number of bios of a request.
+    uint32_t max_bios;
+    /// Maximum number of requests the device keeps in flight.
+    uint32_t queue_depth;
+    /// Operations implemented by the driver.
+    const block_device_operations_t *ops;
+    /// The queue of the requests.
+    block_queue_t queue;
+    /// The I/O statistics.
+    block_stats_t stats;
+    /// List of block devices.
+    list_head list;
+};
+
+/// @brief Initializes the block layer.
+void block_initialize(void);
+
+/// @brief Registers a block device, the driver fills all the fields except the
+/// queue and the list.
+/// @param dev The block device.
+/// @return 0 on success, -1 on failure.
+int block_register_device(block_device_t *dev);
+
+/// @brief Unregisters a block device, which must be idle, e.g., because the
+/// driver failed to set it up.
+/// @param dev The block device.
+void block_unregister_device(block_device_t *dev);
+
+/// @brief Gets the physical address of a buffer, inside lowmem or inside the
+/// memory of the current process, for a DMA transfer.
+/// @param addr The address of the buffer.
+/// @param to_memory 1 if the device writes in the buffer.
+/// @param physical Where the physical address is stored.
+/// @return 1 if the device can reach the buffer, 0 if it needs a bounce buffer.
+int block_get_physical_address(uintptr_t addr, int to_memory, uintptr_t *physical);
+
+/// @brief Makes the pages of a buffer, inside the memory of the current
+/// process, present and, for reads, privately writable. It must be called
+/// before queuing bios which use the buffer; buffers inside lowmem are left
+/// untouched.
+/// @param buffer The buffer.
+/// @param size The size of the buffer.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return 0 on success, -EFAULT if part of the buffer is not mapped.
+int block_fault_in_buffer(uint8_t *buffer, size_t size, int direction);
+
+/// @brief Copies the data between the bios of a request and a contiguous
+/// bounce buffer, used by the drivers when the device cannot reach the bios.
+/// @param request The request.
+/// @param bounce The bounce buffer, with room for all the sectors.
+/// @param sector_size The size of a sector.
+/// @param to_bounce 1 to copy the bios into the bounce buffer, 0 to copy the
+/// bounce buffer into the bios.
+void block_request_copy(block_request_t *request, uint8_t *bounce, uint32_t sector_size, int to_bounce);
+
+/// @brief Picks a free slot, among the first queue_depth ones.
+/// @param dev The block device.
+/// @param slots The slots of the device.
+/// @return The slot, -EBUSY if all of them are in use.
+int block_slot_get(block_device_t *dev, block_slots_t *slots);
+
+/// @brief Allocates a bounce buffer for the request of a slot, used when the
+/// device cannot reach the bios, and fills it with the data of a write.
+/// @param dev The block device.
+/// @param slots The slots of the device.
+/// @param slot The slot.
+/// @param request The request.
+/// @return The bounce buffer, freed once the slot ends, NULL if there is no memory.
+uint8_t *block_slot_bounce(block_device_t *dev, block_slots_t *slots, unsigned slot, block_request_t *request);
+
+/// @brief Marks a slot as in flight, it must be called before telling the
+/// device about the request.
+/// @param slots The slots of the device.
+/// @param slot The slot.
+/// @param request The request.
+void block_slot_start(block_slots_t *slots, unsigned slot, block_request_t *request);
+
+/// @brief Ends the request of a slot, from the interrupt handler too: copies a
+/// bounced read into the bios, frees the slot, and then ends the request, which
+/// might hand the driver the next one on the same slot.
+/// @param dev The block device.
+/// @param slots The slots of the device.
+/// @param slot The slot.
+/// @param error 0 on success, a negative error code on failure.
+void block_slot_end(block_device_t *dev, block_slots_t *slots, unsigned slot, int error);
+
+/// @brief Gives the name of the next disk (e.g., "hda"), letters are shared by
+/// all the disk drivers.
+/// @param name Where the name is stored, at least NAME_MAX characters.
+void block_get_disk_name(char *name);
+
+/// @brief Searches the block device associated with a file.
+/// @param file The file.
+/// @return The block device, NULL if the file is not a block device.
+block_device_t *block_get_device(vfs_file_t *file);
+
+/// @brief Iterates over the registered block devices.
+/// @param dev The current block device, NULL to get the first one.
+/// @return The next block device, NULL if there are no more.
+block_device_t *block_next_device(block_device_t *dev);
+
+/// @brief Gets the I/O statistics of a block device, up to date.
+/// @param dev The block device.
+/// @param stats Where the statistics are stored.
+void block_get_stats(block_device_t *dev, block_stats_t *stats);
+
+/// @brief Changes the I/O scheduler of a block device, it must be idle.
+/// @param dev The block device.
+/// @param name The name of the scheduler (e.g., "noop").
+/// @return 0 on success, -1 if there is no such scheduler or the device is busy.
+int block_set_scheduler(block_device_t *dev, const char *name);
+
+/// @brief Queues a bio, merging it with a queued request if possible. It is
+/// transferred once the queue is unplugged.
+/// @param dev The block device.
+/// @param bio The bio, which must stay valid until its end_io is called.
+void block_submit_bio(block_device_t *dev, block_bio_t *bio);
+
+/// @brief Hands the queued requests to the driver.
+/// @param dev The block device, NULL for all the devices.
+void block_unplug(block_device_t *dev);
+
+/// @brief Called by the driver once a request handed to it is done. It
+/// completes the bios of the request, and hands the next ones to the driver.
+/// @param dev The block device.
+/// @param request The request.
+/// @param error 0 on success, a negative error code on failure.
+void block_end_request(block_device_t *dev, block_request_t *request, int error);
+
+/// @brief Waits until the counter drops to zero, e.g., because the end_io of
+/// the bios we submitted decrement it, keeping the CPU halted meanwhile.
+/// @param pending The counter.
+void block_wait(volatile uint32_t *pending);
+
+/// @brief Reads, or writes, a run of sectors and waits for the transfer.
+/// @param dev The block device.
+/// @param sector The first sector.
+/// @param count The number of sectors.
+/// @param buffer The buffer.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return 0 on success, a negative error code on failure.
+int block_rw(block_device_t *dev, uint32_t sector, uint32_t count, uint8_t *buffer, int direction);
+
+/// @brief Reads, or writes, a range of bytes and waits for the transfer. The
+/// whole sectors go directly from, or to, the buffer, while the partial ones at
+/// the edges go through a staging area.
+/// @param dev The block device.
+/// @param offset The offset of the first byte.
+/// @param size The number of bytes.
+/// @param buffer The buffer.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return 0 on success, a negative error code on failure.
+int block_rw_bytes(block_device_t *dev, uint32_t offset, size_t size, uint8_t *buffer, int direction);
@@ -0,0 +1,180 @@
+/// @file buffer_cache.h
+/// @brief Cache of the blocks of block devices.
+/// @details
+/// Each cached block is described by a buffer head, identified by the device
+/// and by the index of the block. Buffers are found through a hash table, are
+/// reference counted while in use, and the unused ones are kept in LRU order
+/// so that the least recently used are evicted first once the cache reaches
+/// BUFFER_CACHE_MAX_SIZE. Dirty buffers are kept in the order they were
+/// modified, and written back by the flusher, driven by the timer, once they
+/// are older than BUFFER_DIRTY_EXPIRE or while they exceed
+/// BUFFER_DIRTY_BACKGROUND_RATIO of the cache. Writers which push them beyond
+/// BUFFER_DIRTY_RATIO write some of them back themselves. Dirty buffers are
+/// also written back before being evicted. On block devices, buffers are
+/// written back asynchronously: they are queued on the device, and stay in use
+/// until the transfer completes. Drivers serve the raw reads and writes of
+/// their devices with buffer_rw_raw, which keeps them coherent with the cache.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+#include "fs/vfs_types.h"
+#include "klib/list_head.h"
+#include "hardware/timer.h"
+#include "fs/blkdev.h"
+
+#ifndef BUFFER_CACHE_MAX_SIZE
+/// Maximum amount of memory used to store the content of the blocks, it can
+/// be changed at build time (e.g., cmake -DBUFFER_CACHE_SIZE_KB=8192).
+#define BUFFER_CACHE_MAX_SIZE (4U * 1024U * 1024U)
+#endif
+/// Number of buckets of the hash table.
+#define BUFFER_CACHE_HASH_BUCKETS 512
+/// Maximum size of a single read issued by buffer_read_ahead.
+#define BUFFER_READAHEAD_MAX_SIZE (64U * 1024U)
+/// Number of timer ticks between two runs of the flusher.
+#define BUFFER_FLUSH_INTERVAL (TICKS_PER_SECOND / 2)
+/// Age, in timer ticks, after which a dirty buffer is written back.
+#define BUFFER_DIRTY_EXPIRE (5 * TICKS_PER_SECOND)
+/// Percentage of the cache which can be dirty before the flusher starts
+/// writing back buffers which are not expired yet.
+#define BUFFER_DIRTY_BACKGROUND_RATIO 10
+/// Percentage of the cache which can be dirty before writers are throttled.
+#define BUFFER_DIRTY_RATIO 20
+/// Maximum number of buffers written back by each run of the flusher.
+#define BUFFER_FLUSH_BATCH 64
+
+/// The content of the buffer matches, or is newer than, the one on disk.
+#define BH_UPTODATE 0x01U
+/// The content of the buffer must be written back.
+#define BH_DIRTY 0x02U
+/// The buffer is being written back.
+#define BH_WRITEBACK 0x04U
+/// The buffer is being read in advance.
+#define BH_READING 0x08U
+
+/// @brief Describes a cached block.
+typedef struct buffer_head_t {
+    /// The block device.
+    vfs_file_t *device;
+    /// The index of the block.
+    uint32_t block;
+    /// The size of the block.
+    uint32_t size;
+    /// The content of the block.
+    uint8_t *data;
+    /// The state of the buffer (e.g., BH_DIRTY).
+    unsigned int flags;
+    /// The number of users of the buffer.
+    int count;
+    /// List of buffers inside the same bucket of the hash table.
+    list_head hash;
+    /// List of buffers in LRU order, the most recently used are at the front.
+    list_head lru;
+    /// List of dirty buffers, in the order they were modified.
+    list_head dirty;
+    /// When the buffer became dirty, in timer ticks.
+    unsigned long dirtied;
+    /// The bio which writes the buffer back.
+    block_bio_t bio;
+} buffer_head_t;
+
+/// @brief Statistics about the buffer cache.
+typedef struct buffer_cache_info_t {
+    /// Number of cached blocks.
+    unsigned long nr_buffers;
+    /// Number of blocks which must be written back.
+    unsigned long nr_dirty;
+    /// Memory used to store the content of the blocks, in bytes.
+    unsigned long size;
+    /// Number of lookups which found the block inside the cache.
+    unsigned long hits;
+    /// Number of lookups which had to read the block from the device.
+    unsigned long misses;
+    /// Number of blocks read in advance.
+    unsigned long readahead;
+    /// Number of blocks being read in advance.
+    uint32_t nr_reading;
+    /// Number of blocks written back by the flusher.
+    unsigned long flushed;
+    /// Number of blocks being written back.
+    uint32_t nr_writeback;
+    /// Number of blocks which could not be written back.
+    unsigned long write_errors;
+} buffer_cache_info_t;
+
+/// @brief Initializes the buffer cache.
+void buffer_cache_initialize(void);
+
+/// @brief Gets the buffer of a block, without reading its content, waiting
+/// for it if it is being read in advance.
+/// @param device The block device.
+/// @param block  The index of the block.
+/// @param size   The size of the block.
+/// @return The buffer, NULL on failure. Check BH_UPTODATE before using its
+/// content, and release it with buffer_release.
+buffer_head_t *buffer_get(vfs_file_t *device, uint32_t block, uint32_t size);
+
+/// @brief Gets the buffer of a block, reading its content if needed.
+/// @param device The block device.
+/// @param block  The index of the block.
+/// @param size   The size of the block.
+/// @return The buffer, NULL on failure. Release it with buffer_release.
+buffer_head_t *buffer_read(vfs_file_t *device, uint32_t block, uint32_t size);
+
+/// @brief Reads in advance the blocks of a range which are not cached yet,
+/// each run of missing blocks with a single request to the device. On block
+/// devices it does not wait for the transfers: the buffers are marked
+/// BH_READING until they complete.
+/// @param device The block device.
+/// @param block  The index of the first block.
+/// @param count  The number of blocks.
+/// @param size   The size of the blocks.
+/// @return The number of blocks whose read started, or -1 on failure.
+int buffer_read_ahead(vfs_file_t *device, uint32_t block, uint32_t count, uint32_t size);
+
+/// @brief Releases a buffer.
+/// @param bh The buffer.
+void buffer_release(buffer_head_t *bh);
+
+/// @brief Marks the buffer as modified, it will be written back. The current
+/// process is charged for the write of a clean buffer.
+/// @param bh The buffer.
+void buffer_mark_dirty(buffer_head_t *bh);
+
+/// @brief Writes the buffer back, if it is dirty, and waits for it.
+/// @param bh The buffer.
+/// @return 0 on success, -1 on failure.
+int buffer_sync(buffer_head_t *bh);
+
+/// @brief Writes back all the dirty buffers of a device, and waits for them.
+/// @param device The block device, NULL for all the devices.
+/// @return 0 on success, -1 if some buffer could not be written.
+int buffer_sync_device(vfs_file_t *device);
+
+/// @brief Starts writing back the dirty buffers which expired, and the oldest
+/// ones while there are too many of them, without waiting for them.
+/// @param count The maximum number of buffers to write back.
+/// @return The number of buffers whose writeback started.
+unsigned int buffer_flush(unsigned int count);
+
+/// @brief Drops all the unused buffers of a device, writing back the dirty ones.
+/// @param device The block device.
+void buffer_invalidate_device(vfs_file_t *device);
+
+/// @brief Reads, or writes, a range of bytes of a block device without going
+/// through the cache, e.g., for the reads and writes of `/dev/hda`. The dirty
+/// buffers inside the range are written back first, and the cached copies of
+/// the range are updated after a write.
+/// @param dev    The block device.
+/// @param offset The offset of the first byte.
+/// @param size   The number of bytes.
+/// @param buffer The buffer.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return 0 on success, a negative error code on failure.
+int buffer_rw_raw(block_device_t *dev, uint32_t offset, size_t size, uint8_t *buffer, int direction);
+
+/// @brief Retrieves the statistics about the buffer cache.
+/// @param info Where the statistics are stored.
+void buffer_cache_get_info(buffer_cache_info_t *info);
@@ -0,0 +1,19 @@
+/// @file initramfs.h
+/// @brief Root filesystem unpacked from an archive loaded by the bootloader.
+/// @details
+/// When the bootloader passes a cpio (newc) or tar (ustar) archive as a
+/// multiboot module, its content is unpacked into a tmpfs mounted on `/`, so
+/// that init and the core programs are loaded from memory. The disk is then
+/// mounted below it, at INITRAMFS_DISK_PATH.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+/// Where the disk is mounted, when the root comes from the initramfs.
+#define INITRAMFS_DISK_PATH "/mnt"
+
+/// @brief Mounts a tmpfs on `/` and unpacks the initramfs inside it.
+/// @return 0 on success, -ENOENT if there is no archive among the modules,
+/// another negative error code on failure.
+int initramfs_initialize(void);
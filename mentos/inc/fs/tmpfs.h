@@ -0,0 +1,28 @@
+/// @file tmpfs.h
+/// @brief Filesystem which keeps its files in memory.
+/// @details
+/// The inodes, the directory tree and the pages with the content of the files
+/// live in kernel memory, so reads and writes are plain copies, and nothing
+/// survives a reboot. Each mount has its own limits, given by the mount options
+/// (e.g., "size=16M,nr_inodes=1024"), beyond which writes fail with ENOSPC.
+/// The permissions of the root directory are given in octal by the "mode"
+/// option (e.g., "mode=1777" for a directory like /tmp).
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+/// Maximum size of the content of the files of a mount, unless specified.
+#define TMPFS_DEFAULT_SIZE (16U * 1024U * 1024U)
+/// Maximum number of inodes of a mount, unless specified.
+#define TMPFS_DEFAULT_INODES 1024U
+/// Permissions of the root directory of a mount, unless specified.
+#define TMPFS_DEFAULT_MODE 0755U
+
+/// @brief Initializes the tmpfs filesystem.
+/// @return 0 on success, 1 on error.
+int tmpfs_initialize(void);
+
+/// @brief De-initializes the tmpfs filesystem.
+/// @return 0 on success, 1 on error.
+int tmpfs_finalize(void);
@@ -94,6 +94,18 @@ int vfs_getdents(vfs_file_t *file, dirent_t *dirp, off_t off, size_t count);
 /// @return Return value depends on REQUEST. Usually -1 indicates error.
 int vfs_ioctl(vfs_file_t *file, int request, void *data);
 
+/// @brief Writes back the modified content of a file.
+/// @param file     The file.
+/// @param datasync 1 if only the data, and the metadata needed to read it
+///                 back, must be written, 0 otherwise.
+/// @return 0 on success, a negative error code on failure.
+int vfs_fsync(vfs_file_t *file, int datasync);
+
+/// @brief Writes back the modified content of all the mounted filesystems,
+/// and all the dirty blocks.
+/// @return 0 on success, a negative error code on failure.
+int vfs_sync(void);
+
 /// @brief Delete a name and possibly the file it refers to.
 /// @param path The path to the file.
 /// @return On success, zero is returned. On error, -1 is returned, and
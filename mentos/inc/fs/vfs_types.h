@@ -44,6 +44,8 @@ typedef int (*vfs_stat_callback)(const char *, stat_t *);
 typedef int (*vfs_fstat_callback)(vfs_file_t *, stat_t *);
 /// Function used to perform ioctl on files.
 typedef int (*vfs_ioctl_callback)(vfs_file_t *, int, void *);
+/// Function used to write back the modified content of files.
+typedef int (*vfs_fsync_callback)(vfs_file_t *, int);
 
 /// @brief Filesystem information.
 typedef struct file_system_type {
@@ -85,10 +87,25 @@ typedef struct vfs_file_operations_t {
     vfs_fstat_callback stat_f;
     /// Perform ioctl on file.
     vfs_ioctl_callback ioctl_f;
+    /// Write back the modified content of the file.
+    vfs_fsync_callback fsync_f;
     /// Read entries inside the directory.
     vfs_getdents_callback getdents_f;
 } vfs_file_operations_t;
 
+/// @brief Readahead state of an opened file, in blocks of the filesystem.
+typedef struct file_ra_state_t {
+    /// The first block of the current readahead window.
+    uint32_t start;
+    /// The number of blocks of the window, 0 if the access is not sequential.
+    uint32_t size;
+    /// Once the reader enters the last async_size blocks of the window, the
+    /// next window is read.
+    uint32_t async_size;
+    /// The last block read.
+    uint32_t prev_block;
+} file_ra_state_t;
+
 /// @brief Data structure that contains information about the mounted filesystems.
 struct vfs_file_t {
     /// The filename.
@@ -125,6 +142,8 @@ struct vfs_file_t {
     vfs_file_operations_t *fs_operations;
     /// Offset for read operations.
     size_t f_pos;
+    /// Readahead state.
+    file_ra_state_t ra;
     /// The number of links.
     uint32_t nlink;
     /// List to hold all active files associated with a specific entry in a filesystem.
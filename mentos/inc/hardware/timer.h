@@ -56,6 +56,21 @@ unsigned long timer_get_ticks();
 /// @param hz The frequency to set.
 void timer_phase(const uint32_t hz);
 
+/// @brief Reads the time stamp counter, scaled down to fit 32 bits. Unlike the
+/// ticks, it advances also while the interrupts are disabled.
+/// @return the current value, wrapping around about every hour.
+uint32_t timer_get_cycles(void);
+
+/// @brief Measures the rate of timer_get_cycles against the channel 2 of the
+/// PIT. It takes about 10 milliseconds, and leaves the rate unknown if the
+/// channel does not count.
+void timer_calibrate_cycles(void);
+
+/// @brief Converts a difference between two values of timer_get_cycles.
+/// @param cycles the difference.
+/// @return the time in microseconds, zero before the calibration.
+uint32_t timer_cycles_to_us(uint32_t cycles);
+
 // ===============================================================================
 // Per-CPU timer vectors
 
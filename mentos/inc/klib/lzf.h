@@ -0,0 +1,31 @@
+/// @file lzf.h
+/// @brief Fast LZ77-family compressor, compatible with the LZF format.
+/// @details
+/// The stream is a sequence of chunks, each starting with a control byte:
+///  - `000LLLLL` : a run of L + 1 literal bytes follows;
+///  - `LLLOOOOO` : a back-reference of L + 2 bytes, at distance
+///    (O << 8) + next byte + 1. If L is 7, the next byte is added to L.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+#include "stddef.h"
+
+/// @brief Compresses a buffer.
+/// @param in_data  The data to compress.
+/// @param in_len   The length of the data.
+/// @param out_data The output buffer.
+/// @param out_len  The size of the output buffer.
+/// @return The length of the compressed data, 0 if it does not fit.
+/// @details It is not reentrant, the hash table is statically allocated.
+size_t lzf_compress(const void *in_data, size_t in_len, void *out_data, size_t out_len);
+
+/// @brief Decompresses a buffer.
+/// @param in_data  The compressed data.
+/// @param in_len   The length of the compressed data.
+/// @param out_data The output buffer.
+/// @param out_len  The size of the output buffer.
+/// @return The length of the decompressed data, 0 on corrupted input or if
+/// the data does not fit.
+size_t lzf_decompress(const void *in_data, size_t in_len, void *out_data, size_t out_len);
@@ -92,6 +92,16 @@ typedef unsigned int gfp_t;
 
 /// @}
 
+/// @defgroup ActionModifiers Action Modifiers
+/// @brief Change the behaviour of the allocation itself.
+/// @{
+
+/// @brief Returns zeroed page frames on success. Single pages are taken from
+/// the pool of pre-zeroed pages of the zone, when it is not empty.
+#define __GFP_ZERO ___GFP_ZERO
+
+/// @}
+
 /// @defgroup gfp_flag_combinations Flag Combinations
 /// @brief Useful GFP flag combinations.
 /// @details
@@ -0,0 +1,56 @@
+/// @file ksm.h
+/// @brief Merging of anonymous user pages with the same content.
+/// @details
+/// A scanner, driven by the timer, walks the memory of the processes looking
+/// for single anonymous pages with the same content. Each page is hashed, the
+/// match is confirmed by comparing the content, and the pages are merged into
+/// a single read-only page, shared by means of its reference counter. The
+/// first write on a merged page gets a private copy back from the page fault
+/// handler, as with any other copy-on-write page.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+#include "mem/zone_allocator.h"
+
+/// Number of timer ticks between two runs of the scanner.
+#define KSM_SCAN_INTERVAL 10
+/// Maximum number of pages hashed during each run of the scanner.
+#define KSM_SCAN_BATCH 8
+/// Maximum number of page table entries visited during each run of the scanner.
+#define KSM_SCAN_MAX_ENTRIES 1024
+/// Number of buckets of the tables of merged and candidate pages.
+#define KSM_HASH_BUCKETS 1024
+
+/// @brief Statistics about page merging.
+typedef struct ksm_info_t {
+    /// Number of merged pages.
+    unsigned long pages_shared;
+    /// Number of mappings of merged pages, except the first one of each page,
+    /// i.e., the number of pages saved.
+    unsigned long pages_sharing;
+    /// Number of pages waiting for an identical one.
+    unsigned long pages_unshared;
+    /// Number of pages hashed so far.
+    unsigned long pages_scanned;
+    /// Number of times the scanner walked the memory of all the processes.
+    unsigned long full_scans;
+} ksm_info_t;
+
+/// @brief Initializes page merging.
+void ksm_initialize(void);
+
+/// @brief Advances the scanner, merging the identical pages it finds.
+/// @param count The maximum number of pages to hash.
+/// @return The number of pages hashed.
+unsigned int ksm_scan_pages(unsigned int count);
+
+/// @brief Removes a merged page from the table of merged pages, because it
+/// is going to be freed, or because its last user is taking it back.
+/// @param page The merged page.
+void ksm_unmerge_page(page_t *page);
+
+/// @brief Retrieves the statistics about page merging.
+/// @param info Where the statistics are stored.
+void ksm_get_info(ksm_info_t *info);
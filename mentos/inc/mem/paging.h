@@ -49,6 +49,10 @@ typedef struct page_table_entry_t {
     unsigned int frame : 20;     ///< TODO: Comment.
 } page_table_entry_t;
 
+/// @brief Value of the `available` bits of a not-present page table entry
+/// whose `frame` holds the index of the swap slot containing the page.
+#define PTE_AVAILABLE_SWAP 2U
+
 /// @brief Flags associated with virtual memory areas.
 enum MEMMAP_FLAGS {
     MM_USER    = 0x1, ///< Area belongs to user.
@@ -60,6 +64,15 @@ enum MEMMAP_FLAGS {
     MM_UPDADDR = 0x20, ///< Check?
 };
 
+/// @brief Access pattern hints of virtual memory areas, set by `madvise`.
+enum VM_AREA_FLAGS {
+    VM_SEQ_READ  = 0x1, ///< Pages are accessed sequentially, fault around.
+    VM_RAND_READ = 0x2, ///< Pages are accessed randomly, never fault around.
+};
+
+/// Number of pages populated after the faulting one, on sequential areas.
+#define FAULT_AROUND_PAGES 8
+
 /// @brief A page table.
 /// @details
 /// It contains 1024 entries which can be addressed by 10 bits (log_2(1024)).
@@ -171,8 +184,9 @@ static inline void paging_enable()
 {
     // Clear the PSE bit from cr4.
     set_cr4(bitmask_clear(get_cr4(), CR4_PSE));
-    // Set the PG bit in cr0.
-    set_cr0(bitmask_set(get_cr0(), CR0_PG));
+    // Set the PG bit in cr0, and the WP bit so that the kernel cannot write
+    // on read-only user pages (e.g., merged pages) without faulting.
+    set_cr0(bitmask_set(get_cr0(), CR0_PG | CR0_WP));
 }
 
 /// @brief Returns if paging is enabled.
@@ -193,6 +207,43 @@ void page_fault_handler(pt_regs *f);
 /// @return Pointer to the page.
 page_t *mem_virtual_to_page(page_directory_t *pgdir, uint32_t virt_start, size_t *size);
 
+/// @brief Gets the page table entry that maps a virtual address.
+/// @param pgdir The target page directory.
+/// @param vaddr The virtual address to query.
+/// @return Pointer to the page table entry, NULL if the page table is missing.
+page_table_entry_t *mem_virtual_to_pte(page_directory_t *pgdir, uint32_t vaddr);
+
+/// @brief Finds the memory area containing the given address.
+/// @param mm    The memory descriptor.
+/// @param vaddr The virtual address.
+/// @return The memory area, NULL if the address is not mapped.
+vm_area_struct_t *find_vm_area(mm_struct_t *mm, uint32_t vaddr);
+
+/// @brief Makes sure that the page mapped at the given address is present,
+/// and that it is not shared with other processes if we want to write on it.
+/// @param pgdir The target page directory.
+/// @param vaddr The virtual address.
+/// @param write If the page must be privately writable.
+/// @return 0 on success, -1 if the address is not mapped.
+int mem_populate_page(page_directory_t *pgdir, uint32_t vaddr, int write);
+
+/// @brief Frees the page mapped at the given address, if it is a single
+/// anonymous page, so that the next access gets a new zeroed page. Pages
+/// belonging to a larger block (e.g., the heap) are cleared in place.
+/// @param pgdir The target page directory.
+/// @param vaddr The virtual address.
+/// @return 1 if the page was freed, 0 if it was cleared in place or nothing
+/// is mapped there, -1 if the page is locked and was left untouched.
+int mem_discard_page(page_directory_t *pgdir, uint32_t vaddr);
+
+/// @brief Checks if the page mapped by the entry has been swapped out.
+/// @param entry The page table entry.
+/// @return 1 if the page is inside the swap area, 0 otherwise.
+static inline int pte_is_swapped(page_table_entry_t *entry)
+{
+    return !entry->present && !entry->kernel_cow && (entry->available == PTE_AVAILABLE_SWAP);
+}
+
 /// @brief Creates a virtual to physical mapping, incrementing pages usage counters.
 /// @param pgd        The target page directory.
 /// @param virt_start The virtual address to map to.
@@ -0,0 +1,65 @@
+/// @file swap.h
+/// @brief Swapping of anonymous user pages to a block device.
+/// @details
+/// The swap area is a whole block device (e.g., `/dev/hdb`) formatted with
+/// `mkswap`. Its first page contains the header, so the slot zero is never
+/// used, and a not-present page table entry whose `available` bits are equal
+/// to PTE_AVAILABLE_SWAP keeps the index of the slot inside its `frame`.
+/// When there is no swap device, the slots are kept compressed in memory
+/// instead (see zram.h).
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+#include "mem/paging.h"
+
+/// The device used as swap area.
+#define SWAP_DEVICE "/dev/hdb"
+/// Minimum number of pages reclaimed when an allocation fails.
+#define SWAP_RECLAIM_BATCH 32
+
+/// @brief Statistics about the swap area.
+typedef struct swap_info_t {
+    /// Total number of usable slots.
+    unsigned long total_slots;
+    /// Number of free slots.
+    unsigned long free_slots;
+    /// Number of pages read back from the swap area.
+    unsigned long pswpin;
+    /// Number of pages written to the swap area.
+    unsigned long pswpout;
+} swap_info_t;
+
+/// @brief Initializes the swap area on the given device.
+/// @param path The path of the block device.
+/// @return 0 on success, -1 on failure.
+int swap_initialize(const char *path);
+
+/// @brief Initializes a swap area which keeps the pages compressed in memory.
+/// @param nr_pages The number of pages that can be swapped out.
+/// @return 0 on success, -1 on failure.
+int swap_initialize_zram(uint32_t nr_pages);
+
+/// @brief Checks if there is an active swap area.
+/// @return 1 if swapping is enabled, 0 otherwise.
+int swap_enabled(void);
+
+/// @brief Swaps out anonymous user pages, using a clock algorithm on the
+/// accessed bit of their page table entries to approximate LRU.
+/// @param count The number of pages we want to free.
+/// @return The number of pages actually swapped out.
+unsigned int swap_reclaim_pages(unsigned int count);
+
+/// @brief Brings back a swapped out page, and releases its slot.
+/// @param entry The page table entry of the swapped page.
+/// @return 0 on success, -1 on failure.
+int swap_in(page_table_entry_t *entry);
+
+/// @brief Releases the slot referenced by a swapped page table entry.
+/// @param entry The page table entry of the swapped page.
+void swap_free_entry(page_table_entry_t *entry);
+
+/// @brief Retrieves the statistics about the swap area.
+/// @param info Where the statistics are stored.
+void swap_get_info(swap_info_t *info);
@@ -33,6 +33,12 @@ void virt_init(void);
 /// @return The virtual address of the mapping
 uint32_t virt_map_physical_pages(page_t *page, int pfn_count);
 
+/// @brief Map the registers of a device, without caching them.
+/// @param phy_address The physical address of the registers.
+/// @param size The size of the registers.
+/// @return The virtual address of the registers, 0 on failure.
+uint32_t virt_map_io(uint32_t phy_address, uint32_t size);
+
 /// @brief Allocate a virtual page range of the specified size.
 /// @param size The required amount.
 /// @return Pointer to the allocated memory.
@@ -20,6 +20,13 @@
 #define page_inc(p)          atomic_inc(&(p)->count)    ///< Increments the counter for the given page.
 #define page_dec(p)          atomic_dec(&(p)->count)    ///< Decrements the counter for the given page.
 
+/// The page is a single anonymous user page, and it can be swapped out.
+#define PG_SWAPPABLE 0x01U
+/// The page is shared read-only by processes which had identical pages.
+#define PG_MERGED 0x02U
+/// The page is locked in memory by `mlock`, it must not be swapped out nor merged.
+#define PG_MLOCKED 0x04U
+
 /// @brief Page descriptor. Use as a bitmap to understand the order of the block
 /// and if it is free or allocated.
 typedef struct page_t {
@@ -72,6 +79,13 @@ enum zone_type {
     __MAX_NR_ZONES
 };
 
+/// Maximum number of pre-zeroed pages kept by each zone.
+#define ZONE_ZERO_POOL_MAX 64
+/// Number of pages zeroed at each timer tick, while the CPU is idle.
+#define ZONE_ZERO_POOL_IDLE_BATCH 8
+/// Number of pages zeroed at each timer tick, while a process is running.
+#define ZONE_ZERO_POOL_BUSY_BATCH 1
+
 /// @brief Data structure to differentiate memory zone.
 typedef struct zone_t {
     /// Number of free pages in the zone.
@@ -86,6 +100,10 @@ typedef struct zone_t {
     char *name;
     /// Zone's size in number of pages.
     unsigned long size;
+    /// List of pre-zeroed pages, ready to be used by __GFP_ZERO allocations.
+    list_head zero_pool;
+    /// Number of pages inside the pre-zeroed pool.
+    unsigned long zero_pool_pages;
 } zone_t;
 
 /// @brief Data structure to rapresent a memory node. In Uniform memory access
@@ -203,6 +221,19 @@ unsigned long get_zone_free_space(gfp_t gfp_mask);
 /// @return Total cached space of the given zone.
 unsigned long get_zone_cached_space(gfp_t gfp_mask);
 
+/// @brief Returns the number of pre-zeroed pages for the given zone.
+/// @param gfp_mask GFP_FLAGS to decide the zone.
+/// @return Number of pages inside the pre-zeroed pool of the given zone.
+unsigned long get_zone_zero_pool_pages(gfp_t gfp_mask);
+
+/// @brief Refills the pre-zeroed page pools of all the zones.
+/// @param batch The maximum number of pages to zero for each zone.
+/// @return The total number of pages added to the pools.
+/// @details
+/// It is meant to be called from the timer tick, with a bigger batch when no
+/// process wants the CPU, so that zeroing is moved off the page fault path.
+unsigned int zone_zero_pool_refill(unsigned int batch);
+
 /// @brief Checks if the specified address points to a page_t (or field) that
 /// belongs to lowmem.
 /// @param addr The address to check.
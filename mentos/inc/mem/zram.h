@@ -0,0 +1,60 @@
+/// @file zram.h
+/// @brief Compressed in-memory store for swapped out pages.
+/// @details
+/// Pages are compressed with LZF and kept inside kmalloc (i.e., slab) objects
+/// allocated from lowmem. Pages filled with zeros do not take any memory, and
+/// pages which do not compress well are stored as they are.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#pragma once
+
+#include "stdint.h"
+
+/// Number of pages that can be stored.
+#define ZRAM_NR_PAGES 16384
+/// Maximum amount of memory used to store compressed pages.
+#define ZRAM_MAX_POOL_SIZE (16U * 1024U * 1024U)
+
+/// @brief Statistics about the compressed store.
+typedef struct zram_info_t {
+    /// Number of stored pages.
+    unsigned long pages_stored;
+    /// Number of stored pages which are filled with zeros.
+    unsigned long zero_pages;
+    /// Number of pages stored uncompressed.
+    unsigned long huge_pages;
+    /// Size of the stored data before compression, in bytes.
+    unsigned long orig_data_size;
+    /// Size of the stored data after compression, in bytes.
+    unsigned long compr_data_size;
+    /// Memory used by the pool, in bytes.
+    unsigned long mem_used;
+    /// Number of pages we failed to store.
+    unsigned long failed_writes;
+} zram_info_t;
+
+/// @brief Initializes the compressed store.
+/// @param nr_pages The number of pages that can be stored.
+/// @return 0 on success, -1 on failure.
+int zram_initialize(uint32_t nr_pages);
+
+/// @brief Compresses and stores a page.
+/// @param index The index where the page is stored.
+/// @param data  The content of the page.
+/// @return 0 on success, -1 on failure.
+int zram_write_page(uint32_t index, const void *data);
+
+/// @brief Decompresses a page.
+/// @param index The index where the page is stored.
+/// @param data  Where the content of the page is written.
+/// @return 0 on success, -1 on failure.
+int zram_read_page(uint32_t index, void *data);
+
+/// @brief Drops a stored page.
+/// @param index The index where the page is stored.
+void zram_free_page(uint32_t index);
+
+/// @brief Retrieves the statistics about the compressed store.
+/// @param info Where the statistics are stored.
+void zram_get_info(zram_info_t *info);
@@ -75,6 +75,23 @@ typedef struct thread_struct_t {
     savefpu fpu_register;
 } thread_struct_t;
 
+/// @brief Stores the I/O performed by a process, shown in `/proc/<PID>/io`.
+typedef struct task_io_accounting_t {
+    /// Bytes returned by read system calls, from any file.
+    unsigned long rchar;
+    /// Bytes accepted by write system calls, to any file.
+    unsigned long wchar;
+    /// Number of read system calls.
+    unsigned long syscr;
+    /// Number of write system calls.
+    unsigned long syscw;
+    /// Bytes the process caused to be read from block devices.
+    unsigned long read_bytes;
+    /// Bytes the process caused to be written to block devices, charged when
+    /// it dirties the buffer cache rather than at write-back.
+    unsigned long write_bytes;
+} task_io_accounting_t;
+
 /// @brief this is our task object. Every process in the system has this, and
 /// it holds a lot of information. It’ll hold mm information, it’s name,
 /// statistics, etc..
@@ -154,6 +171,9 @@ typedef struct task_struct {
     /// Buffer for managing inputs from keyboard.
     fs_rb_scancode_t keyboard_rb;
 
+    /// The I/O performed by the process.
+    task_io_accounting_t ioac;
+
     //==== Future work =========================================================
     // - task's attributes:
     // struct task_struct __rcu	*real_parent;
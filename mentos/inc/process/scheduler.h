@@ -46,6 +46,10 @@ uint32_t scheduler_getpid();
 /// @return Pointer to the current process.
 task_struct *scheduler_get_current_process();
 
+/// @brief Returns the list of processes, linked through their `run_list`.
+/// @return Pointer to the head of the list.
+list_head *scheduler_get_process_list();
+
 /// @brief Returns the maximum vruntime of all the processes in running state.
 /// @return A maximum vruntime value.
 time_t scheduler_get_maximum_vruntime();
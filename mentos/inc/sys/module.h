@@ -23,6 +23,11 @@ int init_modules(multiboot_info_t *header);
 /// @return 1 on success, 0 on failure.
 int relocate_modules();
 
+/// @brief Frees the memory of a relocated module, once it has been consumed,
+///        and removes it from the list of modules.
+/// @param module The module.
+void release_module(multiboot_module_t *module);
+
 /// @brief Returns the address where the modules end.
 /// @return Address after the modules.
 uintptr_t get_address_after_modules();
\ No newline at end of file
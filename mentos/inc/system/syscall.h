@@ -231,3 +231,38 @@ int sys_getdents(int fd, dirent_t *dirp, unsigned int count);
 /// @param time Where the time should be stored.
 /// @return The current time.
 time_t sys_time(time_t *time);
+
+/// @brief Gives advice about the use of memory.
+/// @param addr   The starting address of the range, aligned to a page.
+/// @param length The length of the range.
+/// @param advice The advice (e.g., MADV_WILLNEED).
+/// @return 0 on success, a negative error code on failure.
+/// @details After MADV_DONTNEED the next access reads zeros. The advice fails
+/// with -EINVAL if a page of the range is locked.
+int sys_madvise(void *addr, size_t length, int advice);
+
+/// @brief Locks the pages of the range in memory.
+/// @param addr   The starting address of the range.
+/// @param length The length of the range.
+/// @return 0 on success, a negative error code on failure.
+int sys_mlock(const void *addr, size_t length);
+
+/// @brief Unlocks the pages of the range.
+/// @param addr   The starting address of the range.
+/// @param length The length of the range.
+/// @return 0 on success, a negative error code on failure.
+int sys_munlock(const void *addr, size_t length);
+
+/// @brief Writes back the modified content of all the filesystems.
+void sys_sync(void);
+
+/// @brief Writes back the modified data and metadata of a file.
+/// @param fd The file descriptor of the file.
+/// @return 0 on success, a negative error code on failure.
+int sys_fsync(int fd);
+
+/// @brief Writes back the modified data of a file, and the metadata needed
+/// to read it back.
+/// @param fd The file descriptor of the file.
+/// @return 0 on success, a negative error code on failure.
+int sys_fdatasync(int fd);
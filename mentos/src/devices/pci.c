@@ -358,8 +358,12 @@ void pci_scan_bus(pci_scan_func_t f, int type, int bus, void *extra)
     }
 }
 
-void pci_scan(pci_scan_func_t f, int type, void *extra)
+/// @brief Walks the configuration space of the whole hierarchy of buses.
+/// @param f the function to call for each device.
+/// @param extra the extra arguemnts.
+static void __pci_scan_hardware(pci_scan_func_t f, void *extra)
 {
+    int type = -1;
     if ((pci_read_field(0, PCI_HEADER_TYPE, 1) & 0x80) == 0) {
         pci_scan_bus(f, type, 0, extra);
         return;
@@ -375,6 +379,77 @@ void pci_scan(pci_scan_func_t f, int type, void *extra)
     }
 }
 
+/// The devices found by the enumeration.
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+/// The number of entries of pci_devices.
+static int pci_device_count = 0;
+/// Whether the enumeration took place.
+static int pci_enumerated = 0;
+
+/// @brief Adds a device to the table.
+/// @param device the device number.
+/// @param vendor_id the vendor ID.
+/// @param device_id the device ID.
+/// @param extra unused.
+static void __pci_table_add(uint32_t device, uint16_t vendor_id, uint16_t device_id, void *extra)
+{
+    (void)extra;
+    if (pci_device_count == PCI_MAX_DEVICES) {
+        pr_warning("Too many PCI devices, ignoring %2x:%2x.%d.\n",
+                   pci_extract_bus(device), pci_extract_slot(device), pci_extract_func(device));
+        return;
+    }
+    pci_device_t *entry = &pci_devices[pci_device_count++];
+    entry->device       = device;
+    entry->vendor_id    = vendor_id;
+    entry->device_id    = device_id;
+    entry->type         = pci_find_type(device);
+}
+
+int pci_initialize(void)
+{
+    if (!pci_enumerated) {
+        __pci_scan_hardware(&__pci_table_add, NULL);
+        pci_enumerated = 1;
+        pr_debug("Found %d PCI devices.\n", pci_device_count);
+    }
+    return pci_device_count;
+}
+
+const pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id, const pci_device_t *prev)
+{
+    pci_initialize();
+    int start = prev ? (int)(prev - pci_devices) + 1 : 0;
+    for (int i = start; i < pci_device_count; ++i) {
+        if ((pci_devices[i].vendor_id == vendor_id) && (pci_devices[i].device_id == device_id)) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+const pci_device_t *pci_find_class(uint32_t type, const pci_device_t *prev)
+{
+    pci_initialize();
+    int start = prev ? (int)(prev - pci_devices) + 1 : 0;
+    for (int i = start; i < pci_device_count; ++i) {
+        if (pci_devices[i].type == type) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+void pci_scan(pci_scan_func_t f, int type, void *extra)
+{
+    pci_initialize();
+    for (int i = 0; i < pci_device_count; ++i) {
+        if ((type == -1) || ((uint32_t)type == pci_devices[i].type)) {
+            f(pci_devices[i].device, pci_devices[i].vendor_id, pci_devices[i].device_id, extra);
+        }
+    }
+}
+
 static void find_isa_bridge(uint32_t device, uint16_t vendorid, uint16_t deviceid, void *extra)
 {
     if (vendorid == 0x8086 && (deviceid == 0x7000 || deviceid == 0x7110)) {
@@ -0,0 +1,784 @@
+/// @file ahci.c
+/// @brief Driver for the Serial ATA disks behind an AHCI controller.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[AHCI  ]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "drivers/ahci.h"
+#include "descriptor_tables/isr.h"
+#include "hardware/pic8259.h"
+#include "hardware/timer.h"
+#include "devices/pci.h"
+#include "mem/vmem_map.h"
+#include "mem/zone_allocator.h"
+#include "mem/slab.h"
+#include "mem/kheap.h"
+#include "sys/bitops.h"
+#include "sys/errno.h"
+#include "io/debug.h"
+#include "fs/buffer_cache.h"
+#include "fs/blkdev.h"
+#include "fs/vfs.h"
+#include "string.h"
+#include "assert.h"
+#include "stdio.h"
+#include "math.h"
+#include "time.h"
+
+#define AHCI_MAX_PORTS       32U                                 ///< The maximum number of ports of a controller.
+#define AHCI_MAX_SLOTS       32U                                 ///< The maximum number of command slots of a port.
+#define AHCI_SECTOR_SIZE     512U                                ///< The sector size.
+#define AHCI_MAX_SECTORS     256U                                ///< The maximum number of sectors of a single command.
+#define AHCI_MAX_BIOS        128U                                ///< The maximum number of bios of a single command.
+#define AHCI_PRD_MAX_SIZE    (4U * 1024U * 1024U)                ///< The maximum size of a PRDT entry.
+#define AHCI_PRDT_ENTRIES    ((PAGE_SIZE - 128U) / 16U)          ///< Entries of a command table, which fills a page.
+#define AHCI_SPIN_TIMEOUT    1000000U                            ///< Iterations after which a register is considered stuck.
+#define AHCI_COMMAND_TIMEOUT (5 * TICKS_PER_SECOND)              ///< Ticks after which a command is considered failed.
+#define AHCI_SIG_ATA         0x00000101U                         ///< Signature of a SATA disk.
+
+#define AHCI_GHC_HR   (1U << 0)  ///< HBA reset.
+#define AHCI_GHC_IE   (1U << 1)  ///< Interrupts enabled.
+#define AHCI_GHC_AE   (1U << 31) ///< AHCI enabled.
+#define AHCI_CAP_SNCQ (1U << 30) ///< The controller supports NCQ.
+
+#define AHCI_PORT_CMD_ST  (1U << 0)  ///< Start processing the command list.
+#define AHCI_PORT_CMD_FRE (1U << 4)  ///< Receive FISes.
+#define AHCI_PORT_CMD_FR  (1U << 14) ///< FIS receive running.
+#define AHCI_PORT_CMD_CR  (1U << 15) ///< Command list running.
+
+/// Interrupts of a port we care about: the FISes which complete a command,
+/// and the errors.
+#define AHCI_PORT_IE_MASK  0x7800000FU
+/// Errors reported in the interrupt status of a port.
+#define AHCI_PORT_IS_ERROR 0x78000000U
+
+#define AHCI_TFD_ERR (1U << 0) ///< The device reported an error.
+#define AHCI_TFD_DRQ (1U << 3) ///< The device is transferring data.
+#define AHCI_TFD_BSY (1U << 7) ///< The device is busy.
+
+/// @brief ATA commands used by the driver.
+typedef enum {
+    ahci_command_identify        = 0xEC, ///< Identify the device.
+    ahci_command_read_dma_ext    = 0x25, ///< Read with 48-bit addresses.
+    ahci_command_write_dma_ext   = 0x35, ///< Write with 48-bit addresses.
+    ahci_command_read_fpdma      = 0x60, ///< Queued read (NCQ).
+    ahci_command_write_fpdma     = 0x61, ///< Queued write (NCQ).
+    ahci_command_flush_cache_ext = 0xEA, ///< Flush the write cache of the device.
+} ahci_ata_command_t;
+
+/// @brief The registers of a port.
+typedef volatile struct ahci_port_regs_t {
+    uint32_t clb;           ///< Command list base address.
+    uint32_t clbu;          ///< Command list base address, upper 32 bits.
+    uint32_t fb;            ///< FIS base address.
+    uint32_t fbu;           ///< FIS base address, upper 32 bits.
+    uint32_t is;            ///< Interrupt status.
+    uint32_t ie;            ///< Interrupt enable.
+    uint32_t cmd;           ///< Command and status.
+    uint32_t reserved0;     ///< Reserved.
+    uint32_t tfd;           ///< Task file data.
+    uint32_t sig;           ///< Signature of the attached device.
+    uint32_t ssts;          ///< SATA status.
+    uint32_t sctl;          ///< SATA control.
+    uint32_t serr;          ///< SATA error.
+    uint32_t sact;          ///< SATA active, the queued commands.
+    uint32_t ci;            ///< Command issue.
+    uint32_t sntf;          ///< SATA notification.
+    uint32_t fbs;           ///< FIS-based switching control.
+    uint32_t reserved1[11]; ///< Reserved.
+    uint32_t vendor[4];     ///< Vendor specific.
+} ahci_port_regs_t;
+
+/// @brief The registers of the controller.
+typedef volatile struct ahci_hba_regs_t {
+    uint32_t cap;                   ///< Capabilities.
+    uint32_t ghc;                   ///< Global host control.
+    uint32_t is;                    ///< Interrupt status, one bit for each port.
+    uint32_t pi;                    ///< Ports implemented.
+    uint32_t vs;                    ///< Version.
+    uint32_t ccc_ctl;               ///< Command completion coalescing control.
+    uint32_t ccc_ports;             ///< Command completion coalescing ports.
+    uint32_t em_loc;                ///< Enclosure management location.
+    uint32_t em_ctl;                ///< Enclosure management control.
+    uint32_t cap2;                  ///< Extended capabilities.
+    uint32_t bohc;                  ///< BIOS/OS handoff control and status.
+    uint8_t reserved[0xA0 - 0x2C];  ///< Reserved.
+    uint8_t vendor[0x100 - 0xA0];   ///< Vendor specific.
+    ahci_port_regs_t ports[AHCI_MAX_PORTS]; ///< The ports.
+} ahci_hba_regs_t;
+
+/// @brief An entry of the command list of a port.
+typedef struct ahci_command_header_t {
+    /// Length of the command FIS in dwords, and the write bit (bit 6).
+    uint16_t flags;
+    /// Number of entries of the PRDT.
+    uint16_t prdtl;
+    /// Number of bytes transferred.
+    volatile uint32_t prdbc;
+    /// Physical address of the command table.
+    uint32_t ctba;
+    /// Physical address of the command table, upper 32 bits.
+    uint32_t ctbau;
+    /// Reserved.
+    uint32_t reserved[4];
+} ahci_command_header_t;
+
+/// @brief Physical Region Descriptor (PRD).
+typedef struct ahci_prd_t {
+    /// Physical address of the region.
+    uint32_t dba;
+    /// Physical address of the region, upper 32 bits.
+    uint32_t dbau;
+    /// Reserved.
+    uint32_t reserved;
+    /// The size of the region minus one (bits 21:0), and the interrupt bit.
+    uint32_t dbc;
+} ahci_prd_t;
+
+/// @brief Register FIS, from the host to the device.
+typedef struct ahci_fis_h2d_t {
+    uint8_t type;       ///< FIS type (0x27).
+    uint8_t flags;      ///< The command bit (bit 7).
+    uint8_t command;    ///< The ATA command.
+    uint8_t feature_lo; ///< Feature, low byte.
+    uint8_t lba0;       ///< LBA, bits 7:0.
+    uint8_t lba1;       ///< LBA, bits 15:8.
+    uint8_t lba2;       ///< LBA, bits 23:16.
+    uint8_t device;     ///< Device register.
+    uint8_t lba3;       ///< LBA, bits 31:24.
+    uint8_t lba4;       ///< LBA, bits 39:32.
+    uint8_t lba5;       ///< LBA, bits 47:40.
+    uint8_t feature_hi; ///< Feature, high byte.
+    uint8_t count_lo;   ///< Sector count, low byte.
+    uint8_t count_hi;   ///< Sector count, high byte.
+    uint8_t icc;        ///< Isochronous command completion.
+    uint8_t control;    ///< Control register.
+    uint8_t reserved[4]; ///< Reserved.
+} ahci_fis_h2d_t;
+
+/// @brief The command table of a command slot.
+typedef struct ahci_command_table_t {
+    /// The command FIS.
+    uint8_t cfis[64];
+    /// The ATAPI command.
+    uint8_t acmd[16];
+    /// Reserved.
+    uint8_t reserved[48];
+    /// The PRDT.
+    ahci_prd_t prdt[AHCI_PRDT_ENTRIES];
+} ahci_command_table_t;
+
+/// @brief A disk attached to a port of the controller.
+typedef struct ahci_device_t {
+    /// Name of the device.
+    char name[NAME_MAX];
+    /// Path of the device.
+    char path[PATH_MAX];
+    /// The index of the port.
+    unsigned port_index;
+    /// The registers of the port.
+    ahci_port_regs_t *port;
+    /// The command list, inside the same page of the received FISes.
+    ahci_command_header_t *command_list;
+    /// Physical address of the command list.
+    uintptr_t command_list_phys;
+    /// The command tables, one page for each slot.
+    ahci_command_table_t *tables;
+    /// Physical address of the command tables.
+    uintptr_t tables_phys;
+    /// The number of sectors.
+    uint32_t sectors;
+    /// If the disk, and the controller, support NCQ.
+    bool_t ncq;
+    /// The commands in flight.
+    block_slots_t inflight;
+    /// When each slot in flight was issued, in timer ticks.
+    unsigned long started[AHCI_MAX_SLOTS];
+    /// The device identity data.
+    uint16_t identity[256];
+    /// Device root file.
+    vfs_file_t *fs_root;
+    /// The block device, with the queue of the requests.
+    block_device_t blkdev;
+} ahci_device_t;
+
+/// The PCI device of the controller.
+static uint32_t ahci_pci = 0;
+/// The registers of the controller.
+static ahci_hba_regs_t *ahci_hba = NULL;
+/// The disks, indexed by port.
+static ahci_device_t *ahci_devices[AHCI_MAX_PORTS];
+
+static vfs_file_t *ahci_open(const char *, int, mode_t);
+static int ahci_close(vfs_file_t *);
+static ssize_t ahci_read(vfs_file_t *, char *, off_t, size_t);
+static ssize_t ahci_write(vfs_file_t *, const void *, off_t, size_t);
+static int ahci_fstat(vfs_file_t *file, stat_t *stat);
+static int ahci_stat(const char *path, stat_t *stat);
+
+// == SUPPORT FUNCTIONS =======================================================
+/// @brief Waits until the bits of a register are cleared.
+/// @param reg the register.
+/// @param mask the bits.
+/// @return 0 on success, -1 if they are still set.
+static inline int ahci_wait_clear(volatile uint32_t *reg, uint32_t mask)
+{
+    for (uint32_t i = 0; i < AHCI_SPIN_TIMEOUT; ++i)
+        if (!(*reg & mask))
+            return 0;
+    return -1;
+}
+
+/// @brief Allocates memory for the structures shared with the controller.
+/// @param order the order of the number of pages.
+/// @param physical where the physical address is stored.
+/// @return the address of the memory, zeroed, NULL on failure.
+static void *ahci_alloc_dma(uint32_t order, uintptr_t *physical)
+{
+    uint32_t addr = __alloc_pages_lowmem(GFP_KERNEL, order);
+    if (addr == 0)
+        return NULL;
+    memset((void *)addr, 0, PAGE_SIZE << order);
+    *physical = get_physical_address_from_page(get_lowmem_page_from_address(addr));
+    return (void *)addr;
+}
+
+/// @brief Stops the processing of the command list of a port.
+/// @param port the port.
+/// @return 0 on success, -1 if the port does not stop.
+static int ahci_port_stop(ahci_port_regs_t *port)
+{
+    port->cmd &= ~AHCI_PORT_CMD_ST;
+    if (ahci_wait_clear(&port->cmd, AHCI_PORT_CMD_CR) < 0)
+        return -1;
+    port->cmd &= ~AHCI_PORT_CMD_FRE;
+    return ahci_wait_clear(&port->cmd, AHCI_PORT_CMD_FR);
+}
+
+/// @brief Starts the processing of the command list of a port.
+/// @param port the port.
+static void ahci_port_start(ahci_port_regs_t *port)
+{
+    ahci_wait_clear(&port->cmd, AHCI_PORT_CMD_CR);
+    port->cmd |= AHCI_PORT_CMD_FRE;
+    port->cmd |= AHCI_PORT_CMD_ST;
+}
+
+/// @brief Adds a memory region to the PRDT of a slot, merging it with the
+/// previous one when they are contiguous.
+/// @param table the command table.
+/// @param count the number of entries already inside the PRDT.
+/// @param physical the physical address of the region.
+/// @param size the size of the region.
+/// @return the new number of entries, or -1 if they do not fit.
+static inline int ahci_prdt_add(ahci_command_table_t *table, int count, uintptr_t physical, size_t size)
+{
+    if (count > 0) {
+        ahci_prd_t *prev = &table->prdt[count - 1];
+        size_t prev_size = (prev->dbc & 0x3FFFFF) + 1;
+        if (((prev->dba + prev_size) == physical) && ((prev_size + size) <= AHCI_PRD_MAX_SIZE)) {
+            prev->dbc = (uint32_t)(prev_size + size - 1);
+            return count;
+        }
+    }
+    if (count == AHCI_PRDT_ENTRIES)
+        return -1;
+    table->prdt[count].dba      = physical;
+    table->prdt[count].dbau     = 0;
+    table->prdt[count].reserved = 0;
+    table->prdt[count].dbc      = (uint32_t)(size - 1);
+    return count + 1;
+}
+
+/// @brief Adds the pages of a buffer to the PRDT of a slot.
+/// @param table the command table.
+/// @param count the number of entries already inside the PRDT.
+/// @param buffer the buffer.
+/// @param size the size of the buffer.
+/// @param to_memory true if the device writes in the buffer.
+/// @return the new number of entries, or -1 if the buffer cannot be used for DMA.
+static int ahci_prdt_add_buffer(ahci_command_table_t *table, int count, uint8_t *buffer, size_t size, bool_t to_memory)
+{
+    // Regions must be aligned to a word.
+    if ((uintptr_t)buffer & 0x1)
+        return -1;
+    for (uintptr_t addr = (uintptr_t)buffer, end = addr + size; addr < end;) {
+        uintptr_t physical;
+        if (!block_get_physical_address(addr, to_memory, &physical))
+            return -1;
+        // Go up to the end of the page, the next one might not be contiguous.
+        size_t chunk = min(end - addr, PAGE_SIZE - (addr & (PAGE_SIZE - 1)));
+        if ((count = ahci_prdt_add(table, count, physical, chunk)) < 0)
+            return -1;
+        addr += chunk;
+    }
+    return count;
+}
+
+/// @brief Fills the command FIS of a slot.
+/// @param table the command table.
+/// @param command the ATA command.
+/// @param lba the first sector, 48-bit addresses are truncated to 32 bits.
+/// @param count the sector count field.
+/// @param feature the feature field.
+static inline void ahci_setup_fis(ahci_command_table_t *table, uint8_t command, uint32_t lba, uint16_t count, uint16_t feature)
+{
+    ahci_fis_h2d_t *fis = (ahci_fis_h2d_t *)table->cfis;
+    memset(fis, 0, sizeof(ahci_fis_h2d_t));
+    fis->type       = 0x27;
+    fis->flags      = 0x80;
+    fis->command    = command;
+    fis->feature_lo = feature & 0xff;
+    fis->feature_hi = (feature >> 8) & 0xff;
+    fis->lba0       = (lba >> 0) & 0xff;
+    fis->lba1       = (lba >> 8) & 0xff;
+    fis->lba2       = (lba >> 16) & 0xff;
+    fis->lba3       = (lba >> 24) & 0xff;
+    fis->lba4       = 0;
+    fis->lba5       = 0;
+    // LBA mode.
+    fis->device   = 0x40;
+    fis->count_lo = count & 0xff;
+    fis->count_hi = (count >> 8) & 0xff;
+}
+
+/// @brief Fills the command header of a slot.
+/// @param dev the device.
+/// @param slot the slot.
+/// @param prdtl the number of entries of the PRDT.
+/// @param write true if the command writes on the device.
+static inline void ahci_setup_header(ahci_device_t *dev, unsigned slot, int prdtl, bool_t write)
+{
+    ahci_command_header_t *header = &dev->command_list[slot];
+    // The length of the command FIS, in dwords.
+    header->flags = (sizeof(ahci_fis_h2d_t) / sizeof(uint32_t)) | (write ? (1U << 6) : 0);
+    header->prdtl = prdtl;
+    header->prdbc = 0;
+    header->ctba  = dev->tables_phys + (slot * sizeof(ahci_command_table_t));
+    header->ctbau = 0;
+}
+
+// == ATA COMMANDS ============================================================
+/// @brief Identifies the disk with the first slot, polling the port.
+/// @param dev the device.
+/// @return 0 on success, -1 on failure.
+static int ahci_identify(ahci_device_t *dev)
+{
+    ahci_command_table_t *table = &dev->tables[0];
+    int count                   = ahci_prdt_add_buffer(table, 0, (uint8_t *)dev->identity, sizeof(dev->identity), true);
+    if (count < 0)
+        return -1;
+    ahci_setup_fis(table, ahci_command_identify, 0, 0, 0);
+    ahci_setup_header(dev, 0, count, false);
+    if (ahci_wait_clear(&dev->port->tfd, AHCI_TFD_BSY | AHCI_TFD_DRQ) < 0)
+        return -1;
+    dev->port->ci = 1U;
+    if ((ahci_wait_clear(&dev->port->ci, 1U) < 0) || (dev->port->tfd & AHCI_TFD_ERR))
+        return -1;
+    dev->port->is = dev->port->is;
+    // Word 83 bit 10 tells if 48-bit addresses are supported, sectors past
+    // the first 2^32 are not reachable anyway.
+    if (dev->identity[83] & (1U << 10))
+        dev->sectors = (dev->identity[103] || dev->identity[102]) ? 0xFFFFFFFFU : (dev->identity[100] | ((uint32_t)dev->identity[101] << 16));
+    else
+        dev->sectors = dev->identity[60] | ((uint32_t)dev->identity[61] << 16);
+    return 0;
+}
+
+/// @brief Restarts a port after an error, failing all the commands in flight.
+/// @param dev the device.
+static void ahci_port_recover(ahci_device_t *dev)
+{
+    pr_err("[%s] Port error (is: 0x%x, tfd: 0x%x, serr: 0x%x).\n", dev->name, dev->port->is, dev->port->tfd, dev->port->serr);
+    // Stopping the port clears the issued and the queued commands.
+    ahci_port_stop(dev->port);
+    dev->port->serr = dev->port->serr;
+    dev->port->is   = dev->port->is;
+    ahci_port_start(dev->port);
+    uint32_t failed = dev->inflight.busy;
+    for (unsigned slot = 0; slot < AHCI_MAX_SLOTS; ++slot)
+        if (bit_check(failed, slot))
+            block_slot_end(&dev->blkdev, &dev->inflight, slot, -EIO);
+}
+
+/// @brief Completes the commands of a port which are done.
+/// @param dev the device.
+static void ahci_port_complete(ahci_device_t *dev)
+{
+    uint32_t is   = dev->port->is;
+    dev->port->is = is;
+    if (is & AHCI_PORT_IS_ERROR) {
+        ahci_port_recover(dev);
+        return;
+    }
+    // Queued commands leave SACT once done, the others leave CI.
+    uint32_t done = dev->inflight.busy & ~(dev->port->sact | dev->port->ci);
+    for (unsigned slot = 0; slot < AHCI_MAX_SLOTS; ++slot)
+        if (bit_check(done, slot))
+            block_slot_end(&dev->blkdev, &dev->inflight, slot, 0);
+}
+
+/// @brief Issues the command which transfers the sectors of a request, the
+/// port raises an interrupt once it is done.
+/// @param blkdev the block device.
+/// @param request the request.
+/// @return 0 if the command was issued, -EBUSY if all the slots are in use,
+/// another negative error code on failure.
+static int ahci_submit_request(block_device_t *blkdev, block_request_t *request)
+{
+    ahci_device_t *dev = container_of(blkdev, ahci_device_t, blkdev);
+    bool_t write       = request->direction == BLOCK_WRITE;
+    if ((request->count > dev->sectors) || (request->sector > (dev->sectors - request->count)))
+        return -EINVAL;
+    int slot = block_slot_get(blkdev, &dev->inflight);
+    if (slot < 0)
+        return slot;
+    ahci_command_table_t *table = &dev->tables[slot];
+    // Point the PRDT to the buffers of the bios, or to a bounce buffer.
+    int count = 0;
+    list_for_each_decl(it, &request->bios)
+    {
+        block_bio_t *bio = list_entry(it, block_bio_t, list);
+        if ((count = ahci_prdt_add_buffer(table, count, bio->buffer, bio->count * AHCI_SECTOR_SIZE, !write)) < 0)
+            break;
+    }
+    if (count < 0) {
+        uint8_t *bounce = block_slot_bounce(blkdev, &dev->inflight, slot, request);
+        if (bounce == NULL)
+            return -ENOMEM;
+        count = ahci_prdt_add_buffer(table, 0, bounce, request->count * AHCI_SECTOR_SIZE, !write);
+        assert((count > 0) && "The bounce buffer does not fit the PRDT.");
+    }
+    if (dev->ncq) {
+        // The sector count goes inside the feature field, the tag inside the
+        // sector count one.
+        ahci_setup_fis(table, write ? ahci_command_write_fpdma : ahci_command_read_fpdma,
+                       request->sector, slot << 3, request->count);
+    } else {
+        ahci_setup_fis(table, write ? ahci_command_write_dma_ext : ahci_command_read_dma_ext,
+                       request->sector, request->count, 0);
+    }
+    ahci_setup_header(dev, slot, count, write);
+    block_slot_start(&dev->inflight, slot, request);
+    dev->started[slot] = timer_get_ticks();
+    if (dev->ncq)
+        dev->port->sact = (1U << slot);
+    dev->port->ci = (1U << slot);
+    return 0;
+}
+
+/// @brief Checks if the commands in flight completed, in case the interrupt
+/// got lost, and fails them once they take too long.
+/// @param blkdev the block device.
+static void ahci_poll(block_device_t *blkdev)
+{
+    ahci_device_t *dev = container_of(blkdev, ahci_device_t, blkdev);
+    ahci_port_complete(dev);
+    unsigned long now = timer_get_ticks();
+    for (unsigned slot = 0; slot < AHCI_MAX_SLOTS; ++slot) {
+        if (bit_check(dev->inflight.busy, slot) && ((now - dev->started[slot]) > AHCI_COMMAND_TIMEOUT)) {
+            pr_err("[%s] The command in slot %d timed out.\n", dev->name, slot);
+            ahci_port_recover(dev);
+            break;
+        }
+    }
+}
+
+/// The operations of the AHCI block devices.
+static const block_device_operations_t ahci_block_operations = {
+    .submit = ahci_submit_request,
+    .poll   = ahci_poll,
+};
+
+// == VFS ENTRY GENERATION ====================================================
+/// Filesystem general operations.
+static vfs_sys_operations_t ahci_sys_operations = {
+    .mkdir_f = NULL,
+    .rmdir_f = NULL,
+    .stat_f  = ahci_stat
+};
+
+/// AHCI filesystem file operations.
+static vfs_file_operations_t ahci_fs_operations = {
+    .open_f     = ahci_open,
+    .unlink_f   = NULL,
+    .close_f    = ahci_close,
+    .read_f     = ahci_read,
+    .write_f    = ahci_write,
+    .lseek_f    = NULL,
+    .stat_f     = ahci_fstat,
+    .ioctl_f    = NULL,
+    .getdents_f = NULL
+};
+
+/// @brief Creates the file of a disk.
+/// @param dev the device.
+/// @return the file, NULL on failure.
+static vfs_file_t *ahci_device_create(ahci_device_t *dev)
+{
+    vfs_file_t *file = kmem_cache_alloc(vfs_file_cache, GFP_KERNEL);
+    if (file == NULL) {
+        pr_err("Failed to create AHCI device.\n");
+        return NULL;
+    }
+    memcpy(file->name, dev->name, NAME_MAX);
+    file->device         = dev;
+    file->flags          = DT_BLK;
+    file->length         = dev->sectors * AHCI_SECTOR_SIZE;
+    file->sys_operations = &ahci_sys_operations;
+    file->fs_operations  = &ahci_fs_operations;
+    return file;
+}
+
+// == VFS CALLBACKS ===========================================================
+static vfs_file_t *ahci_open(const char *path, int flags, mode_t mode)
+{
+    pr_debug("ahci_open(%s, %d, %d)\n", path, flags, mode);
+    for (unsigned i = 0; i < AHCI_MAX_PORTS; ++i) {
+        ahci_device_t *dev = ahci_devices[i];
+        if (dev && dev->fs_root && (strcmp(path, dev->path) == 0)) {
+            ++dev->fs_root->count;
+            return dev->fs_root;
+        }
+    }
+    return NULL;
+}
+
+static int ahci_close(vfs_file_t *file)
+{
+    pr_debug("ahci_close(%p)\n", file);
+    --file->count;
+    return 0;
+}
+
+/// @brief Reads, or writes, a range of bytes of the disk.
+/// @param file the file of the disk.
+/// @param buffer the buffer.
+/// @param offset the offset of the first byte.
+/// @param size the number of bytes.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return the number of bytes transferred, or a negative error code.
+static ssize_t ahci_rw(vfs_file_t *file, uint8_t *buffer, off_t offset, size_t size, int direction)
+{
+    ahci_device_t *dev = (ahci_device_t *)file->device;
+    if ((offset < 0) || ((uint32_t)offset >= file->length))
+        return 0;
+    size = min(size, file->length - offset);
+    if (buffer_rw_raw(&dev->blkdev, offset, size, buffer, direction) < 0)
+        return -EIO;
+    return size;
+}
+
+static ssize_t ahci_read(vfs_file_t *file, char *buffer, off_t offset, size_t size)
+{
+    pr_debug("ahci_read(%p, %p, %d, %d)\n", file, buffer, offset, size);
+    return ahci_rw(file, (uint8_t *)buffer, offset, size, BLOCK_READ);
+}
+
+static ssize_t ahci_write(vfs_file_t *file, const void *buffer, off_t offset, size_t size)
+{
+    pr_debug("ahci_write(%p, %p, %d, %d)\n", file, buffer, offset, size);
+    return ahci_rw(file, (uint8_t *)buffer, offset, size, BLOCK_WRITE);
+}
+
+/// @brief Fills the attributes of a disk.
+/// @param dev the device.
+/// @param stat where the attributes are stored.
+/// @return 0 on success.
+static int _ahci_stat(const ahci_device_t *dev, stat_t *stat)
+{
+    if (dev && dev->fs_root) {
+        stat->st_dev   = 0;
+        stat->st_ino   = 0;
+        stat->st_mode  = 0;
+        stat->st_uid   = 0;
+        stat->st_gid   = 0;
+        stat->st_atime = sys_time(NULL);
+        stat->st_mtime = sys_time(NULL);
+        stat->st_ctime = sys_time(NULL);
+        stat->st_size  = dev->fs_root->length;
+    }
+    return 0;
+}
+
+static int ahci_fstat(vfs_file_t *file, stat_t *stat)
+{
+    return _ahci_stat(file->device, stat);
+}
+
+static int ahci_stat(const char *path, stat_t *stat)
+{
+    super_block_t *sb = vfs_get_superblock(path);
+    if (sb && sb->root) {
+        return _ahci_stat(sb->root->device, stat);
+    }
+    return -1;
+}
+
+// == PORT INITIALIZATION =====================================================
+/// @brief Sets up a port with a disk attached, and registers the disk.
+/// @param index the index of the port.
+/// @return 0 on success, -1 on failure.
+static int ahci_port_init(unsigned index)
+{
+    ahci_port_regs_t *port = &ahci_hba->ports[index];
+    ahci_device_t *dev     = kmalloc(sizeof(ahci_device_t));
+    if (dev == NULL)
+        return -1;
+    memset(dev, 0, sizeof(ahci_device_t));
+    dev->port_index = index;
+    dev->port       = port;
+    // The command list (1K) and the received FISes (256 bytes) share a page,
+    // each command table takes one. Identifying the disk needs only the first.
+    dev->command_list = ahci_alloc_dma(0, &dev->command_list_phys);
+    dev->tables       = ahci_alloc_dma(0, &dev->tables_phys);
+    if ((dev->command_list == NULL) || (dev->tables == NULL) || (ahci_port_stop(port) < 0)) {
+        pr_err("Failed to set up port %d.\n", index);
+        goto free_memory;
+    }
+    port->clb  = dev->command_list_phys;
+    port->clbu = 0;
+    port->fb   = dev->command_list_phys + 1024U;
+    port->fbu  = 0;
+    port->serr = port->serr;
+    port->is   = port->is;
+    ahci_port_start(port);
+    if (ahci_identify(dev) < 0) {
+        pr_err("Failed to identify the disk on port %d.\n", index);
+        goto stop_port;
+    }
+    // Word 76 bit 8 tells if the disk supports NCQ, word 75 its queue depth.
+    uint32_t slots = ((ahci_hba->cap >> 8) & 0x1F) + 1;
+    dev->ncq       = (ahci_hba->cap & AHCI_CAP_SNCQ) && (dev->identity[76] & (1U << 8));
+    uint32_t depth = dev->ncq ? min(slots, (dev->identity[75] & 0x1FU) + 1U) : 1U;
+    if (depth > 1) {
+        // Give a command table to each of the slots we are going to use.
+        uintptr_t tables_phys;
+        uint32_t order               = find_nearest_order_greater(0, depth * sizeof(ahci_command_table_t));
+        ahci_command_table_t *tables = ahci_alloc_dma(order, &tables_phys);
+        if (tables == NULL) {
+            pr_err("Failed to allocate the command tables of port %d.\n", index);
+            goto stop_port;
+        }
+        free_pages_lowmem((uint32_t)dev->tables);
+        dev->tables      = tables;
+        dev->tables_phys = tables_phys;
+    }
+    block_get_disk_name(dev->name);
+    sprintf(dev->path, "/dev/%s", dev->name);
+    dev->fs_root = ahci_device_create(dev);
+    if (dev->fs_root == NULL)
+        goto stop_port;
+    // Register the block device, requests go through its queue, before the
+    // disk becomes visible.
+    strcpy(dev->blkdev.name, dev->name);
+    dev->blkdev.file        = dev->fs_root;
+    dev->blkdev.sector_size = AHCI_SECTOR_SIZE;
+    dev->blkdev.max_sectors = AHCI_MAX_SECTORS;
+    dev->blkdev.max_bios    = AHCI_MAX_BIOS;
+    dev->blkdev.queue_depth = depth;
+    dev->blkdev.ops         = &ahci_block_operations;
+    if (block_register_device(&dev->blkdev) < 0)
+        goto free_file;
+    if (!vfs_mount(dev->path, dev->fs_root)) {
+        pr_err("Failed to mount %s.\n", dev->path);
+        goto unregister;
+    }
+    ahci_devices[index] = dev;
+    port->ie            = AHCI_PORT_IE_MASK;
+    pr_info("    Found SATA disk on port %d (%s, %d sectors, %s, depth %d).\n", index, dev->path,
+            dev->sectors, dev->ncq ? "NCQ" : "no NCQ", dev->blkdev.queue_depth);
+    return 0;
+unregister:
+    block_unregister_device(&dev->blkdev);
+free_file:
+    kmem_cache_free(dev->fs_root);
+stop_port:
+    // The port must not touch the memory we are about to free.
+    ahci_port_stop(port);
+free_memory:
+    if (dev->tables)
+        free_pages_lowmem((uint32_t)dev->tables);
+    if (dev->command_list)
+        free_pages_lowmem((uint32_t)dev->command_list);
+    kfree(dev);
+    return -1;
+}
+
+// == IRQ HANDLER =============================================================
+/// @param f The interrupt stack frame.
+static void ahci_irq_handler(pt_regs *f)
+{
+    uint32_t is = ahci_hba->is;
+    if (is == 0)
+        return;
+    for (unsigned i = 0; i < AHCI_MAX_PORTS; ++i) {
+        if (!bit_check(is, i))
+            continue;
+        if (ahci_devices[i])
+            ahci_port_complete(ahci_devices[i]);
+        else
+            ahci_hba->ports[i].is = ahci_hba->ports[i].is;
+    }
+    // Ports first, then the controller.
+    ahci_hba->is = is;
+}
+
+// == INITIALIZE/FINALIZE AHCI ================================================
+int ahci_initialize(void)
+{
+    const pci_device_t *controller = pci_find_class(0x010601, NULL);
+    if (controller == NULL) {
+        pr_debug("No AHCI controller.\n");
+        return 0;
+    }
+    ahci_pci = controller->device;
+    // Enable the memory space and bus mastering.
+    pci_write_field(ahci_pci, PCI_COMMAND, 2, pci_read_field(ahci_pci, PCI_COMMAND, 2) | 0x06);
+    // The registers are behind BAR5 (ABAR).
+    uint32_t abar = pci_read_field(ahci_pci, PCI_BASE_ADDRESS_5, 4) & ~0xFU;
+    ahci_hba      = (ahci_hba_regs_t *)virt_map_io(abar, sizeof(ahci_hba_regs_t));
+    if (ahci_hba == NULL) {
+        pr_err("Failed to map the AHCI registers.\n");
+        return 1;
+    }
+    // Reset the controller, and switch it to AHCI mode.
+    ahci_hba->ghc |= AHCI_GHC_AE;
+    ahci_hba->ghc |= AHCI_GHC_HR;
+    if (ahci_wait_clear(&ahci_hba->ghc, AHCI_GHC_HR) < 0) {
+        pr_err("Failed to reset the AHCI controller.\n");
+        return 1;
+    }
+    ahci_hba->ghc |= AHCI_GHC_AE;
+    // Install the IRQ handler.
+    unsigned irq = pci_read_field(ahci_pci, PCI_INTERRUPT_LINE, 1);
+    irq_install_handler(irq, ahci_irq_handler, "AHCI");
+    pic8259_irq_enable(irq);
+    // Set up the ports with a disk attached: device present, interface
+    // active, and the signature of a disk.
+    uint32_t implemented = ahci_hba->pi;
+    for (unsigned i = 0; i < AHCI_MAX_PORTS; ++i) {
+        ahci_port_regs_t *port = &ahci_hba->ports[i];
+        if (!bit_check(implemented, i) || ((port->ssts & 0x0F) != 3) || (((port->ssts >> 8) & 0x0F) != 1))
+            continue;
+        if (port->sig != AHCI_SIG_ATA) {
+            pr_warning("Only SATA disks are supported (port %d, signature 0x%x).\n", i, port->sig);
+            continue;
+        }
+        ahci_port_init(i);
+    }
+    ahci_hba->is = ahci_hba->is;
+    ahci_hba->ghc |= AHCI_GHC_IE;
+    return 0;
+}
+
+int ahci_finalize(void)
+{
+    return 0;
+}
@@ -16,7 +16,8 @@
 
 #include "descriptor_tables/isr.h"
 #include "hardware/pic8259.h"
-#include "klib/spinlock.h"
+#include "hardware/timer.h"
+#include "klib/irqflags.h"
 #include "process/wait.h"
 #include "system/panic.h"
 #include "devices/pci.h"
@@ -25,7 +26,11 @@
 #include "mem/kheap.h"
 #include "io/debug.h"
 #include "string.h"
+#include "assert.h"
+#include "math.h"
 #include "fs/vfs.h"
+#include "fs/buffer_cache.h"
+#include "fs/blkdev.h"
 #include "fcntl.h"
 #include "stdio.h"
 
@@ -83,6 +88,8 @@ typedef enum {
     ata_dma_command_read_no_retry  = 0xC9, ///< Read DMA without retries (28 bit LBA).
     ata_dma_command_write          = 0xCA, ///< Write DMA with retries (28 bit LBA).
     ata_dma_command_write_no_retry = 0xCB, ///< Write DMA without retries (28 bit LBA).
+    ata_dma_command_read_ext       = 0x25, ///< Read DMA (48 bit LBA).
+    ata_dma_command_write_ext      = 0x35, ///< Write DMA (48 bit LBA).
 } ata_dma_command_t;
 
 /// @brief ATA identity commands.
@@ -274,7 +281,7 @@ typedef struct ata_device_t {
         /// aligned, contiguous in physical memory, and cannot cross a 64K boundary.
         unsigned prdt;
     } bmr;
-    /// Pointer to the first entry of the PRDT.
+    /// Pointer to the first entry of the PRDT, which has ATA_PRDT_MAX_ENTRIES.
     prdt_t *dma_prdt;
     /// Physical address of the first entry of the PRDT.
     uintptr_t dma_prdt_phys;
@@ -284,14 +291,34 @@ typedef struct ata_device_t {
     uintptr_t dma_start_phys;
     /// Device root file.
     vfs_file_t *fs_root;
+    /// Set while a DMA command is in flight, cleared once it completes.
+    volatile bool_t busy;
+    /// The bus master status, when the command completed.
+    uint8_t bm_status;
+    /// The device status, when the command completed.
+    uint8_t status;
+    /// The error register, when the command failed.
+    uint8_t error;
+    /// The request in flight.
+    block_request_t *request;
+    /// If the request in flight goes through the DMA memory area.
+    bool_t bounce;
+    /// When the request in flight was started, in timer ticks.
+    unsigned long started;
+    /// The block device, with the queue of the requests.
+    block_device_t blkdev;
 } ata_device_t;
 
-#define ATA_SECTOR_SIZE 512 ///< The sector size.
-#define ATA_DMA_SIZE    512 ///< The size of the DMA area.
-
-static spinlock_t ata_lock;
+#define ATA_SECTOR_SIZE      512U                                   ///< The sector size.
+#define ATA_DMA_SIZE         (128U * 1024U)                         ///< The size of the DMA area, and of the largest transfer.
+#define ATA_DMA_MAX_SECTORS  (ATA_DMA_SIZE / ATA_SECTOR_SIZE)       ///< The maximum number of sectors of a single command.
+#define ATA_PRD_MAX_SIZE     (64U * 1024U)                          ///< The maximum size of a PRDT entry.
+#define ATA_PRDT_MAX_ENTRIES (PAGE_SIZE / sizeof(prdt_t))            ///< Entries of the PRDT, which fills a page.
+#define ATA_MAX_BIOS         128U                                   ///< The maximum number of bios of a single command.
+#define ATA_IRQ_TIMEOUT      (TICKS_PER_SECOND / 10)                ///< Ticks after which we check the controller, in case the interrupt got lost.
+#define ATA_COMMAND_TIMEOUT  (5 * TICKS_PER_SECOND)                 ///< Ticks after which a command is considered failed.
+#define ATA_PROBE_TIMEOUT    100000                                 ///< Status reads after which a probing step gives up.
 
-static char ata_drive_char = 'a';
 static int cdrom_number    = 0;
 static uint32_t ata_pci    = 0x00000000;
 
@@ -371,9 +398,6 @@ static ata_device_t ata_secondary_slave = {
     .primary      = false
 };
 
-static void ata_device_read_sector(ata_device_t *, uint64_t, uint8_t *);
-static void ata_device_write_sector(ata_device_t *, uint64_t, uint8_t *);
-
 static vfs_file_t *ata_open(const char *, int, mode_t);
 static int ata_close(vfs_file_t *);
 static ssize_t ata_read(vfs_file_t *, char *, off_t, size_t);
@@ -494,14 +518,28 @@ static inline void ata_fix_string(char *str, unsigned len)
     str[len] = 0;
 }
 
+/// @brief Reads the identity of the device. Every step is bounded, so that a
+/// missing or broken drive cannot hang the boot.
+/// @param dev the device, already selected.
+/// @param command the identify command.
+/// @return true if the identity was read, false otherwise.
 static inline bool_t ata_read_device_identity(ata_device_t *dev, ata_identity_command_t command)
 {
     // Request the device identity.
     outportb(dev->io_reg.command, command);
     // Wait 400ns for the command to work.
     ata_io_wait(dev);
-    inportb(dev->io_reg.command);
-    ata_wait(dev, 0);
+    // A status of zero means that there is no drive.
+    if (inportb(dev->io_reg.status) == 0)
+        return false;
+    uint8_t status = ata_status_wait(dev, ATA_PROBE_TIMEOUT);
+    if (bit_check(status, ata_status_bsy) || bit_check(status, ata_status_err))
+        return false;
+    // Wait for the data to be ready.
+    for (int timeout = ATA_PROBE_TIMEOUT; !bit_check(status, ata_status_drq); status = inportb(dev->io_reg.status)) {
+        if (bit_check(status, ata_status_err) || (--timeout == 0))
+            return false;
+    }
     // Read the identity.
     uint16_t *buffer = (uint16_t *)&dev->identity;
     for (unsigned i = 0; i < 256; ++i) {
@@ -584,14 +622,40 @@ static inline void ata_initialize_bus_mastering_address(ata_device_t *dev)
     }
 }
 
+/// @brief Resets a channel, without waiting for its drives to recover.
+/// @param dev the master device of the channel.
+/// @return false if nothing is connected to the channel.
+static inline bool_t ata_channel_reset(ata_device_t *dev)
+{
+    // The data lines of an empty channel float high.
+    if (inportb(dev->io_reg.status) == 0xFF) {
+        pr_debug("[%s] Floating bus, skipping the channel.\n", ata_get_device_settings_str(dev));
+        return false;
+    }
+    ata_soft_reset(dev);
+    return true;
+}
+
+/// @brief Waits, for a bounded time, for the drives of a channel to recover
+/// from the reset.
+/// @param dev the master device of the channel.
+/// @return false if the channel is still busy.
+static inline bool_t ata_channel_wait(ata_device_t *dev)
+{
+    if (bit_check(ata_status_wait(dev, ATA_PROBE_TIMEOUT), ata_status_bsy)) {
+        pr_warning("[%s] The channel did not recover from the reset.\n", ata_get_device_settings_str(dev));
+        return false;
+    }
+    return true;
+}
+
 /* on Primary bus: ctrl->base =0x1F0, ctrl->dev_ctl =0x3F6. REG_CYL_LO=4, REG_CYL_HI=5, REG_DEVSEL=6 */
+/// @brief Reads the signature left by the reset of the channel.
+/// @param dev the device, whose channel was reset by ata_channel_reset.
+/// @return the type of the device.
 static inline ata_device_type_t ata_detect_device_type(ata_device_t *dev)
 {
     pr_debug("[%s] Detecting device type...\n", ata_get_device_settings_str(dev));
-    // Perform a soft reset.
-    ata_soft_reset(dev);
-    // Wait until master drive is ready again.
-    ata_io_wait(dev);
     // Select the drive.
     outportb(dev->io_reg.hddevsel, 0xA0 | (dev->slave << 4));
     // Wait for drive select to work.
@@ -636,22 +700,12 @@ static bool_t ata_device_init(ata_device_t *dev)
 {
     pr_debug("[%s] Detected ATA device.\n", ata_get_device_settings_str(dev));
 
-    // Select the ATA device.
-    ata_device_select(dev);
-
-    // Read the ATA device identity.
-    ata_read_device_identity(dev, ata_command_pata_ident);
-
-    // Allocate the memory for the Physical Region Descriptor Table (PRDT).
-    dev->dma_prdt = (prdt_t *)malloc_dma(sizeof(prdt_t), &dev->dma_prdt_phys);
-    // Allocate the memory for the Direct Memory Access (DMA).
+    // Allocate the memory for the Physical Region Descriptor Table (PRDT),
+    // which is filled before each transfer.
+    dev->dma_prdt = (prdt_t *)malloc_dma(sizeof(prdt_t) * ATA_PRDT_MAX_ENTRIES, &dev->dma_prdt_phys);
+    // Allocate the memory for the Direct Memory Access (DMA), used for the
+    // buffers which the device cannot reach directly.
     dev->dma_start = (uint8_t *)malloc_dma(ATA_DMA_SIZE, &dev->dma_start_phys);
-    // Initialize the table, specifying the physical address of the DMA.
-    dev->dma_prdt->physical_address = dev->dma_start_phys;
-    // The size of the DMA.
-    dev->dma_prdt->byte_count = ATA_DMA_SIZE;
-    // Set the EOT to 1.
-    dev->dma_prdt->end_of_table = 0x8000;
 
     // Update the filesystem entry with the length of the device.
     dev->fs_root->length = ata_max_offset(dev);
@@ -680,136 +734,269 @@ static bool_t ata_device_init(ata_device_t *dev)
 }
 
 // == ATA SECTOR READ/WRITE FUNCTIONS =========================================
-static void ata_device_read_sector(ata_device_t *dev, uint32_t lba, uint8_t *buffer)
+/// @brief Adds a memory region to the PRDT, splitting it so that no entry
+/// crosses a 64K boundary.
+/// @param dev the device.
+/// @param count the number of entries already inside the PRDT.
+/// @param physical the physical address of the region.
+/// @param size the size of the region.
+/// @return the new number of entries, or -1 if they do not fit.
+static inline int ata_prdt_add(ata_device_t *dev, int count, uintptr_t physical, size_t size)
 {
-    // Check if we are trying to perform the read on the correct drive type.
-    if ((dev->type != ata_dev_type_pata) && (dev->type != ata_dev_type_sata)) {
-        return;
+    while (size > 0) {
+        // Merge the region with the previous one, if they are contiguous.
+        prdt_t *prev = (count > 0) ? &dev->dma_prdt[count - 1] : NULL;
+        size_t prev_size = prev ? (prev->byte_count ? prev->byte_count : ATA_PRD_MAX_SIZE) : 0;
+        size_t chunk     = min(size, ATA_PRD_MAX_SIZE - (physical & (ATA_PRD_MAX_SIZE - 1)));
+        if (prev && ((prev->physical_address + prev_size) == physical) &&
+            ((physical & (ATA_PRD_MAX_SIZE - 1)) != 0)) {
+            prev->byte_count = (unsigned short)(prev_size + chunk);
+        } else {
+            if (count == ATA_PRDT_MAX_ENTRIES)
+                return -1;
+            dev->dma_prdt[count].physical_address = physical;
+            // A count of zero means 64K.
+            dev->dma_prdt[count].byte_count   = (unsigned short)chunk;
+            dev->dma_prdt[count].end_of_table = 0;
+            ++count;
+        }
+        physical += chunk;
+        size -= chunk;
     }
-    //pr_debug("ata_device_read_sector(dev: %p, lba: %d, buff: %p)\n", dev, lba, buffer);
-    spinlock_lock(&ata_lock);
-
-    ata_wait(dev, 0);
-
-    // Reset bus master register's command register.
-    outportb(dev->bmr.command, 0x00);
-
-    // Set the PRDT.
-    outportl(dev->bmr.prdt, dev->dma_prdt_phys);
-
-    // Enable error, irq status.
-    outportb(dev->bmr.status, inportb(dev->bmr.status) | 0x04 | 0x02);
-
-    // Set read.
-    outportb(dev->bmr.command, 0x08);
+    return count;
+}
 
-    while (1) {
-        uint8_t status = inportb(dev->io_reg.status);
-        if (!bit_check(status, ata_status_bsy))
-            break;
+/// @brief Adds the pages of a buffer to the PRDT, so that the device
+/// transfers data directly from, or to, them.
+/// @param dev the device.
+/// @param count the number of entries already inside the PRDT.
+/// @param buffer the buffer.
+/// @param size the size of the buffer.
+/// @param to_memory true if the device writes in the buffer.
+/// @return the new number of entries, or -1 if the buffer cannot be used for DMA.
+static int ata_prdt_add_buffer(ata_device_t *dev, int count, uint8_t *buffer, size_t size, bool_t to_memory)
+{
+    // Regions must be aligned to a word, check it for the whole buffer.
+    if (((uintptr_t)buffer & 0x3) || (size & 0x3))
+        return -1;
+    for (uintptr_t addr = (uintptr_t)buffer, end = addr + size; addr < end;) {
+        uintptr_t physical;
+        if (!block_get_physical_address(addr, to_memory, &physical))
+            return -1;
+        // Go up to the end of the page, the next one might not be contiguous.
+        size_t chunk = min(end - addr, PAGE_SIZE - (addr & (PAGE_SIZE - 1)));
+        if ((count = ata_prdt_add(dev, count, physical, chunk)) < 0)
+            return -1;
+        addr += chunk;
     }
+    return count;
+}
 
-    outportb(dev->control_base, 0x00);
-    outportb(dev->io_reg.hddevsel, 0xe0 | (dev->slave << 4));
-    ata_io_wait(dev);
-    outportb(dev->io_reg.feature, 0x00);
-
-    outportb(dev->io_reg.sector_count, 0);
-    outportb(dev->io_reg.lba_lo, (lba & 0xff000000) >> 24);
-    outportb(dev->io_reg.lba_mid, (lba & 0xff00000000) >> 32);
-    outportb(dev->io_reg.lba_hi, (lba & 0xff0000000000) >> 40);
-
-    outportb(dev->io_reg.sector_count, 1);
-    outportb(dev->io_reg.lba_lo, (lba & 0x000000ff) >> 0);
-    outportb(dev->io_reg.lba_mid, (lba & 0x0000ff00) >> 8);
-    outportb(dev->io_reg.lba_hi, (lba & 0x00ff0000) >> 16);
-
-    while (1) {
-        uint8_t status = inportb(dev->io_reg.status);
-        if (!bit_check(status, ata_status_bsy) && bit_check(status, ata_status_rdy))
-            break;
+/// @brief Fills the PRDT so that the device transfers data directly from, or
+/// to, the buffers of the bios of the request.
+/// @param dev the device.
+/// @param request the request.
+/// @return 1 on success, 0 if some buffer cannot be used for DMA.
+static int ata_prdt_setup_direct(ata_device_t *dev, block_request_t *request)
+{
+    int count = 0;
+    list_for_each_decl(it, &request->bios)
+    {
+        block_bio_t *bio = list_entry(it, block_bio_t, list);
+        if ((count = ata_prdt_add_buffer(dev, count, bio->buffer, bio->count * ATA_SECTOR_SIZE, bio->direction == BLOCK_READ)) < 0)
+            return 0;
     }
+    dev->dma_prdt[count - 1].end_of_table = 0x8000;
+    return 1;
+}
 
-    // Write the READ_DMA to the command register (0xC8)
-    outportb(dev->io_reg.command, ata_dma_command_read);
+/// @brief Fills the PRDT so that the device transfers data from, or to, the
+/// DMA memory area of the device.
+/// @param dev the device.
+/// @param size the size of the transfer.
+static void ata_prdt_setup_bounce(ata_device_t *dev, size_t size)
+{
+    int count = ata_prdt_add(dev, 0, dev->dma_start_phys, size);
+    assert((count > 0) && "The DMA memory area does not fit the PRDT.");
+    dev->dma_prdt[count - 1].end_of_table = 0x8000;
+}
 
-    ata_io_wait(dev);
+/// @brief Completes the command in flight, if the controller says it is done.
+/// @param dev the device.
+/// @return 1 if the command completed, 0 otherwise.
+static int ata_complete(ata_device_t *dev)
+{
+    uint8_t bm_status = inportb(dev->bmr.status);
+    // Neither the interrupt nor the error bit are set, it was not us.
+    if (!bit_check(bm_status, 2) && !bit_check(bm_status, 1))
+        return 0;
+    // Reading the status register also acknowledges the interrupt.
+    dev->bm_status = bm_status;
+    dev->status    = inportb(dev->io_reg.status);
+    dev->error     = bit_check(dev->status, ata_status_err) ? inportb(dev->io_reg.error) : 0;
+    // Stop the bus master, and inform device we are done.
+    outportb(dev->bmr.command, ata_bm_stop_bus_master);
+    outportb(dev->bmr.status, bm_status | 0x04 | 0x02);
+    dev->busy = false;
+    return 1;
+}
 
-    outportb(dev->bmr.command, 0x08 | 0x01);
+/// @brief Gets the other device on the same channel, which shares the bus
+/// master registers with the given one.
+/// @param dev the device.
+/// @return the other device of the channel.
+static inline ata_device_t *ata_get_sibling(ata_device_t *dev)
+{
+    if (dev == &ata_primary_master)
+        return &ata_primary_slave;
+    if (dev == &ata_primary_slave)
+        return &ata_primary_master;
+    if (dev == &ata_secondary_master)
+        return &ata_secondary_slave;
+    return &ata_secondary_master;
+}
 
-    while (1) {
-        int status  = inportb(dev->bmr.status);
-        int dstatus = inportb(dev->io_reg.status);
-        if (!(status & 0x04)) {
-            continue;
-        }
-        if (!bit_check(dstatus, ata_status_bsy)) {
-            break;
-        }
+/// @brief Ends the request in flight, once the command completed, and starts
+/// the next one on the channel.
+/// @param dev the device.
+static void ata_end_request(ata_device_t *dev)
+{
+    block_request_t *request = dev->request;
+    bool_t write             = request->direction == BLOCK_WRITE;
+    int ret                  = 0;
+    if (bit_check(dev->bm_status, 1) || bit_check(dev->status, ata_status_err) || bit_check(dev->status, ata_status_df)) {
+        pr_err("[%s] DMA %s of %d sectors at %d failed (status: 0x%x, error: 0x%x).\n",
+               ata_get_device_settings_str(dev), write ? "write" : "read", request->count, request->sector,
+               dev->status, dev->error);
+        ret = -EIO;
+    } else if (dev->bounce && !write) {
+        // Copy from DMA buffer to the buffers of the bios, which were faulted
+        // in before being queued.
+        block_request_copy(request, dev->dma_start, ATA_SECTOR_SIZE, 0);
     }
-
-    // Copy from DMA buffer to output buffer.
-    memcpy(buffer, dev->dma_start, ATA_DMA_SIZE);
-
-    // Inform device we are done.
-    outportb(dev->bmr.status, inportb(dev->bmr.status) | 0x04 | 0x02);
-
-    spinlock_unlock(&ata_lock);
+    dev->request = NULL;
+    block_end_request(&dev->blkdev, request, ret);
+    // The other device of the channel might be waiting for us.
+    ata_device_t *sibling = ata_get_sibling(dev);
+    if (!dev->busy && sibling->blkdev.ops)
+        block_unplug(&sibling->blkdev);
 }
 
-static void ata_device_write_sector(ata_device_t *dev, uint32_t lba, uint8_t *buffer)
+/// @brief Starts the DMA command which transfers the sectors of a request,
+/// the device raises an interrupt once it is done.
+/// @param blkdev the block device.
+/// @param request the request.
+/// @return 0 if the command started, -EBUSY if the channel is in use,
+/// another negative error code on failure.
+static int ata_submit_request(block_device_t *blkdev, block_request_t *request)
 {
-    spinlock_lock(&ata_lock);
+    ata_device_t *dev = container_of(blkdev, ata_device_t, blkdev);
+    // The devices of the same channel share the bus master registers.
+    if (dev->busy || ata_get_sibling(dev)->busy)
+        return -EBUSY;
+    uint32_t lba   = request->sector;
+    uint32_t count = request->count;
+    bool_t write   = request->direction == BLOCK_WRITE;
+    if (((uint64_t)(lba + count) * ATA_SECTOR_SIZE) > ata_max_offset(dev))
+        return -EINVAL;
+    assert((count > 0) && (count <= ATA_DMA_MAX_SECTORS) && "Wrong number of sectors.");
+    // Use 48-bit commands whenever the device supports them.
+    bool_t lba48 = dev->identity.sectors_48 != 0;
+
+    // Point the PRDT to the buffers of the bios, or to the DMA memory area.
+    dev->bounce = !ata_prdt_setup_direct(dev, request);
+    if (dev->bounce) {
+        ata_prdt_setup_bounce(dev, count * ATA_SECTOR_SIZE);
+        if (write)
+            block_request_copy(request, dev->dma_start, ATA_SECTOR_SIZE, 1);
+    }
 
-    // Copy the buffer over to the DMA area
-    memcpy(dev->dma_start, buffer, ATA_DMA_SIZE);
+    ata_wait(dev, 0);
 
-    // Reset bus master register's command register
-    outportb(dev->bmr.command, 0);
+    // Reset bus master register's command register.
+    outportb(dev->bmr.command, ata_bm_stop_bus_master);
 
-    // Set prdt
+    // Set the PRDT.
     outportl(dev->bmr.prdt, dev->dma_prdt_phys);
 
-    // Enable error, irq status.
+    // Clear the error and irq status.
     outportb(dev->bmr.status, inportb(dev->bmr.status) | 0x04 | 0x02);
 
-    // Select drive
-    ata_wait(dev, 0);
-    outportb(dev->io_reg.hddevsel, 0xe0 | dev->slave << 4 | (lba & 0x0f000000) >> 24);
-    ata_wait(dev, 0);
-
-    // Set sector counts and LBAs
-    outportb(dev->io_reg.feature, 0x00);
-    outportb(dev->io_reg.sector_count, 1);
-    outportb(dev->io_reg.lba_lo, (lba & 0x000000ff) >> 0);
-    outportb(dev->io_reg.lba_mid, (lba & 0x0000ff00) >> 8);
-    outportb(dev->io_reg.lba_hi, (lba & 0x00ff0000) >> 16);
-    ata_wait(dev, 0);
+    // Set the direction, the read bit means that the device writes in memory.
+    outportb(dev->bmr.command, write ? 0x00 : 0x08);
 
-    // Notify that we are starting DMA writing.
-    outportb(dev->io_reg.command, ata_dma_command_write);
+    ata_status_wait(dev, 0);
 
-    // Start DMA Writing.
-    outportb(dev->bmr.command, 0x1);
+    outportb(dev->control_base, 0x00);
+    if (lba48) {
+        outportb(dev->io_reg.hddevsel, 0x40 | (dev->slave << 4));
+        ata_io_wait(dev);
+        outportb(dev->io_reg.feature, 0x00);
+        // High order bytes first.
+        outportb(dev->io_reg.sector_count, (count >> 8) & 0xff);
+        outportb(dev->io_reg.lba_lo, (lba >> 24) & 0xff);
+        outportb(dev->io_reg.lba_mid, 0);
+        outportb(dev->io_reg.lba_hi, 0);
+    } else {
+        outportb(dev->io_reg.hddevsel, 0xe0 | (dev->slave << 4) | ((lba >> 24) & 0x0f));
+        ata_io_wait(dev);
+        outportb(dev->io_reg.feature, 0x00);
+    }
+    // A count of zero means 256 sectors for 28-bit commands.
+    outportb(dev->io_reg.sector_count, count & 0xff);
+    outportb(dev->io_reg.lba_lo, (lba >> 0) & 0xff);
+    outportb(dev->io_reg.lba_mid, (lba >> 8) & 0xff);
+    outportb(dev->io_reg.lba_hi, (lba >> 16) & 0xff);
 
-    // Wait for dma write to complete.
     while (1) {
-        int status  = inportb(dev->bmr.status);
-        int dstatus = inportb(dev->io_reg.status);
-        if (!(status & 0x04)) {
-            continue;
-        }
-        if (!(dstatus & 0x80)) {
+        uint8_t status = inportb(dev->io_reg.status);
+        if (!bit_check(status, ata_status_bsy) && bit_check(status, ata_status_rdy))
             break;
-        }
     }
 
-    // Inform device we are done.
-    outportb(dev->bmr.status, inportb(dev->bmr.status) | 0x04 | 0x02);
+    // Issue the command.
+    if (write)
+        outportb(dev->io_reg.command, lba48 ? ata_dma_command_write_ext : ata_dma_command_write);
+    else
+        outportb(dev->io_reg.command, lba48 ? ata_dma_command_read_ext : ata_dma_command_read);
+
+    ata_io_wait(dev);
+
+    // Start the transfer, the device raises an interrupt once it is done.
+    dev->request = request;
+    dev->started = timer_get_ticks();
+    dev->busy    = true;
+    outportb(dev->bmr.command, (write ? 0x00 : 0x08) | ata_bm_start_bus_master);
+    return 0;
+}
 
-    spinlock_unlock(&ata_lock);
+/// @brief Checks if the command in flight completed, in case the interrupt
+/// got lost, and fails it once it takes too long.
+/// @param blkdev the block device.
+static void ata_poll(block_device_t *blkdev)
+{
+    ata_device_t *dev = container_of(blkdev, ata_device_t, blkdev);
+    if (!dev->busy)
+        return;
+    if (ata_complete(dev)) {
+        ata_end_request(dev);
+    } else if ((timer_get_ticks() - dev->started) > ATA_COMMAND_TIMEOUT) {
+        pr_err("[%s] The command timed out.\n", ata_get_device_settings_str(dev));
+        outportb(dev->bmr.command, ata_bm_stop_bus_master);
+        dev->bm_status = 0x02;
+        dev->status    = inportb(dev->io_reg.status);
+        dev->error     = 0;
+        dev->busy      = false;
+        ata_end_request(dev);
+    }
 }
 
+/// The operations of the ATA block devices.
+static const block_device_operations_t ata_block_operations = {
+    .submit = ata_submit_request,
+    .poll   = ata_poll,
+};
+
 // == VFS ENTRY GENERATION ====================================================
 /// Filesystem general operations.
 static vfs_sys_operations_t ata_sys_operations = {
@@ -894,8 +1081,6 @@ static int ata_close(vfs_file_t *file)
 static ssize_t ata_read(vfs_file_t *file, char *buffer, off_t offset, size_t size)
 {
     pr_debug("ata_read(file: 0x%p, buffer: 0x%p, offest: %8d, size: %8d)\n", file, buffer, offset, size);
-    // Prepare a static support buffer.
-    static char support_buffer[ATA_SECTOR_SIZE];
     // Get the device from the VFS file.
     ata_device_t *dev = (ata_device_t *)file->device;
     // Check the device.
@@ -904,14 +1089,7 @@ static ssize_t ata_read(vfs_file_t *file, char *buffer, off_t offset, size_t siz
     }
 
     if ((dev->type == ata_dev_type_pata) || (dev->type == ata_dev_type_sata)) {
-        uint32_t start_block  = offset / ATA_SECTOR_SIZE;
-        uint32_t start_offset = offset % ATA_SECTOR_SIZE;
-        uint32_t end_block    = (offset + size - 1) / ATA_SECTOR_SIZE;
-        uint32_t end_offset   = (offset + size - 1) % ATA_SECTOR_SIZE;
-        uint32_t prefix_size  = (ATA_SECTOR_SIZE - start_offset);
-        uint32_t postfix_size = (offset + size) % ATA_SECTOR_SIZE;
-        uint32_t max_offset   = ata_max_offset(dev);
-        uint32_t x_offset     = 0;
+        uint32_t max_offset = ata_max_offset(dev);
 
         // Check if with the offset we are exceeding the size.
         if (offset > max_offset) {
@@ -923,25 +1101,13 @@ static ssize_t ata_read(vfs_file_t *file, char *buffer, off_t offset, size_t siz
         if ((offset + size) > max_offset) {
             size = max_offset - offset;
         }
-
-        if (start_offset) {
-            ata_device_read_sector(dev, start_block, (uint8_t *)support_buffer);
-            memcpy(buffer, (void *)((uintptr_t)support_buffer + start_offset), prefix_size);
-            x_offset += prefix_size;
-            ++start_block;
-        }
-
-        if (postfix_size && (start_block <= end_block)) {
-            ata_device_read_sector(dev, end_block, (uint8_t *)support_buffer);
-            memcpy((void *)((uintptr_t)buffer + size - postfix_size), support_buffer, postfix_size);
-            --end_block;
+        if (size == 0) {
+            return 0;
         }
 
-        while (start_block <= end_block) {
-            ata_device_read_sector(dev, start_block, (uint8_t *)((uintptr_t)buffer + x_offset));
-            x_offset += ATA_SECTOR_SIZE;
-            ++start_block;
-        }
+        // Whole sectors go directly in the buffer.
+        if (buffer_rw_raw(&dev->blkdev, offset, size, (uint8_t *)buffer, BLOCK_READ) < 0)
+            return -EIO;
     } else if ((dev->type == ata_dev_type_patapi) || (dev->type == ata_dev_type_satapi)) {
         pr_warning("ATAPI and SATAPI drives are not currently supported.\n");
         size = -EPERM;
@@ -952,8 +1118,6 @@ static ssize_t ata_read(vfs_file_t *file, char *buffer, off_t offset, size_t siz
 static ssize_t ata_write(vfs_file_t *file, const void *buffer, off_t offset, size_t size)
 {
     pr_debug("ata_write(%p, %p, %d, %d)\n", file, buffer, offset, size);
-    // Prepare a static support buffer.
-    static char support_buffer[ATA_SECTOR_SIZE];
     // Get the device from the VFS file.
     ata_device_t *dev = (ata_device_t *)file->device;
     // Check the device.
@@ -962,14 +1126,7 @@ static ssize_t ata_write(vfs_file_t *file, const void *buffer, off_t offset, siz
     }
 
     if ((dev->type == ata_dev_type_pata) || (dev->type == ata_dev_type_sata)) {
-        uint32_t start_block  = offset / ATA_SECTOR_SIZE;
-        uint32_t start_offset = offset % ATA_SECTOR_SIZE;
-        uint32_t end_block    = (offset + size - 1) / ATA_SECTOR_SIZE;
-        uint32_t end_offset   = (offset + size - 1) % ATA_SECTOR_SIZE;
-        uint32_t prefix_size  = (ATA_SECTOR_SIZE - start_offset);
-        uint32_t postfix_size = (offset + size) % ATA_SECTOR_SIZE;
-        uint32_t max_offset   = ata_max_offset(dev);
-        uint32_t x_offset     = 0;
+        uint32_t max_offset = ata_max_offset(dev);
 
         // Check if with the offset we are exceeding the size.
         if (offset > max_offset) {
@@ -980,26 +1137,13 @@ static ssize_t ata_write(vfs_file_t *file, const void *buffer, off_t offset, siz
         if (offset + size > max_offset) {
             size = max_offset - offset;
         }
-        if (start_offset) {
-            ata_device_read_sector(dev, start_block, (uint8_t *)support_buffer);
-            memcpy((void *)((uintptr_t)support_buffer + (start_offset)), buffer, prefix_size);
-            ata_device_write_sector(dev, start_block, (uint8_t *)support_buffer);
-            x_offset += prefix_size;
-            ++start_block;
-        }
-
-        if (postfix_size && (start_block <= end_block)) {
-            ata_device_read_sector(dev, end_block, (uint8_t *)support_buffer);
-            memcpy(support_buffer, (void *)((uintptr_t)buffer + size - postfix_size), postfix_size);
-            ata_device_write_sector(dev, end_block, (uint8_t *)support_buffer);
-            --end_block;
+        if (size == 0) {
+            return 0;
         }
 
-        while (start_block <= end_block) {
-            ata_device_write_sector(dev, start_block, (uint8_t *)((uintptr_t)buffer + x_offset));
-            x_offset += ATA_SECTOR_SIZE;
-            ++start_block;
-        }
+        // Whole sectors go directly from the buffer.
+        if (buffer_rw_raw(&dev->blkdev, offset, size, (uint8_t *)buffer, BLOCK_WRITE) < 0)
+            return -EIO;
     } else if ((dev->type == ata_dev_type_patapi) || (dev->type == ata_dev_type_satapi)) {
         pr_warning("ATAPI and SATAPI drives are not currently supported.\n");
         size = -EPERM;
@@ -1057,12 +1201,19 @@ static ata_device_type_t ata_device_detect(ata_device_t *dev)
     }
     // Parallel ATA drive, or emulated SATA.
     if ((type == ata_dev_type_pata) || (type == ata_dev_type_sata)) {
+        // Read the identity before naming the drive, so that a phantom drive
+        // (e.g., a missing slave mirroring the master) does not take a name.
+        ata_device_select(dev);
+        if (!ata_read_device_identity(dev, ata_command_pata_ident)) {
+            pr_debug("[%s] The drive did not answer the identify command.\n", ata_get_device_settings_str(dev));
+            return ata_dev_type_no_device;
+        }
         // Device type supported, set it.
         dev->type = type;
         // Set the device name.
-        sprintf(dev->name, "hd%c", ata_drive_char);
+        block_get_disk_name(dev->name);
         // Set the device path.
-        sprintf(dev->path, "/dev/hd%c", ata_drive_char);
+        sprintf(dev->path, "/dev/%s", dev->name);
         // Create the filesystem entry for the drive.
         dev->fs_root = ata_device_create(dev);
         // Check if we failed to create the filesystem entry.
@@ -1080,8 +1231,18 @@ static ata_device_type_t ata_device_detect(ata_device_t *dev)
             pr_crit("Failed to initialize ata device!\n");
             return 1;
         }
-        // Increment the drive letter.
-        ++ata_drive_char;
+        // Register the block device, requests go through its queue.
+        strcpy(dev->blkdev.name, dev->name);
+        dev->blkdev.file        = dev->fs_root;
+        dev->blkdev.sector_size = ATA_SECTOR_SIZE;
+        dev->blkdev.max_sectors = ATA_DMA_MAX_SECTORS;
+        dev->blkdev.max_bios    = ATA_MAX_BIOS;
+        dev->blkdev.queue_depth = 1;
+        dev->blkdev.ops         = &ata_block_operations;
+        if (block_register_device(&dev->blkdev) < 0) {
+            pr_crit("Failed to register ata device!\n");
+            return 1;
+        }
     } else if ((type == ata_dev_type_patapi) || (type == ata_dev_type_satapi)) {
         pr_warning("ATAPI and SATAPI drives are not currently supported.\n");
         return ata_dev_type_no_device;
@@ -1093,63 +1254,80 @@ static ata_device_type_t ata_device_detect(ata_device_t *dev)
 }
 
 // == IRQ HANDLERS ============================================================
+/// @brief Handles the interrupt of an ATA channel, completing the command in
+/// flight on one of its devices.
+/// @param master the master device of the channel.
+/// @param slave the slave device of the channel.
+static inline void ata_irq_handle_channel(ata_device_t *master, ata_device_t *slave)
+{
+    if (master->busy && ata_complete(master)) {
+        ata_end_request(master);
+        return;
+    }
+    if (slave->busy && ata_complete(slave)) {
+        ata_end_request(slave);
+        return;
+    }
+    // Nothing in flight (e.g., the identify command), just acknowledge it.
+    inportb(master->io_reg.status);
+}
+
 /// @param f The interrupt stack frame.
 static void ata_irq_handler_master(pt_regs *f)
 {
-    pr_warning("ata_irq_handler_master\n");
-    inportb(ata_primary_master.io_reg.status);
-    inportb(ata_primary_master.bmr.status);
-    //outportb(ata_primary_master.bmr.command, ata_bm_stop_bus_master);
-    pic8259_send_eoi(IRQ_FIRST_HD);
+    ata_irq_handle_channel(&ata_primary_master, &ata_primary_slave);
 }
 
 /// @param f The interrupt stack frame.
 static void ata_irq_handler_slave(pt_regs *f)
 {
-    pr_warning("ata_irq_handler_slave\n");
-    inportb(ata_secondary_master.io_reg.status);
-    inportb(ata_primary_master.bmr.status);
-    //outportb(ata_primary_master.bmr.command, ata_bm_stop_bus_master);
-    pic8259_send_eoi(IRQ_SECOND_HD);
+    ata_irq_handle_channel(&ata_secondary_master, &ata_secondary_slave);
 }
 
-// == PCI FUNCTIONS ===========================================================
-static void pci_find_ata(uint32_t dev, uint16_t vid, uint16_t did, void *extra)
+// == INITIALIZE/FINALIZE ATA =================================================
+/// @brief Detects a device, and reports it.
+/// @param dev the device.
+/// @param position where the device is connected.
+static inline void ata_device_probe(ata_device_t *dev, const char *position)
 {
-    if ((vid == 0x8086) && (did == 0x7010 || did == 0x7111)) {
-        *((uint32_t *)extra) = dev;
+    ata_device_type_t type = ata_device_detect(dev);
+    if ((type != ata_dev_type_no_device) && (type != ata_dev_type_unknown)) {
+        pr_info("    Found %s device connected to %s.\n", ata_get_device_type_str(type), position);
     }
 }
 
-// == INITIALIZE/FINALIZE ATA =================================================
 int ata_initialize()
 {
-    // Initialize the spinlock.
-    spinlock_init(&ata_lock);
-
-    // Search for ATA devices.
-    pci_scan(&pci_find_ata, -1, &ata_pci);
+    // Search for the PIIX3, or PIIX4, IDE controller.
+    const pci_device_t *controller = pci_find_device(0x8086, 0x7010, NULL);
+    if (controller == NULL) {
+        controller = pci_find_device(0x8086, 0x7111, NULL);
+    }
+    if (controller) {
+        ata_pci = controller->device;
+    }
 
     // Install the IRQ handlers.
     irq_install_handler(IRQ_FIRST_HD, ata_irq_handler_master, "IDE Master");
     irq_install_handler(IRQ_SECOND_HD, ata_irq_handler_slave, "IDE Slave");
-
-    ata_device_type_t type;
-    type = ata_device_detect(&ata_primary_master);
-    if ((type != ata_dev_type_no_device) && (type != ata_dev_type_unknown)) {
-        pr_info("    Found %s device connected to primary master.\n", ata_get_device_type_str(type));
-    }
-    type = ata_device_detect(&ata_primary_slave);
-    if ((type != ata_dev_type_no_device) && (type != ata_dev_type_unknown)) {
-        pr_info("    Found %s device connected to primary slave.\n", ata_get_device_type_str(type));
+    pic8259_irq_enable(IRQ_FIRST_HD);
+    pic8259_irq_enable(IRQ_SECOND_HD);
+
+    // Reset both channels before waiting on either of them, so that they
+    // recover at the same time. A reset affects both drives of a channel, so
+    // two resets are enough for the four positions.
+    bool_t primary   = ata_channel_reset(&ata_primary_master);
+    bool_t secondary = ata_channel_reset(&ata_secondary_master);
+    primary          = primary && ata_channel_wait(&ata_primary_master);
+    secondary        = secondary && ata_channel_wait(&ata_secondary_master);
+
+    if (primary) {
+        ata_device_probe(&ata_primary_master, "primary master");
+        ata_device_probe(&ata_primary_slave, "primary slave");
     }
-    type = ata_device_detect(&ata_secondary_master);
-    if ((type != ata_dev_type_no_device) && (type != ata_dev_type_unknown)) {
-        pr_info("    Found %s device connected to secondary master.\n", ata_get_device_type_str(type));
-    }
-    type = ata_device_detect(&ata_secondary_slave);
-    if ((type != ata_dev_type_no_device) && (type != ata_dev_type_unknown)) {
-        pr_info("    Found %s device connected to secondary slave.\n", ata_get_device_type_str(type));
+    if (secondary) {
+        ata_device_probe(&ata_secondary_master, "secondary master");
+        ata_device_probe(&ata_secondary_slave, "secondary slave");
     }
     return 0;
 }
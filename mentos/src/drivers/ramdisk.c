@@ -0,0 +1,303 @@
+/// @file ramdisk.c
+/// @brief Block devices backed by memory (e.g., /dev/ram0).
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[RAMDSK]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "drivers/ramdisk.h"
+#include "mem/zone_allocator.h"
+#include "mem/kheap.h"
+#include "sys/errno.h"
+#include "io/debug.h"
+#include "fs/buffer_cache.h"
+#include "fs/blkdev.h"
+#include "fs/vfs.h"
+#include "string.h"
+#include "stdio.h"
+#include "math.h"
+#include "time.h"
+
+/// The sector size.
+#define RAMDISK_SECTOR_SIZE 512U
+/// The number of pages of each RAM disk.
+#define RAMDISK_PAGES (RAMDISK_SIZE / PAGE_SIZE)
+
+/// @brief A RAM disk.
+typedef struct ramdisk_t {
+    /// Name of the device.
+    char name[NAME_MAX];
+    /// Path of the device.
+    char path[PATH_MAX];
+    /// The pages, NULL until written.
+    uint8_t **pages;
+    /// Number of allocated pages.
+    uint32_t nr_pages;
+    /// Device root file.
+    vfs_file_t *fs_root;
+    /// The block device, with the queue of the requests.
+    block_device_t blkdev;
+} ramdisk_t;
+
+/// The RAM disks.
+static ramdisk_t ramdisks[RAMDISK_COUNT];
+
+static vfs_file_t *ramdisk_open(const char *, int, mode_t);
+static int ramdisk_close(vfs_file_t *);
+static ssize_t ramdisk_read(vfs_file_t *, char *, off_t, size_t);
+static ssize_t ramdisk_write(vfs_file_t *, const void *, off_t, size_t);
+static int ramdisk_fstat(vfs_file_t *file, stat_t *stat);
+static int ramdisk_stat(const char *path, stat_t *stat);
+
+// == SUPPORT FUNCTIONS =======================================================
+/// @brief Copies a range of bytes between the disk and a buffer.
+/// @param dev the RAM disk.
+/// @param offset the offset of the first byte.
+/// @param size the number of bytes, the range must be inside the disk.
+/// @param buffer the buffer.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return 0 on success, -ENOMEM if a page could not be allocated.
+static int ramdisk_copy(ramdisk_t *dev, uint32_t offset, size_t size, uint8_t *buffer, int direction)
+{
+    while (size > 0) {
+        uint32_t index = offset / PAGE_SIZE;
+        uint32_t start = offset % PAGE_SIZE;
+        uint32_t chunk = min(size, PAGE_SIZE - start);
+        uint8_t *page  = dev->pages[index];
+        if (direction == BLOCK_READ) {
+            // Pages never written read back as zeros.
+            if (page)
+                memcpy(buffer, page + start, chunk);
+            else
+                memset(buffer, 0, chunk);
+        } else {
+            if (page == NULL) {
+                page = (uint8_t *)__alloc_page_lowmem(GFP_KERNEL);
+                if (page == NULL)
+                    return -ENOMEM;
+                memset(page, 0, PAGE_SIZE);
+                dev->pages[index] = page;
+                ++dev->nr_pages;
+            }
+            memcpy(page + start, buffer, chunk);
+        }
+        offset += chunk;
+        buffer += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+/// @brief Transfers the sectors of a request, completing it right away.
+/// @param blkdev the block device.
+/// @param request the request.
+/// @return 0, the request is always accepted.
+static int ramdisk_submit_request(block_device_t *blkdev, block_request_t *request)
+{
+    ramdisk_t *dev = container_of(blkdev, ramdisk_t, blkdev);
+    int error      = 0;
+    if ((request->sector + request->count) > (RAMDISK_SIZE / RAMDISK_SECTOR_SIZE)) {
+        error = -EINVAL;
+    } else {
+        uint32_t offset = request->sector * RAMDISK_SECTOR_SIZE;
+        list_for_each_decl(it, &request->bios)
+        {
+            block_bio_t *bio = list_entry(it, block_bio_t, list);
+            size_t size      = bio->count * RAMDISK_SECTOR_SIZE;
+            if ((error = ramdisk_copy(dev, offset, size, bio->buffer, request->direction)) < 0)
+                break;
+            offset += size;
+        }
+    }
+    // The queue copes with requests completed before submit returns.
+    block_end_request(blkdev, request, error);
+    return 0;
+}
+
+/// The operations of the RAM disks.
+static const block_device_operations_t ramdisk_block_operations = {
+    .submit = ramdisk_submit_request,
+    .poll   = NULL,
+};
+
+// == VFS ENTRY GENERATION ====================================================
+/// Filesystem general operations.
+static vfs_sys_operations_t ramdisk_sys_operations = {
+    .mkdir_f = NULL,
+    .rmdir_f = NULL,
+    .stat_f  = ramdisk_stat
+};
+
+/// RAM disk filesystem file operations.
+static vfs_file_operations_t ramdisk_fs_operations = {
+    .open_f     = ramdisk_open,
+    .unlink_f   = NULL,
+    .close_f    = ramdisk_close,
+    .read_f     = ramdisk_read,
+    .write_f    = ramdisk_write,
+    .lseek_f    = NULL,
+    .stat_f     = ramdisk_fstat,
+    .ioctl_f    = NULL,
+    .getdents_f = NULL
+};
+
+/// @brief Creates the file of a RAM disk.
+/// @param dev the RAM disk.
+/// @return the file, NULL on failure.
+static vfs_file_t *ramdisk_device_create(ramdisk_t *dev)
+{
+    vfs_file_t *file = kmem_cache_alloc(vfs_file_cache, GFP_KERNEL);
+    if (file == NULL) {
+        pr_err("Failed to create RAM disk device.\n");
+        return NULL;
+    }
+    memcpy(file->name, dev->name, NAME_MAX);
+    file->device         = dev;
+    file->flags          = DT_BLK;
+    file->length         = RAMDISK_SIZE;
+    file->sys_operations = &ramdisk_sys_operations;
+    file->fs_operations  = &ramdisk_fs_operations;
+    return file;
+}
+
+// == VFS CALLBACKS ===========================================================
+static vfs_file_t *ramdisk_open(const char *path, int flags, mode_t mode)
+{
+    pr_debug("ramdisk_open(%s, %d, %d)\n", path, flags, mode);
+    for (unsigned i = 0; i < RAMDISK_COUNT; ++i) {
+        if (ramdisks[i].fs_root && (strcmp(path, ramdisks[i].path) == 0)) {
+            ++ramdisks[i].fs_root->count;
+            return ramdisks[i].fs_root;
+        }
+    }
+    return NULL;
+}
+
+static int ramdisk_close(vfs_file_t *file)
+{
+    pr_debug("ramdisk_close(%p)\n", file);
+    --file->count;
+    return 0;
+}
+
+/// @brief Reads, or writes, a range of bytes of the disk, through the queue
+/// of the block device like the other disks, so that it is accounted and
+/// coherent with the buffer cache.
+/// @param file the file of the disk.
+/// @param buffer the buffer.
+/// @param offset the offset of the first byte.
+/// @param size the number of bytes.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return the number of bytes transferred, or a negative error code.
+static ssize_t ramdisk_rw(vfs_file_t *file, uint8_t *buffer, off_t offset, size_t size, int direction)
+{
+    ramdisk_t *dev = (ramdisk_t *)file->device;
+    if ((offset < 0) || ((uint32_t)offset >= file->length))
+        return 0;
+    size    = min(size, file->length - offset);
+    int ret = buffer_rw_raw(&dev->blkdev, offset, size, buffer, direction);
+    return (ret < 0) ? ret : (ssize_t)size;
+}
+
+static ssize_t ramdisk_read(vfs_file_t *file, char *buffer, off_t offset, size_t size)
+{
+    return ramdisk_rw(file, (uint8_t *)buffer, offset, size, BLOCK_READ);
+}
+
+static ssize_t ramdisk_write(vfs_file_t *file, const void *buffer, off_t offset, size_t size)
+{
+    return ramdisk_rw(file, (uint8_t *)buffer, offset, size, BLOCK_WRITE);
+}
+
+/// @brief Fills the attributes of a RAM disk.
+/// @param dev the RAM disk.
+/// @param stat where the attributes are stored.
+/// @return 0 on success.
+static int _ramdisk_stat(const ramdisk_t *dev, stat_t *stat)
+{
+    if (dev && dev->fs_root) {
+        stat->st_dev   = 0;
+        stat->st_ino   = 0;
+        stat->st_mode  = 0;
+        stat->st_uid   = 0;
+        stat->st_gid   = 0;
+        stat->st_atime = sys_time(NULL);
+        stat->st_mtime = sys_time(NULL);
+        stat->st_ctime = sys_time(NULL);
+        stat->st_size  = dev->fs_root->length;
+    }
+    return 0;
+}
+
+static int ramdisk_fstat(vfs_file_t *file, stat_t *stat)
+{
+    return _ramdisk_stat(file->device, stat);
+}
+
+static int ramdisk_stat(const char *path, stat_t *stat)
+{
+    super_block_t *sb = vfs_get_superblock(path);
+    if (sb && sb->root) {
+        return _ramdisk_stat(sb->root->device, stat);
+    }
+    return -1;
+}
+
+// == INITIALIZE/FINALIZE RAM DISKS ===========================================
+int ramdisk_initialize(void)
+{
+    for (unsigned i = 0; i < RAMDISK_COUNT; ++i) {
+        ramdisk_t *dev = &ramdisks[i];
+        memset(dev, 0, sizeof(ramdisk_t));
+        dev->pages = kmalloc(RAMDISK_PAGES * sizeof(uint8_t *));
+        if (dev->pages == NULL) {
+            pr_err("Failed to allocate the pages of ram%d.\n", i);
+            return 1;
+        }
+        memset(dev->pages, 0, RAMDISK_PAGES * sizeof(uint8_t *));
+        sprintf(dev->name, "ram%d", i);
+        sprintf(dev->path, "/dev/%s", dev->name);
+        dev->fs_root = ramdisk_device_create(dev);
+        if (dev->fs_root == NULL)
+            return 1;
+        if (!vfs_mount(dev->path, dev->fs_root)) {
+            pr_err("Failed to mount %s.\n", dev->path);
+            return 1;
+        }
+        // Register the block device, so that filesystems can sit on top of
+        // it. Sorting requests is pointless without a seek time.
+        strcpy(dev->blkdev.name, dev->name);
+        dev->blkdev.file        = dev->fs_root;
+        dev->blkdev.sector_size = RAMDISK_SECTOR_SIZE;
+        dev->blkdev.max_sectors = RAMDISK_SIZE / RAMDISK_SECTOR_SIZE;
+        dev->blkdev.max_bios    = 1024U;
+        dev->blkdev.queue_depth = 1;
+        dev->blkdev.ops         = &ramdisk_block_operations;
+        if (block_register_device(&dev->blkdev) < 0)
+            return 1;
+        block_set_scheduler(&dev->blkdev, "noop");
+        pr_debug("Created %s (%d KB).\n", dev->path, RAMDISK_SIZE / 1024U);
+    }
+    return 0;
+}
+
+int ramdisk_finalize(void)
+{
+    for (unsigned i = 0; i < RAMDISK_COUNT; ++i) {
+        ramdisk_t *dev = &ramdisks[i];
+        if (dev->pages == NULL)
+            continue;
+        for (uint32_t j = 0; j < RAMDISK_PAGES; ++j)
+            if (dev->pages[j])
+                free_page_lowmem((uint32_t)dev->pages[j]);
+        kfree(dev->pages);
+        dev->pages    = NULL;
+        dev->nr_pages = 0;
+    }
+    return 0;
+}
@@ -0,0 +1,649 @@
+/// @file virtio_blk.c
+/// @brief Driver for the paravirtual virtio block devices (legacy PCI).
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[VIRTIO]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "drivers/virtio_blk.h"
+#include "descriptor_tables/isr.h"
+#include "hardware/pic8259.h"
+#include "klib/stdatomic.h"
+#include "klib/compiler.h"
+#include "devices/pci.h"
+#include "io/port_io.h"
+#include "mem/zone_allocator.h"
+#include "mem/kheap.h"
+#include "mem/slab.h"
+#include "sys/bitops.h"
+#include "sys/errno.h"
+#include "io/debug.h"
+#include "fs/buffer_cache.h"
+#include "fs/blkdev.h"
+#include "fs/vfs.h"
+#include "string.h"
+#include "assert.h"
+#include "stdio.h"
+#include "math.h"
+#include "time.h"
+
+#define VIRTIO_VENDOR_ID         0x1AF4U ///< Vendor of the virtio devices.
+#define VIRTIO_BLK_DEVICE_ID     0x1001U ///< Legacy (transitional) virtio block device.
+#define VIRTIO_BLK_MAX_DEVICES   4U      ///< The maximum number of devices.
+#define VIRTIO_BLK_SECTOR_SIZE   512U    ///< The sector size.
+#define VIRTIO_BLK_MAX_SECTORS   256U    ///< The maximum number of sectors of a request.
+#define VIRTIO_BLK_MAX_BIOS      128U    ///< The maximum number of bios of a request.
+#define VIRTIO_BLK_QUEUE_DEPTH   32U     ///< The maximum number of requests in flight.
+#define VIRTIO_BLK_DIRECT_CHAIN  16U     ///< Ring descriptors of each request, without indirect ones.
+#define VIRTIO_VRING_ALIGN       4096U   ///< Alignment of the used ring (legacy layout).
+
+// Registers of the legacy interface, offsets from the I/O BAR.
+#define VIRTIO_PCI_HOST_FEATURES  0x00 ///< Features offered by the device (32 bits).
+#define VIRTIO_PCI_GUEST_FEATURES 0x04 ///< Features accepted by the driver (32 bits).
+#define VIRTIO_PCI_QUEUE_PFN      0x08 ///< Page frame of the selected virtqueue (32 bits).
+#define VIRTIO_PCI_QUEUE_NUM      0x0C ///< Size of the selected virtqueue (16 bits).
+#define VIRTIO_PCI_QUEUE_SEL      0x0E ///< Selects a virtqueue (16 bits).
+#define VIRTIO_PCI_QUEUE_NOTIFY   0x10 ///< Notifies the device about a virtqueue (16 bits).
+#define VIRTIO_PCI_STATUS         0x12 ///< Device status (8 bits).
+#define VIRTIO_PCI_ISR            0x13 ///< Interrupt status, cleared when read (8 bits).
+#define VIRTIO_PCI_CONFIG         0x14 ///< Device configuration, without MSI-X.
+
+#define VIRTIO_BLK_CONFIG_CAPACITY (VIRTIO_PCI_CONFIG + 0x00) ///< Number of sectors (64 bits).
+#define VIRTIO_BLK_CONFIG_SEG_MAX  (VIRTIO_PCI_CONFIG + 0x0C) ///< Maximum number of segments (32 bits).
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01U ///< The driver found the device.
+#define VIRTIO_STATUS_DRIVER      0x02U ///< The driver knows how to drive the device.
+#define VIRTIO_STATUS_DRIVER_OK   0x04U ///< The driver is ready.
+#define VIRTIO_STATUS_FAILED      0x80U ///< The driver gave up on the device.
+
+#define VIRTIO_BLK_F_SEG_MAX        (1U << 2)  ///< The device reports seg_max.
+#define VIRTIO_BLK_F_RO             (1U << 5)  ///< The device is read-only.
+#define VIRTIO_RING_F_INDIRECT_DESC (1U << 28) ///< The device supports indirect descriptors.
+
+#define VIRTQ_DESC_F_NEXT     1U ///< The descriptor continues through next.
+#define VIRTQ_DESC_F_WRITE    2U ///< The device writes in the buffer.
+#define VIRTQ_DESC_F_INDIRECT 4U ///< The buffer is a table of descriptors.
+
+#define VIRTIO_BLK_T_IN  0U ///< Read request.
+#define VIRTIO_BLK_T_OUT 1U ///< Write request.
+
+#define VIRTIO_BLK_S_OK 0U ///< The request succeeded.
+
+/// @brief A descriptor of a virtqueue.
+typedef struct virtq_desc_t {
+    /// Physical address of the buffer.
+    uint32_t addr;
+    /// Physical address of the buffer, upper 32 bits.
+    uint32_t addr_hi;
+    /// The size of the buffer.
+    uint32_t len;
+    /// Flags (e.g., VIRTQ_DESC_F_NEXT).
+    uint16_t flags;
+    /// The next descriptor of the chain.
+    uint16_t next;
+} virtq_desc_t;
+
+/// @brief The ring of the chains offered to the device.
+typedef volatile struct virtq_avail_t {
+    /// Flags, the driver does not use them.
+    uint16_t flags;
+    /// Where the driver puts the next chain, it only increases.
+    uint16_t idx;
+    /// The heads of the chains.
+    uint16_t ring[];
+} virtq_avail_t;
+
+/// @brief An entry of the used ring.
+typedef struct virtq_used_elem_t {
+    /// The head of the chain.
+    uint32_t id;
+    /// Number of bytes written by the device.
+    uint32_t len;
+} virtq_used_elem_t;
+
+/// @brief The ring of the chains the device is done with.
+typedef volatile struct virtq_used_t {
+    /// Flags, the driver does not use them.
+    uint16_t flags;
+    /// Where the device puts the next chain, it only increases.
+    uint16_t idx;
+    /// The chains.
+    virtq_used_elem_t ring[];
+} virtq_used_t;
+
+/// @brief The header of a request.
+typedef struct virtio_blk_header_t {
+    /// VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT.
+    uint32_t type;
+    /// Reserved.
+    uint32_t reserved;
+    /// The first sector.
+    uint32_t sector;
+    /// The first sector, upper 32 bits.
+    uint32_t sector_hi;
+} virtio_blk_header_t;
+
+/// @brief The memory of a slot, one page, shared with the device.
+typedef struct virtio_blk_slot_t {
+    /// The header of the request.
+    virtio_blk_header_t header;
+    /// The status written by the device.
+    volatile uint8_t status;
+    /// Padding.
+    uint8_t reserved[15];
+    /// The table of the indirect descriptor.
+    virtq_desc_t table[(PAGE_SIZE - 32U) / sizeof(virtq_desc_t)];
+} virtio_blk_slot_t;
+
+/// @brief A virtio block device.
+typedef struct virtio_blk_device_t {
+    /// Name of the device.
+    char name[NAME_MAX];
+    /// Path of the device.
+    char path[PATH_MAX];
+    /// The PCI device.
+    uint32_t pci;
+    /// The base of the registers.
+    uint16_t iobase;
+    /// The number of sectors.
+    uint32_t sectors;
+    /// The features accepted by the driver.
+    uint32_t features;
+    /// The size of the virtqueue.
+    uint16_t queue_size;
+    /// The descriptors of the virtqueue.
+    virtq_desc_t *desc;
+    /// The available ring.
+    virtq_avail_t *avail;
+    /// The used ring.
+    virtq_used_t *used;
+    /// The next entry of the used ring to process.
+    uint16_t last_used;
+    /// Ring descriptors taken by each request.
+    uint32_t chain;
+    /// Maximum number of buffers of a request.
+    uint32_t max_segments;
+    /// The memory of the slots, one page each.
+    virtio_blk_slot_t *slots;
+    /// Physical address of the slots.
+    uintptr_t slots_phys;
+    /// The requests in flight.
+    block_slots_t inflight;
+    /// Device root file.
+    vfs_file_t *fs_root;
+    /// The block device, with the queue of the requests.
+    block_device_t blkdev;
+} virtio_blk_device_t;
+
+/// The devices.
+static virtio_blk_device_t *virtio_blk_devices[VIRTIO_BLK_MAX_DEVICES];
+/// The number of devices.
+static unsigned virtio_blk_count = 0;
+/// The IRQ lines where the handler is installed, one bit for each of them.
+static uint32_t virtio_blk_irqs = 0;
+
+static vfs_file_t *virtio_blk_open(const char *, int, mode_t);
+static int virtio_blk_close(vfs_file_t *);
+static ssize_t virtio_blk_read(vfs_file_t *, char *, off_t, size_t);
+static ssize_t virtio_blk_write(vfs_file_t *, const void *, off_t, size_t);
+static int virtio_blk_fstat(vfs_file_t *file, stat_t *stat);
+static int virtio_blk_stat(const char *path, stat_t *stat);
+
+// == SUPPORT FUNCTIONS =======================================================
+/// @brief Allocates memory shared with the device.
+/// @param size the size of the memory.
+/// @param physical where the physical address is stored.
+/// @return the address of the memory, zeroed, NULL on failure.
+static void *virtio_alloc_dma(uint32_t size, uintptr_t *physical)
+{
+    uint32_t order = 0;
+    while ((PAGE_SIZE << order) < size)
+        ++order;
+    uint32_t addr = __alloc_pages_lowmem(GFP_KERNEL, order);
+    if (addr == 0)
+        return NULL;
+    memset((void *)addr, 0, PAGE_SIZE << order);
+    *physical = get_physical_address_from_page(get_lowmem_page_from_address(addr));
+    return (void *)addr;
+}
+
+/// @brief Fills a descriptor.
+/// @param desc the descriptor.
+/// @param physical the physical address of the buffer.
+/// @param size the size of the buffer.
+/// @param flags the flags of the descriptor.
+/// @param next the next descriptor of the chain.
+static inline void virtq_desc_set(virtq_desc_t *desc, uintptr_t physical, uint32_t size, uint16_t flags, uint16_t next)
+{
+    desc->addr    = physical;
+    desc->addr_hi = 0;
+    desc->len     = size;
+    desc->flags   = flags;
+    desc->next    = next;
+}
+
+/// @brief Adds the pages of a buffer to a table of descriptors, merging the
+/// physically contiguous ones.
+/// @param table the table.
+/// @param count the number of descriptors already inside the table.
+/// @param max the maximum number of descriptors.
+/// @param buffer the buffer.
+/// @param size the size of the buffer.
+/// @param to_memory true if the device writes in the buffer.
+/// @return the new number of descriptors, or -1 if the buffer does not fit.
+static int virtio_blk_add_buffer(virtq_desc_t *table, int count, int max, uint8_t *buffer, size_t size, bool_t to_memory)
+{
+    for (uintptr_t addr = (uintptr_t)buffer, end = addr + size; addr < end;) {
+        uintptr_t physical;
+        if (!block_get_physical_address(addr, to_memory, &physical))
+            return -1;
+        // Go up to the end of the page, the next one might not be contiguous.
+        size_t chunk = min(end - addr, PAGE_SIZE - (addr & (PAGE_SIZE - 1)));
+        if ((count > 0) && ((table[count - 1].addr + table[count - 1].len) == physical)) {
+            table[count - 1].len += chunk;
+        } else {
+            if (count == max)
+                return -1;
+            virtq_desc_set(&table[count++], physical, chunk, to_memory ? VIRTQ_DESC_F_WRITE : 0, 0);
+        }
+        addr += chunk;
+    }
+    return count;
+}
+
+/// @brief Adds the buffers of the bios of a request to a table of descriptors.
+/// @param table the table.
+/// @param max the maximum number of descriptors.
+/// @param request the request.
+/// @return the number of descriptors, or -1 if the buffers do not fit.
+static int virtio_blk_add_bios(virtq_desc_t *table, int max, block_request_t *request)
+{
+    int count = 0;
+    list_for_each_decl(it, &request->bios)
+    {
+        block_bio_t *bio = list_entry(it, block_bio_t, list);
+        count            = virtio_blk_add_buffer(table, count, max, bio->buffer, bio->count * VIRTIO_BLK_SECTOR_SIZE,
+                                                 request->direction == BLOCK_READ);
+        if (count < 0)
+            break;
+    }
+    return count;
+}
+
+// == REQUESTS ================================================================
+/// @brief Completes the requests the device is done with.
+/// @param dev the device.
+static void virtio_blk_complete(virtio_blk_device_t *dev)
+{
+    while (dev->last_used != READ_ONCE(dev->used->idx)) {
+        // Read the entry only after the index which publishes it.
+        barrier();
+        virtq_used_elem_t *elem = (virtq_used_elem_t *)&dev->used->ring[dev->last_used % dev->queue_size];
+        unsigned slot           = elem->id / dev->chain;
+        ++dev->last_used;
+        if ((slot >= dev->blkdev.queue_depth) || !bit_check(dev->inflight.busy, slot)) {
+            pr_err("[%s] Spurious completion of descriptor %d.\n", dev->name, elem->id);
+            continue;
+        }
+        if (dev->slots[slot].status != VIRTIO_BLK_S_OK) {
+            pr_err("[%s] Request on sector %d failed (status %d).\n", dev->name,
+                   dev->inflight.requests[slot]->sector, dev->slots[slot].status);
+            block_slot_end(&dev->blkdev, &dev->inflight, slot, -EIO);
+        } else {
+            block_slot_end(&dev->blkdev, &dev->inflight, slot, 0);
+        }
+    }
+}
+
+/// @brief Offers a request to the device, which raises an interrupt once it
+/// is done.
+/// @param blkdev the block device.
+/// @param request the request.
+/// @return 0 if the request was offered, -EBUSY if all the slots are in use,
+/// another negative error code on failure.
+static int virtio_blk_submit_request(block_device_t *blkdev, block_request_t *request)
+{
+    virtio_blk_device_t *dev = container_of(blkdev, virtio_blk_device_t, blkdev);
+    bool_t write             = request->direction == BLOCK_WRITE;
+    if ((request->count > dev->sectors) || (request->sector > (dev->sectors - request->count)))
+        return -EINVAL;
+    if (write && (dev->features & VIRTIO_BLK_F_RO))
+        return -EROFS;
+    int slot = block_slot_get(blkdev, &dev->inflight);
+    if (slot < 0)
+        return slot;
+    virtio_blk_slot_t *memory = &dev->slots[slot];
+    uintptr_t physical        = dev->slots_phys + slot * sizeof(virtio_blk_slot_t);
+    // With indirect descriptors the chain lives inside the page of the slot,
+    // otherwise inside the descriptors of the ring reserved to the slot.
+    uint16_t head       = slot * dev->chain;
+    virtq_desc_t *table = (dev->chain == 1) ? memory->table : &dev->desc[head];
+    // The header goes first, then the buffers, then the status.
+    memory->header.type      = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    memory->header.reserved  = 0;
+    memory->header.sector    = request->sector;
+    memory->header.sector_hi = 0;
+    memory->status           = 0xFF;
+    int count                = virtio_blk_add_bios(table + 1, dev->max_segments, request);
+    if (count < 0) {
+        uint8_t *bounce = block_slot_bounce(blkdev, &dev->inflight, slot, request);
+        if (bounce == NULL)
+            return -ENOMEM;
+        count = virtio_blk_add_buffer(table + 1, 0, dev->max_segments, bounce, request->count * VIRTIO_BLK_SECTOR_SIZE, !write);
+        assert((count > 0) && "The bounce buffer does not fit the descriptors.");
+    }
+    virtq_desc_set(&table[0], physical + offsetof(virtio_blk_slot_t, header), sizeof(virtio_blk_header_t), 0, 0);
+    virtq_desc_set(&table[count + 1], physical + offsetof(virtio_blk_slot_t, status), 1, VIRTQ_DESC_F_WRITE, 0);
+    // Link the chain, the indices of an indirect table start from zero.
+    uint16_t base = (dev->chain == 1) ? 0 : head;
+    for (int i = 0; i <= count; ++i) {
+        table[i].flags |= VIRTQ_DESC_F_NEXT;
+        table[i].next = base + i + 1;
+    }
+    if (dev->chain == 1) {
+        virtq_desc_set(&dev->desc[head], physical + offsetof(virtio_blk_slot_t, table),
+                       (count + 2) * sizeof(virtq_desc_t), VIRTQ_DESC_F_INDIRECT, 0);
+    }
+    block_slot_start(&dev->inflight, slot, request);
+    // Publish the chain, then the index, then tell the device.
+    uint16_t idx                              = dev->avail->idx;
+    dev->avail->ring[idx % dev->queue_size] = head;
+    barrier();
+    dev->avail->idx = idx + 1;
+    barrier();
+    outports(dev->iobase + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+    return 0;
+}
+
+/// @brief Checks if the device completed the requests in flight, in case the
+/// interrupt got lost.
+/// @param blkdev the block device.
+static void virtio_blk_poll(block_device_t *blkdev)
+{
+    virtio_blk_complete(container_of(blkdev, virtio_blk_device_t, blkdev));
+}
+
+/// The operations of the virtio block devices.
+static const block_device_operations_t virtio_blk_block_operations = {
+    .submit = virtio_blk_submit_request,
+    .poll   = virtio_blk_poll,
+};
+
+// == VFS ENTRY GENERATION ====================================================
+/// Filesystem general operations.
+static vfs_sys_operations_t virtio_blk_sys_operations = {
+    .mkdir_f = NULL,
+    .rmdir_f = NULL,
+    .stat_f  = virtio_blk_stat
+};
+
+/// Virtio block filesystem file operations.
+static vfs_file_operations_t virtio_blk_fs_operations = {
+    .open_f     = virtio_blk_open,
+    .unlink_f   = NULL,
+    .close_f    = virtio_blk_close,
+    .read_f     = virtio_blk_read,
+    .write_f    = virtio_blk_write,
+    .lseek_f    = NULL,
+    .stat_f     = virtio_blk_fstat,
+    .ioctl_f    = NULL,
+    .getdents_f = NULL
+};
+
+/// @brief Creates the file of a device.
+/// @param dev the device.
+/// @return the file, NULL on failure.
+static vfs_file_t *virtio_blk_device_create(virtio_blk_device_t *dev)
+{
+    vfs_file_t *file = kmem_cache_alloc(vfs_file_cache, GFP_KERNEL);
+    if (file == NULL) {
+        pr_err("Failed to create virtio block device.\n");
+        return NULL;
+    }
+    memcpy(file->name, dev->name, NAME_MAX);
+    file->device         = dev;
+    file->flags          = DT_BLK;
+    file->length         = dev->sectors * VIRTIO_BLK_SECTOR_SIZE;
+    file->sys_operations = &virtio_blk_sys_operations;
+    file->fs_operations  = &virtio_blk_fs_operations;
+    return file;
+}
+
+// == VFS CALLBACKS ===========================================================
+static vfs_file_t *virtio_blk_open(const char *path, int flags, mode_t mode)
+{
+    pr_debug("virtio_blk_open(%s, %d, %d)\n", path, flags, mode);
+    for (unsigned i = 0; i < virtio_blk_count; ++i) {
+        virtio_blk_device_t *dev = virtio_blk_devices[i];
+        if (dev->fs_root && (strcmp(path, dev->path) == 0)) {
+            ++dev->fs_root->count;
+            return dev->fs_root;
+        }
+    }
+    return NULL;
+}
+
+static int virtio_blk_close(vfs_file_t *file)
+{
+    pr_debug("virtio_blk_close(%p)\n", file);
+    --file->count;
+    return 0;
+}
+
+/// @brief Reads, or writes, a range of bytes of the device.
+/// @param file the file of the device.
+/// @param buffer the buffer.
+/// @param offset the offset of the first byte.
+/// @param size the number of bytes.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @return the number of bytes transferred, or a negative error code.
+static ssize_t virtio_blk_rw(vfs_file_t *file, uint8_t *buffer, off_t offset, size_t size, int direction)
+{
+    virtio_blk_device_t *dev = (virtio_blk_device_t *)file->device;
+    if ((offset < 0) || ((uint32_t)offset >= file->length))
+        return 0;
+    size = min(size, file->length - offset);
+    if (buffer_rw_raw(&dev->blkdev, offset, size, buffer, direction) < 0)
+        return -EIO;
+    return size;
+}
+
+static ssize_t virtio_blk_read(vfs_file_t *file, char *buffer, off_t offset, size_t size)
+{
+    pr_debug("virtio_blk_read(%p, %p, %d, %d)\n", file, buffer, offset, size);
+    return virtio_blk_rw(file, (uint8_t *)buffer, offset, size, BLOCK_READ);
+}
+
+static ssize_t virtio_blk_write(vfs_file_t *file, const void *buffer, off_t offset, size_t size)
+{
+    pr_debug("virtio_blk_write(%p, %p, %d, %d)\n", file, buffer, offset, size);
+    return virtio_blk_rw(file, (uint8_t *)buffer, offset, size, BLOCK_WRITE);
+}
+
+/// @brief Fills the attributes of a device.
+/// @param dev the device.
+/// @param stat where the attributes are stored.
+/// @return 0 on success.
+static int _virtio_blk_stat(const virtio_blk_device_t *dev, stat_t *stat)
+{
+    if (dev && dev->fs_root) {
+        stat->st_dev   = 0;
+        stat->st_ino   = 0;
+        stat->st_mode  = 0;
+        stat->st_uid   = 0;
+        stat->st_gid   = 0;
+        stat->st_atime = sys_time(NULL);
+        stat->st_mtime = sys_time(NULL);
+        stat->st_ctime = sys_time(NULL);
+        stat->st_size  = dev->fs_root->length;
+    }
+    return 0;
+}
+
+static int virtio_blk_fstat(vfs_file_t *file, stat_t *stat)
+{
+    return _virtio_blk_stat(file->device, stat);
+}
+
+static int virtio_blk_stat(const char *path, stat_t *stat)
+{
+    super_block_t *sb = vfs_get_superblock(path);
+    if (sb && sb->root) {
+        return _virtio_blk_stat(sb->root->device, stat);
+    }
+    return -1;
+}
+
+// == IRQ HANDLER =============================================================
+/// @param f The interrupt stack frame.
+static void virtio_blk_irq_handler(pt_regs *f)
+{
+    // The line might be shared, reading the status also acknowledges it.
+    for (unsigned i = 0; i < virtio_blk_count; ++i)
+        if (inportb(virtio_blk_devices[i]->iobase + VIRTIO_PCI_ISR) & 0x01)
+            virtio_blk_complete(virtio_blk_devices[i]);
+}
+
+// == DEVICE INITIALIZATION ===================================================
+/// @brief Sets up the virtqueue of a device.
+/// @param dev the device.
+/// @return 0 on success, -1 on failure, the caller frees what was allocated.
+static int virtio_blk_setup_queue(virtio_blk_device_t *dev)
+{
+    outports(dev->iobase + VIRTIO_PCI_QUEUE_SEL, 0);
+    dev->queue_size = inports(dev->iobase + VIRTIO_PCI_QUEUE_NUM);
+    if (dev->queue_size == 0)
+        return -1;
+    // Descriptors, then the available ring, then the used ring on the next
+    // aligned page.
+    uint32_t avail_offset = dev->queue_size * sizeof(virtq_desc_t);
+    uint32_t used_offset  = avail_offset + sizeof(uint16_t) * (3 + dev->queue_size);
+    used_offset           = (used_offset + VIRTIO_VRING_ALIGN - 1) & ~(VIRTIO_VRING_ALIGN - 1);
+    uint32_t size         = used_offset + sizeof(uint16_t) * 3 + sizeof(virtq_used_elem_t) * dev->queue_size;
+    uintptr_t physical;
+    uint8_t *ring = virtio_alloc_dma(size, &physical);
+    if (ring == NULL)
+        return -1;
+    dev->desc  = (virtq_desc_t *)ring;
+    dev->avail = (virtq_avail_t *)(ring + avail_offset);
+    dev->used  = (virtq_used_t *)(ring + used_offset);
+    outportl(dev->iobase + VIRTIO_PCI_QUEUE_PFN, physical / PAGE_SIZE);
+    // Each request takes one descriptor of the ring, pointing to the table
+    // inside its slot, or a fixed range of them.
+    uint32_t depth, segments = ((PAGE_SIZE - 32U) / sizeof(virtq_desc_t)) - 2;
+    if (dev->features & VIRTIO_RING_F_INDIRECT_DESC) {
+        dev->chain = 1;
+        depth      = min(VIRTIO_BLK_QUEUE_DEPTH, dev->queue_size);
+    } else {
+        dev->chain = VIRTIO_BLK_DIRECT_CHAIN;
+        depth      = min(VIRTIO_BLK_QUEUE_DEPTH, dev->queue_size / VIRTIO_BLK_DIRECT_CHAIN);
+        segments   = VIRTIO_BLK_DIRECT_CHAIN - 2;
+    }
+    if (depth == 0)
+        return -1;
+    if (dev->features & VIRTIO_BLK_F_SEG_MAX)
+        segments = min(segments, inportl(dev->iobase + VIRTIO_BLK_CONFIG_SEG_MAX));
+    dev->max_segments       = segments;
+    dev->blkdev.queue_depth = depth;
+    dev->slots              = virtio_alloc_dma(depth * sizeof(virtio_blk_slot_t), &dev->slots_phys);
+    return (dev->slots == NULL) ? -1 : 0;
+}
+
+/// @brief Sets up a device, and registers it.
+/// @param pci the PCI device.
+/// @return 0 on success, -1 on failure.
+static int virtio_blk_device_init(uint32_t pci)
+{
+    virtio_blk_device_t *dev = kmalloc(sizeof(virtio_blk_device_t));
+    if (dev == NULL)
+        return -1;
+    memset(dev, 0, sizeof(virtio_blk_device_t));
+    dev->pci = pci;
+    // Enable the I/O space and bus mastering.
+    pci_write_field(pci, PCI_COMMAND, 2, pci_read_field(pci, PCI_COMMAND, 2) | 0x05);
+    dev->iobase = pci_read_field(pci, PCI_BASE_ADDRESS_0, 4) & ~0x3U;
+    // Reset the device, and tell it we are here.
+    outportb(dev->iobase + VIRTIO_PCI_STATUS, 0);
+    outportb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outportb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    // Accept only the features we know.
+    dev->features = inportl(dev->iobase + VIRTIO_PCI_HOST_FEATURES);
+    dev->features &= VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_RING_F_INDIRECT_DESC;
+    outportl(dev->iobase + VIRTIO_PCI_GUEST_FEATURES, dev->features);
+    if (virtio_blk_setup_queue(dev) < 0) {
+        pr_err("Failed to set up the virtqueue.\n");
+        goto fail;
+    }
+    // Sectors past the first 2^32 are not reachable anyway.
+    dev->sectors = inportl(dev->iobase + VIRTIO_BLK_CONFIG_CAPACITY);
+    if (inportl(dev->iobase + VIRTIO_BLK_CONFIG_CAPACITY + 4))
+        dev->sectors = 0xFFFFFFFFU;
+    block_get_disk_name(dev->name);
+    sprintf(dev->path, "/dev/%s", dev->name);
+    dev->fs_root = virtio_blk_device_create(dev);
+    if (dev->fs_root == NULL)
+        goto fail;
+    // Register the block device, requests go through its queue, before the
+    // disk becomes visible.
+    strcpy(dev->blkdev.name, dev->name);
+    dev->blkdev.file        = dev->fs_root;
+    dev->blkdev.sector_size = VIRTIO_BLK_SECTOR_SIZE;
+    dev->blkdev.max_sectors = VIRTIO_BLK_MAX_SECTORS;
+    dev->blkdev.max_bios    = min(VIRTIO_BLK_MAX_BIOS, dev->max_segments);
+    dev->blkdev.ops         = &virtio_blk_block_operations;
+    if (block_register_device(&dev->blkdev) < 0)
+        goto free_file;
+    if (!vfs_mount(dev->path, dev->fs_root)) {
+        pr_err("Failed to mount %s.\n", dev->path);
+        goto unregister;
+    }
+    virtio_blk_devices[virtio_blk_count++] = dev;
+    // Install the IRQ handler, the line might be shared by many devices.
+    unsigned irq = pci_get_interrupt(pci);
+    if (!bit_check(virtio_blk_irqs, irq)) {
+        virtio_blk_irqs |= (1U << irq);
+        irq_install_handler(irq, virtio_blk_irq_handler, "virtio-blk");
+        pic8259_irq_enable(irq);
+    }
+    outportb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    pr_info("    Found virtio block device (%s, %d sectors, depth %d, %s descriptors).\n", dev->path, dev->sectors,
+            dev->blkdev.queue_depth, (dev->chain == 1) ? "indirect" : "direct");
+    return 0;
+unregister:
+    block_unregister_device(&dev->blkdev);
+free_file:
+    kmem_cache_free(dev->fs_root);
+fail:
+    // The reset makes the device forget the ring, before we free it.
+    outportb(dev->iobase + VIRTIO_PCI_STATUS, 0);
+    outportb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+    if (dev->slots)
+        free_pages_lowmem((uint32_t)dev->slots);
+    if (dev->desc)
+        free_pages_lowmem((uint32_t)dev->desc);
+    kfree(dev);
+    return -1;
+}
+
+// == INITIALIZE/FINALIZE VIRTIO BLOCK ========================================
+int virtio_blk_initialize(void)
+{
+    const pci_device_t *pci = NULL;
+    for (unsigned i = 0; i < VIRTIO_BLK_MAX_DEVICES; ++i) {
+        if ((pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, pci)) == NULL)
+            break;
+        if (virtio_blk_device_init(pci->device) < 0)
+            pr_err("Failed to initialize the virtio block device %d.\n", i);
+    }
+    return 0;
+}
+
+int virtio_blk_finalize(void)
+{
+    return 0;
+}
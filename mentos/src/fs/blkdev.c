@@ -0,0 +1,677 @@
+/// @file blkdev.c
+/// @brief Block devices, and the queues of their I/O requests.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[BLKDEV]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "fs/blkdev.h"
+#include "process/scheduler.h"
+#include "process/process.h"
+#include "klib/irqflags.h"
+#include "sys/bitops.h"
+#include "mem/slab.h"
+#include "mem/paging.h"
+#include "io/debug.h"
+#include "sys/errno.h"
+#include "assert.h"
+#include "string.h"
+#include "math.h"
+#include "stdio.h"
+
+/// The registered block devices.
+static list_head block_devices;
+/// Cache for the requests.
+static kmem_cache_t *block_request_cache;
+
+// ============================================================================
+// I/O Schedulers
+// ============================================================================
+
+/// @brief Queues the request at the end, requests are served in the order
+/// they are queued.
+/// @param dev The block device.
+/// @param request The request.
+static void __noop_add(block_device_t *dev, block_request_t *request)
+{
+    list_head_add_tail(&request->queuelist, &dev->queue.sorted);
+}
+
+/// @brief Picks the oldest request.
+/// @param dev The block device.
+/// @return The request, NULL if there is none.
+static block_request_t *__noop_next(block_device_t *dev)
+{
+    if (list_head_empty(&dev->queue.sorted))
+        return NULL;
+    return list_entry(dev->queue.sorted.next, block_request_t, queuelist);
+}
+
+/// @brief Keeps the requests sorted by their first sector.
+/// @param dev The block device.
+/// @param request The request.
+static void __deadline_add(block_device_t *dev, block_request_t *request)
+{
+    list_head *it;
+    // New requests usually follow the queued ones, start from the end.
+    for (it = dev->queue.sorted.prev; it != &dev->queue.sorted; it = it->prev) {
+        if (list_entry(it, block_request_t, queuelist)->sector <= request->sector)
+            break;
+    }
+    list_head_insert_after(it, &request->queuelist);
+}
+
+/// @brief Moves the request to its new position, after a front merge.
+/// @param dev The block device.
+/// @param request The request.
+static void __deadline_merged(block_device_t *dev, block_request_t *request)
+{
+    list_head_del(&request->queuelist);
+    __deadline_add(dev, request);
+}
+
+/// @brief Picks the oldest request whose deadline expired, reads first, or
+/// the next one moving the head forward.
+/// @param dev The block device.
+/// @return The request, NULL if there is none.
+static block_request_t *__deadline_next(block_device_t *dev)
+{
+    block_queue_t *queue = &dev->queue;
+    unsigned long now    = timer_get_ticks();
+    for (int direction = BLOCK_READ; direction <= BLOCK_WRITE; ++direction) {
+        if (list_head_empty(&queue->fifo[direction]))
+            continue;
+        block_request_t *oldest = list_entry(queue->fifo[direction].next, block_request_t, fifo);
+        if ((long)(now - oldest->deadline) >= 0)
+            return oldest;
+    }
+    if (list_head_empty(&queue->sorted))
+        return NULL;
+    // One-way elevator: go back to the lowest sector once we reach the end.
+    list_for_each_decl(it, &queue->sorted)
+    {
+        block_request_t *request = list_entry(it, block_request_t, queuelist);
+        if (request->sector >= queue->last_sector)
+            return request;
+    }
+    return list_entry(queue->sorted.next, block_request_t, queuelist);
+}
+
+/// The available I/O schedulers.
+static const block_scheduler_t block_schedulers[] = {
+    { .name = "noop", .add = __noop_add, .merged = NULL, .next = __noop_next },
+    { .name = "deadline", .add = __deadline_add, .merged = __deadline_merged, .next = __deadline_next },
+};
+
+/// @brief Searches an I/O scheduler.
+/// @param name The name of the scheduler.
+/// @return The scheduler, NULL if there is no such scheduler.
+static const block_scheduler_t *__block_find_scheduler(const char *name)
+{
+    for (uint32_t i = 0; i < (sizeof(block_schedulers) / sizeof(block_scheduler_t)); ++i)
+        if (strcmp(block_schedulers[i].name, name) == 0)
+            return &block_schedulers[i];
+    return NULL;
+}
+
+// ============================================================================
+// Statistics
+// ============================================================================
+
+/// @brief Accounts the time passed since the last update, for the requests
+/// in flight, it must be called before their number changes.
+/// @param dev The block device.
+static inline void __block_stats_update_time(block_device_t *dev)
+{
+    block_stats_t *stats = &dev->stats;
+    unsigned long now    = timer_get_ticks();
+    if (stats->in_flight) {
+        stats->io_ticks += now - stats->stamp;
+        stats->time_in_queue += stats->in_flight * (now - stats->stamp);
+    }
+    stats->stamp = now;
+}
+
+/// @brief Accounts a new request.
+/// @param dev The block device.
+/// @param request The request.
+static inline void __block_stats_start(block_device_t *dev, block_request_t *request)
+{
+    __block_stats_update_time(dev);
+    ++dev->stats.in_flight;
+    request->start_time = dev->stats.stamp;
+}
+
+/// @brief Accounts a completed request.
+/// @param dev The block device.
+/// @param request The request.
+static inline void __block_stats_done(block_device_t *dev, block_request_t *request)
+{
+    block_stats_t *stats = &dev->stats;
+    __block_stats_update_time(dev);
+    --stats->in_flight;
+    ++stats->ios[request->direction];
+    stats->sectors[request->direction] += request->count;
+    stats->ticks[request->direction] += stats->stamp - request->start_time;
+}
+
+/// @brief Charges a bio to the process which submits it.
+/// @param dev The block device.
+/// @param bio The bio.
+static inline void __block_stats_charge(block_device_t *dev, block_bio_t *bio)
+{
+    task_struct *task = scheduler_get_current_process();
+    // The write-back runs on behalf of whoever dirtied the buffers, and they
+    // were charged at that time.
+    if ((task == NULL) || bio->writeback)
+        return;
+    if (bio->direction == BLOCK_READ)
+        task->ioac.read_bytes += bio->count * dev->sector_size;
+    else
+        task->ioac.write_bytes += bio->count * dev->sector_size;
+}
+
+// ============================================================================
+// Queues
+// ============================================================================
+
+/// @brief Completes all the bios of a request, and frees it.
+/// @param request The request.
+/// @param error 0 on success, a negative error code on failure.
+static void __block_complete_request(block_request_t *request, int error)
+{
+    list_head *it;
+    while ((it = list_head_pop(&request->bios)) != NULL) {
+        block_bio_t *bio = list_entry(it, block_bio_t, list);
+        // The callback might free the bio.
+        if (bio->end_io)
+            bio->end_io(bio, error);
+    }
+    kmem_cache_free(request);
+}
+
+/// @brief Removes the next request from the queue.
+/// @param dev The block device.
+/// @return The request, NULL if the queue is empty.
+static block_request_t *__block_next_request(block_device_t *dev)
+{
+    block_request_t *request = dev->queue.pending;
+    if (request) {
+        dev->queue.pending = NULL;
+        return request;
+    }
+    request = dev->queue.scheduler->next(dev);
+    if (request) {
+        list_head_del(&request->queuelist);
+        list_head_del(&request->fifo);
+        --dev->queue.nr_requests;
+    }
+    return request;
+}
+
+/// @brief Hands requests to the driver, until it has queue_depth of them in
+/// flight, it refuses one, or the queue is empty.
+/// @param dev The block device.
+static void __block_dispatch(block_device_t *dev)
+{
+    block_queue_t *queue = &dev->queue;
+    // Drivers might complete requests while we hand them new ones, the outer
+    // call keeps going.
+    if (queue->dispatching)
+        return;
+    queue->dispatching = 1;
+    while (queue->nr_active < dev->queue_depth) {
+        block_request_t *request = __block_next_request(dev);
+        if (request == NULL)
+            break;
+        ++queue->nr_active;
+        queue->last_sector = request->sector + request->count;
+        int ret            = dev->ops->submit(dev, request);
+        if (ret == 0)
+            continue;
+        --queue->nr_active;
+        if (ret == -EBUSY) {
+            // Try again with the same request later on.
+            queue->pending = request;
+            break;
+        }
+        pr_err("[%s] Failed to submit the request for sector %d (%d).\n", dev->name, request->sector, ret);
+        __block_stats_done(dev, request);
+        __block_complete_request(request, ret);
+    }
+    queue->dispatching = 0;
+}
+
+/// @brief Checks if a bio can be added to a request.
+/// @param dev The block device.
+/// @param request The request.
+/// @param bio The bio.
+/// @return 1 if it can, 0 otherwise.
+static inline int __block_can_merge(block_device_t *dev, block_request_t *request, block_bio_t *bio)
+{
+    return ((request->count + bio->count) <= dev->max_sectors) && (request->nr_bios < dev->max_bios);
+}
+
+/// @brief Adds the bio to a queued request which it continues, or precedes.
+/// @param dev The block device.
+/// @param bio The bio.
+/// @return 1 if the bio was merged, 0 otherwise.
+static int __block_merge_bio(block_device_t *dev, block_bio_t *bio)
+{
+    list_head *fifo = &dev->queue.fifo[bio->direction];
+    // Recent requests are the most likely to be adjacent.
+    for (list_head *it = fifo->prev; it != fifo; it = it->prev) {
+        block_request_t *request = list_entry(it, block_request_t, fifo);
+        if (!__block_can_merge(dev, request, bio))
+            continue;
+        if ((request->sector + request->count) == bio->sector) {
+            list_head_add_tail(&bio->list, &request->bios);
+            request->count += bio->count;
+            ++request->nr_bios;
+            return 1;
+        }
+        if ((bio->sector + bio->count) == request->sector) {
+            list_head_add(&bio->list, &request->bios);
+            request->sector = bio->sector;
+            request->count += bio->count;
+            ++request->nr_bios;
+            if (dev->queue.scheduler->merged)
+                dev->queue.scheduler->merged(dev, request);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void block_initialize(void)
+{
+    list_head_init(&block_devices);
+    block_request_cache = KMEM_CREATE(block_request_t);
+}
+
+int block_register_device(block_device_t *dev)
+{
+    if ((dev->ops == NULL) || (dev->ops->submit == NULL) || (dev->sector_size == 0) ||
+        (dev->max_sectors == 0) || (dev->max_bios == 0) || (dev->queue_depth == 0)) {
+        pr_err("[%s] Wrong block device description.\n", dev->name);
+        return -1;
+    }
+    memset(&dev->queue, 0, sizeof(block_queue_t));
+    memset(&dev->stats, 0, sizeof(block_stats_t));
+    dev->queue.scheduler = __block_find_scheduler(BLOCK_DEFAULT_SCHEDULER);
+    list_head_init(&dev->queue.sorted);
+    list_head_init(&dev->queue.fifo[BLOCK_READ]);
+    list_head_init(&dev->queue.fifo[BLOCK_WRITE]);
+    list_head_add_tail(&dev->list, &block_devices);
+    pr_debug("[%s] Registered with the `%s` scheduler.\n", dev->name, dev->queue.scheduler->name);
+    return 0;
+}
+
+void block_unregister_device(block_device_t *dev)
+{
+    assert((dev->queue.nr_active == 0) && (dev->queue.nr_requests == 0) && "The block device is busy.");
+    list_head_del(&dev->list);
+}
+
+int block_get_physical_address(uintptr_t addr, int to_memory, uintptr_t *physical)
+{
+    if (addr < PROCAREA_END_ADDR) {
+        // Requests are dispatched before the caller returns, while its page
+        // directory is still the current one.
+        page_table_entry_t *entry = mem_virtual_to_pte(paging_get_current_directory(), addr);
+        // Pages which are not there yet, or are shared copy-on-write, must go
+        // through a bounce buffer.
+        if ((entry == NULL) || !entry->present || !entry->user || (to_memory && !entry->rw))
+            return 0;
+        *physical = (entry->frame * PAGE_SIZE) + (addr & (PAGE_SIZE - 1));
+        return 1;
+    }
+    page_t *page = get_lowmem_page_from_address(addr & ~(PAGE_SIZE - 1));
+    if (!is_lowmem_page_struct(page))
+        return 0;
+    *physical = get_physical_address_from_page(page) + (addr & (PAGE_SIZE - 1));
+    return 1;
+}
+
+int block_fault_in_buffer(uint8_t *buffer, size_t size, int direction)
+{
+    uintptr_t addr = (uintptr_t)buffer & ~(PAGE_SIZE - 1), end = (uintptr_t)buffer + size;
+    if ((size == 0) || (addr >= PROCAREA_END_ADDR))
+        return 0;
+    task_struct *task = scheduler_get_current_process();
+    if ((task == NULL) || (task->mm == NULL))
+        return -EFAULT;
+    // Reads write in the buffer, so copy-on-write pages must be broken now.
+    for (; (addr < end) && (addr < PROCAREA_END_ADDR); addr += PAGE_SIZE)
+        if (mem_populate_page(task->mm->pgd, addr, direction == BLOCK_READ) < 0)
+            return -EFAULT;
+    return 0;
+}
+
+void block_request_copy(block_request_t *request, uint8_t *bounce, uint32_t sector_size, int to_bounce)
+{
+    list_for_each_decl(it, &request->bios)
+    {
+        block_bio_t *bio = list_entry(it, block_bio_t, list);
+        size_t size      = bio->count * sector_size;
+        if (to_bounce)
+            memcpy(bounce, bio->buffer, size);
+        else
+            memcpy(bio->buffer, bounce, size);
+        bounce += size;
+    }
+}
+
+int block_slot_get(block_device_t *dev, block_slots_t *slots)
+{
+    assert(dev->queue_depth <= BLOCK_MAX_SLOTS);
+    for (unsigned slot = 0; slot < dev->queue_depth; ++slot)
+        if (!bit_check(slots->busy, slot))
+            return slot;
+    return -EBUSY;
+}
+
+uint8_t *block_slot_bounce(block_device_t *dev, block_slots_t *slots, unsigned slot, block_request_t *request)
+{
+    uint8_t *bounce = kmalloc(request->count * dev->sector_size);
+    if (bounce == NULL)
+        return NULL;
+    if (request->direction == BLOCK_WRITE)
+        block_request_copy(request, bounce, dev->sector_size, 1);
+    slots->bounce[slot] = bounce;
+    return bounce;
+}
+
+void block_slot_start(block_slots_t *slots, unsigned slot, block_request_t *request)
+{
+    slots->requests[slot] = request;
+    slots->busy |= (1U << slot);
+}
+
+void block_slot_end(block_device_t *dev, block_slots_t *slots, unsigned slot, int error)
+{
+    block_request_t *request = slots->requests[slot];
+    uint8_t *bounce          = slots->bounce[slot];
+    slots->requests[slot]    = NULL;
+    slots->bounce[slot]      = NULL;
+    slots->busy &= ~(1U << slot);
+    if (bounce) {
+        // The buffers of the bios were faulted in before being queued.
+        if (!error && (request->direction == BLOCK_READ))
+            block_request_copy(request, bounce, dev->sector_size, 0);
+        kfree(bounce);
+    }
+    block_end_request(dev, request, error);
+}
+
+void block_get_disk_name(char *name)
+{
+    static char disk_letter = 'a';
+    sprintf(name, "hd%c", disk_letter++);
+}
+
+block_device_t *block_get_device(vfs_file_t *file)
+{
+    list_for_each_decl(it, &block_devices)
+    {
+        block_device_t *dev = list_entry(it, block_device_t, list);
+        if (dev->file == file)
+            return dev;
+    }
+    return NULL;
+}
+
+block_device_t *block_next_device(block_device_t *dev)
+{
+    list_head *next = dev ? dev->list.next : block_devices.next;
+    if (next == &block_devices)
+        return NULL;
+    return list_entry(next, block_device_t, list);
+}
+
+void block_get_stats(block_device_t *dev, block_stats_t *stats)
+{
+    uint8_t flags = irq_nested_disable();
+    __block_stats_update_time(dev);
+    memcpy(stats, &dev->stats, sizeof(block_stats_t));
+    irq_nested_enable(flags);
+}
+
+int block_set_scheduler(block_device_t *dev, const char *name)
+{
+    const block_scheduler_t *scheduler = __block_find_scheduler(name);
+    if (scheduler == NULL)
+        return -1;
+    // The requests are linked into the lists of the current scheduler.
+    if (dev->queue.nr_active || dev->queue.pending || dev->queue.nr_requests)
+        return -1;
+    dev->queue.scheduler = scheduler;
+    return 0;
+}
+
+void block_submit_bio(block_device_t *dev, block_bio_t *bio)
+{
+    if ((bio->count == 0) || (bio->count > dev->max_sectors)) {
+        pr_err("[%s] Wrong number of sectors (%d).\n", dev->name, bio->count);
+        if (bio->end_io)
+            bio->end_io(bio, -EINVAL);
+        return;
+    }
+    __block_stats_charge(dev, bio);
+    if (__block_merge_bio(dev, bio)) {
+        ++dev->stats.merges[bio->direction];
+        return;
+    }
+    block_request_t *request = kmem_cache_alloc(block_request_cache, GFP_KERNEL);
+    if (request == NULL) {
+        if (bio->end_io)
+            bio->end_io(bio, -ENOMEM);
+        return;
+    }
+    request->sector    = bio->sector;
+    request->count     = bio->count;
+    request->direction = bio->direction;
+    request->nr_bios   = 1;
+    request->deadline  = timer_get_ticks() + ((bio->direction == BLOCK_READ) ? BLOCK_READ_EXPIRE : BLOCK_WRITE_EXPIRE);
+    list_head_init(&request->bios);
+    list_head_add_tail(&bio->list, &request->bios);
+    list_head_add_tail(&request->fifo, &dev->queue.fifo[bio->direction]);
+    __block_stats_start(dev, request);
+    dev->queue.scheduler->add(dev, request);
+    ++dev->queue.nr_requests;
+}
+
+void block_unplug(block_device_t *dev)
+{
+    if (dev) {
+        __block_dispatch(dev);
+        return;
+    }
+    list_for_each_decl(it, &block_devices)
+    {
+        __block_dispatch(list_entry(it, block_device_t, list));
+    }
+}
+
+void block_end_request(block_device_t *dev, block_request_t *request, int error)
+{
+    assert((dev->queue.nr_active > 0) && "The device has no request in flight.");
+    --dev->queue.nr_active;
+    __block_stats_done(dev, request);
+    __block_complete_request(request, error);
+    // Keep the device busy.
+    __block_dispatch(dev);
+}
+
+void block_wait(volatile uint32_t *pending)
+{
+    uint8_t flags      = irq_nested_disable();
+    unsigned long last = timer_get_ticks();
+    // Our bios might still be inside plugged queues.
+    block_unplug(NULL);
+    while (*pending) {
+        // Enabling interrupts takes effect after the next instruction, so the
+        // interrupt cannot be lost between the check and the halt.
+        __asm__ __volatile__("sti; hlt; cli" ::: "memory");
+        if (*pending && ((timer_get_ticks() - last) > BLOCK_POLL_INTERVAL)) {
+            // The interrupt might have been lost, or a device was busy.
+            list_for_each_decl(it, &block_devices)
+            {
+                block_device_t *dev = list_entry(it, block_device_t, list);
+                if (dev->queue.nr_active && dev->ops->poll)
+                    dev->ops->poll(dev);
+            }
+            block_unplug(NULL);
+            last = timer_get_ticks();
+        }
+    }
+    irq_nested_enable(flags);
+}
+
+/// @brief Status of the transfers started by block_rw.
+typedef struct block_rw_status_t {
+    /// Number of bios which are not completed yet.
+    uint32_t pending;
+    /// The first error.
+    int error;
+} block_rw_status_t;
+
+/// @brief Completes a bio submitted by block_rw.
+/// @param bio The bio.
+/// @param error 0 on success, a negative error code on failure.
+static void __block_rw_end_io(block_bio_t *bio, int error)
+{
+    block_rw_status_t *status = (block_rw_status_t *)bio->private;
+    if (error && !status->error)
+        status->error = error;
+    --status->pending;
+}
+
+/// @brief Queues a bio of a group submitted together.
+/// @param dev The block device.
+/// @param bio The bio.
+/// @param sector The first sector.
+/// @param count The number of sectors, at most max_sectors.
+/// @param buffer The buffer.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @param status The status of the group.
+static inline void __block_rw_submit(block_device_t *dev, block_bio_t *bio, uint32_t sector, uint32_t count,
+                                     uint8_t *buffer, int direction, block_rw_status_t *status)
+{
+    bio->sector    = sector;
+    bio->count     = count;
+    bio->buffer    = buffer;
+    bio->direction = direction;
+    bio->end_io    = __block_rw_end_io;
+    bio->private   = status;
+    bio->writeback = 0;
+    ++status->pending;
+    block_submit_bio(dev, bio);
+}
+
+/// @brief Queues a run of sectors, with one bio every max_sectors.
+/// @param dev The block device.
+/// @param bios Where the bios are stored.
+/// @param sector The first sector.
+/// @param count The number of sectors.
+/// @param buffer The buffer.
+/// @param direction BLOCK_READ or BLOCK_WRITE.
+/// @param status The status of the group.
+/// @return The number of bios used.
+static uint32_t __block_rw_submit_run(block_device_t *dev, block_bio_t *bios, uint32_t sector, uint32_t count,
+                                      uint8_t *buffer, int direction, block_rw_status_t *status)
+{
+    uint32_t nr_bios = 0;
+    while (count > 0) {
+        uint32_t run = min(count, dev->max_sectors);
+        __block_rw_submit(dev, &bios[nr_bios++], sector, run, buffer, direction, status);
+        sector += run;
+        buffer += run * dev->sector_size;
+        count -= run;
+    }
+    return nr_bios;
+}
+
+int block_rw(block_device_t *dev, uint32_t sector, uint32_t count, uint8_t *buffer, int direction)
+{
+    block_rw_status_t status = { 0, 0 };
+    if (count == 0)
+        return 0;
+    if (block_fault_in_buffer(buffer, count * dev->sector_size, direction) < 0)
+        return -EFAULT;
+    // All the bios are queued at once, so that the whole run is transferred
+    // with as few commands as possible.
+    block_bio_t *bios = kmalloc(((count + dev->max_sectors - 1) / dev->max_sectors) * sizeof(block_bio_t));
+    if (bios == NULL)
+        return -ENOMEM;
+    __block_rw_submit_run(dev, bios, sector, count, buffer, direction, &status);
+    block_wait(&status.pending);
+    kfree(bios);
+    return status.error;
+}
+
+int block_rw_bytes(block_device_t *dev, uint32_t offset, size_t size, uint8_t *buffer, int direction)
+{
+    block_rw_status_t status = { 0, 0 };
+    uint32_t sector_size     = dev->sector_size;
+    if (size == 0)
+        return 0;
+    if (block_fault_in_buffer(buffer, size, direction) < 0)
+        return -EFAULT;
+    // The sectors of the range, and the bytes we skip inside the first one.
+    uint32_t start = offset / sector_size, end = (offset + size + sector_size - 1) / sector_size;
+    uint32_t head = offset % sector_size, tail = (offset + size) % sector_size;
+    // The whole sectors go directly from, or to, the buffer, while the
+    // partial ones at the edges go through a staging area.
+    uint32_t first    = start + (head ? 1 : 0);
+    int has_tail      = tail && ((end - 1) >= first);
+    uint32_t last     = has_tail ? (end - 1) : end;
+    uint32_t middle   = (last > first) ? (last - first) : 0;
+    uint32_t head_len = head ? min(sector_size - head, size) : 0;
+    uint32_t nr_bios  = (head ? 1 : 0) + (has_tail ? 1 : 0) + ((middle + dev->max_sectors - 1) / dev->max_sectors);
+    block_bio_t *bios = kmalloc(nr_bios * sizeof(block_bio_t));
+    uint8_t *staging  = (head || has_tail) ? kmalloc(2 * sector_size) : NULL;
+    if ((bios == NULL) || ((head || has_tail) && (staging == NULL))) {
+        status.error = -ENOMEM;
+        goto out;
+    }
+    // Writes must preserve the rest of the partial sectors.
+    if ((direction == BLOCK_WRITE) && (head || has_tail)) {
+        if (head)
+            __block_rw_submit(dev, &bios[0], start, 1, staging, BLOCK_READ, &status);
+        if (has_tail)
+            __block_rw_submit(dev, &bios[head ? 1 : 0], end - 1, 1, staging + sector_size, BLOCK_READ, &status);
+        block_wait(&status.pending);
+        if (status.error)
+            goto out;
+        if (head)
+            memcpy(staging + head, buffer, head_len);
+        if (has_tail)
+            memcpy(staging + sector_size, buffer + size - tail, tail);
+    }
+    // Contiguous bios are merged, and transferred with a single command.
+    nr_bios = 0;
+    if (head)
+        __block_rw_submit(dev, &bios[nr_bios++], start, 1, staging, direction, &status);
+    nr_bios += __block_rw_submit_run(dev, &bios[nr_bios], first, middle, buffer + head_len, direction, &status);
+    if (has_tail)
+        __block_rw_submit(dev, &bios[nr_bios++], end - 1, 1, staging + sector_size, direction, &status);
+    block_wait(&status.pending);
+    if (!status.error && (direction == BLOCK_READ)) {
+        if (head)
+            memcpy(buffer, staging + head, head_len);
+        if (has_tail)
+            memcpy(buffer + size - tail, staging + sector_size, tail);
+    }
+out:
+    if (staging)
+        kfree(staging);
+    if (bios)
+        kfree(bios);
+    return status.error;
+}
@@ -0,0 +1,535 @@
+/// @file buffer_cache.c
+/// @brief Cache of the blocks of block devices.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[BCACHE]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "fs/buffer_cache.h"
+#include "sys/errno.h"
+#include "fs/vfs.h"
+#include "process/scheduler.h"
+#include "mem/slab.h"
+#include "io/debug.h"
+#include "assert.h"
+#include "string.h"
+#include "math.h"
+
+/// @brief The buffer cache.
+typedef struct buffer_cache_t {
+    /// Hash table of the buffers.
+    list_head hash[BUFFER_CACHE_HASH_BUCKETS];
+    /// All the buffers, the most recently used are at the front.
+    list_head lru;
+    /// The dirty buffers, the oldest are at the front.
+    list_head dirty;
+    /// Statistics.
+    buffer_cache_info_t info;
+} buffer_cache_t;
+
+/// The buffer cache.
+static buffer_cache_t bcache;
+/// Cache for the buffer heads.
+static kmem_cache_t *buffer_head_cache;
+
+/// @brief Computes the bucket of a block.
+/// @param device The block device.
+/// @param block  The index of the block.
+/// @return The bucket of the hash table.
+static inline list_head *__buffer_bucket(vfs_file_t *device, uint32_t block)
+{
+    return &bcache.hash[(block ^ ((uint32_t)device >> 4U)) % BUFFER_CACHE_HASH_BUCKETS];
+}
+
+/// @brief Reads or writes the content of a buffer.
+/// @param bh    The buffer.
+/// @param write 1 to write the buffer on the device, 0 to read it.
+/// @return 0 on success, -1 on failure.
+static int __buffer_transfer(buffer_head_t *bh, int write)
+{
+    block_device_t *blkdev = block_get_device(bh->device);
+    ssize_t ret;
+    if (blkdev && !(bh->size % blkdev->sector_size)) {
+        // Straight between the device and the buffer.
+        uint32_t count = bh->size / blkdev->sector_size;
+        if (block_rw(blkdev, bh->block * count, count, bh->data, write ? BLOCK_WRITE : BLOCK_READ) < 0) {
+            pr_err("Failed to %s block %d.\n", write ? "write" : "read", bh->block);
+            return -1;
+        }
+        return 0;
+    }
+    if (write)
+        ret = vfs_write(bh->device, bh->data, bh->block * bh->size, bh->size);
+    else
+        ret = vfs_read(bh->device, bh->data, bh->block * bh->size, bh->size);
+    if (ret != (ssize_t)bh->size) {
+        pr_err("Failed to %s block %d.\n", write ? "write" : "read", bh->block);
+        return -1;
+    }
+    return 0;
+}
+
+/// @brief Frees a buffer which is not in use, writing it back if needed.
+/// @param bh The buffer.
+/// @return 0 on success, -1 if the buffer could not be written back.
+static int __buffer_evict(buffer_head_t *bh)
+{
+    assert((bh->count == 0) && "Trying to evict a buffer which is in use.");
+    if (buffer_sync(bh) < 0)
+        return -1;
+    list_head_del(&bh->hash);
+    list_head_del(&bh->lru);
+    bcache.info.size -= bh->size;
+    --bcache.info.nr_buffers;
+    kfree(bh->data);
+    kmem_cache_free(bh);
+    return 0;
+}
+
+/// @brief Evicts the least recently used buffers, until there is enough space.
+/// @param size The space we need.
+static void __buffer_shrink(uint32_t size)
+{
+    list_head *it = bcache.lru.prev, *prev;
+    while (((bcache.info.size + size) > BUFFER_CACHE_MAX_SIZE) && (it != &bcache.lru)) {
+        prev              = it->prev;
+        buffer_head_t *bh = list_entry(it, buffer_head_t, lru);
+        if (bh->count == 0)
+            __buffer_evict(bh);
+        it = prev;
+    }
+}
+
+/// @brief Searches the buffer of a block.
+/// @param device The block device.
+/// @param block  The index of the block.
+/// @return The buffer, NULL if it is not cached.
+static buffer_head_t *__buffer_lookup(vfs_file_t *device, uint32_t block)
+{
+    list_for_each_decl(it, __buffer_bucket(device, block))
+    {
+        buffer_head_t *bh = list_entry(it, buffer_head_t, hash);
+        if ((bh->device == device) && (bh->block == block))
+            return bh;
+    }
+    return NULL;
+}
+
+void buffer_cache_initialize(void)
+{
+    memset(&bcache, 0, sizeof(buffer_cache_t));
+    for (uint32_t i = 0; i < BUFFER_CACHE_HASH_BUCKETS; ++i)
+        list_head_init(&bcache.hash[i]);
+    list_head_init(&bcache.lru);
+    list_head_init(&bcache.dirty);
+    buffer_head_cache = KMEM_CREATE(buffer_head_t);
+}
+
+buffer_head_t *buffer_get(vfs_file_t *device, uint32_t block, uint32_t size)
+{
+    buffer_head_t *bh = __buffer_lookup(device, block);
+    if (bh) {
+        if (bh->size != size) {
+            pr_err("Block %d is cached with size %d, not %d.\n", block, bh->size, size);
+            return NULL;
+        }
+        // Move it to the front of the LRU list.
+        list_head_del(&bh->lru);
+        list_head_add(&bh->lru, &bcache.lru);
+        ++bh->count;
+        // The device is still filling it, wait for the read ahead.
+        if (bh->flags & BH_READING)
+            block_wait(&bcache.info.nr_reading);
+        return bh;
+    }
+    // Make room for the new buffer.
+    __buffer_shrink(size);
+    bh = kmem_cache_alloc(buffer_head_cache, GFP_KERNEL);
+    if (bh == NULL)
+        return NULL;
+    bh->data = kmalloc(size);
+    if (bh->data == NULL) {
+        kmem_cache_free(bh);
+        return NULL;
+    }
+    bh->device = device;
+    bh->block  = block;
+    bh->size   = size;
+    bh->flags  = 0;
+    bh->count  = 1;
+    list_head_add(&bh->hash, __buffer_bucket(device, block));
+    list_head_add(&bh->lru, &bcache.lru);
+    bcache.info.size += size;
+    ++bcache.info.nr_buffers;
+    return bh;
+}
+
+buffer_head_t *buffer_read(vfs_file_t *device, uint32_t block, uint32_t size)
+{
+    buffer_head_t *bh = buffer_get(device, block, size);
+    if (bh == NULL)
+        return NULL;
+    if (bh->flags & BH_UPTODATE) {
+        ++bcache.info.hits;
+        return bh;
+    }
+    ++bcache.info.misses;
+    if (__buffer_transfer(bh, 0) < 0) {
+        buffer_release(bh);
+        return NULL;
+    }
+    bh->flags |= BH_UPTODATE;
+    return bh;
+}
+
+/// @brief Completes the read in advance of a buffer, possibly from the
+/// interrupt handler of the device.
+/// @param bio   The bio of the buffer.
+/// @param error 0 on success, a negative error code on failure.
+static void __buffer_end_read(block_bio_t *bio, int error)
+{
+    buffer_head_t *bh = container_of(bio, buffer_head_t, bio);
+    bh->flags &= ~BH_READING;
+    if (!error) {
+        bh->flags |= BH_UPTODATE;
+        ++bcache.info.readahead;
+    }
+    --bcache.info.nr_reading;
+    // Buffers which were not filled are dropped here, unless someone waits
+    // for them.
+    buffer_release(bh);
+}
+
+/// @brief Reads a run of blocks with a single request to the device, and
+/// releases their buffers once they are read.
+/// @param bhs   The buffers of the blocks, which are contiguous.
+/// @param count The number of buffers.
+/// @return 0 on success, -1 on failure.
+static int __buffer_read_run(buffer_head_t **bhs, uint32_t count)
+{
+    uint32_t size          = bhs[0]->size;
+    block_device_t *blkdev = block_get_device(bhs[0]->device);
+    if (blkdev && !(size % blkdev->sector_size)) {
+        // One bio for each buffer, the queue merges them into a single
+        // request, and the device stores the blocks straight in the buffers.
+        // Each buffer stays in use until its transfer completes.
+        uint32_t sectors = size / blkdev->sector_size;
+        for (uint32_t i = 0; i < count; ++i) {
+            bhs[i]->flags |= BH_READING;
+            ++bcache.info.nr_reading;
+            bhs[i]->bio.sector    = bhs[i]->block * sectors;
+            bhs[i]->bio.count     = sectors;
+            bhs[i]->bio.buffer    = bhs[i]->data;
+            bhs[i]->bio.direction = BLOCK_READ;
+            bhs[i]->bio.end_io    = __buffer_end_read;
+            bhs[i]->bio.private   = bhs[i];
+            bhs[i]->bio.writeback = 0;
+            block_submit_bio(blkdev, &bhs[i]->bio);
+        }
+        // Start the transfer, without waiting for it.
+        block_unplug(blkdev);
+        return 0;
+    }
+    uint8_t *data = kmalloc(count * size);
+    ssize_t ret   = -1;
+    if (data) {
+        ret = vfs_read(bhs[0]->device, data, bhs[0]->block * size, count * size);
+        if (ret == (ssize_t)(count * size)) {
+            for (uint32_t i = 0; i < count; ++i) {
+                memcpy(bhs[i]->data, data + (i * size), size);
+                bhs[i]->flags |= BH_UPTODATE;
+            }
+            bcache.info.readahead += count;
+        }
+        kfree(data);
+    }
+    // Buffers which were not filled are dropped here.
+    for (uint32_t i = 0; i < count; ++i)
+        buffer_release(bhs[i]);
+    return (ret == (ssize_t)(count * size)) ? 0 : -1;
+}
+
+int buffer_read_ahead(vfs_file_t *device, uint32_t block, uint32_t count, uint32_t size)
+{
+    buffer_head_t *bhs[BUFFER_READAHEAD_MAX_SIZE / 512U];
+    // Blocks are never smaller than a sector.
+    uint32_t max_run = BUFFER_READAHEAD_MAX_SIZE / max(size, 512U);
+    int total = 0, ret = 0;
+    for (uint32_t end = block + count; (block < end) && (ret == 0);) {
+        // Skip the blocks which are already cached, being read, or being
+        // filled by someone else: buffers which are not up to date are only
+        // kept while they are in use.
+        if (__buffer_lookup(device, block)) {
+            ++block;
+            continue;
+        }
+        // Collect the run of missing blocks which follows.
+        uint32_t run = 0;
+        while (((block + run) < end) && (run < max_run)) {
+            if (__buffer_lookup(device, block + run))
+                break;
+            if ((bhs[run] = buffer_get(device, block + run, size)) == NULL)
+                break;
+            ++run;
+        }
+        if (run == 0)
+            return -1;
+        if (__buffer_read_run(bhs, run) < 0)
+            ret = -1;
+        else
+            total += run;
+        block += run;
+    }
+    return (ret < 0) ? -1 : total;
+}
+
+void buffer_release(buffer_head_t *bh)
+{
+    assert((bh->count > 0) && "Releasing a buffer which is not in use.");
+    --bh->count;
+    // Buffers which were never filled are useless.
+    if ((bh->count == 0) && !(bh->flags & BH_UPTODATE))
+        __buffer_evict(bh);
+}
+
+/// @brief Checks if the dirty buffers exceed the given percentage of the cache.
+/// @param ratio The percentage.
+/// @return 1 if they do, 0 otherwise.
+static inline int __buffer_over_dirty_ratio(unsigned int ratio)
+{
+    // Assume all buffers have the size of the first dirty one.
+    if (list_head_empty(&bcache.dirty))
+        return 0;
+    buffer_head_t *bh = list_entry(bcache.dirty.next, buffer_head_t, dirty);
+    return (bcache.info.nr_dirty * bh->size) > ((BUFFER_CACHE_MAX_SIZE / 100U) * ratio);
+}
+
+/// @brief Adds the buffer to the dirty ones.
+/// @param bh The buffer.
+static inline void __buffer_set_dirty(buffer_head_t *bh)
+{
+    ++bcache.info.nr_dirty;
+    bh->dirtied = timer_get_ticks();
+    list_head_add_tail(&bh->dirty, &bcache.dirty);
+    bh->flags |= BH_DIRTY;
+}
+
+/// @brief Removes the buffer from the dirty ones.
+/// @param bh The buffer.
+static inline void __buffer_clear_dirty(buffer_head_t *bh)
+{
+    bh->flags &= ~BH_DIRTY;
+    list_head_del(&bh->dirty);
+    --bcache.info.nr_dirty;
+}
+
+/// @brief Completes the writeback of a buffer, possibly from the interrupt
+/// handler of the device.
+/// @param bio   The bio of the buffer.
+/// @param error 0 on success, a negative error code on failure.
+static void __buffer_end_writeback(block_bio_t *bio, int error)
+{
+    buffer_head_t *bh = (buffer_head_t *)bio->private;
+    bh->flags &= ~BH_WRITEBACK;
+    --bcache.info.nr_writeback;
+    if (error) {
+        pr_err("Failed to write block %d (%d).\n", bh->block, error);
+        ++bcache.info.write_errors;
+        // Retry later, unless it was modified meanwhile.
+        if (!(bh->flags & BH_DIRTY))
+            __buffer_set_dirty(bh);
+    }
+    buffer_release(bh);
+}
+
+/// @brief Starts writing back a dirty buffer, which is not being written back.
+/// @param bh The buffer.
+/// @return 0 on success, -1 on failure.
+static int __buffer_start_writeback(buffer_head_t *bh)
+{
+    block_device_t *blkdev = block_get_device(bh->device);
+    if ((blkdev == NULL) || (bh->size % blkdev->sector_size)) {
+        // Not a block device, write it synchronously. It is clean while the
+        // driver writes it, so buffer_rw_raw does not write it back again.
+        __buffer_clear_dirty(bh);
+        if (__buffer_transfer(bh, 1) < 0) {
+            __buffer_set_dirty(bh);
+            return -1;
+        }
+        return 0;
+    }
+    // Writers can dirty it again while it is written, and it stays in use
+    // until the transfer completes.
+    __buffer_clear_dirty(bh);
+    bh->flags |= BH_WRITEBACK;
+    ++bh->count;
+    ++bcache.info.nr_writeback;
+    bh->bio.sector    = bh->block * (bh->size / blkdev->sector_size);
+    bh->bio.count     = bh->size / blkdev->sector_size;
+    bh->bio.buffer    = bh->data;
+    bh->bio.direction = BLOCK_WRITE;
+    bh->bio.end_io    = __buffer_end_writeback;
+    bh->bio.private   = bh;
+    bh->bio.writeback = 1;
+    block_submit_bio(blkdev, &bh->bio);
+    return 0;
+}
+
+void buffer_mark_dirty(buffer_head_t *bh)
+{
+    if (!(bh->flags & BH_DIRTY)) {
+        // The write-back happens later, on behalf of the process dirtying it.
+        task_struct *task = scheduler_get_current_process();
+        if (task)
+            task->ioac.write_bytes += bh->size;
+        __buffer_set_dirty(bh);
+    }
+    bh->flags |= BH_UPTODATE;
+    // Throttle the writers which dirty buffers faster than the flusher can
+    // write them back.
+    if (__buffer_over_dirty_ratio(BUFFER_DIRTY_RATIO) && buffer_flush(BUFFER_FLUSH_BATCH))
+        block_wait(&bcache.info.nr_writeback);
+}
+
+int buffer_sync(buffer_head_t *bh)
+{
+    // The bio of the buffer cannot be queued twice.
+    if (bh->flags & BH_WRITEBACK)
+        block_wait(&bcache.info.nr_writeback);
+    if (!(bh->flags & BH_DIRTY))
+        return 0;
+    unsigned long errors = bcache.info.write_errors;
+    if (__buffer_start_writeback(bh) < 0)
+        return -1;
+    block_wait(&bcache.info.nr_writeback);
+    return (bcache.info.write_errors == errors) ? 0 : -1;
+}
+
+unsigned int buffer_flush(unsigned int count)
+{
+    unsigned int flushed = 0;
+    unsigned long now    = timer_get_ticks();
+    list_head *it, *tmp;
+    list_for_each_safe (it, tmp, &bcache.dirty) {
+        buffer_head_t *bh = list_entry(it, buffer_head_t, dirty);
+        if (flushed == count)
+            break;
+        // The oldest buffer is not expired, so are the others.
+        if (((now - bh->dirtied) < BUFFER_DIRTY_EXPIRE) && !__buffer_over_dirty_ratio(BUFFER_DIRTY_BACKGROUND_RATIO))
+            break;
+        // Dirtied again while being written back, wait for the transfer.
+        if (bh->flags & BH_WRITEBACK)
+            continue;
+        if (__buffer_start_writeback(bh) < 0) {
+            // Retry later, after the others.
+            list_head_del(&bh->dirty);
+            list_head_add_tail(&bh->dirty, &bcache.dirty);
+            bh->dirtied = now;
+            break;
+        }
+        ++flushed;
+    }
+    // Start the transfers, without waiting for them.
+    block_unplug(NULL);
+    bcache.info.flushed += flushed;
+    return flushed;
+}
+
+int buffer_sync_device(vfs_file_t *device)
+{
+    int ret = 0;
+    // The bios of the buffers being written back cannot be queued twice.
+    block_wait(&bcache.info.nr_writeback);
+    unsigned long errors = bcache.info.write_errors;
+    if (!list_head_empty(&bcache.dirty)) {
+        // Buffers which fail are dirtied again, at the end of the list, stop
+        // at the last one we have now.
+        list_head *it = bcache.dirty.next, *last = bcache.dirty.prev, *next;
+        int done;
+        do {
+            buffer_head_t *bh = list_entry(it, buffer_head_t, dirty);
+            done              = (it == last);
+            next              = it->next;
+            if (((device == NULL) || (bh->device == device)) && (__buffer_start_writeback(bh) < 0))
+                ret = -1;
+            it = next;
+        } while (!done);
+    }
+    // Wait for all of them.
+    block_wait(&bcache.info.nr_writeback);
+    return (bcache.info.write_errors == errors) ? ret : -1;
+}
+
+void buffer_invalidate_device(vfs_file_t *device)
+{
+    list_head *it, *tmp;
+    list_for_each_safe (it, tmp, &bcache.lru) {
+        buffer_head_t *bh = list_entry(it, buffer_head_t, lru);
+        if ((bh->device == device) && (bh->count == 0))
+            __buffer_evict(bh);
+    }
+}
+
+/// @brief Checks if a buffer holds part of a range of bytes of a device.
+/// @param bh     The buffer.
+/// @param device The device.
+/// @param offset The offset of the first byte.
+/// @param size   The number of bytes.
+/// @return 1 if it does, 0 otherwise.
+static inline int __buffer_overlaps(buffer_head_t *bh, vfs_file_t *device, uint32_t offset, size_t size)
+{
+    uint32_t start = bh->block * bh->size;
+    return (bh->device == device) && (start < (offset + size)) && (offset < (start + bh->size));
+}
+
+/// @brief Searches a dirty buffer holding part of a range of bytes of a device.
+/// @param device The device.
+/// @param offset The offset of the first byte.
+/// @param size   The number of bytes.
+/// @return The buffer, NULL if there is none.
+static buffer_head_t *__buffer_find_dirty(vfs_file_t *device, uint32_t offset, size_t size)
+{
+    list_for_each_decl(it, &bcache.dirty)
+    {
+        buffer_head_t *bh = list_entry(it, buffer_head_t, dirty);
+        if (__buffer_overlaps(bh, device, offset, size))
+            return bh;
+    }
+    return NULL;
+}
+
+int buffer_rw_raw(block_device_t *dev, uint32_t offset, size_t size, uint8_t *buffer, int direction)
+{
+    buffer_head_t *bh;
+    // Reads must see the data written in the cache, and writes must not be
+    // overwritten by it later. The flusher changes the list while we wait, so
+    // we search again after each write-back.
+    while ((bh = __buffer_find_dirty(dev->file, offset, size)) != NULL)
+        if (buffer_sync(bh) < 0)
+            return -EIO;
+    int ret = block_rw_bytes(dev, offset, size, buffer, direction);
+    if ((ret < 0) || (direction == BLOCK_READ))
+        return ret;
+    // Update the cached copies of what we wrote.
+    list_for_each_decl(it, &bcache.lru)
+    {
+        bh = list_entry(it, buffer_head_t, lru);
+        if (!(bh->flags & BH_UPTODATE) || !__buffer_overlaps(bh, dev->file, offset, size))
+            continue;
+        uint32_t start = bh->block * bh->size;
+        uint32_t from  = max(start, offset);
+        uint32_t to    = min(start + bh->size, offset + size);
+        memcpy(bh->data + (from - start), buffer + (from - offset), to - from);
+    }
+    return 0;
+}
+
+void buffer_cache_get_info(buffer_cache_info_t *info)
+{
+    *info = bcache.info;
+}
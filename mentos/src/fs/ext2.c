@@ -19,6 +19,7 @@
 #include "sys/errno.h"
 #include "io/debug.h"
 #include "fs/vfs.h"
+#include "fs/buffer_cache.h"
 #include "assert.h"
 #include "libgen.h"
 #include "string.h"
@@ -31,6 +32,22 @@
 #define EXT2_MAX_SYMLINK_COUNT 8      ///< Maximum nesting of symlinks, used to prevent a loop.
 #define EXT2_NAME_LEN          255    ///< The lenght of names inside directory entries.
 
+#define EXT2_INODE_HASH_BUCKETS  256 ///< Number of buckets of the inode cache.
+#define EXT2_INODE_CACHE_MAX     512 ///< Maximum number of inodes cached by each filesystem.
+#define EXT2_DENTRY_HASH_BUCKETS 256 ///< Number of buckets of the directory entry cache.
+#define EXT2_DENTRY_CACHE_MAX    512 ///< Maximum number of directory entries cached by each filesystem.
+#define EXT2_DENTRY_NAME_LEN     32  ///< Longer names are not kept inside the directory entry cache.
+#define EXT2_PREALLOC_BLOCKS     8   ///< Blocks reserved to a regular file each time it grows.
+#define EXT2_PREALLOC_MAX        256 ///< Maximum number of blocks reserved to a regular file at once.
+#define EXT2_READAHEAD_MIN       4   ///< Size of the first readahead window, in blocks.
+#define EXT2_READAHEAD_MAX       32  ///< Maximum size of a readahead window, in blocks.
+
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020      ///< Directories can use a hashed index.
+#define EXT2_INDEX_FL                 0x1000      ///< The directory uses a hashed index.
+#define EXT2_DX_MAX_LEVELS            2           ///< Maximum depth of a directory index (root and nodes).
+#define EXT2_DX_HASH_EOF              0x7FFFFFFFU ///< Hash value reserved to the end of the directory.
+#define EXT2_FLAGS_UNSIGNED_HASH      0x0002      ///< The index hashes names as unsigned characters.
+
 // File types.
 #define EXT2_S_IFMT   0xF000 ///< Format mask
 #define EXT2_S_IFSOCK 0xC000 ///< Socket
@@ -199,17 +216,27 @@ typedef struct ext2_superblock_t {
     /// @brief Ddefault hash version to use.
     uint8_t def_hash_version;
     /// @brief Padding.
-    uint16_t padding1;
+    uint8_t padding1;
     /// @brief Padding.
-    uint8_t padding2;
+    uint16_t padding2;
 
     // == Other Options =======================================================
     /// @brief The default mount options for the file system.
     uint32_t default_mount_options;
     /// @brief The ID of the first meta block group.
     uint32_t first_meta_block_group_id;
+    /// @brief When the filesystem was created.
+    uint32_t mkfs_time;
+    /// @brief Backup of the inode of the journal.
+    uint32_t journal_blocks[17];
+    /// @brief Fields of the 64-bit filesystems, unused.
+    uint32_t padding3[3];
+    /// @brief Fields of the large inodes, unused.
+    uint16_t padding4[2];
+    /// @brief Miscellaneous flags (e.g., EXT2_FLAGS_UNSIGNED_HASH).
+    uint32_t flags;
     /// @brief Reserved.
-    uint8_t reserved[760];
+    uint8_t reserved[668];
 } ext2_superblock_t;
 
 /// @brief Entry of the Block Group Descriptor Table (BGDT).
@@ -286,6 +313,36 @@ typedef struct ext2_inode_t {
     uint32_t osd2[3];
 } ext2_inode_t;
 
+/// @brief An inode kept in memory.
+typedef struct ext2_cached_inode_t {
+    /// The index of the inode.
+    uint32_t ino;
+    /// The content of the inode.
+    ext2_inode_t inode;
+    /// The number of opened files referring to the inode, it cannot be evicted
+    /// until they are closed.
+    unsigned int count;
+    /// The inode has been modified, and must be written back.
+    int dirty;
+    /// The opened file associated with the inode, if any.
+    vfs_file_t *file;
+    /// The first block of the preallocation window, already marked as used
+    /// inside the bitmap but not yet part of the file.
+    uint32_t prealloc_block;
+    /// The number of blocks left inside the preallocation window.
+    uint32_t prealloc_count;
+    /// The first logical block of the last extent mapped by ext2_get_blocks.
+    uint32_t map_block;
+    /// The physical block of the first block of the extent.
+    uint32_t map_real;
+    /// The number of blocks of the extent, 0 if there is none.
+    uint32_t map_count;
+    /// List of inodes inside the same bucket.
+    list_head hash;
+    /// List of inodes in LRU order, the most recently used are at the front.
+    list_head lru;
+} ext2_cached_inode_t;
+
 /// @brief The header of an ext2 directory entry.
 typedef struct ext2_dirent_t {
     /// Number of the inode that this directory entry points to.
@@ -300,6 +357,88 @@ typedef struct ext2_dirent_t {
     char name[EXT2_NAME_LEN];
 } ext2_dirent_t;
 
+/// @brief Hash functions used by directory indexes.
+typedef enum ext2_dx_hash_version_t {
+    ext2_dx_hash_legacy,            ///< The original hash.
+    ext2_dx_hash_half_md4,          ///< Half MD4.
+    ext2_dx_hash_tea,               ///< Tiny Encryption Algorithm.
+    ext2_dx_hash_legacy_unsigned,   ///< The original hash, on unsigned characters.
+    ext2_dx_hash_half_md4_unsigned, ///< Half MD4, on unsigned characters.
+    ext2_dx_hash_tea_unsigned       ///< Tiny Encryption Algorithm, on unsigned characters.
+} ext2_dx_hash_version_t;
+
+/// @brief Information stored inside the root of a directory index, right
+/// after the `.` and `..` entries.
+typedef struct ext2_dx_root_info_t {
+    /// Must be zero.
+    uint32_t reserved_zero;
+    /// The hash function (ext2_dx_hash_version_t).
+    uint8_t hash_version;
+    /// The length of this structure (8).
+    uint8_t info_length;
+    /// Number of levels of nodes below the root.
+    uint8_t indirect_levels;
+    /// Unused.
+    uint8_t unused_flags;
+} ext2_dx_root_info_t;
+
+/// @brief An entry of a directory index, pointing to the block containing the
+/// names whose hash is greater or equal than `hash`.
+typedef struct ext2_dx_entry_t {
+    /// The smallest hash inside the block, the lowest bit is set when the
+    /// previous block contains names with the same hash.
+    uint32_t hash;
+    /// The index of the block inside the directory.
+    uint32_t block;
+} ext2_dx_entry_t;
+
+/// @brief Header of the entries of an index block, stored in place of the
+/// hash of the first entry, which is implicitly zero.
+typedef struct ext2_dx_countlimit_t {
+    /// Maximum number of entries.
+    uint16_t limit;
+    /// Number of entries.
+    uint16_t count;
+} ext2_dx_countlimit_t;
+
+/// @brief The result of a lookup inside a directory, kept in memory.
+typedef struct ext2_dentry_t {
+    /// The inode of the directory.
+    ino_t parent;
+    /// The inode the name points to, zero if the name does not exist.
+    uint32_t ino;
+    /// Length of the directory entry.
+    uint16_t rec_len;
+    /// File type code.
+    uint8_t file_type;
+    /// The index of the directory block containing the entry.
+    uint32_t block_index;
+    /// The offset of the entry inside the block.
+    uint32_t block_offset;
+    /// The name we searched.
+    char name[EXT2_DENTRY_NAME_LEN];
+    /// List of entries inside the same bucket.
+    list_head hash;
+    /// List of entries in LRU order, the most recently used are at the front.
+    list_head lru;
+} ext2_dentry_t;
+
+/// @brief In-memory state of a block group, used by the allocators.
+typedef struct ext2_group_cache_t {
+    /// Copy of the block bitmap, NULL until it is needed.
+    uint8_t *block_bitmap;
+    /// Copy of the inode bitmap, NULL until it is needed.
+    uint8_t *inode_bitmap;
+    /// Where the search for a free block starts.
+    uint32_t block_hint;
+    /// Where the search for a free inode starts.
+    uint32_t inode_hint;
+    /// The block bitmap must be written back.
+    int block_bitmap_dirty;
+    /// The inode bitmap must be written back.
+    int inode_bitmap_dirty;
+} ext2_group_cache_t;
+
 /// @brief The details regarding the filesystem.
 typedef struct ext2_filesystem_t {
     /// Pointer to the block device.
@@ -308,12 +447,28 @@ typedef struct ext2_filesystem_t {
     ext2_superblock_t superblock;
     /// Block Group Descriptor / Block groups.
     ext2_group_descriptor_t *block_groups;
+    /// In-memory state of the block groups.
+    ext2_group_cache_t *group_cache;
     /// EXT2 memory cache for buffers.
     kmem_cache_t *ext2_buffer_cache;
     /// Root FS node (attached to mountpoint).
     vfs_file_t *root;
     /// List of opened files.
     list_head opened_files;
+    /// Hash table of the cached inodes.
+    list_head inode_hash[EXT2_INODE_HASH_BUCKETS];
+    /// The cached inodes, the most recently used are at the front.
+    list_head inode_lru;
+    /// Number of cached inodes.
+    uint32_t nr_cached_inodes;
+    /// Number of cached inodes which must be written back.
+    uint32_t nr_dirty_inodes;
+    /// Hash table of the cached directory entries.
+    list_head dentry_hash[EXT2_DENTRY_HASH_BUCKETS];
+    /// The cached directory entries, the most recently used are at the front.
+    list_head dentry_lru;
+    /// Number of cached directory entries.
+    uint32_t nr_dentries;
 
     /// Size of one block.
     uint32_t block_size;
@@ -332,6 +487,10 @@ typedef struct ext2_filesystem_t {
     uint32_t bgdt_end_block;
     /// The number of blocks containing the BGDT
     uint32_t bgdt_length;
+    /// The BGDT must be written back.
+    int bgdt_dirty;
+    /// The superblock must be written back.
+    int superblock_dirty;
 
     /// Index of indirect blocks.
     uint32_t indirect_blocks_index;
@@ -371,6 +530,9 @@ static int ext2_read_bgdt(ext2_filesystem_t *fs);
 static int ext2_write_bgdt(ext2_filesystem_t *fs);
 static int ext2_read_inode(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index);
 static int ext2_write_inode(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index);
+static int ext2_stage_filesystem(ext2_filesystem_t *fs);
+static int ext2_sync_filesystem(ext2_filesystem_t *fs);
+static int ext2_discard_prealloc(ext2_filesystem_t *fs, ext2_cached_inode_t *cached);
 
 static vfs_file_t *ext2_open(const char *path, int flags, mode_t mode);
 static int ext2_unlink(const char *path);
@@ -380,6 +542,7 @@ static ssize_t ext2_write(vfs_file_t *file, const void *buffer, off_t offset, si
 static off_t ext2_lseek(vfs_file_t *file, off_t offset, int whence);
 static int ext2_fstat(vfs_file_t *file, stat_t *stat);
 static int ext2_ioctl(vfs_file_t *file, int request, void *data);
+static int ext2_fsync(vfs_file_t *file, int datasync);
 static int ext2_getdents(vfs_file_t *file, dirent_t *dirp, off_t doff, size_t count);
 
 static int ext2_mkdir(const char *path, mode_t mode);
@@ -411,9 +574,15 @@ static vfs_file_operations_t ext2_fs_operations = {
     .lseek_f    = ext2_lseek,
     .stat_f     = ext2_fstat,
     .ioctl_f    = ext2_ioctl,
+    .fsync_f    = ext2_fsync,
     .getdents_f = ext2_getdents
 };
 
+/// Cache for the inodes kept in memory.
+static kmem_cache_t *ext2_inode_cache;
+/// Cache for the directory entries kept in memory.
+static kmem_cache_t *ext2_dentry_cache;
+
 // ============================================================================
 // Debugging Support Functions
 // ============================================================================
@@ -720,109 +889,175 @@ static void ext2_set_bitmap_bit(uint8_t *buffer, uint32_t linear_index, ext2_blo
         bit_clear_assign(buffer[linear_index / 8], linear_index % 8);
 }
 
-/// @brief Searches for a free inode inside the group data loaded inside the cache.
+/// @brief Searches the first bit at zero inside a bitmap, a word at a time.
+/// @param bitmap the bitmap, aligned to a word.
+/// @param start the index from which we start searching.
+/// @param end the number of bits of the bitmap.
+/// @return the index of the bit, or `end` if all the bits are set.
+static uint32_t ext2_find_first_zero_bit(const uint8_t *bitmap, uint32_t start, uint32_t end)
+{
+    const uint32_t *words = (const uint32_t *)bitmap;
+    for (uint32_t index = start; index < end;) {
+        // Consider the bits before the starting one as set.
+        uint32_t word = words[index / 32U] | ((1U << (index % 32U)) - 1U);
+        if (word != 0xFFFFFFFFU) {
+            index = (index & ~31U) + find_first_zero(word);
+            return (index < end) ? index : end;
+        }
+        index = (index & ~31U) + 32U;
+    }
+    return end;
+}
+
+/// @brief Searches the first bit at zero inside a bitmap, starting from the
+/// hint and wrapping around.
+/// @param bitmap the bitmap, aligned to a word.
+/// @param first the first index we can return.
+/// @param hint the index from which we start searching.
+/// @param end the number of bits of the bitmap.
+/// @return the index of the bit, or `end` if all the bits are set.
+static inline uint32_t ext2_find_zero_bit_from_hint(const uint8_t *bitmap, uint32_t first, uint32_t hint, uint32_t end)
+{
+    if ((hint < first) || (hint >= end))
+        hint = first;
+    uint32_t index = ext2_find_first_zero_bit(bitmap, hint, end);
+    if ((index == end) && (hint > first)) {
+        index = ext2_find_first_zero_bit(bitmap, first, hint);
+        if (index == hint)
+            return end;
+    }
+    return index;
+}
+
+/// @brief Returns the cached bitmap of a group, reading it if needed.
 /// @param fs the ext2 filesystem structure.
-/// @param cache the cache from which we read the bgdt data.
+/// @param bitmap the cached bitmap.
+/// @param block the block containing the bitmap.
+/// @return the bitmap, NULL on failure.
+static uint8_t *ext2_get_cached_bitmap(ext2_filesystem_t *fs, uint8_t **bitmap, uint32_t block)
+{
+    if (*bitmap == NULL) {
+        uint8_t *buffer = kmalloc(fs->block_size);
+        if (buffer == NULL)
+            return NULL;
+        if (ext2_read_block(fs, block, buffer) < 0) {
+            kfree(buffer);
+            return NULL;
+        }
+        *bitmap = buffer;
+    }
+    return *bitmap;
+}
+
+/// @brief Frees the cached bitmaps of all the groups.
+/// @param fs the ext2 filesystem structure.
+static void ext2_free_cached_bitmaps(ext2_filesystem_t *fs)
+{
+    for (uint32_t i = 0; i < fs->block_groups_count; ++i) {
+        if (fs->group_cache[i].block_bitmap)
+            kfree(fs->group_cache[i].block_bitmap);
+        if (fs->group_cache[i].inode_bitmap)
+            kfree(fs->group_cache[i].inode_bitmap);
+    }
+}
+
+/// @brief Searches for a free inode inside a group.
+/// @param fs the ext2 filesystem structure.
+/// @param group_index the group.
 /// @param linear_index the output variable where we store the linear indes to the free inode.
 /// @return true if we found a free inode, false otherwise.
-static inline bool_t ext2_find_free_inode_in_group(
-    ext2_filesystem_t *fs,
-    uint8_t *cache,
-    uint32_t *linear_index,
-    bool_t skip_reserved)
+static inline bool_t ext2_find_free_inode_in_group(ext2_filesystem_t *fs, uint32_t group_index, uint32_t *linear_index)
 {
-    for ((*linear_index) = 0; (*linear_index) < fs->superblock.inodes_per_group; ++(*linear_index)) {
-        // If we need to skip the reserved inodes, we skip the round if the
-        // index is that of a reserved inode (superblock.first_ino).
-        if (skip_reserved && ((*linear_index) < fs->superblock.first_ino))
-            continue;
-        // Check if the entry is free.
-        if (!ext2_check_bitmap_bit(cache, *linear_index))
-            return true;
-    }
-    return false;
+    ext2_group_cache_t *group = &fs->group_cache[group_index];
+    if (fs->block_groups[group_index].free_inodes_count == 0)
+        return false;
+    uint8_t *bitmap = ext2_get_cached_bitmap(fs, &group->inode_bitmap, fs->block_groups[group_index].inode_bitmap);
+    if (bitmap == NULL) {
+        pr_err("Failed to read the inode bitmap for group `%d`.\n", group_index);
+        return false;
+    }
+    // We need to skip the reserved inodes, only if we are in group 0.
+    uint32_t first = (group_index == 0) ? fs->superblock.first_ino : 0;
+    *linear_index  = ext2_find_zero_bit_from_hint(bitmap, first, group->inode_hint, fs->superblock.inodes_per_group);
+    return *linear_index < fs->superblock.inodes_per_group;
 }
 
 /// @brief Searches for a free inode inside the Block Group Descriptor Table (BGDT).
 /// @param fs the ext2 filesystem structure.
-/// @param cache the cache from which we read the bgdt data.
 /// @param group_index the output variable where we store the group index.
 /// @param linear_index the output variable where we store the linear indes to the free inode.
+/// @param preferred_group the group we try first.
 /// @return true if we found a free inode, false otherwise.
 static inline bool_t ext2_find_free_inode(
     ext2_filesystem_t *fs,
-    uint8_t *cache,
     uint32_t *group_index,
     uint32_t *linear_index,
     uint32_t preferred_group)
 {
-    // If we received a preference, try to find a free inode in that specific group.
-    if (preferred_group != 0) {
-        // Set the group index to the preferred group.
-        (*group_index) = preferred_group;
-        // Find the first free inode. We need to ask to skip reserved inodes,
-        // only if we are in group 0.
-        if (ext2_find_free_inode_in_group(fs, cache, linear_index, (*group_index) == 0))
+    if (preferred_group >= fs->block_groups_count)
+        preferred_group = 0;
+    // Start from the preferred group, then move to the following ones.
+    for (uint32_t i = 0; i < fs->block_groups_count; ++i) {
+        (*group_index) = (preferred_group + i) % fs->block_groups_count;
+        if (ext2_find_free_inode_in_group(fs, *group_index, linear_index))
             return true;
     }
-    // Get the group and bit index of the first free block.
-    for ((*group_index) = 0; (*group_index) < fs->block_groups_count; ++(*group_index)) {
-        // Check if there are free inodes in this block group.
-        if (fs->block_groups[(*group_index)].free_inodes_count > 0) {
-            // Read the block bitmap.
-            if (ext2_read_block(fs, fs->block_groups[(*group_index)].inode_bitmap, cache) < 0) {
-                pr_err("Failed to read the inode bitmap for group `%d`.\n", (*group_index));
-                return false;
-            }
-            // Find the first free inode. We need to ask to skip reserved
-            // inodes, only if we are in group 0.
-            if (ext2_find_free_inode_in_group(fs, cache, linear_index, (*group_index) == 0))
-                return true;
-        }
-    }
     return false;
 }
 
-/// @brief Searches for a free block inside the group data loaded inside the cache.
+/// @brief Returns the number of blocks inside a group, the last one might be smaller.
 /// @param fs the ext2 filesystem structure.
-/// @param cache the cache from which we read the bgdt data.
-/// @param group_index the output variable where we store the group index.
+/// @param group_index the group.
+/// @return the number of blocks.
+static inline uint32_t ext2_get_blocks_in_group(ext2_filesystem_t *fs, uint32_t group_index)
+{
+    uint32_t first = fs->superblock.first_data_block + group_index * fs->superblock.blocks_per_group;
+    return min(fs->superblock.blocks_per_group, fs->superblock.blocks_count - first);
+}
+
+/// @brief Searches for a free block inside a group.
+/// @param fs the ext2 filesystem structure.
+/// @param group_index the group.
+/// @param start the linear index from which we start searching.
 /// @param linear_index the output variable where we store the linear indes to the free block.
 /// @return true if we found a free block, false otherwise.
-static inline bool_t ext2_find_free_block_in_group(ext2_filesystem_t *fs, uint8_t *cache, uint32_t *linear_index)
+static inline bool_t ext2_find_free_block_in_group(ext2_filesystem_t *fs, uint32_t group_index, uint32_t start, uint32_t *linear_index)
 {
-    for ((*linear_index) = 0; (*linear_index) < fs->superblock.blocks_per_group; ++(*linear_index)) {
-        // Check if the entry is free.
-        if (!ext2_check_bitmap_bit(cache, *linear_index))
-            return true;
-    }
-    return false;
+    ext2_group_cache_t *group = &fs->group_cache[group_index];
+    if (fs->block_groups[group_index].free_blocks_count == 0)
+        return false;
+    uint8_t *bitmap = ext2_get_cached_bitmap(fs, &group->block_bitmap, fs->block_groups[group_index].block_bitmap);
+    if (bitmap == NULL) {
+        pr_err("Failed to read the block bitmap for group `%d`.\n", group_index);
+        return false;
+    }
+    uint32_t count = ext2_get_blocks_in_group(fs, group_index);
+    *linear_index  = ext2_find_zero_bit_from_hint(bitmap, 0, start, count);
+    return *linear_index < count;
 }
 
-/// @brief Searches for a free block.
+/// @brief Searches for a free block, as close as possible to the goal.
 /// @param fs the ext2 filesystem structure.
-/// @param cache the cache from which we read the bgdt data.
+/// @param goal the block we would like to get, 0 if we have no preference.
+/// @param group_index the output variable where we store the group index.
 /// @param linear_index the output variable where we store the linear indes to the free block.
 /// @return true if we found a free block, false otherwise.
-static inline bool_t ext2_find_free_block(
-    ext2_filesystem_t *fs,
-    uint8_t *cache,
-    uint32_t *group_index,
-    uint32_t *linear_index)
-{
-    // Get the group and bit index of the first free block.
-    for ((*group_index) = 0; (*group_index) < fs->block_groups_count; ++(*group_index)) {
-        // Check if there are free blocks in this block group.
-        if (fs->block_groups[(*group_index)].free_blocks_count > 0) {
-            // Read the block bitmap.
-            if (ext2_read_block(fs, fs->block_groups[(*group_index)].block_bitmap, cache) < 0) {
-                pr_err("Failed to read the block bitmap for group `%d`.\n", (*group_index));
-                return false;
-            }
-            // Find the first free block.
-            if (ext2_find_free_block_in_group(fs, cache, linear_index))
-                return true;
-        }
+static inline bool_t ext2_find_free_block(ext2_filesystem_t *fs, uint32_t goal, uint32_t *group_index, uint32_t *linear_index)
+{
+    uint32_t goal_group = 0, goal_linear = 0;
+    bool_t has_goal = (goal >= fs->superblock.first_data_block) && (goal < fs->superblock.blocks_count);
+    if (has_goal) {
+        goal_group  = (goal - fs->superblock.first_data_block) / fs->superblock.blocks_per_group;
+        goal_linear = (goal - fs->superblock.first_data_block) % fs->superblock.blocks_per_group;
+    }
+    // Start from the group of the goal, then move to the following ones.
+    for (uint32_t i = 0; i < fs->block_groups_count; ++i) {
+        (*group_index) = (goal_group + i) % fs->block_groups_count;
+        // Inside the group of the goal we search forward from the goal,
+        // inside the others we start where the last allocation stopped.
+        uint32_t start = (has_goal && (i == 0)) ? goal_linear : fs->group_cache[*group_index].block_hint;
+        if (ext2_find_free_block_in_group(fs, *group_index, start, linear_index))
+            return true;
     }
     return false;
 }
@@ -836,13 +1071,39 @@ static int ext2_read_superblock(ext2_filesystem_t *fs)
     return vfs_read(fs->block_device, &fs->superblock, 1024, sizeof(ext2_superblock_t));
 }
 
-/// @brief Writes the superblock on the block device associated with this filesystem.
+/// @brief Copies data inside the cached copy of a block, which is written
+/// back together with the other dirty blocks of the device.
 /// @param fs the ext2 filesystem structure.
-/// @return the amount of data we wrote, or negative value for an error.
+/// @param block_index the index of the block.
+/// @param offset the offset of the data inside the block.
+/// @param data the data.
+/// @param size the size of the data.
+/// @return 0 on success, -1 on failure.
+static int ext2_stage_block(ext2_filesystem_t *fs, uint32_t block_index, uint32_t offset, const void *data, uint32_t size)
+{
+    buffer_head_t *bh;
+    // Partial updates need the rest of the block.
+    if (size < fs->block_size)
+        bh = buffer_read(fs->block_device, block_index, fs->block_size);
+    else
+        bh = buffer_get(fs->block_device, block_index, fs->block_size);
+    if (bh == NULL)
+        return -1;
+    memcpy(bh->data + offset, data, size);
+    buffer_mark_dirty(bh);
+    buffer_release(bh);
+    return 0;
+}
+
+/// @brief Writes the superblock inside the buffer cache, it reaches the disk
+/// with the next ext2_sync_filesystem.
+/// @param fs the ext2 filesystem structure.
+/// @return 0 on success, -1 on failure.
 static int ext2_write_superblock(ext2_filesystem_t *fs)
 {
     pr_debug("Write superblock for EXT2 filesystem (0x%x)\n", fs);
-    return vfs_write(fs->block_device, &fs->superblock, 1024, sizeof(ext2_superblock_t));
+    // The superblock is always 1024 bytes from the start of the device.
+    return ext2_stage_block(fs, 1024U / fs->block_size, 1024U % fs->block_size, &fs->superblock, sizeof(ext2_superblock_t));
 }
 
 /// @brief Read a block from the block device associated with this filesystem.
@@ -861,7 +1122,13 @@ static int ext2_read_block(ext2_filesystem_t *fs, uint32_t block_index, uint8_t
         pr_err("You are trying to read with a NULL buffer.\n");
         return -1;
     }
-    return vfs_read(fs->block_device, buffer, block_index * fs->block_size, fs->block_size);
+    // Go through the buffer cache, the block might have been read already.
+    buffer_head_t *bh = buffer_read(fs->block_device, block_index, fs->block_size);
+    if (bh == NULL)
+        return -1;
+    memcpy(buffer, bh->data, fs->block_size);
+    buffer_release(bh);
+    return fs->block_size;
 }
 
 /// @brief Writes a block on the block device associated with this filesystem.
@@ -880,7 +1147,16 @@ static int ext2_write_block(ext2_filesystem_t *fs, uint32_t block_index, uint8_t
         pr_err("You are trying to write with a NULL buffer.\n");
         return -1;
     }
-    return vfs_write(fs->block_device, buffer, block_index * fs->block_size, fs->block_size);
+    // Update the cached copy, the whole block is overwritten so there is no
+    // need to read it first.
+    buffer_head_t *bh = buffer_get(fs->block_device, block_index, fs->block_size);
+    if (bh == NULL)
+        return -1;
+    memcpy(bh->data, buffer, fs->block_size);
+    // It reaches the disk with the other dirty blocks of the device.
+    buffer_mark_dirty(bh);
+    buffer_release(bh);
+    return fs->block_size;
 }
 
 /// @brief Reads the Block Group Descriptor Table (BGDT) from the block device associated with this filesystem.
@@ -898,7 +1174,8 @@ static int ext2_read_bgdt(ext2_filesystem_t *fs)
     return -1;
 }
 
-/// @brief Writes the Block Group Descriptor Table (BGDT) to the block device associated with this filesystem.
+/// @brief Writes the Block Group Descriptor Table (BGDT) inside the buffer
+/// cache, it reaches the disk with the next ext2_sync_filesystem.
 /// @param fs the ext2 filesystem structure.
 /// @return 0 on success, -1 on failure.
 static int ext2_write_bgdt(ext2_filesystem_t *fs)
@@ -906,84 +1183,278 @@ static int ext2_write_bgdt(ext2_filesystem_t *fs)
     pr_debug("Write BGDT for EXT2 filesystem (0x%x)\n", fs);
     if (fs->block_groups) {
         for (uint32_t i = 0; i < fs->bgdt_length; ++i)
-            ext2_write_block(fs, fs->bgdt_start_block + i, (uint8_t *)((uintptr_t)fs->block_groups + (fs->block_size * i)));
+            if (ext2_stage_block(fs, fs->bgdt_start_block + i, 0, (uint8_t *)((uintptr_t)fs->block_groups + (fs->block_size * i)), fs->block_size) == -1)
+                return -1;
         return 0;
     }
     pr_err("The `block_groups` list is not initialized.\n");
     return -1;
 }
 
-/// @brief Reads an inode.
+/// @brief Computes where an inode is stored inside the inode table.
 /// @param fs the filesystem.
-/// @param inode the inode which we are working with.
 /// @param inode_index The index of the inode.
+/// @param block where we store the block containing the inode.
+/// @param offset where we store the offset of the inode inside the block.
 /// @return 0 on success, -1 on failure.
-static int ext2_read_inode(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index)
+static int ext2_get_inode_location(ext2_filesystem_t *fs, uint32_t inode_index, uint32_t *block, uint32_t *offset)
 {
     if (inode_index == 0) {
-        pr_err("You are trying to read an invalid inode index (%d).\n", inode_index);
+        pr_err("You are trying to access an invalid inode index (%d).\n", inode_index);
         return -1;
     }
     // Retrieve the group index.
     uint32_t group_index = ext2_get_group_index_from_inode(fs, inode_index);
-    if (group_index > fs->block_groups_count) {
+    if (group_index >= fs->block_groups_count) {
         pr_err("Invalid group index computed from inode index `%d`.\n", inode_index);
         return -1;
     }
     // Get the index of the inode inside the group.
-    uint32_t offset = ext2_get_inode_offest_in_group(fs, inode_index);
-    // Get the block offest.
-    uint32_t block = ext2_get_block_index_from_inode_offset(fs, offset);
+    uint32_t index = ext2_get_inode_offest_in_group(fs, inode_index);
+    // Get the block containing the inode.
+    *block = fs->block_groups[group_index].inode_table + ext2_get_block_index_from_inode_offset(fs, index);
     // Get the real inode offset inside the block.
-    offset %= fs->inodes_per_block_count;
-    // Allocate the cache.
-    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
-    // Clean the cache.
-    memset(cache, 0, fs->block_size);
-    // Read the block containing the inode table.
-    ext2_read_block(fs, fs->block_groups[group_index].inode_table + block, cache);
-    // Save the inode content.
-    memcpy(inode, (ext2_inode_t *)((uintptr_t)cache + (offset * fs->superblock.inode_size)), fs->superblock.inode_size);
-    // Free the cache.
-    kmem_cache_free(cache);
+    *offset = (index * fs->superblock.inode_size) % fs->block_size;
+    return 0;
+}
+
+/// @brief Copies a cached inode inside the buffer of its inode table block.
+/// The block is not written, so that inodes sharing the same block are
+/// written together.
+/// @param fs the filesystem.
+/// @param cached the cached inode.
+/// @return 0 on success, -1 on failure.
+static int ext2_stage_inode(ext2_filesystem_t *fs, ext2_cached_inode_t *cached)
+{
+    uint32_t block, offset;
+    if (ext2_get_inode_location(fs, cached->ino, &block, &offset) == -1)
+        return -1;
+    buffer_head_t *bh = buffer_read(fs->block_device, block, fs->block_size);
+    if (bh == NULL) {
+        pr_err("Failed to read the inode table block `%d`.\n", block);
+        return -1;
+    }
+    // Inodes might be larger than the structure, keep the rest untouched.
+    memcpy(bh->data + offset, &cached->inode, sizeof(ext2_inode_t));
+    buffer_mark_dirty(bh);
+    buffer_release(bh);
+    cached->dirty = 0;
+    --fs->nr_dirty_inodes;
+    return 0;
+}
+
+/// @brief Removes an inode from the cache, writing it back if needed.
+/// @param fs the filesystem.
+/// @param cached the cached inode.
+/// @return 0 on success, -1 if the inode could not be written back.
+static int ext2_evict_inode(ext2_filesystem_t *fs, ext2_cached_inode_t *cached)
+{
+    assert((cached->count == 0) && "Trying to evict an inode which is in use.");
+    ext2_discard_prealloc(fs, cached);
+    if (cached->dirty) {
+        if (ext2_stage_inode(fs, cached) == -1)
+            return -1;
+    }
+    list_head_del(&cached->hash);
+    list_head_del(&cached->lru);
+    --fs->nr_cached_inodes;
+    kmem_cache_free(cached);
+    return 0;
+}
+
+/// @brief Drops all the inodes of the cache, without writing them back.
+/// @param fs the filesystem.
+static void ext2_drop_inodes(ext2_filesystem_t *fs)
+{
+    list_head *it;
+    while ((it = list_head_pop(&fs->inode_lru)) != NULL) {
+        ext2_cached_inode_t *cached = list_entry(it, ext2_cached_inode_t, lru);
+        list_head_del(&cached->hash);
+        kmem_cache_free(cached);
+    }
+    fs->nr_cached_inodes = 0;
+    fs->nr_dirty_inodes  = 0;
+}
+
+/// @brief Searches an inode inside the cache.
+/// @param fs the filesystem.
+/// @param inode_index The index of the inode.
+/// @return the cached inode, NULL if it is not cached.
+static ext2_cached_inode_t *ext2_lookup_inode(ext2_filesystem_t *fs, uint32_t inode_index)
+{
+    list_for_each_decl(it, &fs->inode_hash[inode_index % EXT2_INODE_HASH_BUCKETS])
+    {
+        ext2_cached_inode_t *cached = list_entry(it, ext2_cached_inode_t, hash);
+        if (cached->ino == inode_index)
+            return cached;
+    }
+    return NULL;
+}
+
+/// @brief Gets an inode from the cache, adding it if needed.
+/// @param fs the filesystem.
+/// @param inode_index The index of the inode.
+/// @param read 1 if we must read the inode when it is not cached, 0 if the
+/// caller is going to overwrite it.
+/// @return the cached inode, NULL on failure.
+static ext2_cached_inode_t *ext2_get_cached_inode(ext2_filesystem_t *fs, uint32_t inode_index, int read)
+{
+    ext2_cached_inode_t *cached = ext2_lookup_inode(fs, inode_index);
+    if (cached) {
+        // Move it to the front of the LRU list.
+        list_head_del(&cached->lru);
+        list_head_add(&cached->lru, &fs->inode_lru);
+        return cached;
+    }
+    uint32_t block, offset;
+    if (ext2_get_inode_location(fs, inode_index, &block, &offset) == -1)
+        return NULL;
+    // Make room for the new inode, starting from the least recently used.
+    list_head *it = fs->inode_lru.prev, *prev;
+    while ((fs->nr_cached_inodes >= EXT2_INODE_CACHE_MAX) && (it != &fs->inode_lru)) {
+        prev = it->prev;
+        ext2_cached_inode_t *victim = list_entry(it, ext2_cached_inode_t, lru);
+        if (victim->count == 0)
+            ext2_evict_inode(fs, victim);
+        it = prev;
+    }
+    cached = kmem_cache_alloc(ext2_inode_cache, GFP_KERNEL);
+    if (cached == NULL) {
+        pr_err("Failed to allocate memory for the inode `%d`.\n", inode_index);
+        return NULL;
+    }
+    memset(cached, 0, sizeof(ext2_cached_inode_t));
+    cached->ino = inode_index;
+    if (read) {
+        buffer_head_t *bh = buffer_read(fs->block_device, block, fs->block_size);
+        if (bh == NULL) {
+            pr_err("Failed to read the inode table block `%d`.\n", block);
+            kmem_cache_free(cached);
+            return NULL;
+        }
+        memcpy(&cached->inode, bh->data + offset, sizeof(ext2_inode_t));
+        buffer_release(bh);
+    }
+    list_head_add(&cached->hash, &fs->inode_hash[inode_index % EXT2_INODE_HASH_BUCKETS]);
+    list_head_add(&cached->lru, &fs->inode_lru);
+    ++fs->nr_cached_inodes;
+    return cached;
+}
+
+/// @brief Writes the modified bitmaps, group descriptors and superblock
+/// inside the buffer cache.
+/// @param fs the filesystem.
+/// @return 0 on success, -1 on failure.
+static int ext2_stage_metadata(ext2_filesystem_t *fs)
+{
+    int ret = 0;
+    for (uint32_t i = 0; i < fs->block_groups_count; ++i) {
+        ext2_group_cache_t *group = &fs->group_cache[i];
+        if (group->block_bitmap_dirty) {
+            if (ext2_stage_block(fs, fs->block_groups[i].block_bitmap, 0, group->block_bitmap, fs->block_size) == -1)
+                ret = -1;
+            else
+                group->block_bitmap_dirty = 0;
+        }
+        if (group->inode_bitmap_dirty) {
+            if (ext2_stage_block(fs, fs->block_groups[i].inode_bitmap, 0, group->inode_bitmap, fs->block_size) == -1)
+                ret = -1;
+            else
+                group->inode_bitmap_dirty = 0;
+        }
+    }
+    if (fs->bgdt_dirty) {
+        if (ext2_write_bgdt(fs) == -1)
+            ret = -1;
+        else
+            fs->bgdt_dirty = 0;
+    }
+    if (fs->superblock_dirty) {
+        if (ext2_write_superblock(fs) == -1)
+            ret = -1;
+        else
+            fs->superblock_dirty = 0;
+    }
+    return ret;
+}
+
+/// @brief Copies all the modified inodes and metadata of the filesystem inside
+/// the buffer cache, which writes them back later on.
+/// @param fs the filesystem.
+/// @return 0 on success, -1 on failure.
+static int ext2_stage_filesystem(ext2_filesystem_t *fs)
+{
+    int ret = 0;
+    if (fs->nr_dirty_inodes > 0) {
+        list_for_each_decl(it, &fs->inode_lru)
+        {
+            ext2_cached_inode_t *cached = list_entry(it, ext2_cached_inode_t, lru);
+            if (cached->dirty && (ext2_stage_inode(fs, cached) == -1))
+                ret = -1;
+        }
+    }
+    if (ext2_stage_metadata(fs) == -1)
+        ret = -1;
+    return ret;
+}
+
+/// @brief Writes back all the modified inodes and metadata of the filesystem,
+/// together with all its dirty blocks.
+/// @param fs the filesystem.
+/// @return 0 on success, -1 on failure.
+static int ext2_sync_filesystem(ext2_filesystem_t *fs)
+{
+    // The preallocation windows are marked as used inside the bitmaps, give
+    // them back first, or a crash would leak their blocks on disk. Writers
+    // reserve a new window with their next allocation.
+    list_for_each_decl(it, &fs->inode_lru)
+    {
+        ext2_discard_prealloc(fs, list_entry(it, ext2_cached_inode_t, lru));
+    }
+    int ret = ext2_stage_filesystem(fs);
+    // Each block is written once, no matter how many times it has been
+    // modified since the last synchronization (e.g., the bitmaps and the BGDT
+    // while allocating the blocks of a large write).
+    if (buffer_sync_device(fs->block_device) < 0)
+        ret = -1;
+    return ret;
+}
+
+/// @brief Reads an inode.
+/// @param fs the filesystem.
+/// @param inode the inode which we are working with.
+/// @param inode_index The index of the inode.
+/// @return 0 on success, -1 on failure.
+static int ext2_read_inode(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index)
+{
+    ext2_cached_inode_t *cached = ext2_get_cached_inode(fs, inode_index, 1);
+    if (cached == NULL)
+        return -1;
+    memcpy(inode, &cached->inode, sizeof(ext2_inode_t));
     return 0;
 }
 
-/// @brief Writes the inode.
+/// @brief Writes the inode. The inode is only updated inside the cache, and
+/// it is copied inside the buffer cache by ext2_stage_filesystem.
 /// @param fs the filesystem.
 /// @param inode the inode which we are working with.
 /// @param inode_index The index of the inode.
 /// @return 0 on success, -1 on failure.
 static int ext2_write_inode(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index)
 {
-    if (inode_index == 0) {
-        pr_err("You are trying to read an invalid inode index (%d).\n", inode_index);
+    ext2_cached_inode_t *cached = ext2_get_cached_inode(fs, inode_index, 0);
+    if (cached == NULL)
         return -1;
-    }
-    // Retrieve the group index.
-    uint32_t group_index = ext2_get_group_index_from_inode(fs, inode_index);
-    if (group_index > fs->block_groups_count) {
-        pr_err("Invalid group index computed from inode index `%d`.\n", inode_index);
-        return -1;
-    }
-    // Get the offset of the inode inside the group.
-    uint32_t offset = ext2_get_inode_offest_in_group(fs, inode_index);
-    // Get the block offest.
-    uint32_t block = ext2_get_block_index_from_inode_offset(fs, offset);
-    // Get the real inode offset inside the block.
-    offset %= fs->inodes_per_block_count;
-    // Allocate the cache.
-    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
-    // Clean the cache.
-    memset(cache, 0, fs->block_size);
-    // Read the block containing the inode table.
-    ext2_read_block(fs, fs->block_groups[group_index].inode_table + block, cache);
-    // Write the inode.
-    memcpy((ext2_inode_t *)((uintptr_t)cache + (offset * fs->superblock.inode_size)), inode, fs->superblock.inode_size);
-    // Write back the block.
-    ext2_write_block(fs, fs->block_groups[group_index].inode_table + block, cache);
-    // Free the cache.
-    kmem_cache_free(cache);
+    // Forget the cached extent if a block which was mapped moved (e.g., the
+    // inode has been reused), growing the file does not affect it.
+    uint32_t *old_blocks = (uint32_t *)&cached->inode.data.blocks, *new_blocks = (uint32_t *)&inode->data.blocks;
+    for (uint32_t i = 0; (i < (sizeof(inode->data.blocks) / sizeof(uint32_t))) && cached->map_count; ++i)
+        if (old_blocks[i] && (old_blocks[i] != new_blocks[i]))
+            cached->map_count = 0;
+    memcpy(&cached->inode, inode, sizeof(ext2_inode_t));
+    if (!cached->dirty)
+        ++fs->nr_dirty_inodes;
+    cached->dirty = 1;
     return 0;
 }
 
@@ -1001,86 +1472,162 @@ static int ext2_allocate_inode(ext2_filesystem_t *fs, unsigned preferred_group)
     uint32_t group_index = 0, linear_index = 0, inode_index = 0;
     // Lock the filesystem.
     spinlock_lock(&fs->spinlock);
-    // Allocate the cache.
-    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
-    // Clean the cache.
-    memset(cache, 0, fs->block_size);
     // Search for a free inode.
-    if (!ext2_find_free_inode(fs, cache, &group_index, &linear_index, preferred_group)) {
+    if (!ext2_find_free_inode(fs, &group_index, &linear_index, preferred_group)) {
         pr_warning("Failed to find a free inode.\n");
         // Unlock the filesystem.
         spinlock_unlock(&fs->spinlock);
-        // Free the cache.
-        kmem_cache_free(cache);
         return 0;
     }
     // Compute the inode index.
     inode_index = (group_index * fs->superblock.inodes_per_group) + linear_index + 1U;
-    // Set the inode as occupied.
-    ext2_set_bitmap_bit(cache, linear_index, ext2_block_status_occupied);
-    // Write back the inode bitmap.
-    ext2_write_block(fs, fs->block_groups[group_index].inode_bitmap, cache);
-    // Free the cache.
-    kmem_cache_free(cache);
-    // Reduce the number of free inodes.
+    // Set the inode as occupied, the next search starts right after it.
+    ext2_group_cache_t *group = &fs->group_cache[group_index];
+    ext2_set_bitmap_bit(group->inode_bitmap, linear_index, ext2_block_status_occupied);
+    group->inode_hint = linear_index + 1U;
+    group->inode_bitmap_dirty = 1;
+    // Reduce the number of free inodes, inside both the BGDT and the
+    // superblock. They are staged by ext2_stage_filesystem.
     fs->block_groups[group_index].free_inodes_count -= 1;
-    // Update the bgdt.
-    ext2_write_bgdt(fs);
-    // Reduce the number of inodes inside the superblock.
     fs->superblock.free_inodes_count -= 1;
-    // Update the superblock.
-    ext2_write_superblock(fs);
+    fs->bgdt_dirty       = 1;
+    fs->superblock_dirty = 1;
     // Unlock the filesystem.
     spinlock_unlock(&fs->spinlock);
     // Return the inode.
     return inode_index;
 }
 
-/// @brief Allocates a new block.
+/// @brief Allocates a run of contiguous blocks.
 /// @param fs the filesystem.
-/// @return 0 on failure, or the index of the new block on success.
-static uint32_t ext2_allocate_block(ext2_filesystem_t *fs)
+/// @param goal the block we would like to get first, 0 if we have no preference.
+/// @param count the maximum number of blocks we want.
+/// @param allocated where we store the number of blocks we got, which might
+/// be less than count if the blocks after the first one are in use.
+/// @return 0 on failure, or the index of the first block on success.
+static uint32_t ext2_allocate_blocks(ext2_filesystem_t *fs, uint32_t goal, uint32_t count, uint32_t *allocated)
 {
-    uint32_t group_index = 0, linear_index = 0, block_index = 0;
+    uint32_t group_index = 0, linear_index = 0, block_index = 0, run = 1;
     // Lock the filesystem.
     spinlock_lock(&fs->spinlock);
-    // Allocate the cache.
-    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
-    // Clean the cache.
-    memset(cache, 0, fs->block_size);
     // Search for a free block.
-    if (!ext2_find_free_block(fs, cache, &group_index, &linear_index)) {
+    if (!ext2_find_free_block(fs, goal, &group_index, &linear_index)) {
         pr_warning("Failed to find a free block.\n");
         // Unlock the filesystem.
         spinlock_unlock(&fs->spinlock);
-        // Free the cache.
-        kmem_cache_free(cache);
         return 0;
     }
-    // Compute the block index.
-    block_index = (group_index * fs->superblock.blocks_per_group) + linear_index;
-    // Set the block as occupied.
-    ext2_set_bitmap_bit(cache, linear_index, ext2_block_status_occupied);
-    // Update the bitmap.
-    ext2_write_block(fs, fs->block_groups[group_index].block_bitmap, cache);
-    // Decrease the number of free blocks inside the BGDT entry.
-    fs->block_groups[group_index].free_blocks_count -= 1;
-    // Update the BGDT.
-    ext2_write_bgdt(fs);
-    // Decrease the number of free blocks inside the superblock.
-    fs->superblock.free_blocks_count -= 1;
-    // Update the superblock.
-    ext2_write_superblock(fs);
-    // Empty out the new block.
-    memset(cache, 0, fs->block_size);
-    ext2_write_block(fs, block_index, cache);
-    // Free the cache.
-    kmem_cache_free(cache);
+    // Compute the block index, the first bit of the bitmap of group 0 is the
+    // first data block.
+    block_index = fs->superblock.first_data_block + (group_index * fs->superblock.blocks_per_group) + linear_index;
+    // Extend the run with the free blocks which follow.
+    ext2_group_cache_t *group = &fs->group_cache[group_index];
+    uint32_t limit            = min(ext2_get_blocks_in_group(fs, group_index), linear_index + count);
+    while (((linear_index + run) < limit) && !ext2_check_bitmap_bit(group->block_bitmap, linear_index + run))
+        ++run;
+    // Set the blocks as occupied, the next search starts right after them.
+    for (uint32_t i = 0; i < run; ++i)
+        ext2_set_bitmap_bit(group->block_bitmap, linear_index + i, ext2_block_status_occupied);
+    group->block_hint         = linear_index + run;
+    group->block_bitmap_dirty = 1;
+    // Decrease the number of free blocks, inside both the BGDT and the
+    // superblock. They are staged by ext2_stage_filesystem.
+    fs->block_groups[group_index].free_blocks_count -= run;
+    fs->superblock.free_blocks_count -= run;
+    fs->bgdt_dirty       = 1;
+    fs->superblock_dirty = 1;
     // Unlock the spinlock.
     spinlock_unlock(&fs->spinlock);
+    *allocated = run;
     return block_index;
 }
 
+/// @brief Releases a run of contiguous blocks, which must belong to the same group.
+/// @param fs the filesystem.
+/// @param block_index the first block.
+/// @param count the number of blocks.
+static void ext2_free_blocks(ext2_filesystem_t *fs, uint32_t block_index, uint32_t count)
+{
+    uint32_t group_index  = (block_index - fs->superblock.first_data_block) / fs->superblock.blocks_per_group;
+    uint32_t linear_index = (block_index - fs->superblock.first_data_block) % fs->superblock.blocks_per_group;
+    ext2_group_cache_t *group = &fs->group_cache[group_index];
+    // Lock the filesystem.
+    spinlock_lock(&fs->spinlock);
+    if (ext2_get_cached_bitmap(fs, &group->block_bitmap, fs->block_groups[group_index].block_bitmap) == NULL) {
+        pr_err("Failed to read the block bitmap for group `%d`.\n", group_index);
+        spinlock_unlock(&fs->spinlock);
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i)
+        ext2_set_bitmap_bit(group->block_bitmap, linear_index + i, ext2_block_status_free);
+    group->block_hint         = min(group->block_hint, linear_index);
+    group->block_bitmap_dirty = 1;
+    fs->block_groups[group_index].free_blocks_count += count;
+    fs->superblock.free_blocks_count += count;
+    fs->bgdt_dirty       = 1;
+    fs->superblock_dirty = 1;
+    // Unlock the spinlock.
+    spinlock_unlock(&fs->spinlock);
+}
+
+/// @brief Fills a block with zeros.
+/// @param fs the filesystem.
+/// @param block_index the block.
+static void ext2_zero_block(ext2_filesystem_t *fs, uint32_t block_index)
+{
+    // The old content is not needed, so there is no need to read it.
+    buffer_head_t *bh = buffer_get(fs->block_device, block_index, fs->block_size);
+    if (bh) {
+        memset(bh->data, 0, fs->block_size);
+        buffer_mark_dirty(bh);
+        buffer_release(bh);
+    }
+}
+
+/// @brief Allocates a new block.
+/// @param fs the filesystem.
+/// @param goal the block we would like to get, 0 if we have no preference.
+/// @param zero 1 if the block must be filled with zeros, 0 if the caller is
+/// going to overwrite all of it.
+/// @return 0 on failure, or the index of the new block on success.
+static uint32_t ext2_allocate_block(ext2_filesystem_t *fs, uint32_t goal, int zero)
+{
+    uint32_t allocated;
+    uint32_t block_index = ext2_allocate_blocks(fs, goal, 1, &allocated);
+    if (block_index && zero)
+        ext2_zero_block(fs, block_index);
+    return block_index;
+}
+
+/// @brief Releases the blocks left inside the preallocation window of an inode.
+/// @param fs the filesystem.
+/// @param cached the cached inode.
+/// @return 1 if some block was released, 0 otherwise.
+static int ext2_discard_prealloc(ext2_filesystem_t *fs, ext2_cached_inode_t *cached)
+{
+    if (cached->prealloc_count == 0)
+        return 0;
+    ext2_free_blocks(fs, cached->prealloc_block, cached->prealloc_count);
+    cached->prealloc_block = 0;
+    cached->prealloc_count = 0;
+    return 1;
+}
+
+/// @brief Reserves a new preallocation window to an inode, dropping the old one.
+/// @param fs the filesystem.
+/// @param cached the cached inode.
+/// @param goal where the window should start.
+/// @param count the number of blocks we want to reserve.
+static void ext2_reserve_window(ext2_filesystem_t *fs, ext2_cached_inode_t *cached, uint32_t goal, uint32_t count)
+{
+    // Release the old window first, so that the new one can overlap it.
+    ext2_discard_prealloc(fs, cached);
+    count = min(max(count, EXT2_PREALLOC_BLOCKS), EXT2_PREALLOC_MAX);
+    cached->prealloc_block = ext2_allocate_blocks(fs, goal, count, &cached->prealloc_count);
+    if (cached->prealloc_block == 0)
+        cached->prealloc_count = 0;
+}
+
 /// @brief Sets the real block index based on the block index inside an inode.
 /// @param fs the filesystem.
 /// @param inode the inode which we are working with.
@@ -1089,6 +1636,15 @@ static uint32_t ext2_allocate_block(ext2_filesystem_t *fs)
 /// @return 0 on success, a negative value on failure.
 static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index, uint32_t real_index)
 {
+    // Keep the extent cached inside the inode coherent, extending it when the
+    // new block follows it both inside the file and on disk.
+    ext2_cached_inode_t *cached = ext2_lookup_inode(fs, inode_index);
+    if (cached && cached->map_count) {
+        if ((block_index == (cached->map_block + cached->map_count)) && (real_index == (cached->map_real + cached->map_count)))
+            ++cached->map_count;
+        else if ((block_index >= cached->map_block) && (block_index < (cached->map_block + cached->map_count)))
+            cached->map_count = 0;
+    }
     // Set the direct block pointer.
     if (block_index < EXT2_INDIRECT_BLOCKS) {
         inode->data.blocks.dir_blocks[block_index] = real_index;
@@ -1103,7 +1659,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Check that the indirect block points to a valid block.
         if (!inode->data.blocks.indir_block) {
             // Allocate a new block.
-            uint32_t new_block_index = ext2_allocate_block(fs);
+            uint32_t new_block_index = ext2_allocate_block(fs, real_index, 1);
             if (new_block_index == 0)
                 return -1;
             // Update the index.
@@ -1122,7 +1678,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Write the index inside the final block.
         ((uint32_t *)cache)[a] = real_index;
         // Write back the indirect block.
-        ext2_read_block(fs, inode->data.blocks.indir_block, cache);
+        ext2_write_block(fs, inode->data.blocks.indir_block, cache);
         // Free the cache.
         kmem_cache_free(cache);
         return 0;
@@ -1142,7 +1698,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Check that the indirect block points to a valid block.
         if (!inode->data.blocks.doubly_indir_block) {
             // Allocate a new block.
-            uint32_t new_block_index = ext2_allocate_block(fs);
+            uint32_t new_block_index = ext2_allocate_block(fs, real_index, 1);
             if (new_block_index == 0)
                 return -1;
             // Update the index.
@@ -1162,7 +1718,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Check that the indirect block points to a valid block.
         if (!((uint32_t *)cache)[c]) {
             // Allocate a new block.
-            uint32_t new_block_index = ext2_allocate_block(fs);
+            uint32_t new_block_index = ext2_allocate_block(fs, real_index, 1);
             if (new_block_index == 0) {
                 // Free the cache.
                 kmem_cache_free(cache);
@@ -1174,12 +1730,13 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
             ext2_write_block(fs, inode->data.blocks.doubly_indir_block, cache);
         }
 
-        // Compute the index inside the indirect block.
-        ext2_read_block(fs, ((uint32_t *)cache)[c], cache);
+        // Read the indirect block, saving its index first.
+        uint32_t indirect_block = ((uint32_t *)cache)[c];
+        ext2_read_block(fs, indirect_block, cache);
         // Write the index inside the final block.
         ((uint32_t *)cache)[d] = real_index;
         // Write back the indirect block.
-        ext2_read_block(fs, ((uint32_t *)cache)[c], cache);
+        ext2_write_block(fs, indirect_block, cache);
         // Free the cache.
         kmem_cache_free(cache);
         return 0;
@@ -1200,7 +1757,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Check that the indirect block points to a valid block.
         if (!inode->data.blocks.trebly_indir_block) {
             // Allocate a new block.
-            uint32_t new_block_index = ext2_allocate_block(fs);
+            uint32_t new_block_index = ext2_allocate_block(fs, real_index, 1);
             if (new_block_index == 0)
                 return -1;
             // Update the index.
@@ -1220,7 +1777,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Check that the indirect block points to a valid block.
         if (!((uint32_t *)cache)[d]) {
             // Allocate a new block.
-            uint32_t new_block_index = ext2_allocate_block(fs);
+            uint32_t new_block_index = ext2_allocate_block(fs, real_index, 1);
             if (new_block_index == 0) {
                 // Free the cache.
                 kmem_cache_free(cache);
@@ -1239,7 +1796,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Check that the indirect block points to a valid block.
         if (!((uint32_t *)cache)[f]) {
             // Allocate a new block.
-            uint32_t new_block_index = ext2_allocate_block(fs);
+            uint32_t new_block_index = ext2_allocate_block(fs, real_index, 1);
             if (new_block_index == 0) {
                 // Free the cache.
                 kmem_cache_free(cache);
@@ -1258,7 +1815,7 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
         // Write the index inside the final block.
         ((uint32_t *)cache)[g] = real_index;
         // Write back the indirect block.
-        ext2_read_block(fs, block_index_save, cache);
+        ext2_write_block(fs, block_index_save, cache);
         // Free the cache.
         kmem_cache_free(cache);
         return 0;
@@ -1267,87 +1824,180 @@ static int ext2_set_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode,
     return -1;
 }
 
-/// @brief Returns the real block index starting from a block index inside an inode.
+/// @brief Finds the slot of the block map pointing to a block of an inode.
 /// @param fs the filesystem.
 /// @param inode the inode which we are working with.
 /// @param block_index the block index inside the inode.
-/// @return the real block number.
-static uint32_t ext2_get_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t block_index)
+/// @param bh where we store the buffer of the indirect block containing the
+/// slot, NULL if the slot is inside the inode. It must be released.
+/// @param slots where we store the number of slots from the returned one to
+/// the end of the array containing it.
+/// @return a pointer to the slot, NULL if the block is not mapped.
+static uint32_t *ext2_get_block_slot(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t block_index, buffer_head_t **bh, uint32_t *slots)
 {
-    // Return the direct block pointer.
+    uint32_t p1 = fs->pointers_per_block, p2 = fs->pointers_per_block * fs->pointers_per_block;
+    uint32_t path[3], depth, block;
+    *bh = NULL;
+    // The direct blocks are inside the inode.
     if (block_index < EXT2_INDIRECT_BLOCKS) {
-        return inode->data.blocks.dir_blocks[block_index];
-    }
-    // Create a variable for the real index.
-    uint32_t real_index = 0;
-    // For simplicity.
-    uint32_t p1 = fs->pointers_per_block;
-    uint32_t p2 = fs->pointers_per_block * fs->pointers_per_block;
-    // Allocate the cache.
-    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
-    // Clean the cache.
-    memset(cache, 0, fs->block_size);
-    // Check if the index is among the indirect blocks.
-    if (block_index < fs->indirect_blocks_index) {
-        // Compute the indirect indices.
-        uint32_t a = block_index - EXT2_INDIRECT_BLOCKS;
-        // Read the indirect block (which contains pointers to the next set of blocks).
-        ext2_read_block(fs, inode->data.blocks.indir_block, cache);
-        // Compute the index inside the final block.
-        real_index = ((uint32_t *)cache)[a];
-    } else if (block_index < fs->doubly_indirect_blocks_index) {
-        // The index is among the doubly-indirect blocks.
-        // Compute the indirect indices.
-        uint32_t a = block_index - EXT2_INDIRECT_BLOCKS;
-        uint32_t b = a - p1;
-        uint32_t c = b / p1;
-        uint32_t d = b - (c * p1);
-        // Read the doubly-indirect block (which contains pointers to indirect blocks).
-        ext2_read_block(fs, inode->data.blocks.doubly_indir_block, cache);
-        // Compute the index inside the indirect block.
-        ext2_read_block(fs, ((uint32_t *)cache)[c], cache);
-        // Compute the index inside the final block.
-        real_index = ((uint32_t *)cache)[d];
-    } else if (block_index < fs->trebly_indirect_blocks_index) {
-        // The index is among the trebly-indirect blocks.
-        // Compute the indirect indices.
-        uint32_t a = block_index - EXT2_INDIRECT_BLOCKS;
-        uint32_t b = a - p1;
-        uint32_t c = b - p2;
-        uint32_t d = c / p2;
-        uint32_t e = c - (d * p2);
-        uint32_t f = e / p1;
-        uint32_t g = e - (f * p1);
-        // Read the trebly-indirect block (which contains pointers to doubly-indirect blocks).
-        ext2_read_block(fs, inode->data.blocks.trebly_indir_block, cache);
-        // Read the doubly-indirect block (which contains pointers to indirect blocks).
-        ext2_read_block(fs, ((uint32_t *)cache)[d], cache);
-        // Read the indirect block (which contains pointers to the next set of blocks).
-        ext2_read_block(fs, ((uint32_t *)cache)[f], cache);
-        // Compute the index inside the final block.
-        real_index = ((uint32_t *)cache)[g];
+        *slots = EXT2_INDIRECT_BLOCKS - block_index;
+        return &inode->data.blocks.dir_blocks[block_index];
+    }
+    // Compute the path through the indirect blocks.
+    block_index -= EXT2_INDIRECT_BLOCKS;
+    if (block_index < p1) {
+        block   = inode->data.blocks.indir_block;
+        path[0] = block_index;
+        depth   = 1;
+    } else if ((block_index -= p1) < p2) {
+        block   = inode->data.blocks.doubly_indir_block;
+        path[0] = block_index / p1;
+        path[1] = block_index % p1;
+        depth   = 2;
+    } else if ((block_index -= p2) < (p2 * p1)) {
+        block   = inode->data.blocks.trebly_indir_block;
+        path[0] = block_index / p2;
+        path[1] = (block_index % p2) / p1;
+        path[2] = block_index % p1;
+        depth   = 3;
     } else {
-        pr_err("We failed to retrieve the real block number of the block with index `%d`\n", block_index);
+        pr_err("The block index is beyond the trebly-indirect blocks.\n");
+        return NULL;
     }
-    // Free the cache.
-    kmem_cache_free(cache);
-    // Return the real index.
+    // Walk through the indirect blocks, straight from the buffer cache.
+    for (uint32_t level = 0; block != 0; ++level) {
+        *bh = buffer_read(fs->block_device, block, fs->block_size);
+        if (*bh == NULL)
+            return NULL;
+        uint32_t *pointers = (uint32_t *)(*bh)->data;
+        if (level == (depth - 1)) {
+            *slots = p1 - path[level];
+            return &pointers[path[level]];
+        }
+        block = pointers[path[level]];
+        buffer_release(*bh);
+        *bh = NULL;
+    }
+    return NULL;
+}
+
+/// @brief Maps a run of blocks of an inode, which are contiguous on disk.
+/// @param fs the filesystem.
+/// @param inode the inode which we are working with.
+/// @param block_index the first block index inside the inode.
+/// @param count the maximum number of blocks we want to map.
+/// @param real_index where we store the real block number of the first block.
+/// @return the number of blocks mapped, 0 if the first one is not mapped.
+static uint32_t ext2_map_blocks(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t block_index, uint32_t count, uint32_t *real_index)
+{
+    buffer_head_t *bh;
+    uint32_t slots, mapped = 0;
+    uint32_t *slot = ext2_get_block_slot(fs, inode, block_index, &bh, &slots);
+    if (slot && (*slot != 0)) {
+        // The run cannot go beyond the array of pointers containing the slot.
+        *real_index = slot[0];
+        mapped      = 1;
+        while ((mapped < min(count, slots)) && (slot[mapped] == (*real_index + mapped)))
+            ++mapped;
+    }
+    if (bh)
+        buffer_release(bh);
+    return mapped;
+}
+
+/// @brief Returns the real block index starting from a block index inside an inode.
+/// @param fs the filesystem.
+/// @param inode the inode which we are working with.
+/// @param block_index the block index inside the inode.
+/// @return the real block number.
+static uint32_t ext2_get_real_block_index(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t block_index)
+{
+    uint32_t real_index;
+    if (ext2_map_blocks(fs, inode, block_index, 1, &real_index) == 0)
+        return 0;
     return real_index;
 }
 
+/// @brief Maps a run of blocks of an inode, which are contiguous on disk,
+/// going through the extent cached inside the inode.
+/// @param fs the filesystem.
+/// @param inode the inode which we are working with.
+/// @param inode_index The index of the inode.
+/// @param block_index the first block index inside the inode.
+/// @param count the maximum number of blocks we want to map.
+/// @param real_index where we store the real block number of the first block.
+/// @return the number of blocks mapped, 0 if the first one is not mapped.
+static uint32_t ext2_get_blocks(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index, uint32_t count, uint32_t *real_index)
+{
+    uint32_t allocated = inode->blocks_count / fs->blocks_per_block_count;
+    if (block_index >= allocated)
+        return 0;
+    ext2_cached_inode_t *cached = ext2_lookup_inode(fs, inode_index);
+    if (cached == NULL)
+        return ext2_map_blocks(fs, inode, block_index, count, real_index);
+    if ((block_index < cached->map_block) || (block_index >= (cached->map_block + cached->map_count))) {
+        // Map as much as we can, the following calls will likely need it.
+        cached->map_count = ext2_map_blocks(fs, inode, block_index, allocated - block_index, &cached->map_real);
+        cached->map_block = block_index;
+        if (cached->map_count == 0)
+            return 0;
+    }
+    *real_index = cached->map_real + (block_index - cached->map_block);
+    return min(count, cached->map_count - (block_index - cached->map_block));
+}
+
+/// @brief Chooses the block we would like to allocate for an inode.
+/// @param fs the filesystem.
+/// @param inode the inode which we are working with.
+/// @param inode_index The index of the inode.
+/// @param block_index The index of the block within the inode.
+/// @return the goal block.
+static uint32_t ext2_find_goal(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index)
+{
+    // Right after the previous block of the file, if there is one.
+    if ((block_index > 0) && ((block_index - 1) < (inode->blocks_count / fs->blocks_per_block_count))) {
+        uint32_t previous = ext2_get_real_block_index(fs, inode, block_index - 1);
+        if (previous != 0)
+            return previous + 1;
+    }
+    // Otherwise, inside the group of the inode.
+    return fs->superblock.first_data_block + ext2_get_group_index_from_inode(fs, inode_index) * fs->superblock.blocks_per_group;
+}
+
 /// @brief Allocate a new block for an inode.
 /// @param fs the filesystem.
 /// @param inode the inode which we are working with.
 /// @param inode_index The index of the inode.
 /// @param block_index The index of the block within the inode.
+/// @param zero 1 if the block must be filled with zeros, 0 if the caller is
+/// going to overwrite all of it.
 /// @return 0 on success, -1 on failure.
-static int ext2_allocate_inode_block(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index)
+/// @details
+/// Regular files take their blocks from a preallocation window, a run of
+/// contiguous blocks reserved right after their last block, so that files
+/// growing at the same time do not interleave on disk.
+static int ext2_allocate_inode_block(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index, int zero)
 {
     pr_debug("Allocating block with index `%d` for inode with index `%d`.\n", block_index, inode_index);
+    uint32_t goal       = ext2_find_goal(fs, inode, inode_index, block_index);
+    uint32_t real_index = 0;
+    ext2_cached_inode_t *cached = ext2_lookup_inode(fs, inode_index);
+    if (cached && ((inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG)) {
+        // The window is useful only if it continues the file.
+        if ((cached->prealloc_count == 0) || (cached->prealloc_block != goal))
+            ext2_reserve_window(fs, cached, goal, EXT2_PREALLOC_BLOCKS);
+        if (cached->prealloc_count > 0) {
+            real_index = cached->prealloc_block++;
+            --cached->prealloc_count;
+        }
+    }
     // Allocate the block.
-    int real_index = ext2_allocate_block(fs);
-    if (real_index == -1)
+    if (real_index == 0)
+        real_index = ext2_allocate_block(fs, goal, 0);
+    if (real_index == 0)
         return -1;
+    if (zero)
+        ext2_zero_block(fs, real_index);
     // Associate the real index and the index inside the inode.
     if (ext2_set_real_block_index(fs, inode, inode_index, block_index, real_index) == -1)
         return -1;
@@ -1384,6 +2034,26 @@ static ssize_t ext2_read_inode_block(ext2_filesystem_t *fs, ext2_inode_t *inode,
     return ext2_read_block(fs, real_index, buffer);
 }
 
+/// @brief Gets the real block of an inode which we are going to write,
+/// allocating it, and the holes before it, if needed.
+/// @param fs the filesystem.
+/// @param inode the inode which we are working with.
+/// @param inode_index The index of the inode.
+/// @param block_index the index of the block within the inode.
+/// @param zero if a new block must read as zeros, since we are not going to
+/// overwrite all of it.
+/// @return the real index of the block, 0 on failure.
+static uint32_t ext2_map_inode_block(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index, int zero)
+{
+    while (block_index >= (inode->blocks_count / fs->blocks_per_block_count)) {
+        uint32_t next = inode->blocks_count / fs->blocks_per_block_count;
+        // Only the holes before the block we are writing must read as zeros.
+        if (ext2_allocate_inode_block(fs, inode, inode_index, next, zero || (next != block_index)) == -1)
+            return 0;
+    }
+    return ext2_get_real_block_index(fs, inode, block_index);
+}
+
 /// @brief Writes the real block starting from an inode and the block index inside the inode.
 /// @param fs the filesystem.
 /// @param inode the inode which we are working with.
@@ -1393,12 +2063,8 @@ static ssize_t ext2_read_inode_block(ext2_filesystem_t *fs, ext2_inode_t *inode,
 /// @return the amount of data we wrote, or negative value for an error.
 static ssize_t ext2_write_inode_block(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index, uint8_t *buffer)
 {
-    while (block_index >= (inode->blocks_count / fs->blocks_per_block_count)) {
-        ext2_allocate_inode_block(fs, inode, inode_index, (inode->blocks_count / fs->blocks_per_block_count));
-        ext2_write_inode(fs, inode, inode_index);
-    }
-    // Get the real index.
-    uint32_t real_index = ext2_get_real_block_index(fs, inode, block_index);
+    // Get the real index, the whole block is overwritten.
+    uint32_t real_index = ext2_map_inode_block(fs, inode, inode_index, block_index, 0);
     if (real_index == 0)
         return -1;
     // Write the block.
@@ -1415,8 +2081,8 @@ static ssize_t ext2_write_inode_block(ext2_filesystem_t *fs, ext2_inode_t *inode
 /// @return the amount we read.
 static ssize_t ext2_read_inode_data(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, off_t offset, size_t nbyte, char *buffer)
 {
-    // Check if the file is empty.
-    if (inode->size == 0)
+    // Check if there is something to read.
+    if ((uint32_t)offset >= inode->size)
         return 0;
 
     uint32_t end;
@@ -1426,56 +2092,105 @@ static ssize_t ext2_read_inode_data(ext2_filesystem_t *fs, ext2_inode_t *inode,
         end = offset + nbyte;
     }
     uint32_t start_block  = offset / fs->block_size;
-    uint32_t end_block    = end / fs->block_size;
-    uint32_t end_size     = end - end_block * fs->block_size;
+    uint32_t last_block   = (end - 1) / fs->block_size;
     uint32_t size_to_read = end - offset;
 
-    // Allocate the cache.
-    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
-    // Clean the cache.
-    memset(cache, 0, fs->block_size);
-
-    if (start_block == end_block) {
-        // Read the real block.
-        if (ext2_read_inode_block(fs, inode, start_block, cache) == -1) {
-            pr_err("Failed to read the inode block `%d`\n", start_block);
-            goto free_cache_return_error;
+    // The blocks are mapped a run at a time, and copied straight from the
+    // buffer cache.
+    uint32_t real_index = 0, mapped = 0, copied = 0;
+    for (uint32_t block_index = start_block; block_index <= last_block; ++block_index) {
+        if (mapped == 0) {
+            mapped = ext2_get_blocks(fs, inode, inode_index, block_index, last_block - block_index + 1, &real_index);
+            if (mapped == 0) {
+                pr_err("Failed to map the inode block `%d`\n", block_index);
+                return -1;
+            }
         }
-        // Copy the content back to the buffer.
-        memcpy(buffer, (uint8_t *)(((uintptr_t)cache) + ((uintptr_t)offset % fs->block_size)), size_to_read);
+        buffer_head_t *bh = buffer_read(fs->block_device, real_index, fs->block_size);
+        if (bh == NULL) {
+            pr_err("Failed to read the inode block `%d`\n", block_index);
+            return -1;
+        }
+        uint32_t block_offset = (block_index == start_block) ? (offset % fs->block_size) : 0;
+        uint32_t chunk        = min(fs->block_size - block_offset, size_to_read - copied);
+        memcpy(buffer + copied, bh->data + block_offset, chunk);
+        buffer_release(bh);
+        copied += chunk;
+        ++real_index;
+        --mapped;
+    }
+    return size_to_read;
+}
+
+/// @brief Reads in advance the blocks of a file, a run of contiguous blocks
+/// at a time.
+/// @param fs the filesystem.
+/// @param inode the inode which we are working with.
+/// @param inode_index the index of the inode.
+/// @param block_index the first block.
+/// @param count the number of blocks.
+static void ext2_readahead_blocks(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t block_index, uint32_t count)
+{
+    uint32_t real_index, end = block_index + count;
+    while (block_index < end) {
+        uint32_t mapped = ext2_get_blocks(fs, inode, inode_index, block_index, end - block_index, &real_index);
+        if (mapped == 0)
+            break;
+        if (buffer_read_ahead(fs->block_device, real_index, mapped, fs->block_size) < 0)
+            break;
+        block_index += mapped;
+    }
+}
+
+/// @brief Updates the readahead state of an opened file, and reads in
+/// advance the blocks which will likely be needed by the following reads.
+/// @param fs the filesystem.
+/// @param file the opened file.
+/// @param inode the inode of the file.
+/// @param offset the offset of the read.
+/// @param nbyte the number of bytes of the read.
+/// @details
+/// A read which starts from the beginning of the file, or right where the
+/// previous one stopped, is sequential: it opens a window of
+/// EXT2_READAHEAD_MIN blocks (or as large as the read) after the blocks it
+/// needs. When a sequential reader enters the last async_size blocks of the
+/// window, the next window, twice as large up to EXT2_READAHEAD_MAX, is read.
+/// Any other read closes the window.
+static void ext2_readahead(ext2_filesystem_t *fs, vfs_file_t *file, ext2_inode_t *inode, off_t offset, size_t nbyte)
+{
+    file_ra_state_t *ra = &file->ra;
+    uint32_t allocated  = inode->blocks_count / fs->blocks_per_block_count;
+    if ((nbyte == 0) || ((uint32_t)offset >= inode->size))
+        return;
+    uint32_t first = offset / fs->block_size;
+    uint32_t last  = min((uint32_t)(offset + nbyte - 1), inode->size - 1) / fs->block_size;
+    bool_t sequential = (first == 0) || (first == ra->prev_block) || (first == (ra->prev_block + 1));
+    ra->prev_block = last;
+    if (!sequential) {
+        ra->size = 0;
+        return;
+    }
+    uint32_t start, size;
+    if ((ra->size == 0) || (first >= (ra->start + ra->size))) {
+        // Open a new window, covering the read and the blocks after it.
+        start = first;
+        size  = min(max(2 * (last - first + 1), EXT2_READAHEAD_MIN), EXT2_READAHEAD_MAX);
+        size  = max(size, last - first + 1);
+    } else if (last >= (ra->start + ra->size - ra->async_size)) {
+        // The reader reached the end of the window, move to the next one.
+        start = ra->start + ra->size;
+        size  = min(2 * ra->size, EXT2_READAHEAD_MAX);
+        if (last >= start)
+            size = max(size, last + 1 - start);
     } else {
-        uint32_t block_offset;
-        uint32_t blocks_read = 0;
-        for (block_offset = start_block; block_offset < end_block; block_offset++, blocks_read++) {
-            // Read the real block.
-            if (ext2_read_inode_block(fs, inode, block_offset, cache) == -1) {
-                pr_err("Failed to read the inode block `%d`\n", block_offset);
-                goto free_cache_return_error;
-            }
-            // Copy the content back to the buffer.
-            if (block_offset == start_block) {
-                memcpy(buffer, (uint8_t *)(((uintptr_t)cache) + ((uintptr_t)offset % fs->block_size)), fs->block_size - (offset % fs->block_size));
-            } else {
-                memcpy(buffer + fs->block_size * blocks_read - (offset % fs->block_size), cache, fs->block_size);
-            }
-        }
-        if (end_size) {
-            // Read the real block.
-            if (ext2_read_inode_block(fs, inode, end_block, cache) == -1) {
-                pr_err("Failed to read the inode block `%d`\n", block_offset);
-                goto free_cache_return_error;
-            }
-            // Copy the content back to the buffer.
-            memcpy(buffer + fs->block_size * blocks_read - (offset % fs->block_size), cache, end_size);
-        }
+        return;
     }
-    // Free the cache.
-    kmem_cache_free(cache);
-    return size_to_read;
-free_cache_return_error:
-    // Free the cache.
-    kmem_cache_free(cache);
-    return -1;
+    // The blocks of the window not needed by this read are read in advance.
+    ra->start      = start;
+    ra->size       = size;
+    ra->async_size = (last >= start) ? (size - (last + 1 - start)) : size;
+    if (start < allocated)
+        ext2_readahead_blocks(fs, inode, file->ino, start, min(size, allocated - start));
 }
 
 /// @brief Writes the data on the given inode.
@@ -1493,60 +2208,32 @@ static ssize_t ext2_write_inode_data(ext2_filesystem_t *fs, ext2_inode_t *inode,
         inode->size = end;
     }
     uint32_t start_block   = offset / fs->block_size;
-    uint32_t end_block     = end / fs->block_size;
-    uint32_t end_size      = end - end_block * fs->block_size;
     uint32_t size_to_write = end - offset;
 
-    // Allocate the cache.
-    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
-    // Clean the cache.
-    memset(cache, 0, fs->block_size);
-
-    if (start_block == end_block) {
-        // Read the real block, if we fail is not a problem.
-        ext2_read_inode_block(fs, inode, start_block, cache);
-        // Copy the content back to the buffer.
-        memcpy((uint8_t *)(((uintptr_t)cache) + ((uintptr_t)offset % fs->block_size)), buffer, size_to_write);
-        // Write the block back.
-        if (!ext2_write_inode_block(fs, inode, inode_index, start_block, cache)) {
-            pr_err("Failed to write the inode block `%d`\n", start_block);
-            goto free_cache_return_error;
-        }
-    } else {
-        uint32_t block_offset, blocks_read = 0;
-        for (block_offset = start_block; block_offset < end_block; ++block_offset, ++blocks_read) {
-            // Read the real block, if we fail is not a problem.
-            ext2_read_inode_block(fs, inode, block_offset, cache);
-            if (block_offset == start_block) {
-                // Copy the content back to the buffer.
-                memcpy((uint8_t *)(((uintptr_t)cache) + ((uintptr_t)offset % fs->block_size)), buffer, fs->block_size - (offset % fs->block_size));
-            } else {
-                // Copy the content back to the buffer.
-                memcpy(cache, buffer + fs->block_size * blocks_read - (offset % fs->block_size), fs->block_size);
-            }
-            // Write the block back.
-            if (!ext2_write_inode_block(fs, inode, inode_index, block_offset, cache)) {
-                pr_err("Failed to write the inode block `%d`\n", start_block);
-                goto free_cache_return_error;
-            }
-        }
-        if (end_size) {
-            // Read the real block, if we fail is not a problem.
-            ext2_read_inode_block(fs, inode, end_block, cache);
-            // Copy the content back to the buffer.
-            memcpy(cache, buffer + fs->block_size * blocks_read - (offset % fs->block_size), end_size);
-            // Write the block back.
-            if (ext2_write_inode_block(fs, inode, inode_index, end_block, cache)) {
-                pr_err("Failed to write the inode block `%d`\n", start_block);
-                goto free_cache_return_error;
-            }
+    // Reserve, at once, a contiguous run for all the blocks the file gains.
+    uint32_t allocated_blocks = inode->blocks_count / fs->blocks_per_block_count;
+    uint32_t last_block       = (end - 1) / fs->block_size;
+    ext2_cached_inode_t *cached = ext2_lookup_inode(fs, inode_index);
+    if ((nbyte > 0) && (last_block >= allocated_blocks) && cached && ((inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG)) {
+        uint32_t goal = ext2_find_goal(fs, inode, inode_index, allocated_blocks);
+        if ((cached->prealloc_block != goal) || (cached->prealloc_count < (last_block - allocated_blocks + 1)))
+            ext2_reserve_window(fs, cached, goal, last_block - allocated_blocks + 1);
+    }
+
+    // The data is copied straight inside the buffer cache, a block at a time.
+    uint32_t written = 0;
+    for (uint32_t block_index = start_block; written < size_to_write; ++block_index) {
+        uint32_t block_offset = (block_index == start_block) ? (offset % fs->block_size) : 0;
+        uint32_t chunk        = min(fs->block_size - block_offset, size_to_write - written);
+        // Blocks we only partially overwrite must read as zeros elsewhere.
+        uint32_t real_index = ext2_map_inode_block(fs, inode, inode_index, block_index, chunk < fs->block_size);
+        if ((real_index == 0) || (ext2_stage_block(fs, real_index, block_offset, buffer + written, chunk) < 0)) {
+            pr_err("Failed to write the inode block `%d`\n", block_index);
+            return -1;
         }
+        written += chunk;
     }
     return size_to_write;
-free_cache_return_error:
-    // Free the cache.
-    kmem_cache_free(cache);
-    return -1;
 }
 
 // ============================================================================
@@ -1653,6 +2340,118 @@ static inline bool_t ext2_directory_is_empty(ext2_filesystem_t *fs, uint8_t *cac
 // Directory Entry Management Functions
 // ============================================================================
 
+/// @brief Computes the bucket of a directory entry.
+/// @param fs the filesystem.
+/// @param parent the inode of the directory.
+/// @param name the name of the entry.
+/// @return the bucket of the hash table.
+static inline list_head *ext2_dcache_bucket(ext2_filesystem_t *fs, ino_t parent, const char *name)
+{
+    uint32_t hash = 2166136261U ^ parent;
+    while (*name)
+        hash = (hash ^ (uint8_t)*name++) * 16777619U;
+    return &fs->dentry_hash[hash % EXT2_DENTRY_HASH_BUCKETS];
+}
+
+/// @brief Removes an entry from the directory entry cache.
+/// @param fs the filesystem.
+/// @param dentry the entry.
+static void ext2_dcache_evict(ext2_filesystem_t *fs, ext2_dentry_t *dentry)
+{
+    list_head_del(&dentry->hash);
+    list_head_del(&dentry->lru);
+    --fs->nr_dentries;
+    kmem_cache_free(dentry);
+}
+
+/// @brief Searches a name inside the directory entry cache.
+/// @param fs the filesystem.
+/// @param parent the inode of the directory.
+/// @param name the name of the entry.
+/// @return the cached entry, NULL if it is not cached.
+static ext2_dentry_t *ext2_dcache_lookup(ext2_filesystem_t *fs, ino_t parent, const char *name)
+{
+    list_for_each_decl(it, ext2_dcache_bucket(fs, parent, name))
+    {
+        ext2_dentry_t *dentry = list_entry(it, ext2_dentry_t, hash);
+        if ((dentry->parent == parent) && !strcmp(dentry->name, name)) {
+            // Move it to the front of the LRU list.
+            list_head_del(&dentry->lru);
+            list_head_add(&dentry->lru, &fs->dentry_lru);
+            return dentry;
+        }
+    }
+    return NULL;
+}
+
+/// @brief Adds the result of a lookup to the directory entry cache.
+/// @param fs the filesystem.
+/// @param parent the inode of the directory.
+/// @param name the name of the entry.
+/// @param search the result of the lookup, NULL if the name does not exist.
+static void ext2_dcache_add(ext2_filesystem_t *fs, ino_t parent, const char *name, ext2_direntry_search_t *search)
+{
+    if (strlen(name) >= EXT2_DENTRY_NAME_LEN)
+        return;
+    // Evict the least recently used entry.
+    if (fs->nr_dentries >= EXT2_DENTRY_CACHE_MAX)
+        ext2_dcache_evict(fs, list_entry(fs->dentry_lru.prev, ext2_dentry_t, lru));
+    ext2_dentry_t *dentry = kmem_cache_alloc(ext2_dentry_cache, GFP_KERNEL);
+    if (dentry == NULL)
+        return;
+    memset(dentry, 0, sizeof(ext2_dentry_t));
+    dentry->parent = parent;
+    strcpy(dentry->name, name);
+    if (search) {
+        dentry->ino          = search->direntry->inode;
+        dentry->rec_len      = search->direntry->rec_len;
+        dentry->file_type    = search->direntry->file_type;
+        dentry->block_index  = search->block_index;
+        dentry->block_offset = search->block_offset;
+    }
+    list_head_add(&dentry->hash, ext2_dcache_bucket(fs, parent, name));
+    list_head_add(&dentry->lru, &fs->dentry_lru);
+    ++fs->nr_dentries;
+}
+
+/// @brief Removes a name from the directory entry cache.
+/// @param fs the filesystem.
+/// @param parent the inode of the directory.
+/// @param name the name of the entry.
+static void ext2_dcache_remove(ext2_filesystem_t *fs, ino_t parent, const char *name)
+{
+    ext2_dentry_t *dentry = ext2_dcache_lookup(fs, parent, name);
+    if (dentry)
+        ext2_dcache_evict(fs, dentry);
+}
+
+/// @brief Removes all the cached entries of a directory, because its content
+/// changed, or because it was removed.
+/// @param fs the filesystem.
+/// @param parent the inode of the directory.
+static void ext2_dcache_invalidate_dir(ext2_filesystem_t *fs, ino_t parent)
+{
+    list_head *it, *tmp;
+    list_for_each_safe (it, tmp, &fs->dentry_lru) {
+        ext2_dentry_t *dentry = list_entry(it, ext2_dentry_t, lru);
+        if (dentry->parent == parent)
+            ext2_dcache_evict(fs, dentry);
+    }
+}
+
+/// @brief Drops all the cached directory entries.
+/// @param fs the filesystem.
+static void ext2_dcache_drop(ext2_filesystem_t *fs)
+{
+    list_head *it;
+    while ((it = list_head_pop(&fs->dentry_lru)) != NULL) {
+        ext2_dentry_t *dentry = list_entry(it, ext2_dentry_t, lru);
+        list_head_del(&dentry->hash);
+        kmem_cache_free(dentry);
+    }
+    fs->nr_dentries = 0;
+}
+
 static inline uint32_t ext2_get_rec_len_from_name(const char *name)
 {
     unsigned int rec_len = sizeof(ext2_dirent_t) + strlen(name) - EXT2_NAME_LEN;
@@ -1667,6 +2466,689 @@ static inline uint32_t ext2_get_rec_len_from_direntry(const ext2_dirent_t *diren
     return rec_len;
 }
 
+// ============================================================================
+// Hashed Directory Index (HTree) Functions
+// ============================================================================
+
+/// @brief Information about an index block visited during a lookup.
+typedef struct ext2_dx_frame_t {
+    /// The index of the block inside the directory.
+    uint32_t block;
+    /// The content of the block.
+    uint8_t *buffer;
+    /// The entries of the block, the first one overlaps with the count/limit.
+    ext2_dx_entry_t *entries;
+    /// The entry we followed.
+    ext2_dx_entry_t *at;
+} ext2_dx_frame_t;
+
+/// @brief The path from the root of a directory index to a leaf block.
+typedef struct ext2_dx_lookup_t {
+    /// The visited index blocks, starting from the root.
+    ext2_dx_frame_t frames[EXT2_DX_MAX_LEVELS];
+    /// Number of visited index blocks.
+    uint32_t levels;
+    /// The hash function of the index.
+    uint32_t hash_version;
+} ext2_dx_lookup_t;
+
+/// @brief Describes a directory entry while a leaf block is being split.
+typedef struct ext2_dx_map_entry_t {
+    /// The hash of the name.
+    uint32_t hash;
+    /// The offset of the entry inside the block.
+    uint16_t offset;
+    /// The length of the entry, without the unused space.
+    uint16_t size;
+} ext2_dx_map_entry_t;
+
+/// @brief Returns the count/limit header of index entries.
+static inline ext2_dx_countlimit_t *ext2_dx_countlimit(ext2_dx_entry_t *entries)
+{
+    return (ext2_dx_countlimit_t *)entries;
+}
+
+/// @brief Returns the maximum number of entries inside the root block.
+static inline uint32_t ext2_dx_root_limit(ext2_filesystem_t *fs)
+{
+    return (fs->block_size - 24U - sizeof(ext2_dx_root_info_t)) / sizeof(ext2_dx_entry_t);
+}
+
+/// @brief Returns the maximum number of entries inside a node block.
+static inline uint32_t ext2_dx_node_limit(ext2_filesystem_t *fs)
+{
+    return (fs->block_size - 8U) / sizeof(ext2_dx_entry_t);
+}
+
+/// @brief One round of the Tiny Encryption Algorithm.
+static void ext2_dx_tea_transform(uint32_t buf[4], const uint32_t in[4])
+{
+    uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+    for (int n = 0; n < 16; ++n) {
+        sum += 0x9E3779B9U;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+/// @brief Rotates a word to the left.
+static inline uint32_t ext2_dx_rol(uint32_t word, unsigned int shift)
+{
+    return (word << shift) | (word >> (32U - shift));
+}
+
+/// @brief The basic MD4 functions.
+#define DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z) ((x) ^ (y) ^ (z))
+/// @brief One step of MD4.
+#define DX_ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = ext2_dx_rol(a, s))
+
+/// @brief A reduced version of the MD4 transform.
+static void ext2_dx_half_md4_transform(uint32_t buf[4], const uint32_t in[8])
+{
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+    const uint32_t k2 = 013240474631U, k3 = 015666365641U;
+    // Round 1.
+    DX_ROUND(DX_F, a, b, c, d, in[0], 3);
+    DX_ROUND(DX_F, d, a, b, c, in[1], 7);
+    DX_ROUND(DX_F, c, d, a, b, in[2], 11);
+    DX_ROUND(DX_F, b, c, d, a, in[3], 19);
+    DX_ROUND(DX_F, a, b, c, d, in[4], 3);
+    DX_ROUND(DX_F, d, a, b, c, in[5], 7);
+    DX_ROUND(DX_F, c, d, a, b, in[6], 11);
+    DX_ROUND(DX_F, b, c, d, a, in[7], 19);
+    // Round 2.
+    DX_ROUND(DX_G, a, b, c, d, in[1] + k2, 3);
+    DX_ROUND(DX_G, d, a, b, c, in[3] + k2, 5);
+    DX_ROUND(DX_G, c, d, a, b, in[5] + k2, 9);
+    DX_ROUND(DX_G, b, c, d, a, in[7] + k2, 13);
+    DX_ROUND(DX_G, a, b, c, d, in[0] + k2, 3);
+    DX_ROUND(DX_G, d, a, b, c, in[2] + k2, 5);
+    DX_ROUND(DX_G, c, d, a, b, in[4] + k2, 9);
+    DX_ROUND(DX_G, b, c, d, a, in[6] + k2, 13);
+    // Round 3.
+    DX_ROUND(DX_H, a, b, c, d, in[3] + k3, 3);
+    DX_ROUND(DX_H, d, a, b, c, in[7] + k3, 9);
+    DX_ROUND(DX_H, c, d, a, b, in[2] + k3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[6] + k3, 15);
+    DX_ROUND(DX_H, a, b, c, d, in[1] + k3, 3);
+    DX_ROUND(DX_H, d, a, b, c, in[5] + k3, 9);
+    DX_ROUND(DX_H, c, d, a, b, in[0] + k3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[4] + k3, 15);
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/// @brief The original hash function of directory indexes.
+static uint32_t ext2_dx_legacy_hash(const char *name, int len, int is_unsigned)
+{
+    uint32_t hash, hash0 = 0x12A3FE2DU, hash1 = 0x37ABE8F9U;
+    for (int i = 0; i < len; ++i) {
+        int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        hash  = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+        if (hash & 0x80000000U)
+            hash -= 0x7FFFFFFFU;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+/// @brief Packs the characters of a name into words, padding them with its length.
+static void ext2_dx_str2hashbuf(const char *name, int len, uint32_t *buf, int num, int is_unsigned)
+{
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8), val;
+    pad |= pad << 16;
+    val = pad;
+    if (len > num * 4)
+        len = num * 4;
+    for (int i = 0; i < len; ++i) {
+        int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        val   = (uint32_t)c + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val    = pad;
+            --num;
+        }
+    }
+    if (--num >= 0)
+        *buf++ = val;
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+/// @brief Computes the hash of a name, as done by ext3 and later filesystems.
+/// @param fs the filesystem.
+/// @param name the name.
+/// @param len the length of the name.
+/// @param version the hash function (ext2_dx_hash_version_t).
+/// @return the hash, with the lowest bit cleared.
+static uint32_t ext2_dx_hash(ext2_filesystem_t *fs, const char *name, int len, uint32_t version)
+{
+    uint32_t buf[4] = { 0x67452301U, 0xEFCDAB89U, 0x98BADCFEU, 0x10325476U }, in[8], hash;
+    int is_unsigned = version >= ext2_dx_hash_legacy_unsigned;
+    // Use the seed of the filesystem, if there is one.
+    if (fs->superblock.hash_seed[0] | fs->superblock.hash_seed[1] | fs->superblock.hash_seed[2] | fs->superblock.hash_seed[3])
+        memcpy(buf, fs->superblock.hash_seed, sizeof(buf));
+    switch (version) {
+    case ext2_dx_hash_legacy:
+    case ext2_dx_hash_legacy_unsigned:
+        hash = ext2_dx_legacy_hash(name, len, is_unsigned);
+        break;
+    case ext2_dx_hash_half_md4:
+    case ext2_dx_hash_half_md4_unsigned:
+        for (; len > 0; len -= 32, name += 32) {
+            ext2_dx_str2hashbuf(name, len, in, 8, is_unsigned);
+            ext2_dx_half_md4_transform(buf, in);
+        }
+        hash = buf[1];
+        break;
+    default:
+        for (; len > 0; len -= 16, name += 16) {
+            ext2_dx_str2hashbuf(name, len, in, 4, is_unsigned);
+            ext2_dx_tea_transform(buf, in);
+        }
+        hash = buf[0];
+        break;
+    }
+    hash &= ~1U;
+    if (hash == (EXT2_DX_HASH_EOF << 1))
+        hash = (EXT2_DX_HASH_EOF - 1) << 1;
+    return hash;
+}
+
+/// @brief Checks if the directory uses a hashed index.
+static inline int ext2_dx_is_indexed(ext2_filesystem_t *fs, ext2_inode_t *inode)
+{
+    return (fs->superblock.feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) && (inode->flags & EXT2_INDEX_FL);
+}
+
+/// @brief Frees the buffers of a lookup.
+static void ext2_dx_release(ext2_dx_lookup_t *lookup)
+{
+    for (uint32_t i = 0; i < lookup->levels; ++i)
+        kmem_cache_free(lookup->frames[i].buffer);
+    lookup->levels = 0;
+}
+
+/// @brief Walks the index of a directory, from the root down to the leaf
+/// block which should contain the given hash.
+/// @param fs the filesystem.
+/// @param inode the inode of the directory.
+/// @param name the name we are looking for, NULL if the hash is provided.
+/// @param hash the hash of the name, computed when the name is provided.
+/// @param lookup where we store the visited index blocks.
+/// @return 0 on success, -1 if a block could not be read, -2 if the index is
+/// not supported or corrupted.
+static int ext2_dx_probe(ext2_filesystem_t *fs, ext2_inode_t *inode, const char *name, uint32_t *hash, ext2_dx_lookup_t *lookup)
+{
+    memset(lookup, 0, sizeof(ext2_dx_lookup_t));
+    uint32_t block = 0, levels = 0;
+    int ret        = -1;
+    do {
+        ext2_dx_frame_t *frame = &lookup->frames[lookup->levels];
+        frame->block           = block;
+        frame->buffer          = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+        if (frame->buffer == NULL)
+            goto release_return_error;
+        ++lookup->levels;
+        if (ext2_read_inode_block(fs, inode, block, frame->buffer) == -1)
+            goto release_return_error;
+        uint32_t limit;
+        if (lookup->levels == 1) {
+            // The root follows the `.` and `..` entries.
+            ext2_dx_root_info_t *info = (ext2_dx_root_info_t *)(frame->buffer + 24U);
+            if ((info->reserved_zero != 0) || (info->info_length != sizeof(ext2_dx_root_info_t)) ||
+                (info->hash_version > ext2_dx_hash_tea_unsigned) || (info->indirect_levels >= EXT2_DX_MAX_LEVELS)) {
+                pr_warning("Unsupported index for directory (hash: %d, levels: %d).\n", info->hash_version, info->indirect_levels);
+                ret = -2;
+                goto release_return_error;
+            }
+            levels               = info->indirect_levels;
+            lookup->hash_version = info->hash_version;
+            // The filesystem says whether the legacy versions hash unsigned
+            // characters, as it depends on the host which created it.
+            if ((lookup->hash_version <= ext2_dx_hash_tea) && (fs->superblock.flags & EXT2_FLAGS_UNSIGNED_HASH))
+                lookup->hash_version += ext2_dx_hash_legacy_unsigned;
+            frame->entries         = (ext2_dx_entry_t *)((uint8_t *)info + info->info_length);
+            limit                  = ext2_dx_root_limit(fs);
+            if (name)
+                *hash = ext2_dx_hash(fs, name, strlen(name), lookup->hash_version);
+        } else {
+            // Nodes start with an empty directory entry spanning the block.
+            frame->entries = (ext2_dx_entry_t *)(frame->buffer + 8U);
+            limit          = ext2_dx_node_limit(fs);
+        }
+        ext2_dx_countlimit_t *countlimit = ext2_dx_countlimit(frame->entries);
+        if ((countlimit->limit != limit) || (countlimit->count == 0) || (countlimit->count > limit)) {
+            pr_warning("Corrupted directory index block %d (count: %d, limit: %d).\n", block, countlimit->count, countlimit->limit);
+            ret = -2;
+            goto release_return_error;
+        }
+        // Find the last entry whose hash is not greater than ours, the first
+        // entry has an implicit hash of zero.
+        ext2_dx_entry_t *left = frame->entries + 1, *right = frame->entries + countlimit->count - 1;
+        while (left <= right) {
+            ext2_dx_entry_t *middle = left + (right - left) / 2;
+            if (middle->hash > *hash)
+                right = middle - 1;
+            else
+                left = middle + 1;
+        }
+        frame->at = left - 1;
+        block     = frame->at->block & 0x0FFFFFFFU;
+    } while (lookup->levels <= levels);
+    return 0;
+release_return_error:
+    ext2_dx_release(lookup);
+    return ret;
+}
+
+/// @brief Returns the leaf block pointed by the lookup.
+static inline uint32_t ext2_dx_leaf(ext2_dx_lookup_t *lookup)
+{
+    return lookup->frames[lookup->levels - 1].at->block & 0x0FFFFFFFU;
+}
+
+/// @brief Checks if the names with the given hash continue inside the next
+/// leaf block, and moves the lookup there.
+/// @param lookup the lookup.
+/// @param hash the hash.
+/// @return 1 if we moved to the next block, 0 if there are no more names
+/// with that hash, -1 if they continue under another index block.
+static int ext2_dx_next_leaf(ext2_dx_lookup_t *lookup, uint32_t hash)
+{
+    ext2_dx_frame_t *frame = &lookup->frames[lookup->levels - 1];
+    if ((frame->at + 1) < (frame->entries + ext2_dx_countlimit(frame->entries)->count)) {
+        if ((frame->at + 1)->hash != (hash | 1U))
+            return 0;
+        ++frame->at;
+        return 1;
+    }
+    // Check the entry of the parent, we do not follow it.
+    for (int level = (int)lookup->levels - 2; level >= 0; --level) {
+        frame = &lookup->frames[level];
+        if ((frame->at + 1) < (frame->entries + ext2_dx_countlimit(frame->entries)->count))
+            return ((frame->at + 1)->hash == (hash | 1U)) ? -1 : 0;
+    }
+    return 0;
+}
+
+/// @brief Searches a name inside a leaf block.
+/// @param fs the filesystem.
+/// @param buffer the content of the block.
+/// @param name the name.
+/// @return the offset of the entry, -1 if it is not there.
+static int ext2_dx_search_leaf(ext2_filesystem_t *fs, uint8_t *buffer, const char *name)
+{
+    size_t name_len = strlen(name);
+    for (uint32_t offset = 0; offset < fs->block_size;) {
+        ext2_dirent_t *direntry = (ext2_dirent_t *)(buffer + offset);
+        if (direntry->rec_len < 8U)
+            break;
+        if (direntry->inode && (direntry->name_len == name_len) && !strncmp(direntry->name, name, name_len))
+            return offset;
+        offset += direntry->rec_len;
+    }
+    return -1;
+}
+
+/// @brief Searches a name using the index of the directory.
+/// @param fs the filesystem.
+/// @param inode the inode of the directory.
+/// @param name the name.
+/// @param search where we store the entry.
+/// @return 0 if found, -1 if not found, -2 if the index cannot be used,
+/// -EIO if a block could not be read.
+static int ext2_dx_find_direntry(ext2_filesystem_t *fs, ext2_inode_t *inode, const char *name, ext2_direntry_search_t *search)
+{
+    ext2_dx_lookup_t lookup;
+    uint32_t hash = 0;
+    int ret       = ext2_dx_probe(fs, inode, name, &hash, &lookup);
+    if (ret < 0)
+        return (ret == -2) ? -2 : -EIO;
+    uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+    do {
+        uint32_t block = ext2_dx_leaf(&lookup);
+        if (ext2_read_inode_block(fs, inode, block, cache) == -1) {
+            ret = -EIO;
+            break;
+        }
+        int offset = ext2_dx_search_leaf(fs, cache, name);
+        if (offset >= 0) {
+            ext2_dirent_t *direntry = (ext2_dirent_t *)(cache + offset);
+            memcpy(search->direntry, direntry, ext2_get_rec_len_from_direntry(direntry));
+            search->direntry->name[direntry->name_len] = 0;
+            search->block_index                        = block;
+            search->block_offset                       = offset;
+            ret                                        = 0;
+            break;
+        }
+        // Names with the same hash might continue in the next block.
+        int next = ext2_dx_next_leaf(&lookup, hash);
+        if (next <= 0) {
+            ret = (next == 0) ? -1 : -2;
+            break;
+        }
+    } while (1);
+    kmem_cache_free(cache);
+    ext2_dx_release(&lookup);
+    return ret;
+}
+
+/// @brief Inserts a new entry inside a directory block, if there is room.
+/// @param fs the filesystem.
+/// @param buffer the content of the block.
+/// @param inode_index the inode of the new entry.
+/// @param name the name of the new entry.
+/// @param file_type the type of the new entry.
+/// @return 0 on success, -1 if there is no room.
+static int ext2_dx_insert_in_leaf(ext2_filesystem_t *fs, uint8_t *buffer, uint32_t inode_index, const char *name, uint8_t file_type)
+{
+    uint32_t rec_len = ext2_get_rec_len_from_name(name);
+    for (uint32_t offset = 0; offset < fs->block_size;) {
+        ext2_dirent_t *direntry = (ext2_dirent_t *)(buffer + offset);
+        if (direntry->rec_len < 8U)
+            break;
+        uint32_t used = direntry->inode ? ext2_get_rec_len_from_direntry(direntry) : 0;
+        if ((direntry->rec_len - used) >= rec_len) {
+            if (used) {
+                // Take the unused space at the end of the entry.
+                ext2_dirent_t *new_direntry = (ext2_dirent_t *)(buffer + offset + used);
+                new_direntry->rec_len       = direntry->rec_len - used;
+                direntry->rec_len           = used;
+                direntry                    = new_direntry;
+            }
+            direntry->inode     = inode_index;
+            direntry->name_len  = strlen(name);
+            direntry->file_type = file_type;
+            memcpy(direntry->name, name, direntry->name_len);
+            return 0;
+        }
+        offset += direntry->rec_len;
+    }
+    return -1;
+}
+
+/// @brief Copies the given entries one after the other inside a block, the
+/// last one takes the rest of the block.
+/// @param fs the filesystem.
+/// @param dst the destination block.
+/// @param src the source block.
+/// @param map the entries.
+/// @param count the number of entries.
+static void ext2_dx_pack_leaf(ext2_filesystem_t *fs, uint8_t *dst, uint8_t *src, ext2_dx_map_entry_t *map, uint32_t count)
+{
+    ext2_dirent_t *last = NULL;
+    uint32_t offset     = 0;
+    memset(dst, 0, fs->block_size);
+    for (uint32_t i = 0; i < count; ++i) {
+        last = (ext2_dirent_t *)(dst + offset);
+        memcpy(last, src + map[i].offset, map[i].size);
+        last->rec_len = map[i].size;
+        offset += map[i].size;
+    }
+    if (last == NULL) {
+        // An empty block.
+        last        = (ext2_dirent_t *)dst;
+        last->inode = 0;
+    }
+    last->rec_len += fs->block_size - offset;
+}
+
+/// @brief Collects the entries of a leaf block.
+/// @param fs the filesystem.
+/// @param buffer the content of the block.
+/// @param map where we store the entries.
+/// @param hash_version the hash function, or -1 to skip hashing.
+/// @return the number of entries.
+static uint32_t ext2_dx_map_leaf(ext2_filesystem_t *fs, uint8_t *buffer, ext2_dx_map_entry_t *map, int hash_version)
+{
+    uint32_t count = 0;
+    for (uint32_t offset = 0; offset < fs->block_size;) {
+        ext2_dirent_t *direntry = (ext2_dirent_t *)(buffer + offset);
+        if (direntry->rec_len < 8U)
+            break;
+        if (direntry->inode) {
+            map[count].hash   = (hash_version < 0) ? 0 : ext2_dx_hash(fs, direntry->name, direntry->name_len, hash_version);
+            map[count].offset = offset;
+            map[count].size   = ext2_get_rec_len_from_direntry(direntry);
+            ++count;
+        }
+        offset += direntry->rec_len;
+    }
+    return count;
+}
+
+/// @brief Inserts a new entry inside an index block, after the followed one.
+/// The block must have room for it.
+static void ext2_dx_insert_entry(ext2_dx_frame_t *frame, uint32_t hash, uint32_t block)
+{
+    ext2_dx_countlimit_t *countlimit = ext2_dx_countlimit(frame->entries);
+    ext2_dx_entry_t *position        = frame->at + 1;
+    memmove(position + 1, position, (frame->entries + countlimit->count - position) * sizeof(ext2_dx_entry_t));
+    position->hash  = hash;
+    position->block = block;
+    ++countlimit->count;
+}
+
+/// @brief Appends a new block to the directory.
+/// @param fs the filesystem.
+/// @param inode the inode of the directory.
+/// @param inode_index the index of the directory inode.
+/// @param buffer the content of the block.
+/// @return the index of the block inside the directory, 0 on failure.
+static uint32_t ext2_dx_append_block(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint8_t *buffer)
+{
+    // The directory blocks are never sparse.
+    uint32_t block = inode->size / fs->block_size;
+    if (ext2_allocate_inode_block(fs, inode, inode_index, block, 0) == -1)
+        return 0;
+    if (inode->size < ((block + 1) * fs->block_size)) {
+        inode->size = (block + 1) * fs->block_size;
+        if (ext2_write_inode(fs, inode, inode_index) == -1)
+            return 0;
+    }
+    if (ext2_write_inode_block(fs, inode, inode_index, block, buffer) == -1)
+        return 0;
+    return block;
+}
+
+/// @brief Makes room inside the lowest index block of the lookup, either by
+/// adding a level below the root, or by splitting a node.
+/// @param fs the filesystem.
+/// @param inode the inode of the directory.
+/// @param inode_index the index of the directory inode.
+/// @param lookup the lookup, which is released.
+/// @return 0 on success, -1 on failure, -2 if the index is full.
+static int ext2_dx_grow_index(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, ext2_dx_lookup_t *lookup)
+{
+    ext2_dx_frame_t *root = &lookup->frames[0];
+    int ret               = -1;
+    uint8_t *node         = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+    memset(node, 0, fs->block_size);
+    // Nodes start with an empty directory entry spanning the block.
+    ((ext2_dirent_t *)node)->rec_len        = fs->block_size;
+    ext2_dx_entry_t *entries                = (ext2_dx_entry_t *)(node + 8U);
+    ext2_dx_countlimit(entries)->limit      = ext2_dx_node_limit(fs);
+    if (lookup->levels == 1) {
+        // Move all the entries of the root inside a new node.
+        ext2_dx_countlimit_t *countlimit = ext2_dx_countlimit(root->entries);
+        memcpy(entries + 1, root->entries + 1, (countlimit->count - 1) * sizeof(ext2_dx_entry_t));
+        entries[0].block                  = root->entries[0].block;
+        ext2_dx_countlimit(entries)->count = countlimit->count;
+        uint32_t block                     = ext2_dx_append_block(fs, inode, inode_index, node);
+        if (block == 0)
+            goto free_node_return;
+        countlimit->count       = 1;
+        root->entries[0].block = block;
+        ((ext2_dx_root_info_t *)(root->buffer + 24U))->indirect_levels = 1;
+    } else {
+        ext2_dx_countlimit_t *root_countlimit = ext2_dx_countlimit(root->entries);
+        if (root_countlimit->count >= root_countlimit->limit) {
+            ret = -2;
+            goto free_node_return;
+        }
+        // Move the upper half of the node inside a new node.
+        ext2_dx_frame_t *frame           = &lookup->frames[1];
+        ext2_dx_countlimit_t *countlimit = ext2_dx_countlimit(frame->entries);
+        uint32_t half = countlimit->count / 2, moved = countlimit->count - half;
+        uint32_t hash = frame->entries[half].hash;
+        memcpy(entries + 1, frame->entries + half + 1, (moved - 1) * sizeof(ext2_dx_entry_t));
+        entries[0].block                  = frame->entries[half].block;
+        ext2_dx_countlimit(entries)->count = moved;
+        uint32_t block                     = ext2_dx_append_block(fs, inode, inode_index, node);
+        if (block == 0)
+            goto free_node_return;
+        countlimit->count = half;
+        if (ext2_write_inode_block(fs, inode, inode_index, frame->block, frame->buffer) == -1)
+            goto free_node_return;
+        ext2_dx_insert_entry(root, hash, block);
+    }
+    if (ext2_write_inode_block(fs, inode, inode_index, root->block, root->buffer) == -1)
+        goto free_node_return;
+    ret = 0;
+free_node_return:
+    kmem_cache_free(node);
+    ext2_dx_release(lookup);
+    return ret;
+}
+
+/// @brief Adds a new entry to a directory, using its index.
+/// @param fs the filesystem.
+/// @param inode the inode of the directory.
+/// @param inode_index the index of the directory inode.
+/// @param new_inode the inode of the new entry.
+/// @param name the name of the new entry.
+/// @param file_type the type of the new entry.
+/// @return 0 on success, -1 on failure, -2 if the index cannot be used.
+static int ext2_dx_add_direntry(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index, uint32_t new_inode, const char *name, uint8_t file_type)
+{
+    ext2_dx_lookup_t lookup;
+    uint32_t hash = 0;
+    int ret       = ext2_dx_probe(fs, inode, name, &hash, &lookup);
+    if (ret < 0)
+        return ret;
+    uint8_t *leaf = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+    uint32_t block = ext2_dx_leaf(&lookup);
+    if (ext2_read_inode_block(fs, inode, block, leaf) == -1) {
+        ret = -1;
+        goto free_leaf_return;
+    }
+    // The easy case, the leaf has room for the entry.
+    if (ext2_dx_insert_in_leaf(fs, leaf, new_inode, name, file_type) == 0) {
+        ret = (ext2_write_inode_block(fs, inode, inode_index, block, leaf) == -1) ? -1 : 0;
+        goto free_leaf_return;
+    }
+    // We need to split the leaf, make sure the index has room for it.
+    ext2_dx_frame_t *frame = &lookup.frames[lookup.levels - 1];
+    if (ext2_dx_countlimit(frame->entries)->count >= ext2_dx_countlimit(frame->entries)->limit) {
+        kmem_cache_free(leaf);
+        ret = ext2_dx_grow_index(fs, inode, inode_index, &lookup);
+        if (ret < 0)
+            return ret;
+        // Start again, with the new index.
+        return ext2_dx_add_direntry(fs, inode, inode_index, new_inode, name, file_type);
+    }
+    // Sort the entries of the leaf by hash.
+    ext2_dx_map_entry_t *map = kmalloc((fs->block_size / 12U + 1U) * sizeof(ext2_dx_map_entry_t));
+    uint8_t *sibling         = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+    uint8_t *original        = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+    uint32_t count           = ext2_dx_map_leaf(fs, leaf, map, lookup.hash_version);
+    for (uint32_t i = 1; i < count; ++i) {
+        ext2_dx_map_entry_t entry = map[i];
+        uint32_t j                = i;
+        for (; (j > 0) && (map[j - 1].hash > entry.hash); --j)
+            map[j] = map[j - 1];
+        map[j] = entry;
+    }
+    // Move the upper half inside a new block.
+    uint32_t half       = count / 2;
+    uint32_t split_hash = map[half].hash;
+    // Mark that the names with this hash continue from the previous block.
+    if ((half > 0) && (map[half - 1].hash == split_hash))
+        split_hash |= 1U;
+    memcpy(original, leaf, fs->block_size);
+    ext2_dx_pack_leaf(fs, leaf, original, map, half);
+    ext2_dx_pack_leaf(fs, sibling, original, map + half, count - half);
+    // Insert the entry inside the right half.
+    if (ext2_dx_insert_in_leaf(fs, (hash >= (split_hash & ~1U)) ? sibling : leaf, new_inode, name, file_type) == -1) {
+        ret = -2;
+        goto free_split_return;
+    }
+    ret                  = -1;
+    uint32_t new_block   = ext2_dx_append_block(fs, inode, inode_index, sibling);
+    if (new_block == 0)
+        goto free_split_return;
+    if (ext2_write_inode_block(fs, inode, inode_index, block, leaf) == -1)
+        goto free_split_return;
+    ext2_dx_insert_entry(frame, split_hash, new_block);
+    if (ext2_write_inode_block(fs, inode, inode_index, frame->block, frame->buffer) == -1)
+        goto free_split_return;
+    ret = 0;
+free_split_return:
+    kmem_cache_free(original);
+    kmem_cache_free(sibling);
+    kfree(map);
+free_leaf_return:
+    kmem_cache_free(leaf);
+    ext2_dx_release(&lookup);
+    return ret;
+}
+
+/// @brief Turns a directory made of a single block into an indexed one: the
+/// entries are moved to a new block, and the first one becomes the root.
+/// @param fs the filesystem.
+/// @param inode the inode of the directory.
+/// @param inode_index the index of the directory inode.
+/// @return 0 on success, -1 on failure.
+static int ext2_dx_make_indexed(ext2_filesystem_t *fs, ext2_inode_t *inode, uint32_t inode_index)
+{
+    if (!(fs->superblock.feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) || (inode->size != fs->block_size))
+        return -1;
+    int ret                  = -1;
+    uint8_t *root            = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+    uint8_t *leaf            = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
+    ext2_dx_map_entry_t *map = kmalloc((fs->block_size / 12U + 1U) * sizeof(ext2_dx_map_entry_t));
+    if (ext2_read_inode_block(fs, inode, 0, root) == -1)
+        goto free_return;
+    // The block must start with the `.` and `..` entries.
+    ext2_dirent_t *dot = (ext2_dirent_t *)root, *dotdot = (ext2_dirent_t *)(root + 12U);
+    uint32_t count = ext2_dx_map_leaf(fs, root, map, -1);
+    if ((count < 2) || (dot->rec_len != 12U) || (dot->name_len != 1) || (dot->name[0] != '.') ||
+        (dotdot->name_len != 2) || strncmp(dotdot->name, "..", 2) || (dotdot->rec_len < 12U))
+        goto free_return;
+    // Move the other entries inside a new block.
+    ext2_dx_pack_leaf(fs, leaf, root, map + 2, count - 2);
+    uint32_t block = ext2_dx_append_block(fs, inode, inode_index, leaf);
+    if (block == 0)
+        goto free_return;
+    // Build the root, `..` spans the rest of the block.
+    memset(root + 24U, 0, fs->block_size - 24U);
+    dotdot->rec_len                 = fs->block_size - 12U;
+    ext2_dx_root_info_t *info       = (ext2_dx_root_info_t *)(root + 24U);
+    info->hash_version              = (fs->superblock.def_hash_version <= ext2_dx_hash_tea_unsigned) ? fs->superblock.def_hash_version : ext2_dx_hash_half_md4;
+    info->info_length               = sizeof(ext2_dx_root_info_t);
+    ext2_dx_entry_t *entries        = (ext2_dx_entry_t *)(root + 24U + sizeof(ext2_dx_root_info_t));
+    ext2_dx_countlimit(entries)->limit = ext2_dx_root_limit(fs);
+    ext2_dx_countlimit(entries)->count = 1;
+    entries[0].block                = block;
+    if (ext2_write_inode_block(fs, inode, inode_index, 0, root) == -1)
+        goto free_return;
+    inode->flags |= EXT2_INDEX_FL;
+    ret = ext2_write_inode(fs, inode, inode_index);
+free_return:
+    kfree(map);
+    kmem_cache_free(leaf);
+    kmem_cache_free(root);
+    return ret;
+}
+
 static int ext2_allocate_direntry(
     ext2_filesystem_t *fs,
     uint32_t parent_inode_index,
@@ -1674,6 +3156,9 @@ static int ext2_allocate_direntry(
     const char *name,
     uint8_t file_type)
 {
+    // Adding the entry might move the other ones, and the name might be
+    // cached as missing.
+    ext2_dcache_invalidate_dir(fs, parent_inode_index);
     // Get the inode associated with the new directory entry.
     ext2_inode_t inode;
     if (ext2_read_inode(fs, &inode, inode_index) == -1) {
@@ -1699,6 +3184,17 @@ static int ext2_allocate_direntry(
         return -1;
     }
     pr_debug("ext2_allocate_direntry(parent: %d, name: \"%s\", inode: %d)\n", parent_inode_index, name, inode_index);
+    // Use the index of the directory, if it has one.
+    if (ext2_dx_is_indexed(fs, &parent_inode)) {
+        int ret = ext2_dx_add_direntry(fs, &parent_inode, parent_inode_index, inode_index, name, file_type);
+        if (ret != -2)
+            return ret;
+        // Drop the index, the directory is still readable as a plain one.
+        pr_warning("Dropping the index of directory %d.\n", parent_inode_index);
+        parent_inode.flags &= ~EXT2_INDEX_FL;
+        if (ext2_write_inode(fs, &parent_inode, parent_inode_index) == -1)
+            return -1;
+    }
     // Compute the rec_len for the name of the new direntry. Remember, the name
     // is not actually 256 chars long as specified in EXT2_NAME_LEN, that is
     // just a maximum.
@@ -1764,8 +3260,15 @@ static int ext2_allocate_direntry(
 
     } else if ((it.block_offset + rec_len) >= fs->block_size) {
         pr_debug("    We need a new direntry, and a new block (%d + %d >= %d).\n", it.block_offset, rec_len, fs->block_size);
+        // Rather than growing a plain directory, give it an index.
+        if ((it.block_index == 0) && (ext2_dx_make_indexed(fs, &parent_inode, parent_inode_index) == 0)) {
+            if (ext2_dx_add_direntry(fs, &parent_inode, parent_inode_index, inode_index, name, file_type) == 0)
+                goto free_cache_return_success;
+            goto free_cache_return_error;
+        }
         it.block_index += 1;
-        if (ext2_allocate_inode_block(fs, &parent_inode, parent_inode_index, it.block_index) == -1) {
+        // The new entry covers the whole block.
+        if (ext2_allocate_inode_block(fs, &parent_inode, parent_inode_index, it.block_index, 0) == -1) {
             pr_err("Failed to allocate a new block for an inode.\n");
             goto free_cache_return_error;
         }
@@ -1829,6 +3332,25 @@ static int ext2_find_direntry(ext2_filesystem_t *fs, ino_t ino, const char *name
         return -1;
     }
     //pr_debug("ext2_find_direntry(ino: %d, name: \"%s\")\n", ino, name);
+    // Check if we already searched the name.
+    ext2_dentry_t *dentry = ext2_dcache_lookup(fs, ino, name);
+    if (dentry) {
+        search->parent_inode = ino;
+        if (dentry->ino == 0)
+            return -1;
+        search->direntry->inode     = dentry->ino;
+        search->direntry->rec_len   = dentry->rec_len;
+        search->direntry->file_type = dentry->file_type;
+        // The special name `/` is stored inside the `.` entry.
+        if (!strcmp(name, "/"))
+            strcpy(search->direntry->name, ".");
+        else
+            strcpy(search->direntry->name, name);
+        search->direntry->name_len = strlen(search->direntry->name);
+        search->block_index        = dentry->block_index;
+        search->block_offset       = dentry->block_offset;
+        return 0;
+    }
     // Get the inode associated with the file.
     ext2_inode_t inode;
     if (ext2_read_inode(fs, &inode, ino) == -1) {
@@ -1840,6 +3362,19 @@ static int ext2_find_direntry(ext2_filesystem_t *fs, ino_t ino, const char *name
         pr_err("The parent inode is not a directory (ino: %d, mode: %d).\n", ino, inode.mode);
         return -1;
     }
+    // Use the index of the directory, if it has one. The `.` and `..` entries
+    // are not indexed, but they are at the beginning of the directory.
+    if (ext2_dx_is_indexed(fs, &inode) && strcmp(name, "/") && strcmp(name, ".") && strcmp(name, "..")) {
+        search->parent_inode = ino;
+        int ret              = ext2_dx_find_direntry(fs, &inode, name, search);
+        // Failed reads are not cached, the name might be there.
+        if (ret == -EIO)
+            return -1;
+        if (ret != -2) {
+            ext2_dcache_add(fs, ino, name, (ret == 0) ? search : NULL);
+            return ret;
+        }
+    }
     // Allocate the cache.
     uint8_t *cache = kmem_cache_alloc(fs->ext2_buffer_cache, GFP_KERNEL);
     // Clean the cache.
@@ -1860,9 +3395,11 @@ static int ext2_find_direntry(ext2_filesystem_t *fs, ino_t ino, const char *name
     }
     // Copy the inode of the parent, even if we did not find the entry.
     search->parent_inode = ino;
-    // Check if we have found the entry.
-    if (it.direntry == NULL)
+    // Check if we have found the entry, and remember that it does not exist.
+    if (it.direntry == NULL) {
+        ext2_dcache_add(fs, ino, name, NULL);
         goto free_cache_return_error;
+    }
     // Copy the direntry.
     memcpy(search->direntry, it.direntry, sizeof(ext2_dirent_t));
     // Close the name.
@@ -1871,6 +3408,8 @@ static int ext2_find_direntry(ext2_filesystem_t *fs, ino_t ino, const char *name
     search->block_index = it.block_index;
     // Copy the offset of the direntry inside the block.
     search->block_offset = it.block_offset;
+    // Remember the entry.
+    ext2_dcache_add(fs, ino, name, search);
     // Free the cache.
     kmem_cache_free(cache);
 
@@ -1926,6 +3465,16 @@ static int ext2_resolve_path(vfs_file_t *directory, char *path, ext2_direntry_se
         pr_err("The file does not belong to an EXT2 filesystem `%s`.\n", directory->name);
         return -1;
     }
+    // Absolute paths include the mount point, which is not inside the
+    // filesystem when it is not mounted on `/` (e.g., below an initramfs).
+    if ((path[0] == '/') && (directory == fs->root)) {
+        super_block_t *sb = vfs_get_superblock(path);
+        if (sb && (sb->root == fs->root) && (strcmp(sb->path, "/") != 0)) {
+            path += strlen(sb->path);
+            if (*path == 0)
+                path = "/";
+        }
+    }
     // If the path is `/`.
     if (strcmp(path, "/") == 0)
         return ext2_find_direntry(fs, directory->ino, path, search);
@@ -2073,6 +3622,8 @@ static int ext2_init_vfs_file(
     file->fs_operations  = &ext2_fs_operations;
     // Set the read offest.
     file->f_pos = 0;
+    // Reset the readahead state.
+    memset(&file->ra, 0, sizeof(file_ra_state_t));
     // Set the number of links.
     file->nlink = inode->links_count;
     // Initialize the list of siblings.
@@ -2082,25 +3633,77 @@ static int ext2_init_vfs_file(
     return 0;
 }
 
+/// @brief Searches the opened file associated with the inode.
+/// @param fs the filesystem.
+/// @param inode the index of the inode.
+/// @return the opened file, NULL if the inode is not opened.
 static vfs_file_t *ext2_find_vfs_file_with_inode(ext2_filesystem_t *fs, ino_t inode)
 {
-    vfs_file_t *file = NULL;
-    if (!list_head_empty(&fs->opened_files)) {
-        list_for_each_decl(it, &fs->opened_files)
-        {
-            // Get the file structure.
-            file = list_entry(it, vfs_file_t, siblings);
-            if (file && (file->ino == inode))
-                return file;
-        }
+    ext2_cached_inode_t *cached = ext2_lookup_inode(fs, inode);
+    return cached ? cached->file : NULL;
+}
+
+/// @brief Adds the file to the list of opened files, and keeps its inode
+/// inside the cache until the file is closed.
+/// @param fs the filesystem.
+/// @param file the file.
+/// @return 0 on success, -1 on failure.
+static int ext2_add_opened_file(ext2_filesystem_t *fs, vfs_file_t *file)
+{
+    ext2_cached_inode_t *cached = ext2_get_cached_inode(fs, file->ino, 1);
+    if (cached == NULL)
+        return -1;
+    ++cached->count;
+    cached->file = file;
+    list_head_add_tail(&file->siblings, &fs->opened_files);
+    return 0;
+}
+
+/// @brief Removes the file from the list of opened files, writing back its
+/// inode if it was modified.
+/// @param fs the filesystem.
+/// @param file the file.
+static void ext2_remove_opened_file(ext2_filesystem_t *fs, vfs_file_t *file)
+{
+    list_head_del(&file->siblings);
+    ext2_cached_inode_t *cached = ext2_lookup_inode(fs, file->ino);
+    if (cached && (cached->file == file)) {
+        assert((cached->count > 0) && "The inode of an opened file is not referenced.");
+        --cached->count;
+        cached->file = NULL;
+        // Give back the blocks reserved to the file, once it is closed.
+        int released = (cached->count == 0) && ext2_discard_prealloc(fs, cached);
+        if (cached->dirty || released)
+            ext2_stage_filesystem(fs);
     }
-    return NULL;
 }
 
 // ============================================================================
 // Virtual FileSystem (VFS) Functions
 // ============================================================================
 
+/// @brief Chooses the group of a new directory, spreading directories
+/// across the groups: among the groups with at least the average number of
+/// free inodes, the one with the most free blocks.
+/// @param fs the filesystem.
+/// @param parent_group the group of the parent directory, used as fallback.
+/// @return the group index.
+static uint32_t ext2_find_group_for_directory(ext2_filesystem_t *fs, uint32_t parent_group)
+{
+    uint32_t average = fs->superblock.free_inodes_count / fs->block_groups_count;
+    uint32_t best = parent_group, best_free_blocks = 0;
+    for (uint32_t i = 0; i < fs->block_groups_count; ++i) {
+        ext2_group_descriptor_t *gd = &fs->block_groups[i];
+        if ((gd->free_inodes_count == 0) || (gd->free_inodes_count < average))
+            continue;
+        if (gd->free_blocks_count > best_free_blocks) {
+            best             = i;
+            best_free_blocks = gd->free_blocks_count;
+        }
+    }
+    return best;
+}
+
 /// @brief Creates and initializes a new inode.
 /// @param fs the filesystem.
 /// @param inode the inode we use to initialize the root of the filesystem.
@@ -2125,6 +3728,10 @@ static int ext2_create_inode(
         pr_err("Failed to get the current running process.\n");
         return -1;
     }
+    // Files stay close to their parent directory, while directories are
+    // spread across the groups.
+    if ((mode & EXT2_S_IFMT) == EXT2_S_IFDIR)
+        preferred_group = ext2_find_group_for_directory(fs, preferred_group);
     // Allocate an inode, inside the preferred_group if possible.
     int inode_index = ext2_allocate_inode(fs, preferred_group);
     if (inode_index == 0) {
@@ -2226,7 +3833,10 @@ static vfs_file_t *ext2_creat(const char *path, mode_t permission)
                 goto close_parent_return_null;
             }
             // Add the vfs_file to the list of associated files.
-            list_head_add_tail(&file->siblings, &fs->opened_files);
+            if (ext2_add_opened_file(fs, file) == -1) {
+                kmem_cache_free(file);
+                goto close_parent_return_null;
+            }
         }
         return file;
     }
@@ -2261,6 +3871,13 @@ static vfs_file_t *ext2_creat(const char *path, mode_t permission)
         pr_err("Failed to properly set the VFS file.\n");
         goto close_parent_return_null;
     }
+    // Add the vfs_file to the list of associated files.
+    if (ext2_add_opened_file(fs, new_file) == -1) {
+        kmem_cache_free(new_file);
+        goto close_parent_return_null;
+    }
+    // Stage the new inode, together with the parent.
+    ext2_stage_filesystem(fs);
     return new_file;
 close_parent_return_null:
     vfs_close(parent);
@@ -2345,7 +3962,10 @@ static vfs_file_t *ext2_open(const char *path, int flags, mode_t mode)
             return NULL;
         }
         // Add the vfs_file to the list of associated files.
-        list_head_add_tail(&file->siblings, &fs->opened_files);
+        if (ext2_add_opened_file(fs, file) == -1) {
+            kmem_cache_free(file);
+            return NULL;
+        }
     }
     return file;
 }
@@ -2410,6 +4030,8 @@ static int ext2_unlink(const char *path)
     }
     // Set the inode to zero.
     actual_dirent->inode = 0;
+    // Forget the entry.
+    ext2_dcache_remove(fs, search.parent_inode, direntry.name);
     // Write back the parent directory block.
     if (!ext2_write_inode_block(fs, &parent_inode, search.parent_inode, search.block_index, cache)) {
         pr_err("Failed to write the inode block `%d`\n", search.block_index);
@@ -2429,6 +4051,8 @@ static int ext2_unlink(const char *path)
             goto free_cache_return_error;
         }
     }
+    // Stage the modified inodes.
+    ext2_stage_filesystem(fs);
     // Free the cache.
     kmem_cache_free(cache);
     return 0;
@@ -2454,7 +4078,7 @@ static int ext2_close(vfs_file_t *file)
     }
     pr_debug("ext2_close(ino: %d, file: \"%s\")\n", file->ino, file->name);
     // Remove the file from the list of opened files.
-    list_head_del(&file->siblings);
+    ext2_remove_opened_file(fs, file);
     // Free the cache.
     kmem_cache_free(file);
     return 0;
@@ -2481,6 +4105,9 @@ static ssize_t ext2_read(vfs_file_t *file, char *buffer, off_t offset, size_t nb
         pr_err("Failed to read the inode `%s`.\n", file->name);
         return -1;
     }
+    // Regular files are mostly read front to back.
+    if ((inode.mode & EXT2_S_IFMT) == EXT2_S_IFREG)
+        ext2_readahead(fs, file, &inode, offset, nbyte);
     return ext2_read_inode_data(fs, &inode, file->ino, offset, nbyte, buffer);
 }
 
@@ -2504,7 +4131,11 @@ static ssize_t ext2_write(vfs_file_t *file, const void *buffer, off_t offset, si
         pr_err("Failed to read the inode `%s`.\n", file->name);
         return -1;
     }
-    return ext2_write_inode_data(fs, &inode, file->ino, offset, nbyte, (char *)buffer);
+    ssize_t written = ext2_write_inode_data(fs, &inode, file->ino, offset, nbyte, (char *)buffer);
+    // Stage the inode once, rather than after each block. The data reaches the
+    // disk with the flusher, or with fsync.
+    ext2_stage_filesystem(fs);
+    return written;
 }
 
 /// @brief Repositions the file offset inside a file.
@@ -2601,6 +4232,27 @@ static int ext2_ioctl(vfs_file_t *file, int request, void *data)
     return -1;
 }
 
+/// @brief Writes back the modified data and metadata of a file.
+/// @param file     The file.
+/// @param datasync 1 if only the metadata needed to read the data back must
+///                 be written, 0 otherwise.
+/// @return 0 on success, a negative error code on failure.
+static int ext2_fsync(vfs_file_t *file, int datasync)
+{
+    // Get the filesystem.
+    ext2_filesystem_t *fs = (ext2_filesystem_t *)file->device;
+    if (fs == NULL) {
+        pr_err("The file does not belong to an EXT2 filesystem `%s`.\n", file->name);
+        return -EINVAL;
+    }
+    // The buffer cache does not know which blocks belong to the file, so we
+    // write back the whole filesystem, which covers both cases.
+    (void)datasync;
+    if (ext2_sync_filesystem(fs) == -1)
+        return -EIO;
+    return 0;
+}
+
 /// @brief Reads contents of the directories to a dirent buffer, updating
 ///        the offset and returning the number of written bytes in the buffer,
 ///        it assumes that all paths are well-formed.
@@ -2707,10 +4359,9 @@ static int ext2_mkdir(const char *path, mode_t permission)
         vfs_close(parent);
         return -ENOENT;
     }
-    // Increase the number of directories inside the group.
-    fs->block_groups[group_index].used_dirs_count += 1;
-    // Update the bgdt.
-    ext2_write_bgdt(fs);
+    // Increase the number of directories inside the group of the new inode.
+    fs->block_groups[ext2_get_group_index_from_inode(fs, inode_index)].used_dirs_count += 1;
+    fs->bgdt_dirty = 1;
     // Write the inode.
     if (ext2_write_inode(fs, &inode, inode_index) == -1) {
         pr_err("Failed to write the newly created inode.\n");
@@ -2739,6 +4390,8 @@ static int ext2_mkdir(const char *path, mode_t permission)
         vfs_close(parent);
         return -ENOENT;
     }
+    // Stage the new inode, together with the parent.
+    ext2_stage_filesystem(fs);
     // Close the parent directory.
     vfs_close(parent);
     return 0;
@@ -2805,6 +4458,8 @@ static int ext2_rmdir(const char *path)
         kmem_cache_free(cache);
         return -ENOTEMPTY;
     }
+    // Forget the entries of the directory.
+    ext2_dcache_invalidate_dir(fs, direntry.inode);
     // Reduce the number of links to the inode.
     if (inode.links_count > 0) {
         inode.links_count--;
@@ -2828,12 +4483,16 @@ static int ext2_rmdir(const char *path)
     }
     // Set the inode to zero.
     actual_dirent->inode = 0;
+    // Forget the entry.
+    ext2_dcache_remove(fs, search.parent_inode, direntry.name);
     // Write back the parent directory block.
     if (!ext2_write_inode_block(fs, &parent_inode, search.parent_inode, search.block_index, cache)) {
         pr_err("Failed to write the inode block `%d`\n", search.block_index);
         goto free_cache_return_error;
     }
 
+    // Stage the modified inodes.
+    ext2_stage_filesystem(fs);
     // Free the cache.
     kmem_cache_free(cache);
     return 0;
@@ -2898,6 +4557,14 @@ static vfs_file_t *ext2_mount(vfs_file_t *block_device, const char *path)
     spinlock_init(&fs->spinlock);
     // Initialize the list of opened files.
     list_head_init(&fs->opened_files);
+    // Initialize the inode cache.
+    for (uint32_t i = 0; i < EXT2_INODE_HASH_BUCKETS; ++i)
+        list_head_init(&fs->inode_hash[i]);
+    list_head_init(&fs->inode_lru);
+    // Initialize the directory entry cache.
+    for (uint32_t i = 0; i < EXT2_DENTRY_HASH_BUCKETS; ++i)
+        list_head_init(&fs->dentry_hash[i]);
+    list_head_init(&fs->dentry_lru);
     // Set the pointer to the block device.
     fs->block_device = block_device;
     // Read the superblock.
@@ -2982,6 +4649,14 @@ static vfs_file_t *ext2_mount(vfs_file_t *block_device, const char *path)
         goto free_block_groups;
     }
 
+    // The bitmaps of the groups are read when the allocators need them.
+    fs->group_cache = kmalloc(sizeof(ext2_group_cache_t) * fs->block_groups_count);
+    if (fs->group_cache == NULL) {
+        pr_err("Failed to allocate memory for the groups cache.\n");
+        goto free_block_groups;
+    }
+    memset(fs->group_cache, 0, sizeof(ext2_group_cache_t) * fs->block_groups_count);
+
     // We need the root inode in order to set the root file.
     ext2_inode_t root_inode;
     if (ext2_read_inode(fs, &root_inode, 2U) == -1) {
@@ -3007,7 +4682,10 @@ static vfs_file_t *ext2_mount(vfs_file_t *block_device, const char *path)
         goto free_all;
     }
     // Add the root to the list of opened files.
-    list_head_add_tail(&fs->root->siblings, &fs->opened_files);
+    if (ext2_add_opened_file(fs, fs->root) == -1) {
+        pr_err("Failed to cache the EXT2 root inode.\n");
+        goto free_all;
+    }
 
     // Dump the filesystem details for debugging.
     ext2_dump_filesystem(fs);
@@ -3022,8 +4700,14 @@ free_all:
     // Free the memory occupied by the root.
     kmem_cache_free(fs->root);
 free_block_buffer:
+    // Drop the cached inodes and directory entries.
+    ext2_drop_inodes(fs);
+    ext2_dcache_drop(fs);
     // Free the memory occupied by the block buffer.
     kmem_cache_destroy(fs->ext2_buffer_cache);
+    // Free the cached bitmaps of the groups.
+    ext2_free_cached_bitmaps(fs);
+    kfree(fs->group_cache);
 free_block_groups:
     // Free the memory occupied by the block groups.
     kfree(fs->block_groups);
@@ -3072,6 +4756,10 @@ static file_system_type ext2_file_system_type = {
 
 int ext2_initialize(void)
 {
+    // Create the cache for the inodes.
+    ext2_inode_cache = KMEM_CREATE(ext2_cached_inode_t);
+    // Create the cache for the directory entries.
+    ext2_dentry_cache = KMEM_CREATE(ext2_dentry_t);
     // Register the filesystem.
     vfs_register_filesystem(&ext2_file_system_type);
     return 0;
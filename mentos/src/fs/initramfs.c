@@ -0,0 +1,255 @@
+/// @file initramfs.c
+/// @brief Root filesystem unpacked from an archive loaded by the bootloader.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[INITRD]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "fs/initramfs.h"
+#include "sys/module.h"
+#include "sys/errno.h"
+#include "io/debug.h"
+#include "fs/tmpfs.h"
+#include "fs/vfs.h"
+#include "string.h"
+#include "stdio.h"
+#include "fcntl.h"
+
+/// Size of the header of a cpio (newc) entry.
+#define CPIO_HEADER_SIZE 110U
+/// Size of the blocks of a tar archive.
+#define TAR_BLOCK_SIZE 512U
+/// Offset of the `ustar` magic inside a tar header.
+#define TAR_MAGIC_OFFSET 257U
+
+/// Mode of the directories.
+#define INITRAMFS_S_IFDIR 0040000
+/// Mode of the regular files.
+#define INITRAMFS_S_IFREG 0100000
+
+/// @brief The formats of the archives.
+typedef enum initramfs_format_t {
+    initramfs_format_none, ///< Not an archive.
+    initramfs_format_cpio, ///< cpio, with the `newc` (SVR4) headers.
+    initramfs_format_tar,  ///< tar, with the `ustar` headers.
+} initramfs_format_t;
+
+/// @brief An entry of the archive.
+typedef struct initramfs_entry_t {
+    /// The absolute path of the entry.
+    char path[PATH_MAX];
+    /// The type and the permissions.
+    uint32_t mode;
+    /// The content of the entry.
+    const uint8_t *data;
+    /// The size of the content.
+    uint32_t size;
+} initramfs_entry_t;
+
+/// @brief Parses a number stored as text inside a fixed-width field.
+/// @param field the field.
+/// @param length the width of the field.
+/// @param base 16 for cpio, 8 for tar.
+/// @return the number.
+static uint32_t initramfs_number(const uint8_t *field, size_t length, uint32_t base)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < length; ++i) {
+        uint32_t digit;
+        if ((field[i] >= '0') && (field[i] <= '9'))
+            digit = field[i] - '0';
+        else if ((field[i] >= 'a') && (field[i] <= 'f'))
+            digit = field[i] - 'a' + 10;
+        else if ((field[i] >= 'A') && (field[i] <= 'F'))
+            digit = field[i] - 'A' + 10;
+        else if ((field[i] == ' ') && (value == 0))
+            continue;
+        else
+            break;
+        if (digit >= base)
+            break;
+        value = value * base + digit;
+    }
+    return value;
+}
+
+/// @brief Detects the format of an archive.
+/// @param archive the archive.
+/// @param length the size of the archive.
+/// @return the format.
+static initramfs_format_t initramfs_detect(const uint8_t *archive, size_t length)
+{
+    if ((length >= CPIO_HEADER_SIZE) && !strncmp((const char *)archive, "07070", 5) &&
+        ((archive[5] == '1') || (archive[5] == '2')))
+        return initramfs_format_cpio;
+    if ((length >= TAR_BLOCK_SIZE) && !strncmp((const char *)archive + TAR_MAGIC_OFFSET, "ustar", 5))
+        return initramfs_format_tar;
+    return initramfs_format_none;
+}
+
+/// @brief Turns the name stored inside the archive into an absolute path.
+/// @param entry the entry where the path is stored.
+/// @param prefix the first part of the name, it can be empty.
+/// @param prefix_length the maximum length of the prefix.
+/// @param name the second part of the name.
+/// @param name_length the maximum length of the name.
+static void initramfs_set_path(initramfs_entry_t *entry,
+                               const char *prefix, size_t prefix_length,
+                               const char *name, size_t name_length)
+{
+    size_t length = 0;
+    // Archives store relative paths, e.g., `./bin/init` or `bin/init`.
+    for (int part = 0; part < 2; ++part) {
+        const char *it  = part ? name : prefix;
+        const char *end = it + strnlen(it, part ? name_length : prefix_length);
+        while (it < end) {
+            while ((it < end) && (*it == '/'))
+                ++it;
+            const char *component = it;
+            while ((it < end) && (*it != '/'))
+                ++it;
+            size_t size = it - component;
+            if ((size == 0) || ((size == 1) && (component[0] == '.')))
+                continue;
+            if ((length + size + 2) >= PATH_MAX)
+                break;
+            entry->path[length++] = '/';
+            memcpy(entry->path + length, component, size);
+            length += size;
+        }
+    }
+    entry->path[length] = 0;
+}
+
+/// @brief Reads the entry at the given offset of the archive.
+/// @param archive the archive.
+/// @param length the size of the archive.
+/// @param format the format of the archive.
+/// @param offset the offset of the entry, moved to the next one.
+/// @param entry where the entry is stored.
+/// @return 1 if there is an entry, 0 at the end of the archive, -EINVAL if
+/// the archive is corrupted.
+static int initramfs_next(const uint8_t *archive, size_t length, initramfs_format_t format, size_t *offset, initramfs_entry_t *entry)
+{
+    const uint8_t *header = archive + *offset;
+    if (format == initramfs_format_cpio) {
+        if ((*offset + CPIO_HEADER_SIZE) > length)
+            return -EINVAL;
+        if (initramfs_detect(header, CPIO_HEADER_SIZE) != initramfs_format_cpio)
+            return -EINVAL;
+        uint32_t name_size = initramfs_number(header + 94, 8, 16);
+        if ((name_size == 0) || ((*offset + CPIO_HEADER_SIZE + name_size) > length))
+            return -EINVAL;
+        const char *name = (const char *)header + CPIO_HEADER_SIZE;
+        if (!strncmp(name, "TRAILER!!!", name_size))
+            return 0;
+        entry->mode = initramfs_number(header + 14, 8, 16);
+        entry->size = initramfs_number(header + 54, 8, 16);
+        // Both the name and the content are aligned to 4 bytes.
+        size_t data = (*offset + CPIO_HEADER_SIZE + name_size + 3U) & ~3U;
+        if ((data + entry->size) > length)
+            return -EINVAL;
+        entry->data = archive + data;
+        *offset     = (data + entry->size + 3U) & ~3U;
+        initramfs_set_path(entry, "", 0, name, name_size);
+        return 1;
+    }
+    // The archive ends with blocks of zeros.
+    if (((*offset + TAR_BLOCK_SIZE) > length) || (header[0] == 0))
+        return 0;
+    if (initramfs_detect(header, TAR_BLOCK_SIZE) != initramfs_format_tar)
+        return -EINVAL;
+    entry->size = initramfs_number(header + 124, 12, 8);
+    entry->mode = initramfs_number(header + 100, 8, 8) & 07777;
+    if ((header[156] == '0') || (header[156] == 0))
+        entry->mode |= INITRAMFS_S_IFREG;
+    else if (header[156] == '5')
+        entry->mode |= INITRAMFS_S_IFDIR;
+    if ((*offset + TAR_BLOCK_SIZE + entry->size) > length)
+        return -EINVAL;
+    entry->data = header + TAR_BLOCK_SIZE;
+    *offset += TAR_BLOCK_SIZE + ((entry->size + TAR_BLOCK_SIZE - 1) & ~(TAR_BLOCK_SIZE - 1));
+    initramfs_set_path(entry, (const char *)header + 345, 155, (const char *)header, 100);
+    return 1;
+}
+
+/// @brief Creates an entry of the archive inside the root filesystem.
+/// @param entry the entry.
+/// @return 0 on success, a negative error code on failure.
+static int initramfs_create(initramfs_entry_t *entry)
+{
+    if (S_ISDIR(entry->mode)) {
+        int ret = vfs_mkdir(entry->path, entry->mode & 07777);
+        return (ret == -EEXIST) ? 0 : ret;
+    }
+    if (!S_ISREG(entry->mode)) {
+        pr_warning("Skipping `%s`, only files and directories are supported.\n", entry->path);
+        return 0;
+    }
+    vfs_file_t *file = vfs_open(entry->path, O_WRONLY | O_CREAT | O_TRUNC, entry->mode & 07777);
+    if (file == NULL)
+        return -errno;
+    ssize_t written = vfs_write(file, (void *)entry->data, 0, entry->size);
+    vfs_close(file);
+    if (written < 0)
+        return written;
+    return ((uint32_t)written == entry->size) ? 0 : -ENOSPC;
+}
+
+int initramfs_initialize(void)
+{
+    multiboot_module_t *module = NULL;
+    initramfs_format_t format  = initramfs_format_none;
+    for (int i = 0; (i < MAX_MODULES) && modules[i].mod_start; ++i) {
+        format = initramfs_detect((const uint8_t *)modules[i].mod_start, modules[i].mod_end - modules[i].mod_start);
+        if (format != initramfs_format_none) {
+            module = &modules[i];
+            break;
+        }
+    }
+    if (module == NULL)
+        return -ENOENT;
+    const uint8_t *archive = (const uint8_t *)module->mod_start;
+    size_t length          = module->mod_end - module->mod_start;
+    // Count the entries first, to size the filesystem, and take the
+    // permissions of the root from the `.` entry, if there is one.
+    initramfs_entry_t entry;
+    uint32_t nr_entries = 0, root_mode = TMPFS_DEFAULT_MODE;
+    size_t offset       = 0;
+    int ret;
+    while ((ret = initramfs_next(archive, length, format, &offset, &entry)) > 0) {
+        if ((entry.path[0] == 0) && S_ISDIR(entry.mode))
+            root_mode = entry.mode & 07777;
+        ++nr_entries;
+    }
+    if (ret < 0) {
+        pr_err("The archive is corrupted at offset %u.\n", offset);
+        return ret;
+    }
+    // Leave room for the files created at run-time.
+    char options[64];
+    sprintf(options, "size=%uK,nr_inodes=%u,mode=%o",
+            (length + TMPFS_DEFAULT_SIZE) / 1024U,
+            nr_entries + TMPFS_DEFAULT_INODES,
+            root_mode);
+    if ((ret = do_mount("tmpfs", "/", options)) < 0)
+        return ret;
+    for (offset = 0; initramfs_next(archive, length, format, &offset, &entry) > 0;) {
+        // The root has been created by the mount.
+        if ((entry.path[0] == 0) || ((ret = initramfs_create(&entry)) == 0))
+            continue;
+        pr_err("Failed to unpack `%s` (%d).\n", entry.path, ret);
+        return ret;
+    }
+    // The mount point of the disk.
+    vfs_mkdir(INITRAMFS_DISK_PATH, 0755);
+    pr_notice("Unpacked %u entries (%u KB) into `/`.\n", nr_entries, length / 1024U);
+    // The content now lives in the filesystem.
+    release_module(module);
+    return 0;
+}
@@ -42,7 +42,9 @@ ssize_t sys_read(int fd, void *buf, size_t nbytes)
     // Update the offset.
     if (read > 0) {
         vfd->file_struct->f_pos += read;
+        task->ioac.rchar += read;
     }
+    ++task->ioac.syscr;
     return read;
 }
 
@@ -75,7 +77,9 @@ ssize_t sys_write(int fd, void *buf, size_t nbytes)
     // Update the offset.
     if (written > 0) {
         vfd->file_struct->f_pos += written;
+        task->ioac.wchar += written;
     }
+    ++task->ioac.syscw;
     return written;
 }
 
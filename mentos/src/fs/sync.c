@@ -0,0 +1,43 @@
+/// @file sync.c
+/// @brief Functions used to write back the modified content of files.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#include "system/syscall.h"
+#include "process/scheduler.h"
+#include "sys/errno.h"
+#include "fs/vfs.h"
+
+/// @brief Writes back the modified content of the file associated with the
+/// file descriptor.
+/// @param fd       The file descriptor.
+/// @param datasync 1 if only the data must be written back, 0 otherwise.
+/// @return 0 on success, a negative error code on failure.
+static int __sync_fd(int fd, int datasync)
+{
+    // Get the current task.
+    task_struct *task = scheduler_get_current_process();
+    // Check the current FD.
+    if ((fd < 0) || (fd >= task->max_fd))
+        return -EBADF;
+    // Get the file.
+    vfs_file_t *file = task->fd_list[fd].file_struct;
+    if (file == NULL)
+        return -EBADF;
+    return vfs_fsync(file, datasync);
+}
+
+void sys_sync(void)
+{
+    vfs_sync();
+}
+
+int sys_fsync(int fd)
+{
+    return __sync_fd(fd, 0);
+}
+
+int sys_fdatasync(int fd)
+{
+    return __sync_fd(fd, 1);
+}
@@ -0,0 +1,845 @@
+/// @file tmpfs.c
+/// @brief Filesystem which keeps its files in memory.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[TMPFS ]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "fs/tmpfs.h"
+#include "mem/zone_allocator.h"
+#include "process/scheduler.h"
+#include "process/process.h"
+#include "mem/kheap.h"
+#include "sys/bitops.h"
+#include "sys/errno.h"
+#include "io/debug.h"
+#include "fs/vfs.h"
+#include "libgen.h"
+#include "string.h"
+#include "assert.h"
+#include "stdio.h"
+#include "fcntl.h"
+#include "math.h"
+#include "time.h"
+
+#define TMPFS_S_IFMT  0xF000 ///< Format mask.
+#define TMPFS_S_IFREG 0x8000 ///< Regular file.
+#define TMPFS_S_IFDIR 0x4000 ///< Directory.
+
+/// Checks if the inode is a directory.
+#define TMPFS_IS_DIR(inode) (((inode)->mode & TMPFS_S_IFMT) == TMPFS_S_IFDIR)
+
+/// Maximum length of the mount options.
+#define TMPFS_OPTIONS_MAX 128U
+
+// ============================================================================
+// Data Structures
+// ============================================================================
+
+typedef struct tmpfs_t tmpfs_t;
+
+/// @brief A file, or a directory, of a tmpfs.
+typedef struct tmpfs_inode_t {
+    /// The inode number.
+    uint32_t ino;
+    /// The type and the permissions.
+    uint32_t mode;
+    /// User id of the file.
+    uid_t uid;
+    /// Group id of the file.
+    gid_t gid;
+    /// Time of last access.
+    time_t atime;
+    /// Time of last data modification.
+    time_t mtime;
+    /// Time of last status change.
+    time_t ctime;
+    /// The size of the file.
+    uint32_t size;
+    /// The pages with the content of the file, NULL for holes.
+    uint8_t **pages;
+    /// The number of entries of pages.
+    uint32_t nr_slots;
+    /// The name of the entry inside its parent.
+    char name[NAME_MAX];
+    /// The parent directory, NULL for the root and once unlinked.
+    struct tmpfs_inode_t *parent;
+    /// The entries of the directory.
+    list_head children;
+    /// List of the entries of the same directory.
+    list_head siblings;
+    /// The opened VFS files associated with the inode.
+    list_head files;
+    /// The filesystem.
+    tmpfs_t *fs;
+} tmpfs_inode_t;
+
+/// @brief A mounted tmpfs.
+struct tmpfs_t {
+    /// The root directory.
+    tmpfs_inode_t *root;
+    /// The VFS file of the root directory.
+    vfs_file_t *root_file;
+    /// Maximum number of pages of content.
+    uint32_t max_pages;
+    /// Number of pages of content.
+    uint32_t nr_pages;
+    /// Maximum number of inodes.
+    uint32_t max_inodes;
+    /// Number of inodes.
+    uint32_t nr_inodes;
+    /// The next inode number.
+    uint32_t next_ino;
+    /// Permissions of the root directory.
+    uint32_t root_mode;
+};
+
+/// Cache for the inodes.
+static kmem_cache_t *tmpfs_inode_cache;
+
+// ============================================================================
+// Forward Declaration of Functions
+// ============================================================================
+
+static int tmpfs_mkdir(const char *path, mode_t mode);
+static int tmpfs_rmdir(const char *path);
+static int tmpfs_stat(const char *path, stat_t *stat);
+static vfs_file_t *tmpfs_creat(const char *path, mode_t mode);
+
+static vfs_file_t *tmpfs_open(const char *path, int flags, mode_t mode);
+static int tmpfs_unlink(const char *path);
+static int tmpfs_close(vfs_file_t *file);
+static ssize_t tmpfs_read(vfs_file_t *file, char *buffer, off_t offset, size_t nbyte);
+static ssize_t tmpfs_write(vfs_file_t *file, const void *buffer, off_t offset, size_t nbyte);
+static off_t tmpfs_lseek(vfs_file_t *file, off_t offset, int whence);
+static int tmpfs_fstat(vfs_file_t *file, stat_t *stat);
+static int tmpfs_fsync(vfs_file_t *file, int datasync);
+static int tmpfs_getdents(vfs_file_t *file, dirent_t *dirp, off_t doff, size_t count);
+
+// ============================================================================
+// Virtual FileSystem (VFS) Operaions
+// ============================================================================
+
+/// Filesystem general operations.
+static vfs_sys_operations_t tmpfs_sys_operations = {
+    .mkdir_f = tmpfs_mkdir,
+    .rmdir_f = tmpfs_rmdir,
+    .stat_f  = tmpfs_stat,
+    .creat_f = tmpfs_creat
+};
+
+/// Filesystem file operations.
+static vfs_file_operations_t tmpfs_fs_operations = {
+    .open_f     = tmpfs_open,
+    .unlink_f   = tmpfs_unlink,
+    .close_f    = tmpfs_close,
+    .read_f     = tmpfs_read,
+    .write_f    = tmpfs_write,
+    .lseek_f    = tmpfs_lseek,
+    .stat_f     = tmpfs_fstat,
+    .ioctl_f    = NULL,
+    .fsync_f    = tmpfs_fsync,
+    .getdents_f = tmpfs_getdents
+};
+
+// ============================================================================
+// TMPFS Core Functions
+// ============================================================================
+
+/// @brief Checks if the current process can access the inode.
+/// @param inode the inode.
+/// @param want the permissions, as the bits of the others (e.g., S_IWOTH).
+/// @return true if it can, false otherwise.
+static bool_t tmpfs_may_access(tmpfs_inode_t *inode, uint32_t want)
+{
+    task_struct *task = scheduler_get_current_process();
+    // The kernel itself, and root, can do anything.
+    if ((task == NULL) || (task->uid == 0))
+        return true;
+    uint32_t mode = inode->mode;
+    if (task->uid == inode->uid)
+        mode >>= 6;
+    else if (task->gid == inode->gid)
+        mode >>= 3;
+    return (mode & want) == want;
+}
+
+/// @brief Checks if the current process can remove an entry from a directory,
+/// which might be sticky (e.g., /tmp).
+/// @param parent the directory.
+/// @param inode the entry.
+/// @return true if it can, false otherwise.
+static bool_t tmpfs_may_delete(tmpfs_inode_t *parent, tmpfs_inode_t *inode)
+{
+    if (!tmpfs_may_access(parent, S_IWOTH | S_IXOTH))
+        return false;
+    task_struct *task = scheduler_get_current_process();
+    if (!bitmask_check(parent->mode, S_ISVTX) || (task == NULL) || (task->uid == 0))
+        return true;
+    // Only the owners can remove the entries of a sticky directory.
+    return (task->uid == inode->uid) || (task->uid == parent->uid);
+}
+
+/// @brief Searches an entry of a directory.
+/// @param dir the directory.
+/// @param name the name of the entry, not terminated.
+/// @param len the length of the name.
+/// @return the entry, NULL if there is none.
+static tmpfs_inode_t *tmpfs_find_child(tmpfs_inode_t *dir, const char *name, size_t len)
+{
+    list_for_each_decl(it, &dir->children)
+    {
+        tmpfs_inode_t *child = list_entry(it, tmpfs_inode_t, siblings);
+        if ((strncmp(child->name, name, len) == 0) && (child->name[len] == 0))
+            return child;
+    }
+    return NULL;
+}
+
+/// @brief Finds the inode at the given path.
+/// @param path the absolute path, without `.` and `..`.
+/// @param parent if the path is missing only its last entry, where its
+/// directory is stored, NULL otherwise.
+/// @param name where the name of the last entry is stored, if parent is set.
+/// @return the inode, NULL if there is none, with errno set.
+static tmpfs_inode_t *tmpfs_lookup(const char *path, tmpfs_inode_t **parent, char *name)
+{
+    super_block_t *sb = vfs_get_superblock(path);
+    if ((sb == NULL) || (sb->root == NULL)) {
+        errno = ENOENT;
+        return NULL;
+    }
+    tmpfs_inode_t *inode = (tmpfs_inode_t *)sb->root->device;
+    const char *it       = path + strlen(sb->path);
+    if (parent)
+        *parent = NULL;
+    while (true) {
+        while (*it == '/')
+            ++it;
+        if (*it == 0)
+            return inode;
+        if (!TMPFS_IS_DIR(inode)) {
+            errno = ENOTDIR;
+            return NULL;
+        }
+        size_t len = 0;
+        while (it[len] && (it[len] != '/'))
+            ++len;
+        if (len >= NAME_MAX) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        tmpfs_inode_t *child = tmpfs_find_child(inode, it, len);
+        if (child == NULL) {
+            const char *rest = it + len;
+            while (*rest == '/')
+                ++rest;
+            // Only the last entry can be created.
+            if (parent && (*rest == 0)) {
+                *parent = inode;
+                strncpy(name, it, len);
+                name[len] = 0;
+            }
+            errno = ENOENT;
+            return NULL;
+        }
+        inode = child;
+        it += len;
+    }
+}
+
+/// @brief Creates a new inode.
+/// @param fs the filesystem.
+/// @param parent the directory which contains it, NULL for the root.
+/// @param name the name of the entry.
+/// @param mode the type and the permissions.
+/// @return the inode, NULL on failure, with errno set.
+static tmpfs_inode_t *tmpfs_inode_create(tmpfs_t *fs, tmpfs_inode_t *parent, const char *name, uint32_t mode)
+{
+    if (fs->nr_inodes >= fs->max_inodes) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    tmpfs_inode_t *inode = kmem_cache_alloc(tmpfs_inode_cache, GFP_KERNEL);
+    if (inode == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(inode, 0, sizeof(tmpfs_inode_t));
+    task_struct *task = scheduler_get_current_process();
+    inode->ino        = fs->next_ino++;
+    inode->mode       = mode;
+    inode->uid        = task ? task->uid : 0;
+    inode->gid        = task ? task->gid : 0;
+    inode->atime      = sys_time(NULL);
+    inode->mtime      = inode->atime;
+    inode->ctime      = inode->atime;
+    inode->fs         = fs;
+    strncpy(inode->name, name, NAME_MAX - 1);
+    list_head_init(&inode->children);
+    list_head_init(&inode->siblings);
+    list_head_init(&inode->files);
+    if (parent) {
+        inode->parent = parent;
+        list_head_add_tail(&inode->siblings, &parent->children);
+        parent->mtime = parent->ctime = inode->atime;
+    }
+    ++fs->nr_inodes;
+    return inode;
+}
+
+/// @brief Changes the size of a file, freeing the pages past the end.
+/// @param inode the inode.
+/// @param size the new size.
+static void tmpfs_set_size(tmpfs_inode_t *inode, uint32_t size)
+{
+    if (size < inode->size) {
+        uint32_t first = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+        for (uint32_t i = first; i < inode->nr_slots; ++i) {
+            if (inode->pages[i]) {
+                free_page_lowmem((uint32_t)inode->pages[i]);
+                inode->pages[i] = NULL;
+                --inode->fs->nr_pages;
+            }
+        }
+        // The tail of the last page must read back as zeros, if the file
+        // grows again.
+        if ((size % PAGE_SIZE) && (first - 1 < inode->nr_slots) && inode->pages[first - 1])
+            memset(inode->pages[first - 1] + (size % PAGE_SIZE), 0, PAGE_SIZE - (size % PAGE_SIZE));
+    }
+    inode->size = size;
+    // Keep the opened files up to date.
+    list_for_each_decl(it, &inode->files)
+    {
+        list_entry(it, vfs_file_t, siblings)->length = size;
+    }
+}
+
+/// @brief Destroys an inode, which has no entries and no opened files.
+/// @param inode the inode.
+static void tmpfs_inode_destroy(tmpfs_inode_t *inode)
+{
+    tmpfs_set_size(inode, 0);
+    if (inode->pages)
+        kfree(inode->pages);
+    if (inode->parent)
+        list_head_del(&inode->siblings);
+    --inode->fs->nr_inodes;
+    kmem_cache_free(inode);
+}
+
+/// @brief Removes an entry from its directory, the inode is destroyed once
+/// the last opened file is closed.
+/// @param inode the inode.
+static void tmpfs_inode_unlink(tmpfs_inode_t *inode)
+{
+    inode->parent->mtime = inode->parent->ctime = sys_time(NULL);
+    list_head_del(&inode->siblings);
+    inode->parent = NULL;
+    if (list_head_empty(&inode->files))
+        tmpfs_inode_destroy(inode);
+}
+
+/// @brief Gets the page of a file, allocating it if needed.
+/// @param inode the inode.
+/// @param index the index of the page.
+/// @return the page, NULL on failure, with errno set.
+static uint8_t *tmpfs_get_page(tmpfs_inode_t *inode, uint32_t index)
+{
+    if (index >= inode->nr_slots) {
+        // Grow the table of pages geometrically.
+        uint32_t nr_slots = max(16U, inode->nr_slots);
+        while (nr_slots <= index)
+            nr_slots *= 2;
+        uint8_t **pages = kmalloc(nr_slots * sizeof(uint8_t *));
+        if (pages == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(pages, 0, nr_slots * sizeof(uint8_t *));
+        if (inode->pages) {
+            memcpy(pages, inode->pages, inode->nr_slots * sizeof(uint8_t *));
+            kfree(inode->pages);
+        }
+        inode->pages    = pages;
+        inode->nr_slots = nr_slots;
+    }
+    if (inode->pages[index] == NULL) {
+        if (inode->fs->nr_pages >= inode->fs->max_pages) {
+            errno = ENOSPC;
+            return NULL;
+        }
+        uint8_t *page = (uint8_t *)__alloc_page_lowmem(GFP_KERNEL);
+        if (page == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(page, 0, PAGE_SIZE);
+        inode->pages[index] = page;
+        ++inode->fs->nr_pages;
+    }
+    return inode->pages[index];
+}
+
+/// @brief Creates a VFS file for an inode.
+/// @param inode the inode.
+/// @return a pointer to the VFS file, NULL on failure, with errno set.
+static vfs_file_t *tmpfs_create_file_struct(tmpfs_inode_t *inode)
+{
+    vfs_file_t *file = kmem_cache_alloc(vfs_file_cache, GFP_KERNEL);
+    if (file == NULL) {
+        pr_err("Failed to allocate memory for the VFS file.\n");
+        errno = ENFILE;
+        return NULL;
+    }
+    memset(file, 0, sizeof(vfs_file_t));
+    strcpy(file->name, inode->name);
+    file->device         = inode;
+    file->ino            = inode->ino;
+    file->uid            = inode->uid;
+    file->gid            = inode->gid;
+    file->mask           = inode->mode & 0xFFF;
+    file->length         = inode->size;
+    file->flags          = TMPFS_IS_DIR(inode) ? DT_DIR : DT_REG;
+    file->atime          = inode->atime;
+    file->mtime          = inode->mtime;
+    file->ctime          = inode->ctime;
+    file->nlink          = 1;
+    file->sys_operations = &tmpfs_sys_operations;
+    file->fs_operations  = &tmpfs_fs_operations;
+    list_head_add_tail(&file->siblings, &inode->files);
+    return file;
+}
+
+// ============================================================================
+// Virtual FileSystem (VFS) Functions
+// ============================================================================
+
+/// @brief Creates a new directory.
+/// @param path The path to the new directory.
+/// @param mode The file mode.
+/// @return 0 on success, a negative error code on failure.
+static int tmpfs_mkdir(const char *path, mode_t mode)
+{
+    char name[NAME_MAX];
+    tmpfs_inode_t *parent;
+    if (tmpfs_lookup(path, &parent, name))
+        return -EEXIST;
+    if (parent == NULL)
+        return -errno;
+    if (!tmpfs_may_access(parent, S_IWOTH | S_IXOTH))
+        return -EACCES;
+    if (tmpfs_inode_create(parent->fs, parent, name, TMPFS_S_IFDIR | (mode & 0xFFF)) == NULL)
+        return -errno;
+    return 0;
+}
+
+/// @brief Removes a directory.
+/// @param path The path to the directory.
+/// @return 0 on success, a negative error code on failure.
+static int tmpfs_rmdir(const char *path)
+{
+    tmpfs_inode_t *inode = tmpfs_lookup(path, NULL, NULL);
+    if (inode == NULL)
+        return -errno;
+    if (!TMPFS_IS_DIR(inode))
+        return -ENOTDIR;
+    if (inode->parent == NULL)
+        return -EBUSY;
+    if (!list_head_empty(&inode->children))
+        return -ENOTEMPTY;
+    if (!tmpfs_may_delete(inode->parent, inode))
+        return -EACCES;
+    tmpfs_inode_unlink(inode);
+    return 0;
+}
+
+/// @brief Saves the information concerning the inode.
+/// @param inode The inode.
+/// @param stat The structure where the information are stored.
+/// @return 0 if success.
+static int __tmpfs_stat(tmpfs_inode_t *inode, stat_t *stat)
+{
+    stat->st_dev   = 0;
+    stat->st_ino   = inode->ino;
+    stat->st_mode  = inode->mode;
+    stat->st_uid   = inode->uid;
+    stat->st_gid   = inode->gid;
+    stat->st_size  = inode->size;
+    stat->st_atime = inode->atime;
+    stat->st_mtime = inode->mtime;
+    stat->st_ctime = inode->ctime;
+    return 0;
+}
+
+/// @brief Retrieves information concerning the file at the given path.
+/// @param path The path to the file.
+/// @param stat The structure where the information are stored.
+/// @return 0 on success, a negative error code on failure.
+static int tmpfs_stat(const char *path, stat_t *stat)
+{
+    tmpfs_inode_t *inode = tmpfs_lookup(path, NULL, NULL);
+    if (inode == NULL)
+        return -errno;
+    return __tmpfs_stat(inode, stat);
+}
+
+/// @brief Creates a file, or truncates it if it exists.
+/// @param path The path to the file.
+/// @param mode The permissions of the file.
+/// @return The file, NULL on failure.
+static vfs_file_t *tmpfs_creat(const char *path, mode_t mode)
+{
+    return tmpfs_open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+}
+
+/// @brief Opens the file at the given path.
+/// @param path  The path to the file.
+/// @param flags The flags used to determine the behavior of the function.
+/// @param mode  The mode with which we create the file.
+/// @return The file, NULL on failure, with errno set.
+static vfs_file_t *tmpfs_open(const char *path, int flags, mode_t mode)
+{
+    pr_debug("tmpfs_open(%s, %d, %d)\n", path, flags, mode);
+    char name[NAME_MAX];
+    tmpfs_inode_t *parent;
+    tmpfs_inode_t *inode = tmpfs_lookup(path, &parent, name);
+    // Writing needs both bits, reading needs none of them.
+    uint32_t want = (flags & O_RDWR) ? (S_IROTH | S_IWOTH) : ((flags & O_WRONLY) ? S_IWOTH : S_IROTH);
+    if (inode) {
+        if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) {
+            errno = EEXIST;
+            return NULL;
+        }
+        if (TMPFS_IS_DIR(inode) && (flags & (O_WRONLY | O_RDWR))) {
+            errno = EISDIR;
+            return NULL;
+        }
+        if (!TMPFS_IS_DIR(inode) && (flags & O_DIRECTORY)) {
+            errno = ENOTDIR;
+            return NULL;
+        }
+        if (!tmpfs_may_access(inode, want)) {
+            errno = EACCES;
+            return NULL;
+        }
+        if ((flags & O_TRUNC) && (flags & (O_WRONLY | O_RDWR))) {
+            tmpfs_set_size(inode, 0);
+            inode->mtime = inode->ctime = sys_time(NULL);
+        }
+        inode->atime = sys_time(NULL);
+    } else {
+        // When both O_CREAT and O_DIRECTORY are specified, a regular file is
+        // created.
+        if ((parent == NULL) || !(flags & O_CREAT))
+            return NULL;
+        if (!tmpfs_may_access(parent, S_IWOTH | S_IXOTH)) {
+            errno = EACCES;
+            return NULL;
+        }
+        inode = tmpfs_inode_create(parent->fs, parent, name, TMPFS_S_IFREG | (mode & 0xFFF));
+        if (inode == NULL)
+            return NULL;
+    }
+    return tmpfs_create_file_struct(inode);
+}
+
+/// @brief Deletes the file at the given path.
+/// @param path The path to the file.
+/// @return 0 on success, a negative error code on failure.
+static int tmpfs_unlink(const char *path)
+{
+    tmpfs_inode_t *inode = tmpfs_lookup(path, NULL, NULL);
+    if (inode == NULL)
+        return -errno;
+    if (TMPFS_IS_DIR(inode))
+        return -EISDIR;
+    if (!tmpfs_may_delete(inode->parent, inode))
+        return -EACCES;
+    // The content stays there for whoever has the file open.
+    tmpfs_inode_unlink(inode);
+    return 0;
+}
+
+/// @brief Closes the given file.
+/// @param file The file structure.
+/// @return 0 on success.
+static int tmpfs_close(vfs_file_t *file)
+{
+    tmpfs_inode_t *inode = (tmpfs_inode_t *)file->device;
+    // We cannot close the root.
+    if (file == inode->fs->root_file)
+        return -1;
+    list_head_del(&file->siblings);
+    kmem_cache_free(file);
+    if ((inode->parent == NULL) && (inode != inode->fs->root) && list_head_empty(&inode->files))
+        tmpfs_inode_destroy(inode);
+    return 0;
+}
+
+/// @brief Reads from the file.
+/// @param file The file.
+/// @param buffer Buffer where the read content must be placed.
+/// @param offset Offset from which we start reading from the file.
+/// @param nbyte The number of bytes to read.
+/// @return The number of read bytes.
+static ssize_t tmpfs_read(vfs_file_t *file, char *buffer, off_t offset, size_t nbyte)
+{
+    tmpfs_inode_t *inode = (tmpfs_inode_t *)file->device;
+    if (TMPFS_IS_DIR(inode))
+        return -EISDIR;
+    if ((offset < 0) || ((uint32_t)offset >= inode->size))
+        return 0;
+    nbyte = min(nbyte, inode->size - offset);
+    for (size_t done = 0; done < nbyte;) {
+        uint32_t index = (offset + done) / PAGE_SIZE;
+        uint32_t start = (offset + done) % PAGE_SIZE;
+        size_t chunk   = min(nbyte - done, PAGE_SIZE - start);
+        // Holes read back as zeros.
+        if ((index < inode->nr_slots) && inode->pages[index])
+            memcpy(buffer + done, inode->pages[index] + start, chunk);
+        else
+            memset(buffer + done, 0, chunk);
+        done += chunk;
+    }
+    inode->atime = sys_time(NULL);
+    return nbyte;
+}
+
+/// @brief Writes the given content inside the file.
+/// @param file The file.
+/// @param buffer The content to write.
+/// @param offset Offset from which we start writing in the file.
+/// @param nbyte The number of bytes to write.
+/// @return The number of written bytes, or a negative error code if none was.
+static ssize_t tmpfs_write(vfs_file_t *file, const void *buffer, off_t offset, size_t nbyte)
+{
+    tmpfs_inode_t *inode = (tmpfs_inode_t *)file->device;
+    if (TMPFS_IS_DIR(inode))
+        return -EISDIR;
+    if ((offset < 0) || ((uint32_t)offset + nbyte < (uint32_t)offset))
+        return -EFBIG;
+    size_t done = 0;
+    while (done < nbyte) {
+        uint32_t index = (offset + done) / PAGE_SIZE;
+        uint32_t start = (offset + done) % PAGE_SIZE;
+        size_t chunk   = min(nbyte - done, PAGE_SIZE - start);
+        uint8_t *page  = tmpfs_get_page(inode, index);
+        if (page == NULL)
+            break;
+        memcpy(page + start, (const uint8_t *)buffer + done, chunk);
+        done += chunk;
+    }
+    if (done == 0)
+        return (nbyte == 0) ? 0 : -errno;
+    if ((offset + done) > inode->size)
+        tmpfs_set_size(inode, offset + done);
+    inode->mtime = inode->ctime = sys_time(NULL);
+    return done;
+}
+
+/// @brief Repositions the file offset inside a file.
+/// @param file the file we are working with.
+/// @param offset the offest to use for the operation.
+/// @param whence the type of operation.
+/// @return the resulting offset, or a negative error code.
+static off_t tmpfs_lseek(vfs_file_t *file, off_t offset, int whence)
+{
+    tmpfs_inode_t *inode = (tmpfs_inode_t *)file->device;
+    switch (whence) {
+    case SEEK_END:
+        offset += inode->size;
+        break;
+    case SEEK_CUR:
+        offset += file->f_pos;
+        break;
+    case SEEK_SET:
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (offset < 0)
+        return -EINVAL;
+    file->f_pos = offset;
+    return offset;
+}
+
+/// @brief Retrieves information concerning the file.
+/// @param file The file struct.
+/// @param stat The structure where the information are stored.
+/// @return 0 if success.
+static int tmpfs_fstat(vfs_file_t *file, stat_t *stat)
+{
+    return __tmpfs_stat((tmpfs_inode_t *)file->device, stat);
+}
+
+/// @brief There is nothing to write back.
+/// @param file The file.
+/// @param datasync Ignored.
+/// @return 0.
+static int tmpfs_fsync(vfs_file_t *file, int datasync)
+{
+    return 0;
+}
+
+/// @brief Fills a directory entry.
+/// @param dirp the directory entry.
+/// @param ino the inode number.
+/// @param type the type of the entry.
+/// @param name the name of the entry.
+static inline void tmpfs_fill_dirent(dirent_t *dirp, uint32_t ino, int type, const char *name)
+{
+    dirp->d_ino  = ino;
+    dirp->d_type = type;
+    strncpy(dirp->d_name, name, NAME_MAX - 1);
+    dirp->d_off    = sizeof(dirent_t);
+    dirp->d_reclen = sizeof(dirent_t);
+}
+
+/// @brief Reads the entries of a directory, starting from `.` and `..`.
+/// @param file  The directory handler.
+/// @param dirp  The buffer where the data should be written.
+/// @param doff  The offset, in bytes, of the first entry to write.
+/// @param count The maximum length of the buffer.
+/// @return The number of written bytes in the buffer.
+static int tmpfs_getdents(vfs_file_t *file, dirent_t *dirp, off_t doff, size_t count)
+{
+    tmpfs_inode_t *inode = (tmpfs_inode_t *)file->device;
+    if (!TMPFS_IS_DIR(inode))
+        return -ENOTDIR;
+    size_t written = 0;
+    off_t current  = 0;
+    // The parent of the root belongs to another filesystem, point it to itself.
+    tmpfs_inode_t *parent = inode->parent ? inode->parent : inode;
+    if ((current++ >= (doff / (off_t)sizeof(dirent_t))) && ((written + sizeof(dirent_t)) <= count)) {
+        tmpfs_fill_dirent(dirp++, inode->ino, DT_DIR, ".");
+        written += sizeof(dirent_t);
+    }
+    if ((current++ >= (doff / (off_t)sizeof(dirent_t))) && ((written + sizeof(dirent_t)) <= count)) {
+        tmpfs_fill_dirent(dirp++, parent->ino, DT_DIR, "..");
+        written += sizeof(dirent_t);
+    }
+    list_for_each_decl(it, &inode->children)
+    {
+        if ((written + sizeof(dirent_t)) > count)
+            break;
+        if (current++ < (doff / (off_t)sizeof(dirent_t)))
+            continue;
+        tmpfs_inode_t *child = list_entry(it, tmpfs_inode_t, siblings);
+        tmpfs_fill_dirent(dirp++, child->ino, TMPFS_IS_DIR(child) ? DT_DIR : DT_REG, child->name);
+        written += sizeof(dirent_t);
+    }
+    inode->atime = sys_time(NULL);
+    return written;
+}
+
+// ============================================================================
+// Initialization Functions
+// ============================================================================
+
+/// @brief Parses the mount options (e.g., "size=16M,nr_inodes=1024,mode=755").
+/// @param fs the filesystem.
+/// @param args the options, it can be NULL.
+/// @return 0 on success, -1 on failure.
+static int tmpfs_parse_options(tmpfs_t *fs, const char *args)
+{
+    char options[TMPFS_OPTIONS_MAX], *saveptr;
+    fs->max_pages  = TMPFS_DEFAULT_SIZE / PAGE_SIZE;
+    fs->max_inodes = TMPFS_DEFAULT_INODES;
+    fs->root_mode  = TMPFS_DEFAULT_MODE;
+    if ((args == NULL) || (*args == 0))
+        return 0;
+    if (strlen(args) >= TMPFS_OPTIONS_MAX)
+        return -1;
+    strcpy(options, args);
+    for (char *option = strtok_r(options, ",", &saveptr); option; option = strtok_r(NULL, ",", &saveptr)) {
+        char *value = strchr(option, '='), *end;
+        if (value == NULL)
+            return -1;
+        *value++ = 0;
+        // The permissions are in octal, and zero is a valid value.
+        if (strcmp(option, "mode") == 0) {
+            long mode = strtol(value, &end, 8);
+            if ((end == value) || (*end != 0) || (mode < 0) || (mode > 07777))
+                return -1;
+            fs->root_mode = (uint32_t)mode;
+            continue;
+        }
+        long number     = strtol(value, &end, 10);
+        uint32_t factor = 1;
+        if ((*end == 'k') || (*end == 'K'))
+            factor = 1024U;
+        else if ((*end == 'm') || (*end == 'M'))
+            factor = 1024U * 1024U;
+        else if (*end != 0)
+            return -1;
+        if ((number <= 0) || ((uint32_t)number > (0xFFFFFFFFU / factor)))
+            return -1;
+        if (strcmp(option, "size") == 0)
+            fs->max_pages = ((uint32_t)number * factor + PAGE_SIZE - 1) / PAGE_SIZE;
+        else if (strcmp(option, "nr_inodes") == 0)
+            fs->max_inodes = (uint32_t)number * factor;
+        else
+            return -1;
+    }
+    return 0;
+}
+
+/// @brief Mounts a new, empty, tmpfs at the given path.
+/// @param path the path where we want to mount the tmpfs.
+/// @param args the mount options, it can be NULL.
+/// @return a pointer to the root VFS file.
+static vfs_file_t *tmpfs_mount_callback(const char *path, const char *args)
+{
+    pr_debug("tmpfs_mount_callback(%s, %s)\n", path, args);
+    tmpfs_t *fs = kmalloc(sizeof(tmpfs_t));
+    if (fs == NULL)
+        return NULL;
+    memset(fs, 0, sizeof(tmpfs_t));
+    fs->next_ino = 1;
+    if (tmpfs_parse_options(fs, args) < 0) {
+        pr_err("Wrong mount options `%s`.\n", args);
+        kfree(fs);
+        return NULL;
+    }
+    fs->root = tmpfs_inode_create(fs, NULL, basename(path), TMPFS_S_IFDIR | fs->root_mode);
+    if (fs->root == NULL) {
+        kfree(fs);
+        return NULL;
+    }
+    fs->root_file = tmpfs_create_file_struct(fs->root);
+    if (fs->root_file == NULL) {
+        tmpfs_inode_destroy(fs->root);
+        kfree(fs);
+        return NULL;
+    }
+    pr_debug("Mounted on `%s` (%d pages, %d inodes).\n", path, fs->max_pages, fs->max_inodes);
+    return fs->root_file;
+}
+
+/// Filesystem information.
+static file_system_type tmpfs_file_system_type = {
+    .name     = "tmpfs",
+    .fs_flags = 0,
+    .mount    = tmpfs_mount_callback
+};
+
+int tmpfs_initialize(void)
+{
+    tmpfs_inode_cache = KMEM_CREATE(tmpfs_inode_t);
+    if (tmpfs_inode_cache == NULL)
+        return 1;
+    vfs_register_filesystem(&tmpfs_file_system_type);
+    return 0;
+}
+
+int tmpfs_finalize(void)
+{
+    vfs_unregister_filesystem(&tmpfs_file_system_type);
+    return 0;
+}
@@ -19,6 +19,8 @@
 #include "klib/hashmap.h"
 #include "string.h"
 #include "fs/procfs.h"
+#include "fs/buffer_cache.h"
+#include "fs/blkdev.h"
 #include "assert.h"
 #include "libgen.h"
 #include "io/debug.h"
@@ -48,6 +50,9 @@ void vfs_init()
     // Initialize the caches for superblocks and files.
     vfs_superblock_cache = KMEM_CREATE(super_block_t);
     vfs_file_cache       = KMEM_CREATE(vfs_file_t);
+    // Initialize the block layer, and the cache for the blocks of block devices.
+    block_initialize();
+    buffer_cache_initialize();
     // Allocate the hashmap for the different filesystems.
     vfs_filesystems = hashmap_create(
         vfs_filesystems_max,
@@ -97,12 +102,11 @@ super_block_t *vfs_get_superblock(const char *absolute_path)
             }
         }
 #else
-        int len = strlen(superblock->path);
-        if (!strncmp(absolute_path, superblock->path, len)) {
-            if (len > last_sb_len) {
-                last_sb_len = len;
-                last_sb     = superblock;
-            }
+        size_t len = strlen(superblock->path);
+        // Only compare the mount points which are longer than the best match.
+        if ((len > last_sb_len) && !strncmp(absolute_path, superblock->path, len)) {
+            last_sb_len = len;
+            last_sb     = superblock;
         }
 #endif
     }
@@ -211,6 +215,31 @@ int vfs_ioctl(vfs_file_t *file, int request, void *data)
     return file->fs_operations->ioctl_f(file, request, data);
 }
 
+int vfs_fsync(vfs_file_t *file, int datasync)
+{
+    if (file->fs_operations->fsync_f == NULL) {
+        // Nothing is cached by the filesystem, e.g., procfs.
+        return -EINVAL;
+    }
+    return file->fs_operations->fsync_f(file, datasync);
+}
+
+int vfs_sync(void)
+{
+    int ret = 0;
+    list_for_each_decl(it, &vfs_super_blocks)
+    {
+        super_block_t *sb = list_entry(it, super_block_t, mounts);
+        // Filesystems which do not cache anything have no fsync.
+        if (sb->root && sb->root->fs_operations->fsync_f && (sb->root->fs_operations->fsync_f(sb->root, 0) < 0))
+            ret = -EIO;
+    }
+    // Write back the blocks which do not belong to a filesystem.
+    if (buffer_sync_device(NULL) < 0)
+        ret = -EIO;
+    return ret;
+}
+
 int vfs_unlink(const char *path)
 {
     // Allocate a variable for the path.
@@ -20,6 +20,9 @@
 #include "io/video.h"
 #include "stdint.h"
 #include "mem/kheap.h"
+#include "mem/zone_allocator.h"
+#include "mem/ksm.h"
+#include "fs/buffer_cache.h"
 #include "process/wait.h"
 #include "drivers/rtc.h"
 #include "descriptor_tables/isr.h"
@@ -83,9 +86,29 @@
 /// Mask used to set the divisor.
 #define PIT_MASK 0xFFu
 
+/// Port gating channel 2, and reading its output (bit 5).
+#define PIT_GATE2_PORT 0x61u
+
+/// Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count).
+#define PIT_CALIBRATION_CONFIGURATION 0xB0u
+
+/// Length of the calibration of the time stamp counter, in milliseconds.
+#define TSC_CALIBRATION_MS 10u
+
+/// Reads of the gate port after which the calibration gives up, about a
+/// second, should channel 2 never reach the end of the countdown.
+#define TSC_CALIBRATION_TIMEOUT 1000000u
+
+/// Bits dropped from the time stamp counter, so that 32 bits cover about an
+/// hour, and a millisecond times 1000 still fits 32 bits.
+#define TSC_SHIFT 12u
+
 /// The number of ticks since the system started its execution.
 static __volatile__ unsigned long timer_ticks = 0;
 
+/// Units of timer_get_cycles per millisecond, zero until calibrated.
+static uint32_t tsc_units_per_ms = 0;
+
 void timer_phase(const uint32_t hz)
 {
     // Calculate our divisor.
@@ -100,6 +123,13 @@ void timer_phase(const uint32_t hz)
 
 void timer_handler(pt_regs *reg)
 {
+    // The kernel was waiting for a device with interrupts enabled, we cannot
+    // switch process in the middle of a system call.
+    if ((reg->cs & 0x3) == 0) {
+        ++timer_ticks;
+        pic8259_send_eoi(IRQ_TIMER);
+        return;
+    }
     // Save current process fpu state.
     switch_fpu();
     // Check if a second has passed.
@@ -108,12 +138,25 @@ void timer_handler(pt_regs *reg)
     run_timer_softirq();
     // Perform the schedule.
     scheduler_run(reg);
+    // Prepare some pre-zeroed pages, more of them if nobody wants the CPU.
+    task_struct *current = scheduler_get_current_process();
+    if (current && (current->state == TASK_RUNNING))
+        zone_zero_pool_refill(ZONE_ZERO_POOL_BUSY_BATCH);
+    else
+        zone_zero_pool_refill(ZONE_ZERO_POOL_IDLE_BATCH);
+    // Look for identical pages to merge, every now and then.
+    if ((timer_ticks % KSM_SCAN_INTERVAL) == 0)
+        ksm_scan_pages(KSM_SCAN_BATCH);
     // Update graphics.
     video_update();
+    // The ack is sent to PIC only when all handlers terminated, except for
+    // the write back, which waits for the interrupts of the disk.
+    pic8259_send_eoi(IRQ_TIMER);
+    // Write back the dirty buffers which have been waiting for too long.
+    if ((timer_ticks % BUFFER_FLUSH_INTERVAL) == 0)
+        buffer_flush(BUFFER_FLUSH_BATCH);
     // Restore fpu state.
     unswitch_fpu();
-    // The ack is sent to PIC only when all handlers terminated!
-    pic8259_send_eoi(IRQ_TIMER);
 }
 
 void timer_install()
@@ -128,6 +171,45 @@ void timer_install()
     pic8259_irq_enable(IRQ_TIMER);
 }
 
+uint32_t timer_get_cycles(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc"
+                         : "=a"(lo), "=d"(hi));
+    return (lo >> TSC_SHIFT) | (hi << (32u - TSC_SHIFT));
+}
+
+void timer_calibrate_cycles(void)
+{
+    uint32_t count = (PIT_DIVISOR / 1000u) * TSC_CALIBRATION_MS;
+    // Open the gate of channel 2, keeping the speaker off.
+    outportb(PIT_GATE2_PORT, (inportb(PIT_GATE2_PORT) & ~0x02u) | 0x01u);
+    // Program a one-shot countdown, channel 0 keeps running untouched.
+    outportb(PIT_COMREG, PIT_CALIBRATION_CONFIGURATION);
+    outportb(PIT_DATAREG2, count & PIT_MASK);
+    outportb(PIT_DATAREG2, (count >> 8u) & PIT_MASK);
+    uint32_t start = timer_get_cycles(), timeout = TSC_CALIBRATION_TIMEOUT;
+    // The output goes high at the end of the countdown.
+    while (!(inportb(PIT_GATE2_PORT) & 0x20u)) {
+        if (--timeout == 0) {
+            pr_warning("Channel 2 of the PIT does not count, boot times are not measured.\n");
+            return;
+        }
+    }
+    tsc_units_per_ms = (timer_get_cycles() - start) / TSC_CALIBRATION_MS;
+    if (tsc_units_per_ms == 0)
+        tsc_units_per_ms = 1;
+    pr_debug("Time stamp counter: %u units per ms.\n", tsc_units_per_ms);
+}
+
+uint32_t timer_cycles_to_us(uint32_t cycles)
+{
+    if (tsc_units_per_ms == 0)
+        return 0;
+    // Split the division, the product would overflow 32 bits.
+    return (cycles / tsc_units_per_ms) * 1000u + ((cycles % tsc_units_per_ms) * 1000u) / tsc_units_per_ms;
+}
+
 uint64_t timer_get_seconds()
 {
     return timer_ticks / TICKS_PER_SECOND;
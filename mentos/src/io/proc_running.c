@@ -371,6 +371,26 @@ static inline ssize_t __procr_do_stat(char *buffer, size_t bufsize, task_struct
     return 1;
 }
 
+/// @brief Returns the data for the `/proc/<PID>/io` file.
+/// @param buffer the buffer where the data should be placed.
+/// @param bufsize the size of the buffer.
+/// @param task the task associated with the `/proc/<PID>` folder.
+/// @return size of the written data in buffer.
+static inline ssize_t __procr_do_io(char *buffer, size_t bufsize, task_struct *task)
+{
+    sprintf(buffer,
+            "rchar: %lu\n"
+            "wchar: %lu\n"
+            "syscr: %lu\n"
+            "syscw: %lu\n"
+            "read_bytes: %lu\n"
+            "write_bytes: %lu\n",
+            task->ioac.rchar, task->ioac.wchar,
+            task->ioac.syscr, task->ioac.syscw,
+            task->ioac.read_bytes, task->ioac.write_bytes);
+    return 1;
+}
+
 /// @brief Performs a read of files inside the `/proc/<PID>/` folder.
 /// @param file is the `/proc/<PID>/` folder, thus, it should be a `proc_dir_entry_t` data.
 /// @param buffer buffer where the read content must be placed.
@@ -398,6 +418,8 @@ static inline ssize_t __procr_read(vfs_file_t *file, char *buffer, off_t offset,
         ret = __procr_do_cmdline(support, BUFSIZ, task);
     else if (strcmp(entry->name, "stat") == 0)
         ret = __procr_do_stat(support, BUFSIZ, task);
+    else if (strcmp(entry->name, "io") == 0)
+        ret = __procr_do_io(support, BUFSIZ, task);
     // Copmute the amounts of bytes we want (and can) read.
     ssize_t bytes_to_read = max(0, min(strlen(support) - offset, nbyte));
     // Perform the read.
@@ -460,6 +482,16 @@ int procr_create_entry_pid(task_struct *entry)
         proc_entry->fs_operations  = &procr_fs_operations;
         proc_entry->data           = entry;
     }
+    {
+        // Create `/proc/[PID]/io`.
+        if ((proc_entry = proc_create_entry("io", proc_dir)) == NULL) {
+            pr_err("[task: %d] Cannot create proc entry `%s`.\n", entry->pid, path);
+            return -ENOENT;
+        }
+        proc_entry->sys_operations = &procr_sys_operations;
+        proc_entry->fs_operations  = &procr_fs_operations;
+        proc_entry->data           = entry;
+    }
     return 0;
 }
 
@@ -484,6 +516,11 @@ int procr_destroy_entry_pid(task_struct *entry)
         pr_err("[task: %d] Cannot destroy proc stat.\n", entry->pid);
         return -ENOENT;
     }
+    // Destroy `/proc/[PID]/io`.
+    if (proc_destroy_entry("io", proc_dir)) {
+        pr_err("[task: %d] Cannot destroy proc io.\n", entry->pid);
+        return -ENOENT;
+    }
     // Destroy `/proc/[PID]`.
     if (proc_rmdir(pid_str, NULL)) {
         pr_err("[task: %d] Cannot remove proc root directory `%s`.\n", entry->pid, pid_str);
@@ -11,6 +11,11 @@
 #include "sys/errno.h"
 #include "io/debug.h"
 #include "hardware/timer.h"
+#include "mem/swap.h"
+#include "fs/buffer_cache.h"
+#include "mem/zram.h"
+#include "mem/ksm.h"
+#include "fs/blkdev.h"
 
 static ssize_t procs_do_uptime(char *buffer, size_t bufsize);
 
@@ -24,6 +29,12 @@ static ssize_t procs_do_meminfo(char *buffer, size_t bufsize);
 
 static ssize_t procs_do_stat(char *buffer, size_t bufsize);
 
+static ssize_t procs_do_zram(char *buffer, size_t bufsize);
+
+static ssize_t procs_do_ksm(char *buffer, size_t bufsize);
+
+static ssize_t procs_do_diskstats(char *buffer, size_t bufsize);
+
 static ssize_t procs_read(vfs_file_t *file, char *buf, off_t offset, size_t nbyte)
 {
     if (file == NULL)
@@ -48,6 +59,12 @@ static ssize_t procs_read(vfs_file_t *file, char *buf, off_t offset, size_t nbyt
         ret = procs_do_meminfo(buffer, BUFSIZ);
     else if (strcmp(entry->name, "stat") == 0)
         ret = procs_do_stat(buffer, BUFSIZ);
+    else if (strcmp(entry->name, "zram") == 0)
+        ret = procs_do_zram(buffer, BUFSIZ);
+    else if (strcmp(entry->name, "ksm") == 0)
+        ret = procs_do_ksm(buffer, BUFSIZ);
+    else if (strcmp(entry->name, "diskstats") == 0)
+        ret = procs_do_diskstats(buffer, BUFSIZ);
     // Perform read.
     ssize_t it = 0;
     if (ret == 0) {
@@ -146,6 +163,36 @@ int procs_module_init()
     // Set the specific operations.
     system_entry->sys_operations = &procs_sys_operations;
     system_entry->fs_operations  = &procs_fs_operations;
+
+    // == /proc/zram ========================================================
+    if ((system_entry = proc_create_entry("zram", NULL)) == NULL) {
+        pr_err("Cannot create `/proc/zram`.\n");
+        return 1;
+    }
+    pr_debug("Created `/proc/zram` (%p)\n", system_entry);
+    // Set the specific operations.
+    system_entry->sys_operations = &procs_sys_operations;
+    system_entry->fs_operations  = &procs_fs_operations;
+
+    // == /proc/ksm =========================================================
+    if ((system_entry = proc_create_entry("ksm", NULL)) == NULL) {
+        pr_err("Cannot create `/proc/ksm`.\n");
+        return 1;
+    }
+    pr_debug("Created `/proc/ksm` (%p)\n", system_entry);
+    // Set the specific operations.
+    system_entry->sys_operations = &procs_sys_operations;
+    system_entry->fs_operations  = &procs_fs_operations;
+
+    // == /proc/diskstats ===================================================
+    if ((system_entry = proc_create_entry("diskstats", NULL)) == NULL) {
+        pr_err("Cannot create `/proc/diskstats`.\n");
+        return 1;
+    }
+    pr_debug("Created `/proc/diskstats` (%p)\n", system_entry);
+    // Set the specific operations.
+    system_entry->sys_operations = &procs_sys_operations;
+    system_entry->fs_operations  = &procs_fs_operations;
     return 0;
 }
 
@@ -184,22 +231,126 @@ static ssize_t procs_do_meminfo(char *buffer, size_t bufsize)
                         get_zone_free_space(GFP_USER),
            cached_space = get_zone_cached_space(GFP_KERNEL) +
                           get_zone_cached_space(GFP_USER),
-           used_space = total_space - free_space;
+           zeroed_space = (get_zone_zero_pool_pages(GFP_KERNEL) +
+                           get_zone_zero_pool_pages(GFP_HIGHUSER)) * PAGE_SIZE;
+    // Pre-zeroed pages are still free memory.
+    free_space += zeroed_space;
+    double used_space = total_space - free_space;
+    swap_info_t swap;
+    swap_get_info(&swap);
+    buffer_cache_info_t buffers;
+    buffer_cache_get_info(&buffers);
+    double swap_total = (double)swap.total_slots * PAGE_SIZE / (double)K,
+           swap_free  = (double)swap.free_slots * PAGE_SIZE / (double)K;
     total_space /= (double)K;
     free_space /= (double)K;
     cached_space /= (double)K;
+    zeroed_space /= (double)K;
     used_space /= (double)K;
     sprintf(
         buffer,
         "MemTotal : %12.2f Kb\n"
         "MemFree  : %12.2f Kb\n"
         "MemUsed  : %12.2f Kb\n"
-        "Cached   : %12.2f Kb\n",
-        total_space, free_space, used_space, cached_space);
+        "Cached   : %12.2f Kb\n"
+        "Zeroed   : %12.2f Kb\n"
+        "Buffers  : %12.2f Kb\n"
+        "Dirty    : %12u blocks\n"
+        "Writeback: %12u blocks\n"
+        "Flushed  : %12u blocks\n"
+        "SwapTotal: %12.2f Kb\n"
+        "SwapFree : %12.2f Kb\n"
+        "SwapIn   : %12u pages\n"
+        "SwapOut  : %12u pages\n",
+        total_space, free_space, used_space, cached_space, zeroed_space,
+        (double)buffers.size / (double)K, buffers.nr_dirty, buffers.nr_writeback, buffers.flushed,
+        swap_total, swap_free, swap.pswpin, swap.pswpout);
     return 0;
 }
 
 static ssize_t procs_do_stat(char *buffer, size_t bufsize)
 {
     return 0;
-}
\ No newline at end of file
+}
+
+static ssize_t procs_do_zram(char *buffer, size_t bufsize)
+{
+    zram_info_t zram;
+    zram_get_info(&zram);
+    // The ratio between the data we keep and the memory we use to keep it.
+    double ratio = zram.mem_used ? (double)zram.orig_data_size / (double)zram.mem_used : 0.0;
+    sprintf(
+        buffer,
+        "PagesStored : %12u pages\n"
+        "ZeroPages   : %12u pages\n"
+        "HugePages   : %12u pages\n"
+        "OrigData    : %12.2f Kb\n"
+        "ComprData   : %12.2f Kb\n"
+        "MemUsed     : %12.2f Kb\n"
+        "MemLimit    : %12.2f Kb\n"
+        "Ratio       : %12.2f\n"
+        "FailedWrites: %12u pages\n",
+        zram.pages_stored, zram.zero_pages, zram.huge_pages,
+        (double)zram.orig_data_size / (double)K,
+        (double)zram.compr_data_size / (double)K,
+        (double)zram.mem_used / (double)K,
+        (double)ZRAM_MAX_POOL_SIZE / (double)K,
+        ratio, zram.failed_writes);
+    return 0;
+}
+
+static ssize_t procs_do_ksm(char *buffer, size_t bufsize)
+{
+    ksm_info_t ksm;
+    ksm_get_info(&ksm);
+    sprintf(
+        buffer,
+        "PagesShared  : %12u pages\n"
+        "PagesSharing : %12u pages\n"
+        "PagesUnshared: %12u pages\n"
+        "PagesScanned : %12u pages\n"
+        "FullScans    : %12u\n"
+        "Saved        : %12.2f Kb\n",
+        ksm.pages_shared, ksm.pages_sharing, ksm.pages_unshared,
+        ksm.pages_scanned, ksm.full_scans,
+        (double)ksm.pages_sharing * PAGE_SIZE / (double)K);
+    return 0;
+}
+
+/// @brief Turns timer ticks into milliseconds, without overflowing.
+/// @param ticks the ticks.
+/// @return the milliseconds.
+static inline unsigned long procs_ticks_to_ms(unsigned long ticks)
+{
+    return (ticks / TICKS_PER_SECOND) * 1000UL + ((ticks % TICKS_PER_SECOND) * 1000UL) / TICKS_PER_SECOND;
+}
+
+static ssize_t procs_do_diskstats(char *buffer, size_t bufsize)
+{
+    // One line per device, with the columns of Linux without the device
+    // numbers, followed by the requests held by the driver and its queue
+    // depth. Sectors are always of 512 bytes.
+    block_stats_t stats;
+    size_t length = 0;
+    for (block_device_t *dev = block_next_device(NULL); dev; dev = block_next_device(dev)) {
+        // Leave room for a whole line.
+        if ((length + 160) > bufsize)
+            break;
+        block_get_stats(dev, &stats);
+        length += sprintf(
+            buffer + length,
+            "%s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %u %u\n",
+            dev->name,
+            stats.ios[BLOCK_READ], stats.merges[BLOCK_READ],
+            stats.sectors[BLOCK_READ] * (dev->sector_size / 512U),
+            procs_ticks_to_ms(stats.ticks[BLOCK_READ]),
+            stats.ios[BLOCK_WRITE], stats.merges[BLOCK_WRITE],
+            stats.sectors[BLOCK_WRITE] * (dev->sector_size / 512U),
+            procs_ticks_to_ms(stats.ticks[BLOCK_WRITE]),
+            stats.in_flight,
+            procs_ticks_to_ms(stats.io_ticks),
+            procs_ticks_to_ms(stats.time_in_queue),
+            dev->queue.nr_active, dev->queue_depth);
+    }
+    return 0;
+}
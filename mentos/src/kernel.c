@@ -15,9 +15,15 @@
 #include "fs/procfs.h"
 #include "devices/pci.h"
 #include "drivers/ata.h"
+#include "drivers/ahci.h"
+#include "drivers/virtio_blk.h"
+#include "drivers/ramdisk.h"
 #include "descriptor_tables/idt.h"
 #include "kernel.h"
 #include "mem/zone_allocator.h"
+#include "mem/swap.h"
+#include "mem/zram.h"
+#include "mem/ksm.h"
 #include "descriptor_tables/gdt.h"
 #include "system/syscall.h"
 #include "version.h"
@@ -26,6 +32,9 @@
 #include "io/debug.h"
 #include "drivers/fdc.h"
 #include "fs/ext2.h"
+#include "fs/tmpfs.h"
+#include "fs/initramfs.h"
+#include "sys/errno.h"
 #include "klib/irqflags.h"
 #include "drivers/keyboard/keyboard.h"
 #include "drivers/keyboard/keymap.h"
@@ -82,9 +91,24 @@ uintptr_t initial_esp = 0;
 /// The boot info.
 boot_info_t boot_info;
 
+/// When the boot started, see timer_get_cycles.
+static uint32_t boot_start;
+/// When the current boot phase started.
+static uint32_t boot_phase_start;
+
+/// @brief Logs the time spent in the current phase, and starts the next one.
+static inline void print_phase_time()
+{
+    uint32_t now = timer_get_cycles();
+    uint32_t us  = timer_cycles_to_us(now - boot_phase_start);
+    pr_notice("    done in %u.%03u ms\n", us / 1000U, us % 1000U);
+    boot_phase_start = now;
+}
+
 /// @brief Prints [OK] at the current row and column 60.
 static inline void print_ok()
 {
+    print_phase_time();
     unsigned y, width;
     video_get_cursor_position(NULL, &y);
     video_get_screen_size(&width, NULL);
@@ -95,6 +119,7 @@ static inline void print_ok()
 /// @brief Prints [FAIL] at the current row and column 60.
 static inline void print_fail()
 {
+    print_phase_time();
     unsigned y, width;
     video_get_cursor_position(NULL, &y);
     video_get_screen_size(&width, NULL);
@@ -102,6 +127,17 @@ static inline void print_fail()
     video_puts("[FAIL]\n");
 }
 
+/// @brief Prints [SKIP] at the current row and column 60.
+static inline void print_skip()
+{
+    print_phase_time();
+    unsigned y, width;
+    video_get_cursor_position(NULL, &y);
+    video_get_screen_size(&width, NULL);
+    video_move_cursor(width - 7, y);
+    video_puts("[SKIP]\n");
+}
+
 /// @brief Entry point of the kernel.
 /// @param boot_informations Information concerning the boot.
 /// @return The exit status of the kernel.
@@ -125,6 +161,13 @@ int kmain(boot_info_t *boot_informations)
     // work properly.
     keyboard_disable();
 
+    //==========================================================================
+    // Measure the time stamp counter, the ticks do not advance while the
+    // interrupts are disabled, and each phase logs how long it took.
+    timer_calibrate_cycles();
+    boot_start       = timer_get_cycles();
+    boot_phase_start = boot_start;
+
     //==========================================================================
     pr_notice("Initialize the video...\n");
     vga_initialize();
@@ -232,6 +275,39 @@ int kmain(boot_info_t *boot_informations)
     vfs_init();
     print_ok();
 
+    //==========================================================================
+    pr_notice("Initialize 'tmpfs'...\n");
+    printf("Initialize 'tmpfs'...");
+    if (tmpfs_initialize()) {
+        print_fail();
+        pr_emerg("Failed to register `tmpfs`!\n");
+        return 1;
+    }
+    print_ok();
+
+    //==========================================================================
+    // If the bootloader gave us an archive, it becomes the root filesystem, and
+    // programs are loaded from memory rather than from the disk.
+    pr_notice("Unpack initramfs...\n");
+    printf("Unpack initramfs...");
+    int initramfs = initramfs_initialize();
+    if (initramfs == 0) {
+        print_ok();
+    } else if (initramfs == -ENOENT) {
+        print_skip();
+    } else {
+        print_fail();
+        pr_emerg("Failed to unpack the initramfs!\n");
+        return 1;
+    }
+
+    //==========================================================================
+    // Enumerate the PCI devices once, the drivers search the resulting table.
+    pr_notice("Initialize PCI devices...\n");
+    printf("Initialize PCI devices...");
+    pr_notice("    Found %d devices.\n", pci_initialize());
+    print_ok();
+
     //==========================================================================
     // Scan for ata devices.
     pr_notice("Initialize ATA devices...\n");
@@ -242,6 +318,35 @@ int kmain(boot_info_t *boot_informations)
     }
     print_ok();
 
+    //==========================================================================
+    // Scan for the disks behind an AHCI controller.
+    pr_notice("Initialize AHCI devices...\n");
+    printf("Initialize AHCI devices...");
+    if (ahci_initialize()) {
+        pr_emerg("Failed to initialize AHCI devices!\n");
+        return 1;
+    }
+    print_ok();
+
+    //==========================================================================
+    // Scan for the paravirtual disks of the hypervisor.
+    pr_notice("Initialize virtio block devices...\n");
+    printf("Initialize virtio block devices...");
+    if (virtio_blk_initialize()) {
+        pr_emerg("Failed to initialize virtio block devices!\n");
+        return 1;
+    }
+    print_ok();
+
+    //==========================================================================
+    pr_notice("Initialize RAM disks...\n");
+    printf("Initialize RAM disks...");
+    if (ramdisk_initialize()) {
+        pr_emerg("Failed to initialize RAM disks!\n");
+        return 1;
+    }
+    print_ok();
+
     //==========================================================================
     pr_notice("Initialize EXT2 filesystem...\n");
     printf("Initialize EXT2 filesystem...");
@@ -254,10 +359,34 @@ int kmain(boot_info_t *boot_informations)
     //==========================================================================
     pr_notice("Mount EXT2 filesystem...\n");
     printf("Mount EXT2 filesystem...");
-    if (do_mount("ext2", "/", "/dev/hda")) {
+    if (initramfs == 0) {
+        // The disk is optional, when the root is in memory.
+        if (do_mount("ext2", INITRAMFS_DISK_PATH, "/dev/hda"))
+            print_fail();
+        else
+            print_ok();
+    } else if (do_mount("ext2", "/", "/dev/hda")) {
         pr_emerg("Failed to mount EXT2 filesystem...\n");
         return 1;
+    } else {
+        print_ok();
     }
+
+    //==========================================================================
+    pr_notice("Initialize swap area...\n");
+    printf("Initialize swap area...");
+    // Without a swap device, fall back to keeping the pages compressed in memory.
+    if (swap_initialize(SWAP_DEVICE) && swap_initialize_zram(ZRAM_NR_PAGES)) {
+        // Swapping is optional, keep booting without it.
+        print_fail();
+    } else {
+        print_ok();
+    }
+
+    //==========================================================================
+    pr_notice("Initialize page merging...\n");
+    printf("Initialize page merging...");
+    ksm_initialize();
     print_ok();
 
     //==========================================================================
@@ -279,6 +408,16 @@ int kmain(boot_info_t *boot_informations)
     }
     print_ok();
 
+    //==========================================================================
+    pr_notice("    Mounting 'tmpfs'...\n");
+    printf("    Mounting 'tmpfs'...");
+    // Everyone can create files in /tmp, but only remove their own.
+    if (do_mount("tmpfs", "/tmp", "size=16M,mode=1777")) {
+        pr_emerg("Failed to mount tmpfs at `/tmp`!\n");
+        return 1;
+    }
+    print_ok();
+
     //==========================================================================
     pr_notice("Initialize video procfs file...\n");
     printf("Initialize video procfs file...");
@@ -373,7 +512,8 @@ int kmain(boot_info_t *boot_informations)
     print_ok();
 
     // We have completed the booting procedure.
-    pr_notice("Booting done, jumping into init process.\n");
+    uint32_t boot_us = timer_cycles_to_us(timer_get_cycles() - boot_start);
+    pr_notice("Booting done in %u.%03u ms, jumping into init process.\n", boot_us / 1000U, boot_us % 1000U);
     // Print the welcome message.
     printf("\n                .: Welcome to MentOS :.\n\n");
     // Switch to the page directory of init.
@@ -0,0 +1,127 @@
+/// @file lzf.c
+/// @brief Fast LZ77-family compressor, compatible with the LZF format.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#include "klib/lzf.h"
+#include "stdint.h"
+#include "string.h"
+
+/// Logarithm of the size of the hash table.
+#define LZF_HLOG 12U
+/// Size of the hash table.
+#define LZF_HSIZE (1U << LZF_HLOG)
+/// Maximum length of a literal run.
+#define LZF_MAX_LIT (1U << 5U)
+/// Maximum distance of a back-reference.
+#define LZF_MAX_OFF (1U << 13U)
+/// Maximum length of a back-reference.
+#define LZF_MAX_REF ((1U << 8U) + (1U << 3U))
+/// Hashes the three bytes starting at `p`.
+#define LZF_HASH(p) \
+    (((((uint32_t)(p)[0] << 16U) | ((uint32_t)(p)[1] << 8U) | (p)[2]) * 2654435761U) >> (32U - LZF_HLOG))
+
+/// Last position (plus one) where each hashed sequence was seen.
+static uint32_t lzf_htab[LZF_HSIZE];
+
+size_t lzf_compress(const void *in_data, size_t in_len, void *out_data, size_t out_len)
+{
+    const uint8_t *in = (const uint8_t *)in_data, *ip = in, *in_end = in + in_len;
+    uint8_t *out = (uint8_t *)out_data, *op = out, *out_end = out + out_len;
+    // The length of the current literal run, and where its control byte goes.
+    uint32_t lit = 0;
+    uint8_t *lit_ctrl;
+    if ((in_len == 0) || (out_len == 0))
+        return 0;
+    memset(lzf_htab, 0, sizeof(lzf_htab));
+    // Open the first literal run.
+    lit_ctrl = op++;
+    while (ip < in_end) {
+        if ((ip + 2) < in_end) {
+            uint32_t hval = LZF_HASH(ip);
+            const uint8_t *ref = lzf_htab[hval] ? (in + lzf_htab[hval] - 1) : NULL;
+            lzf_htab[hval]  = (ip - in) + 1;
+            if (ref && ((uint32_t)(ip - ref - 1) < LZF_MAX_OFF) &&
+                (ref[0] == ip[0]) && (ref[1] == ip[1]) && (ref[2] == ip[2])) {
+                uint32_t off    = ip - ref - 1;
+                uint32_t maxlen = ((in_end - ip) < LZF_MAX_REF) ? (in_end - ip) : LZF_MAX_REF;
+                uint32_t len    = 3;
+                while ((len < maxlen) && (ref[len] == ip[len]))
+                    ++len;
+                // Close the literal run, or drop its unused control byte.
+                if (lit)
+                    *lit_ctrl = lit - 1;
+                else
+                    --op;
+                // Up to three bytes for the reference, and one for the next run.
+                if ((op + 4) > out_end)
+                    return 0;
+                ip += len;
+                len -= 2;
+                if (len < 7) {
+                    *op++ = (off >> 8U) + (len << 5U);
+                } else {
+                    *op++ = (off >> 8U) + (7U << 5U);
+                    *op++ = len - 7;
+                }
+                *op++ = off & 0xFFU;
+                // Open a new literal run.
+                lit      = 0;
+                lit_ctrl = op++;
+                continue;
+            }
+        }
+        // One byte for the literal, and one for the next run.
+        if ((op + 2) > out_end)
+            return 0;
+        *op++ = *ip++;
+        if (++lit == LZF_MAX_LIT) {
+            *lit_ctrl = lit - 1;
+            lit       = 0;
+            lit_ctrl  = op++;
+        }
+    }
+    // Close the last literal run, or drop its unused control byte.
+    if (lit)
+        *lit_ctrl = lit - 1;
+    else
+        --op;
+    return op - out;
+}
+
+size_t lzf_decompress(const void *in_data, size_t in_len, void *out_data, size_t out_len)
+{
+    const uint8_t *ip = (const uint8_t *)in_data, *in_end = ip + in_len;
+    uint8_t *out = (uint8_t *)out_data, *op = out, *out_end = out + out_len;
+    while (ip < in_end) {
+        uint32_t ctrl = *ip++;
+        if (ctrl < LZF_MAX_LIT) {
+            // Literal run.
+            ++ctrl;
+            if (((op + ctrl) > out_end) || ((ip + ctrl) > in_end))
+                return 0;
+            memcpy(op, ip, ctrl);
+            op += ctrl;
+            ip += ctrl;
+        } else {
+            // Back-reference.
+            uint32_t len = ctrl >> 5U;
+            if (len == 7) {
+                if (ip >= in_end)
+                    return 0;
+                len += *ip++;
+            }
+            if (ip >= in_end)
+                return 0;
+            uint32_t off = ((ctrl & 0x1FU) << 8U) + *ip++ + 1;
+            len += 2;
+            if (((op + len) > out_end) || (off > (uint32_t)(op - out)))
+                return 0;
+            // The regions may overlap, copy byte by byte.
+            const uint8_t *ref = op - off;
+            while (len--)
+                *op++ = *ref++;
+        }
+    }
+    return op - out;
+}
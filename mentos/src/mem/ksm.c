@@ -0,0 +1,285 @@
+/// @file ksm.c
+/// @brief Merging of anonymous user pages with the same content.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[KSM   ]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "mem/ksm.h"
+#include "mem/paging.h"
+#include "mem/vmem_map.h"
+#include "mem/slab.h"
+#include "process/scheduler.h"
+#include "process/wait.h"
+#include "io/debug.h"
+#include "assert.h"
+#include "string.h"
+
+/// @brief A page which is waiting for an identical one. We keep where it is
+/// mapped rather than the page itself, since it might be freed meanwhile.
+typedef struct ksm_item_t {
+    /// The hash of the content of the page, when it was scanned.
+    uint32_t checksum;
+    /// The process owning the page.
+    pid_t pid;
+    /// The address where the page is mapped.
+    uint32_t addr;
+    /// List of items inside the same bucket.
+    list_head list;
+} ksm_item_t;
+
+/// @brief The state of page merging.
+typedef struct ksm_t {
+    /// Merged pages, linked through their `slabs` field.
+    list_head stable[KSM_HASH_BUCKETS];
+    /// Pages scanned during the current pass, which are waiting for an
+    /// identical one.
+    list_head unstable[KSM_HASH_BUCKETS];
+    /// The process the scanner is pointing to.
+    pid_t scan_pid;
+    /// The address the scanner is pointing to.
+    uint32_t scan_addr;
+    /// Number of pages waiting for an identical one.
+    unsigned long pages_unshared;
+    /// Number of pages hashed so far.
+    unsigned long pages_scanned;
+    /// Number of complete passes.
+    unsigned long full_scans;
+} ksm_t;
+
+/// The state of page merging.
+static ksm_t ksm;
+/// Cache for the pages waiting for an identical one.
+static kmem_cache_t *ksm_item_cache;
+
+/// @brief Computes the hash of the content of a page (FNV-1a on words).
+/// @param data The content of the page.
+/// @return The hash.
+static inline uint32_t __ksm_checksum(const uint32_t *data)
+{
+    uint32_t hash = 2166136261U;
+    for (uint32_t i = 0; i < (PAGE_SIZE / sizeof(uint32_t)); ++i)
+        hash = (hash ^ data[i]) * 16777619U;
+    return hash;
+}
+
+/// @brief Compares the content of a page with the given data.
+/// @param page The page.
+/// @param data The data.
+/// @return 1 if they are the same, 0 otherwise.
+static int __ksm_same_page(page_t *page, const void *data)
+{
+    uint32_t vaddr = virt_map_physical_pages(page, 1);
+    if (vaddr == 0)
+        return 0;
+    int same = memcmp((void *)vaddr, data, PAGE_SIZE) == 0;
+    virt_unmap(vaddr);
+    return same;
+}
+
+/// @brief Checks if we can scan the pages of the given process.
+/// @param task The process.
+/// @return 1 if we can, 0 otherwise.
+static inline int __ksm_can_scan(task_struct *task)
+{
+    // Processes which are exiting do not have a valid memory descriptor, while
+    // the pages of the current one might be cached by the TLB.
+    if ((task->state == EXIT_ZOMBIE) || (task->state == EXIT_DEAD))
+        return 0;
+    return (task->mm != NULL) && (task != scheduler_get_current_process());
+}
+
+/// @brief Merges a page into a merged page with the same content.
+/// @param entry  The page table entry mapping the page.
+/// @param page   The page, which is freed.
+/// @param stable The merged page.
+static void __ksm_merge(page_table_entry_t *entry, page_t *page, page_t *stable)
+{
+    page_inc(stable);
+    // The process is not running, so the entry is not inside the TLB.
+    entry->frame = get_physical_address_from_page(stable) >> 12U;
+    entry->rw    = 0;
+    __free_pages(page);
+}
+
+/// @brief Searches a merged page with the given content.
+/// @param data     The content.
+/// @param checksum The hash of the content.
+/// @return The merged page, NULL if there is none.
+static page_t *__ksm_stable_search(const void *data, uint32_t checksum)
+{
+    list_for_each_decl(it, &ksm.stable[checksum % KSM_HASH_BUCKETS])
+    {
+        page_t *stable = list_entry(it, page_t, slabs);
+        if (__ksm_same_page(stable, data))
+            return stable;
+    }
+    return NULL;
+}
+
+/// @brief Searches a page waiting for an identical one with the given
+/// content, and turns it into a merged page.
+/// @param page     The page we are scanning, which must not be picked.
+/// @param data     The content.
+/// @param checksum The hash of the content.
+/// @return The new merged page, NULL if there is none.
+static page_t *__ksm_unstable_search(page_t *page, const void *data, uint32_t checksum)
+{
+    list_head *it, *tmp;
+    list_for_each_safe (it, tmp, &ksm.unstable[checksum % KSM_HASH_BUCKETS]) {
+        ksm_item_t *item = list_entry(it, ksm_item_t, list);
+        if (item->checksum != checksum)
+            continue;
+        // Check that the page is still there, and that it did not change.
+        task_struct *task = scheduler_get_running_process(item->pid);
+        if ((task == NULL) || !__ksm_can_scan(task))
+            continue;
+        page_table_entry_t *entry = mem_virtual_to_pte(task->mm->pgd, item->addr);
+        if ((entry == NULL) || !entry->present || !entry->user)
+            continue;
+        page_t *candidate = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+        if ((candidate == page) || !(candidate->flags & PG_SWAPPABLE) || (candidate->flags & PG_MLOCKED) ||
+            (page_count(candidate) != 1))
+            continue;
+        if (!__ksm_same_page(candidate, data))
+            continue;
+        // The page is no longer waiting.
+        list_head_del(&item->list);
+        kmem_cache_free(item);
+        --ksm.pages_unshared;
+        // Turn it into a read-only merged page.
+        entry->rw         = 0;
+        candidate->flags  = PG_MERGED;
+        list_head_add_tail(&candidate->slabs, &ksm.stable[checksum % KSM_HASH_BUCKETS]);
+        return candidate;
+    }
+    return NULL;
+}
+
+/// @brief Drops all the pages waiting for an identical one.
+static void __ksm_unstable_clear(void)
+{
+    for (uint32_t i = 0; i < KSM_HASH_BUCKETS; ++i) {
+        list_head *it;
+        while ((it = list_head_pop(&ksm.unstable[i])) != NULL)
+            kmem_cache_free(list_entry(it, ksm_item_t, list));
+    }
+    ksm.pages_unshared = 0;
+}
+
+/// @brief Hashes the page mapped by the entry, and merges it if there is
+/// another one with the same content.
+/// @param task  The process owning the page.
+/// @param addr  The address where the page is mapped.
+/// @param entry The page table entry.
+/// @return 1 if the page was hashed, 0 otherwise.
+static int __ksm_scan_entry(task_struct *task, uint32_t addr, page_table_entry_t *entry)
+{
+    page_t *page = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+    // Only single anonymous pages, which are not shared nor locked.
+    if (!(page->flags & PG_SWAPPABLE) || (page->flags & PG_MLOCKED) || (page_count(page) != 1))
+        return 0;
+    uint32_t vaddr = virt_map_physical_pages(page, 1);
+    if (vaddr == 0)
+        return 0;
+    uint32_t checksum = __ksm_checksum((uint32_t *)vaddr);
+    ++ksm.pages_scanned;
+    // First, look for a page which is already merged, then for one which is
+    // waiting for an identical page.
+    page_t *stable = __ksm_stable_search((void *)vaddr, checksum);
+    if (stable == NULL)
+        stable = __ksm_unstable_search(page, (void *)vaddr, checksum);
+    virt_unmap(vaddr);
+    if (stable) {
+        __ksm_merge(entry, page, stable);
+        return 1;
+    }
+    // Wait for an identical page.
+    ksm_item_t *item = kmem_cache_alloc(ksm_item_cache, GFP_KERNEL);
+    if (item) {
+        item->checksum = checksum;
+        item->pid      = task->pid;
+        item->addr     = addr;
+        list_head_add_tail(&item->list, &ksm.unstable[checksum % KSM_HASH_BUCKETS]);
+        ++ksm.pages_unshared;
+    }
+    return 1;
+}
+
+void ksm_initialize(void)
+{
+    memset(&ksm, 0, sizeof(ksm_t));
+    for (uint32_t i = 0; i < KSM_HASH_BUCKETS; ++i) {
+        list_head_init(&ksm.stable[i]);
+        list_head_init(&ksm.unstable[i]);
+    }
+    ksm_item_cache = KMEM_CREATE(ksm_item_t);
+}
+
+unsigned int ksm_scan_pages(unsigned int count)
+{
+    unsigned int scanned = 0, visited = 0;
+    if (ksm_item_cache == NULL)
+        return 0;
+    list_head *process_list = scheduler_get_process_list();
+    list_for_each_decl(it, process_list)
+    {
+        task_struct *task = list_entry(it, task_struct, run_list);
+        // Move forward up to the process pointed by the scanner.
+        if ((task->pid < ksm.scan_pid) || !__ksm_can_scan(task))
+            continue;
+        uint32_t start = (task->pid == ksm.scan_pid) ? ksm.scan_addr : 0;
+        list_for_each_decl(it_segment, &task->mm->mmap_list)
+        {
+            vm_area_struct_t *segment = list_entry(it_segment, vm_area_struct_t, vm_list);
+            for (uint32_t addr = max(segment->vm_start, start); addr < segment->vm_end; addr += PAGE_SIZE) {
+                if ((scanned == count) || (visited == KSM_SCAN_MAX_ENTRIES)) {
+                    // Leave the scanner here.
+                    ksm.scan_pid  = task->pid;
+                    ksm.scan_addr = addr;
+                    return scanned;
+                }
+                ++visited;
+                page_table_entry_t *entry = mem_virtual_to_pte(task->mm->pgd, addr);
+                if ((entry == NULL) || !entry->present || !entry->user || entry->global)
+                    continue;
+                scanned += __ksm_scan_entry(task, addr, entry);
+            }
+        }
+    }
+    // We went through all the processes, pages which did not find an identical
+    // one will be hashed again during the next pass, if they did not change.
+    __ksm_unstable_clear();
+    ksm.scan_pid  = 0;
+    ksm.scan_addr = 0;
+    ++ksm.full_scans;
+    return scanned;
+}
+
+void ksm_unmerge_page(page_t *page)
+{
+    assert((page->flags & PG_MERGED) && "The page is not merged.");
+    list_head_del(&page->slabs);
+    page->flags &= ~PG_MERGED;
+}
+
+void ksm_get_info(ksm_info_t *info)
+{
+    memset(info, 0, sizeof(ksm_info_t));
+    for (uint32_t i = 0; i < KSM_HASH_BUCKETS; ++i) {
+        list_for_each_decl(it, &ksm.stable[i])
+        {
+            page_t *stable = list_entry(it, page_t, slabs);
+            ++info->pages_shared;
+            info->pages_sharing += page_count(stable) - 1;
+        }
+    }
+    info->pages_unshared = ksm.pages_unshared;
+    info->pages_scanned  = ksm.pages_scanned;
+    info->full_scans     = ksm.full_scans;
+}
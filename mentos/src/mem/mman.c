@@ -0,0 +1,137 @@
+/// @file mman.c
+/// @brief Memory management hints and locking system calls.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[MMAN  ]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "system/syscall.h"
+#include "process/scheduler.h"
+#include "mem/paging.h"
+#include "io/debug.h"
+#include "sys/errno.h"
+#include "sys/mman.h"
+
+/// @brief Checks that the whole range is mapped by the memory of the process.
+/// @param mm    The memory descriptor.
+/// @param start The first page of the range.
+/// @param end   The end of the range, aligned to a page.
+/// @return 1 if it is mapped, 0 otherwise.
+static int __mman_range_is_mapped(mm_struct_t *mm, uint32_t start, uint32_t end)
+{
+    for (uint32_t addr = start; addr < end;) {
+        vm_area_struct_t *segment = find_vm_area(mm, addr);
+        if (segment == NULL)
+            return 0;
+        addr = segment->vm_end;
+    }
+    return 1;
+}
+
+/// @brief Sets the access pattern hints of the areas overlapping the range.
+/// @param mm    The memory descriptor.
+/// @param start The first page of the range.
+/// @param end   The end of the range, aligned to a page.
+/// @param flags The hints.
+static void __mman_set_hints(mm_struct_t *mm, uint32_t start, uint32_t end, unsigned short flags)
+{
+    // Areas are not split, the hints apply to the whole areas.
+    for (uint32_t addr = start; addr < end;) {
+        vm_area_struct_t *segment = find_vm_area(mm, addr);
+        segment->vm_flags &= ~(VM_SEQ_READ | VM_RAND_READ);
+        segment->vm_flags |= flags;
+        addr = segment->vm_end;
+    }
+}
+
+/// @brief Locks, or unlocks, the pages of the range.
+/// @param addr   The starting address of the range.
+/// @param length The length of the range.
+/// @param lock   1 to lock the pages, 0 to unlock them.
+/// @return 0 on success, a negative error code on failure.
+static int __mman_do_mlock(const void *addr, size_t length, int lock)
+{
+    task_struct *current = scheduler_get_current_process();
+    uint32_t start       = (uint32_t)addr & ~(PAGE_SIZE - 1);
+    uint32_t end         = ((uint32_t)addr + length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (end < start)
+        return -EINVAL;
+    if (!__mman_range_is_mapped(current->mm, start, end))
+        return -ENOMEM;
+    for (uint32_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+        page_table_entry_t *entry;
+        if (lock) {
+            // Bring in the page, with a private copy since it cannot be shared.
+            if (mem_populate_page(current->mm->pgd, vaddr, 1) < 0)
+                return -ENOMEM;
+        }
+        entry = mem_virtual_to_pte(current->mm->pgd, vaddr);
+        if ((entry == NULL) || !entry->present)
+            continue;
+        page_t *page = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+        if (lock)
+            page->flags |= PG_MLOCKED;
+        else
+            page->flags &= ~PG_MLOCKED;
+    }
+    return 0;
+}
+
+int sys_madvise(void *addr, size_t length, int advice)
+{
+    task_struct *current = scheduler_get_current_process();
+    uint32_t start       = (uint32_t)addr;
+    uint32_t end         = (start + length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if ((start & (PAGE_SIZE - 1)) || (end < start))
+        return -EINVAL;
+    if (!__mman_range_is_mapped(current->mm, start, end))
+        return -ENOMEM;
+    switch (advice) {
+    case MADV_NORMAL:
+        __mman_set_hints(current->mm, start, end, 0);
+        break;
+    case MADV_RANDOM:
+        __mman_set_hints(current->mm, start, end, VM_RAND_READ);
+        break;
+    case MADV_SEQUENTIAL:
+        __mman_set_hints(current->mm, start, end, VM_SEQ_READ);
+        break;
+    case MADV_WILLNEED:
+        // Populate the pages now, rather than on the first access.
+        for (uint32_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE)
+            mem_populate_page(current->mm->pgd, vaddr, 0);
+        break;
+    case MADV_DONTNEED: {
+        // Locked pages cannot be discarded, as on Linux reject the whole range.
+        for (uint32_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+            page_table_entry_t *entry = mem_virtual_to_pte(current->mm->pgd, vaddr);
+            if (entry && entry->present &&
+                (get_page_from_physical_address(entry->frame * PAGE_SIZE)->flags & PG_MLOCKED))
+                return -EINVAL;
+        }
+        unsigned int discarded = 0;
+        for (uint32_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE)
+            discarded += (mem_discard_page(current->mm->pgd, vaddr) > 0);
+        pr_debug("Discarded %d pages of process %d.\n", discarded, current->pid);
+        break;
+    }
+    default:
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int sys_mlock(const void *addr, size_t length)
+{
+    return __mman_do_mlock(addr, length, 1);
+}
+
+int sys_munlock(const void *addr, size_t length)
+{
+    return __mman_do_mlock(addr, length, 0);
+}
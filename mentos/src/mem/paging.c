@@ -15,6 +15,9 @@
 #include "mem/vmem_map.h"
 #include "mem/zone_allocator.h"
 #include "mem/kheap.h"
+#include "mem/swap.h"
+#include "mem/ksm.h"
+#include "process/scheduler.h"
 #include "io/debug.h"
 #include "assert.h"
 #include "string.h"
@@ -102,6 +105,7 @@ uint32_t create_vm_area(mm_struct_t *mm,
     new_segment->vm_start = vm_start;
     new_segment->vm_end   = vm_start + size;
     new_segment->vm_mm    = mm;
+    new_segment->vm_flags = 0;
 
     // Update memory descriptor list of vm_area_struct.
     list_head_add(&new_segment->vm_list, &mm->mmap_list);
@@ -261,13 +265,10 @@ static void __page_handle_cow(page_table_entry_t *entry)
         entry->kernel_cow = 0;
         // Check if the entry is not present (allocated).
         if (!entry->present) {
-            // Allocate a new page.
-            page_t *page = _alloc_pages(GFP_HIGHUSER, 0);
-            // Clear the new page.
-            uint32_t vaddr = virt_map_physical_pages(page, 1);
-            memset((void *)vaddr, 0, PAGE_SIZE);
-            // Unmap the virtual address.
-            virt_unmap(vaddr);
+            // Allocate a new zeroed page, possibly from the pre-zeroed pool.
+            page_t *page = _alloc_pages(GFP_HIGHUSER | __GFP_ZERO, 0);
+            // The page belongs only to this entry, so it can be swapped out.
+            page->flags |= PG_SWAPPABLE;
             // Set it as current table entry frame.
             entry->frame = get_physical_address_from_page(page) >> 12U;
             // Set it as allocated.
@@ -278,6 +279,76 @@ static void __page_handle_cow(page_table_entry_t *entry)
     kernel_panic("Page not cow!");
 }
 
+/// @brief Handles a write on a read-only page which is shared with other
+/// processes, by giving the writer a private copy.
+/// @param entry The page table entry.
+static void __page_handle_shared(page_table_entry_t *entry)
+{
+    page_t *page = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+    if (!(page->flags & PG_MERGED))
+        kernel_panic("Page not shared!");
+    if (page_count(page) == 1) {
+        // We are the last user, take the page back.
+        ksm_unmerge_page(page);
+    } else {
+        page_t *copy = _alloc_pages(GFP_HIGHUSER, 0);
+        // Both pages might be in highmem.
+        uint32_t src = virt_map_physical_pages(page, 1);
+        uint32_t dst = virt_map_physical_pages(copy, 1);
+        if (!src || !dst)
+            kernel_panic("Failed to map the pages for copy-on-write!");
+        memcpy((void *)dst, (void *)src, PAGE_SIZE);
+        virt_unmap(src);
+        virt_unmap(dst);
+        page_dec(page);
+        page = copy;
+        entry->frame = get_physical_address_from_page(page) >> 12U;
+    }
+    // The page belongs only to this entry, so it can be swapped out.
+    page->flags |= PG_SWAPPABLE;
+    entry->rw = 1;
+}
+
+/// @brief Handles a fault on a not-present page table entry.
+/// @param entry The page table entry.
+static void __page_handle_not_present(page_table_entry_t *entry)
+{
+    // Check if the page has been swapped out.
+    if (pte_is_swapped(entry)) {
+        if (swap_in(entry) < 0)
+            kernel_panic("Failed to swap in the page!");
+        return;
+    }
+    // Check if the page is Copy on Write (CoW).
+    __page_handle_cow(entry);
+}
+
+/// @brief Populates the pages following the faulting one, if the area they
+/// belong to is accessed sequentially, so that we take a single fault. Pages
+/// which were swapped out are read back too.
+/// @param pgdir         The current page directory.
+/// @param faulting_addr The faulting address.
+static void __page_fault_around(page_directory_t *pgdir, uint32_t faulting_addr)
+{
+    task_struct *current = scheduler_get_current_process();
+    // Only for the memory of the current process.
+    if ((current == NULL) || (current->mm == NULL) || (current->mm->pgd != pgdir))
+        return;
+    vm_area_struct_t *segment = find_vm_area(current->mm, faulting_addr);
+    if ((segment == NULL) || !(segment->vm_flags & VM_SEQ_READ))
+        return;
+    uint32_t addr = (faulting_addr & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+    for (uint32_t i = 0; (i < FAULT_AROUND_PAGES) && (addr < segment->vm_end); ++i, addr += PAGE_SIZE) {
+        page_table_entry_t *entry = mem_virtual_to_pte(pgdir, addr);
+        if ((entry == NULL) || entry->present)
+            continue;
+        if (entry->kernel_cow || pte_is_swapped(entry)) {
+            __page_handle_not_present(entry);
+            paging_flush_tlb_single(addr);
+        }
+    }
+}
+
 static page_table_t *__mem_pg_entry_alloc(page_dir_entry_t *entry, uint32_t flags)
 {
     if (!entry->present) {
@@ -352,15 +423,20 @@ void page_fault_handler(pt_regs *f)
     if (virtual_check_address(faulting_addr)) {
         // Get the original page table entry from the virtually mapped one.
         page_table_entry_t *orig_entry = (page_table_entry_t *)(*(uint32_t *)entry);
-        // Check if the page is Copy on Write (CoW).
-        __page_handle_cow(orig_entry);
+        // Check if the page is swapped out, or Copy on Write (CoW).
+        __page_handle_not_present(orig_entry);
         // Update the page table entry frame.
         entry->frame = orig_entry->frame;
         // Update the entry flags.
         __set_pg_table_flags(entry, MM_PRESENT | MM_RW | MM_GLOBAL | MM_COW | MM_UPDADDR);
+    } else if ((f->err_code & (ERR_PRESENT | ERR_RW)) == (ERR_PRESENT | ERR_RW)) {
+        // Write on a present read-only page, which is shared.
+        __page_handle_shared(entry);
     } else {
-        // Check if the page is Copy on Write (CoW).
-        __page_handle_cow(entry);
+        // Check if the page is swapped out, or Copy on Write (CoW).
+        __page_handle_not_present(entry);
+        // Populate the following pages too, if they are accessed sequentially.
+        __page_fault_around(lowmem_dir, faulting_addr);
     }
     // Invalidate the page table entry.
     paging_flush_tlb_single(faulting_addr);
@@ -424,6 +500,102 @@ static pg_iter_entry_t __pg_iter_next(page_iterator_t *iter)
     return result;
 }
 
+page_table_entry_t *mem_virtual_to_pte(page_directory_t *pgdir, uint32_t vaddr)
+{
+    uint32_t virt_pfn = vaddr / PAGE_SIZE;
+    // Get the directory entry.
+    page_dir_entry_t *direntry = &pgdir->entries[virt_pfn / 1024];
+    if (!direntry->present)
+        return NULL;
+    // Get the page table.
+    page_table_t *table = (page_table_t *)get_lowmem_address_from_page(mem_map + direntry->frame);
+    return &table->pages[virt_pfn % 1024];
+}
+
+vm_area_struct_t *find_vm_area(mm_struct_t *mm, uint32_t vaddr)
+{
+    // Check the last area we found first.
+    if (mm->mmap_cache && (vaddr >= mm->mmap_cache->vm_start) && (vaddr < mm->mmap_cache->vm_end))
+        return mm->mmap_cache;
+    vm_area_struct_t *segment;
+    list_for_each_decl(it, &mm->mmap_list)
+    {
+        segment = list_entry(it, vm_area_struct_t, vm_list);
+        if ((vaddr >= segment->vm_start) && (vaddr < segment->vm_end)) {
+            mm->mmap_cache = segment;
+            return segment;
+        }
+    }
+    return NULL;
+}
+
+int mem_populate_page(page_directory_t *pgdir, uint32_t vaddr, int write)
+{
+    page_table_entry_t *entry = mem_virtual_to_pte(pgdir, vaddr);
+    if (entry == NULL)
+        return -1;
+    if (!entry->present) {
+        if (!entry->kernel_cow && !pte_is_swapped(entry))
+            return -1;
+        __page_handle_not_present(entry);
+    } else if (write && !entry->rw) {
+        // Only merged pages are mapped read-only.
+        page_t *page = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+        if (page->flags & PG_MERGED)
+            __page_handle_shared(entry);
+    }
+    paging_flush_tlb_single(vaddr);
+    return 0;
+}
+
+int mem_discard_page(page_directory_t *pgdir, uint32_t vaddr)
+{
+    page_table_entry_t *entry = mem_virtual_to_pte(pgdir, vaddr);
+    if (entry == NULL)
+        return 0;
+    if (pte_is_swapped(entry)) {
+        // Keep the protection bits, the slot is released.
+        unsigned int rw = entry->rw, user = entry->user;
+        swap_free_entry(entry);
+        entry->rw   = rw;
+        entry->user = user;
+    } else if (entry->present) {
+        page_t *page = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+        if (page->flags & PG_MLOCKED)
+            return -1;
+        // Pages belonging to a larger block can only be freed with the block,
+        // clear them in place instead.
+        if (!(page->flags & (PG_SWAPPABLE | PG_MERGED))) {
+            uint32_t addr = virt_map_physical_pages(page, 1);
+            if (!addr)
+                kernel_panic("Failed to map the page to clear!");
+            memset((void *)addr, 0, PAGE_SIZE);
+            virt_unmap(addr);
+            return 0;
+        }
+        if ((page->flags & PG_MERGED) && (page_count(page) > 1)) {
+            page_dec(page);
+        } else {
+            if (page->flags & PG_MERGED)
+                ksm_unmerge_page(page);
+            __free_pages(page);
+        }
+        // Merged pages are mapped read-only.
+        entry->rw      = 1;
+        entry->present = 0;
+    } else {
+        return 0;
+    }
+    // The next access gets a new zeroed page.
+    entry->frame      = 0;
+    entry->accessed   = 0;
+    entry->dirty      = 0;
+    entry->available  = 1;
+    entry->kernel_cow = 1;
+    paging_flush_tlb_single(vaddr);
+    return 1;
+}
+
 page_t *mem_virtual_to_page(page_directory_t *pgdir, uint32_t virt_start, size_t *size)
 {
     uint32_t virt_pfn        = virt_start / PAGE_SIZE;
@@ -490,7 +662,7 @@ void mem_clone_vm_area(page_directory_t *src_pgd,
         pg_iter_entry_t src_it = __pg_iter_next(&src_iter);
         pg_iter_entry_t dst_it = __pg_iter_next(&dst_iter);
 
-        if (src_it.entry->kernel_cow) {
+        if (src_it.entry->kernel_cow || pte_is_swapped(src_it.entry)) {
             *(uint32_t *)dst_it.entry = (uint32_t)src_it.entry;
             // This is to make it clear that the page is not present,
             // can be omitted because the .entry address is aligned to 4 bytes boundary
@@ -586,6 +758,17 @@ void destroy_process_image(mm_struct_t *mm)
         uint32_t area_start = segment->vm_start;
 
         while (size > 0) {
+            page_table_entry_t *entry = mem_virtual_to_pte(mm->pgd, area_start);
+            // Pages which are not present have no frame to free, but they
+            // might be holding a slot of the swap area.
+            if (entry && !entry->present) {
+                if (pte_is_swapped(entry))
+                    swap_free_entry(entry);
+                size -= min(size, PAGE_SIZE);
+                area_start += PAGE_SIZE;
+                continue;
+            }
+
             size_t area_size = size;
             page_t *phy_page = mem_virtual_to_page(mm->pgd, area_start, &area_size);
 
@@ -597,6 +780,8 @@ void destroy_process_image(mm_struct_t *mm)
                     page_dec(phy_page + i);
                 }
             } else {
+                if (phy_page->flags & PG_MERGED)
+                    ksm_unmerge_page(phy_page);
                 __free_pages(phy_page);
             }
 
@@ -0,0 +1,371 @@
+/// @file swap.c
+/// @brief Swapping of anonymous user pages to a block device, or to a
+/// compressed in-memory store.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[SWAP  ]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "mem/swap.h"
+#include "mem/zram.h"
+#include "mem/vmem_map.h"
+#include "mem/slab.h"
+#include "process/scheduler.h"
+#include "process/wait.h"
+#include "fs/vfs.h"
+#include "io/debug.h"
+#include "assert.h"
+#include "string.h"
+#include "fcntl.h"
+
+/// The signature written by `mkswap` at the end of the first page.
+#define SWAP_MAGIC "SWAPSPACE2"
+/// The length of the signature.
+#define SWAP_MAGIC_LEN 10
+/// The maximum number of slots, limited by the size of the `frame` field.
+#define SWAP_MAX_SLOTS (1U << 20U)
+
+/// @brief The header of a swap area, as written by `mkswap`.
+typedef struct swap_header_t {
+    /// Space for the disk label, or a boot sector.
+    char bootbits[1024];
+    /// The version of the swap area.
+    uint32_t version;
+    /// The index of the last usable page.
+    uint32_t last_page;
+    /// The number of bad pages.
+    uint32_t nr_badpages;
+    /// The UUID of the swap area.
+    uint8_t uuid[16];
+    /// The label of the swap area.
+    char volume_name[16];
+    /// Unused space.
+    uint32_t padding[117];
+    /// The list of bad pages.
+    uint32_t badpages[1];
+} swap_header_t;
+
+/// @brief The swap area.
+typedef struct swap_area_t {
+    /// The block device.
+    vfs_file_t *file;
+    /// If pages are kept compressed in memory, rather than on the device.
+    int zram;
+    /// One bit for each slot, set when the slot is used.
+    uint32_t *bitmap;
+    /// The number of slots, including the one holding the header.
+    uint32_t nr_slots;
+    /// The number of free slots.
+    uint32_t free_slots;
+    /// The bitmap word from which we start searching for free slots.
+    uint32_t hint;
+    /// The process the clock hand is pointing to.
+    pid_t clock_pid;
+    /// The address the clock hand is pointing to.
+    uint32_t clock_addr;
+    /// Number of pages read back from the swap area.
+    unsigned long pswpin;
+    /// Number of pages written to the swap area.
+    unsigned long pswpout;
+} swap_area_t;
+
+/// The only swap area.
+static swap_area_t swap_area;
+
+/// @brief Marks the slot as used.
+/// @param slot The index of the slot.
+static inline void __swap_set_slot(uint32_t slot)
+{
+    swap_area.bitmap[slot / 32U] |= (1U << (slot % 32U));
+    --swap_area.free_slots;
+}
+
+/// @brief Marks the slot as free.
+/// @param slot The index of the slot.
+static inline void __swap_clear_slot(uint32_t slot)
+{
+    assert((swap_area.bitmap[slot / 32U] & (1U << (slot % 32U))) && "The swap slot is already free.");
+    swap_area.bitmap[slot / 32U] &= ~(1U << (slot % 32U));
+    ++swap_area.free_slots;
+    // Drop the compressed copy of the page.
+    if (swap_area.zram)
+        zram_free_page(slot);
+    // Start the next search from here.
+    if ((slot / 32U) < swap_area.hint)
+        swap_area.hint = slot / 32U;
+}
+
+/// @brief Allocates a free slot.
+/// @return The index of the slot, 0 if the swap area is full.
+static uint32_t __swap_alloc_slot(void)
+{
+    uint32_t nr_words = (swap_area.nr_slots + 31U) / 32U;
+    if (swap_area.free_slots == 0)
+        return 0;
+    for (uint32_t word = swap_area.hint; word < nr_words; ++word) {
+        // Skip the words which are completely used.
+        if (swap_area.bitmap[word] == 0xFFFFFFFFU)
+            continue;
+        for (uint32_t bit = 0; bit < 32U; ++bit) {
+            if (!(swap_area.bitmap[word] & (1U << bit))) {
+                uint32_t slot = (word * 32U) + bit;
+                if (slot >= swap_area.nr_slots)
+                    return 0;
+                __swap_set_slot(slot);
+                swap_area.hint = word;
+                return slot;
+            }
+        }
+    }
+    return 0;
+}
+
+/// @brief Transfers a page from/to the swap area.
+/// @param page  The page.
+/// @param slot  The index of the slot.
+/// @param write 1 to write the page to the slot, 0 to read it.
+/// @return 0 on success, -1 on failure.
+static int __swap_transfer(page_t *page, uint32_t slot, int write)
+{
+    ssize_t ret;
+    // Highmem pages must be temporarily mapped.
+    uint32_t vaddr = virt_map_physical_pages(page, 1);
+    if (vaddr == 0) {
+        pr_err("Failed to map the page for swapping.\n");
+        return -1;
+    }
+    if (swap_area.zram)
+        ret = (write ? zram_write_page(slot, (void *)vaddr) : zram_read_page(slot, (void *)vaddr)) ? -1 : PAGE_SIZE;
+    else if (write)
+        ret = vfs_write(swap_area.file, (void *)vaddr, slot * PAGE_SIZE, PAGE_SIZE);
+    else
+        ret = vfs_read(swap_area.file, (void *)vaddr, slot * PAGE_SIZE, PAGE_SIZE);
+    virt_unmap(vaddr);
+    if (ret != PAGE_SIZE) {
+        pr_err("Failed to %s swap slot %d.\n", write ? "write" : "read", slot);
+        return -1;
+    }
+    return 0;
+}
+
+/// @brief Writes the page mapped by the entry to the swap area, and frees it.
+/// @param entry The page table entry.
+/// @return 1 if the page was swapped out, 0 otherwise.
+static int __swap_out_entry(page_table_entry_t *entry)
+{
+    page_t *page  = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+    uint32_t slot = __swap_alloc_slot();
+    if (slot == 0)
+        return 0;
+    if (__swap_transfer(page, slot, 1) < 0) {
+        __swap_clear_slot(slot);
+        return 0;
+    }
+    // Keep the protection bits, so that the page is restored as it was.
+    entry->present   = 0;
+    entry->accessed  = 0;
+    entry->dirty     = 0;
+    entry->available = PTE_AVAILABLE_SWAP;
+    entry->frame     = slot;
+    // Give the page back.
+    __free_pages(page);
+    ++swap_area.pswpout;
+    return 1;
+}
+
+/// @brief Checks if we can steal pages from the given process.
+/// @param task The process.
+/// @return 1 if we can, 0 otherwise.
+static inline int __swap_can_reclaim_from(task_struct *task)
+{
+    // Processes which are exiting do not have a valid memory descriptor, while
+    // the memory of the current one might be in use by the kernel right now.
+    if ((task->state == EXIT_ZOMBIE) || (task->state == EXIT_DEAD))
+        return 0;
+    return (task->mm != NULL) && (task != scheduler_get_current_process());
+}
+
+/// @brief Advances the clock hand over the memory of a process.
+/// @param task  The process.
+/// @param start The address from which we resume scanning.
+/// @param count The number of pages we want to free.
+/// @return The number of pages swapped out.
+static unsigned int __swap_scan_task(task_struct *task, uint32_t start, unsigned int count)
+{
+    unsigned int reclaimed = 0;
+    vm_area_struct_t *segment;
+    list_for_each_decl(it, &task->mm->mmap_list)
+    {
+        segment = list_entry(it, vm_area_struct_t, vm_list);
+        for (uint32_t addr = max(segment->vm_start, start); addr < segment->vm_end; addr += PAGE_SIZE) {
+            page_table_entry_t *entry = mem_virtual_to_pte(task->mm->pgd, addr);
+            if ((entry == NULL) || !entry->present || !entry->user || entry->global)
+                continue;
+            page_t *page = get_page_from_physical_address(entry->frame * PAGE_SIZE);
+            // Only single anonymous pages, which are not shared nor locked.
+            if (!(page->flags & PG_SWAPPABLE) || (page->flags & PG_MLOCKED) || (page_count(page) != 1))
+                continue;
+            // Recently used, give it a second chance.
+            if (entry->accessed) {
+                entry->accessed = 0;
+                continue;
+            }
+            if (!__swap_out_entry(entry))
+                return reclaimed;
+            if (++reclaimed == count) {
+                // Leave the clock hand here.
+                swap_area.clock_pid  = task->pid;
+                swap_area.clock_addr = addr + PAGE_SIZE;
+                return reclaimed;
+            }
+        }
+    }
+    return reclaimed;
+}
+
+/// @brief Allocates the bitmap of the slots.
+/// @param nr_slots The number of slots, including the one holding the header.
+static void __swap_init_bitmap(uint32_t nr_slots)
+{
+    uint32_t bitmap_size = ((nr_slots + 31U) / 32U) * sizeof(uint32_t);
+    swap_area.nr_slots   = nr_slots;
+    swap_area.bitmap     = kmalloc(bitmap_size);
+    memset(swap_area.bitmap, 0, bitmap_size);
+    swap_area.free_slots = nr_slots;
+    // The first slot contains the header.
+    __swap_set_slot(0);
+}
+
+int swap_initialize(const char *path)
+{
+    memset(&swap_area, 0, sizeof(swap_area_t));
+    // Open the device.
+    vfs_file_t *file = vfs_open(path, O_RDWR, 0);
+    if (file == NULL) {
+        pr_notice("There is no swap device `%s`.\n", path);
+        return -1;
+    }
+    // Read the header.
+    swap_header_t *header = kmalloc(PAGE_SIZE);
+    if (vfs_read(file, header, 0, PAGE_SIZE) != PAGE_SIZE) {
+        pr_err("Failed to read the header of the swap area `%s`.\n", path);
+        goto error_free_header;
+    }
+    // Check the signature, we must not trash a disk that is not meant for swapping.
+    if (strncmp((char *)header + PAGE_SIZE - SWAP_MAGIC_LEN, SWAP_MAGIC, SWAP_MAGIC_LEN)) {
+        pr_notice("The device `%s` is not a swap area (use `mkswap`).\n", path);
+        goto error_free_header;
+    }
+    // Compute the number of slots.
+    uint32_t nr_slots = min(header->last_page + 1U, file->length / PAGE_SIZE);
+    nr_slots          = min(nr_slots, SWAP_MAX_SLOTS);
+    if (nr_slots < 2) {
+        pr_err("The swap area `%s` is too small.\n", path);
+        goto error_free_header;
+    }
+    __swap_init_bitmap(nr_slots);
+    // Skip the bad pages.
+    for (uint32_t i = 0; i < header->nr_badpages; ++i) {
+        uint32_t slot = header->badpages[i];
+        if ((slot > 0) && (slot < swap_area.nr_slots))
+            __swap_set_slot(slot);
+    }
+    swap_area.file = file;
+    kfree(header);
+    pr_notice("Swap area `%s` with %d pages.\n", path, swap_area.free_slots);
+    return 0;
+
+error_free_header:
+    kfree(header);
+    vfs_close(file);
+    return -1;
+}
+
+int swap_initialize_zram(uint32_t nr_pages)
+{
+    memset(&swap_area, 0, sizeof(swap_area_t));
+    // There is no header, but we keep the first slot unused all the same.
+    if (zram_initialize(nr_pages + 1) < 0)
+        return -1;
+    __swap_init_bitmap(nr_pages + 1);
+    swap_area.zram = 1;
+    pr_notice("Compressed swap area with %d pages.\n", swap_area.free_slots);
+    return 0;
+}
+
+int swap_enabled(void)
+{
+    return (swap_area.file != NULL) || swap_area.zram;
+}
+
+unsigned int swap_reclaim_pages(unsigned int count)
+{
+    unsigned int reclaimed = 0;
+    if (!swap_enabled())
+        return 0;
+    // During the first round the hand might just clear the accessed bits,
+    // during the second one it finds the pages that were not used meanwhile.
+    list_head *process_list = scheduler_get_process_list();
+    for (int round = 0; round < 2; ++round) {
+        list_for_each_decl(it, process_list)
+        {
+            task_struct *task = list_entry(it, task_struct, run_list);
+            // Move forward up to the process pointed by the clock hand.
+            if ((task->pid < swap_area.clock_pid) || !__swap_can_reclaim_from(task))
+                continue;
+            uint32_t start = (task->pid == swap_area.clock_pid) ? swap_area.clock_addr : 0;
+            reclaimed += __swap_scan_task(task, start, count - reclaimed);
+            if ((reclaimed == count) || (swap_area.free_slots == 0))
+                return reclaimed;
+        }
+        // Wrap the clock hand around.
+        swap_area.clock_pid  = 0;
+        swap_area.clock_addr = 0;
+    }
+    pr_debug("Reclaimed %d out of %d pages.\n", reclaimed, count);
+    return reclaimed;
+}
+
+int swap_in(page_table_entry_t *entry)
+{
+    assert(pte_is_swapped(entry) && "The page is not inside the swap area.");
+    uint32_t slot = entry->frame;
+    // Allocate a new page.
+    page_t *page = _alloc_pages(GFP_HIGHUSER, 0);
+    if (__swap_transfer(page, slot, 0) < 0) {
+        __free_pages(page);
+        return -1;
+    }
+    // The slot is no longer needed.
+    __swap_clear_slot(slot);
+    // The page can be swapped out again.
+    page->flags |= PG_SWAPPABLE;
+    // Restore the entry.
+    entry->frame     = get_physical_address_from_page(page) >> 12U;
+    entry->available = 1;
+    entry->present   = 1;
+    ++swap_area.pswpin;
+    return 0;
+}
+
+void swap_free_entry(page_table_entry_t *entry)
+{
+    assert(pte_is_swapped(entry) && "The page is not inside the swap area.");
+    __swap_clear_slot(entry->frame);
+    // Leave an empty entry.
+    *(uint32_t *)entry = 0;
+}
+
+void swap_get_info(swap_info_t *info)
+{
+    // The first slot contains the header.
+    info->total_slots = swap_area.nr_slots ? swap_area.nr_slots - 1 : 0;
+    info->free_slots  = swap_area.free_slots;
+    info->pswpin      = swap_area.pswpin;
+    info->pswpout     = swap_area.pswpout;
+}
@@ -100,6 +100,26 @@ uint32_t virt_map_physical_pages(page_t *page, int pfn_count)
     return virt_address;
 }
 
+uint32_t virt_map_io(uint32_t phy_address, uint32_t size)
+{
+    uint32_t offset        = phy_address & (PAGE_SIZE - 1);
+    uint32_t pfn_count     = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    virt_map_page_t *vpage = _alloc_virt_pages(pfn_count);
+    if (!vpage)
+        return 0;
+
+    uint32_t virt_address = VIRT_PAGE_TO_ADDRESS(vpage);
+    mem_upd_vm_area(paging_get_main_directory(), virt_address, phy_address - offset,
+                    pfn_count * PAGE_SIZE, MM_PRESENT | MM_RW | MM_GLOBAL | MM_UPDADDR);
+    // Device registers must not be cached.
+    for (uint32_t i = 0; i < pfn_count; ++i) {
+        page_table_entry_t *entry = mem_virtual_to_pte(paging_get_main_directory(), virt_address + i * PAGE_SIZE);
+        entry->cache              = 1;
+        paging_flush_tlb_single(virt_address + i * PAGE_SIZE);
+    }
+    return virt_address + offset;
+}
+
 virt_map_page_t *virt_map_alloc(uint32_t size)
 {
     uint32_t pages_count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
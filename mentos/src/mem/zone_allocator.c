@@ -16,6 +16,8 @@
 #include "kernel.h"
 #include "assert.h"
 #include "mem/paging.h"
+#include "mem/vmem_map.h"
+#include "mem/swap.h"
 #include "string.h"
 #include "io/debug.h"
 
@@ -89,7 +91,8 @@ static zone_t *get_zone_from_page(page_t *page)
 /// @return The zone requested.
 static zone_t *get_zone_from_flags(gfp_t gfp_mask)
 {
-    switch (gfp_mask) {
+    // Action modifiers do not change the zone.
+    switch (gfp_mask & ~__GFP_ZERO) {
     case GFP_KERNEL:
     case GFP_ATOMIC:
     case GFP_NOFS:
@@ -233,6 +236,9 @@ static void zone_init(char *name, int zone_index, uint32_t adr_from, uint32_t ad
              zone->zone_mem_map, zone->zone_mem_map + zone->size, zone->size);
     // Set to zero all page structures.
     memset(zone->zone_mem_map, 0, zone->size * sizeof(page_t));
+    // Initialize the pool of pre-zeroed pages.
+    list_head_init(&zone->zero_pool);
+    zone->zero_pool_pages = 0;
     // Initialize the buddy system for the new zone.
     buddy_system_init(&zone->buddy_system,
                       name,
@@ -405,6 +411,73 @@ uint32_t __alloc_pages_lowmem(gfp_t gfp_mask, uint32_t order)
     return block_frame_adr;
 }
 
+/// @brief Sets to zero the content of the given page frames.
+/// @param zone  The zone the pages belong to.
+/// @param page  The first page of the block.
+/// @param count The number of contiguous pages to clear.
+static void __zone_clear_pages(zone_t *zone, page_t *page, uint32_t count)
+{
+    if (zone == &contig_page_data->node_zones[ZONE_NORMAL]) {
+        // Lowmem pages are directly mapped.
+        memset((void *)get_lowmem_address_from_page(page), 0, count * PAGE_SIZE);
+    } else {
+        // Highmem pages must be temporarily mapped.
+        uint32_t vaddr = virt_map_physical_pages(page, count);
+        memset((void *)vaddr, 0, count * PAGE_SIZE);
+        virt_unmap(vaddr);
+    }
+}
+
+/// @brief Removes a page from the pre-zeroed pool of the zone.
+/// @param zone The zone.
+/// @return A zeroed page, or NULL if the pool is empty.
+static page_t *__zone_zero_pool_pop(zone_t *zone)
+{
+    if (list_head_empty(&zone->zero_pool))
+        return NULL;
+    // While inside the pool, the page is not managed by the slab, so we can
+    // use its `slabs` list to link it.
+    page_t *page = list_entry(zone->zero_pool.next, page_t, slabs);
+    list_head_del(&page->slabs);
+    --zone->zero_pool_pages;
+    return page;
+}
+
+/// @brief Gives back to the buddy system all the pages of the pre-zeroed pool.
+/// @param zone The zone.
+static void __zone_zero_pool_drain(zone_t *zone)
+{
+    page_t *page;
+    while ((page = __zone_zero_pool_pop(zone)) != NULL) {
+        bb_free_pages(&zone->buddy_system, &page->bbpage);
+    }
+}
+
+/// @brief Adds up to `batch` zeroed pages to the pool of the zone.
+/// @param zone  The zone.
+/// @param batch The maximum number of pages to zero.
+/// @return The number of pages added to the pool.
+static unsigned int __zone_zero_pool_fill(zone_t *zone, unsigned int batch)
+{
+    unsigned int added = 0;
+    bb_page_t *bbpage;
+    // Never take the last free pages of the zone, they are worth more to
+    // real allocations than to the pool.
+    while ((added < batch) &&
+           (zone->zero_pool_pages < ZONE_ZERO_POOL_MAX) &&
+           (zone->free_pages > (zone->zero_pool_pages + ZONE_ZERO_POOL_MAX))) {
+        bbpage = bb_alloc_pages(&zone->buddy_system, 0);
+        if (bbpage == NULL)
+            break;
+        page_t *page = PG_FROM_BBSTRUCT(bbpage, page_t, bbpage);
+        __zone_clear_pages(zone, page, 1);
+        list_head_add_tail(&page->slabs, &zone->zero_pool);
+        ++zone->zero_pool_pages;
+        ++added;
+    }
+    return added;
+}
+
 page_t *_alloc_pages(gfp_t gfp_mask, uint32_t order)
 {
     uint32_t block_size = 1UL << order;
@@ -412,16 +485,39 @@ page_t *_alloc_pages(gfp_t gfp_mask, uint32_t order)
     zone_t *zone = get_zone_from_flags(gfp_mask);
     page_t *page = NULL;
 
-    // Search for a block of page frames by using the BuddySystem.
-    page = PG_FROM_BBSTRUCT(bb_alloc_pages(&zone->buddy_system, order), page_t, bbpage);
+    // Single zeroed pages are taken from the pre-zeroed pool, if possible.
+    if ((gfp_mask & __GFP_ZERO) && (order == 0)) {
+        page = __zone_zero_pool_pop(zone);
+    }
+    if (page == NULL) {
+        // Search for a block of page frames by using the BuddySystem.
+        bb_page_t *bbpage = bb_alloc_pages(&zone->buddy_system, order);
+        // Give the pre-zeroed pages back to the buddy system, and retry.
+        if ((bbpage == NULL) && zone->zero_pool_pages) {
+            __zone_zero_pool_drain(zone);
+            bbpage = bb_alloc_pages(&zone->buddy_system, order);
+        }
+        // Swap out some user pages, if the caller can wait for the I/O.
+        if ((bbpage == NULL) && (gfp_mask & __GFP_HIGHMEM) && (gfp_mask & __GFP_IO)) {
+            if (swap_reclaim_pages(max(block_size, SWAP_RECLAIM_BATCH)))
+                bbpage = bb_alloc_pages(&zone->buddy_system, order);
+        }
+        if (bbpage) {
+            page = PG_FROM_BBSTRUCT(bbpage, page_t, bbpage);
+        }
+        // Clear the pages, if requested.
+        if (page && (gfp_mask & __GFP_ZERO)) {
+            __zone_clear_pages(zone, page, block_size);
+        }
+    }
+
+    assert(page && "Cannot allocate pages.");
 
     // Set page counters
     for (int i = 0; i < block_size; i++) {
         set_page_count(&page[i], 1);
     }
 
-    assert(page && "Cannot allocate pages.");
-
     // Decrement the number of pages in the zone.
     if (page) {
         zone->free_pages -= block_size;
@@ -449,6 +545,7 @@ void __free_pages(page_t *page)
 
     for (int i = 0; i < block_size; i++) {
         set_page_count(&page[i], 0);
+        page[i].flags = 0;
     }
 
     bb_free_pages(&zone->buddy_system, &page->bbpage);
@@ -474,6 +571,23 @@ unsigned long get_zone_free_space(gfp_t gfp_mask)
     return buddy_system_get_free_space(&zone->buddy_system);
 }
 
+unsigned long get_zone_zero_pool_pages(gfp_t gfp_mask)
+{
+    zone_t *zone = get_zone_from_flags(gfp_mask);
+    assert(zone && "Cannot retrieve the correct zone.");
+    return zone->zero_pool_pages;
+}
+
+unsigned int zone_zero_pool_refill(unsigned int batch)
+{
+    unsigned int added = 0;
+    // The pool is used mostly by user pages, so start from highmem.
+    for (int zone_index = contig_page_data->nr_zones - 1; zone_index >= 0; --zone_index) {
+        added += __zone_zero_pool_fill(contig_page_data->node_zones + zone_index, batch);
+    }
+    return added;
+}
+
 unsigned long get_zone_cached_space(gfp_t gfp_mask)
 {
     zone_t *zone = get_zone_from_flags(gfp_mask);
@@ -0,0 +1,181 @@
+/// @file zram.c
+/// @brief Compressed in-memory store for swapped out pages.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+// Include the kernel log levels.
+#include "sys/kernel_levels.h"
+/// Change the header.
+#define __DEBUG_HEADER__ "[ZRAM  ]"
+/// Set the log level.
+#define __DEBUG_LEVEL__ LOGLEVEL_NOTICE
+
+#include "mem/zram.h"
+#include "mem/paging.h"
+#include "mem/slab.h"
+#include "klib/lzf.h"
+#include "io/debug.h"
+#include "assert.h"
+#include "string.h"
+
+/// Compressed pages larger than this are stored as they are, since a kmalloc
+/// object of this size, or more, takes a whole page anyway.
+#define ZRAM_MAX_COMPR_SIZE (PAGE_SIZE / 2)
+
+/// @brief A stored page.
+typedef struct zram_slot_t {
+    /// The stored data, NULL if the page is filled with zeros.
+    void *data;
+    /// The length of the stored data, PAGE_SIZE if it is not compressed.
+    uint16_t size;
+    /// If the slot contains a page.
+    uint16_t used;
+} zram_slot_t;
+
+/// @brief The compressed store.
+typedef struct zram_t {
+    /// The stored pages.
+    zram_slot_t *table;
+    /// The number of slots.
+    uint32_t nr_pages;
+    /// Statistics.
+    zram_info_t info;
+} zram_t;
+
+/// The only compressed store.
+static zram_t zram;
+/// Where pages are compressed.
+static uint8_t zram_buffer[ZRAM_MAX_COMPR_SIZE];
+
+/// @brief Computes the memory actually taken by an object of the given size.
+/// @param size The size of the object.
+/// @return The size of the memory used.
+static inline unsigned long __zram_object_size(uint32_t size)
+{
+    // Stored inside a raw page.
+    if (size >= ZRAM_MAX_COMPR_SIZE)
+        return PAGE_SIZE;
+    // Stored inside the smallest kmalloc cache that fits it.
+    unsigned long object_size = 1;
+    while (object_size < size)
+        object_size <<= 1U;
+    return object_size;
+}
+
+/// @brief Checks if the page is filled with zeros.
+/// @param data The content of the page.
+/// @return 1 if it is, 0 otherwise.
+static inline int __zram_page_is_zero(const void *data)
+{
+    const uint32_t *word = (const uint32_t *)data;
+    for (uint32_t i = 0; i < (PAGE_SIZE / sizeof(uint32_t)); ++i)
+        if (word[i])
+            return 0;
+    return 1;
+}
+
+int zram_initialize(uint32_t nr_pages)
+{
+    memset(&zram, 0, sizeof(zram_t));
+    zram.table = kmalloc(nr_pages * sizeof(zram_slot_t));
+    if (zram.table == NULL) {
+        pr_err("Failed to allocate the table of the compressed store.\n");
+        return -1;
+    }
+    memset(zram.table, 0, nr_pages * sizeof(zram_slot_t));
+    zram.nr_pages = nr_pages;
+    pr_notice("Compressed store with %d pages, and a pool of %d KB.\n", nr_pages, ZRAM_MAX_POOL_SIZE / 1024U);
+    return 0;
+}
+
+int zram_write_page(uint32_t index, const void *data)
+{
+    assert((index < zram.nr_pages) && "The index is outside the compressed store.");
+    assert(!zram.table[index].used && "The slot of the compressed store is already in use.");
+    zram_slot_t *slot = &zram.table[index];
+    // Pages filled with zeros are only accounted.
+    if (__zram_page_is_zero(data)) {
+        slot->data = NULL;
+        slot->size = 0;
+        slot->used = 1;
+        ++zram.info.zero_pages;
+        ++zram.info.pages_stored;
+        zram.info.orig_data_size += PAGE_SIZE;
+        return 0;
+    }
+    // Compress the page, if it does not shrink enough store it as it is.
+    uint32_t size = lzf_compress(data, PAGE_SIZE, zram_buffer, ZRAM_MAX_COMPR_SIZE - 1);
+    if (size == 0)
+        size = PAGE_SIZE;
+    // Check that the pool does not grow too much.
+    if ((zram.info.mem_used + __zram_object_size(size)) > ZRAM_MAX_POOL_SIZE) {
+        ++zram.info.failed_writes;
+        return -1;
+    }
+    if (size == PAGE_SIZE) {
+        slot->data = (void *)__alloc_pages_lowmem(GFP_KERNEL, 0);
+    } else {
+        slot->data = kmalloc(size);
+    }
+    if (slot->data == NULL) {
+        ++zram.info.failed_writes;
+        return -1;
+    }
+    memcpy(slot->data, (size == PAGE_SIZE) ? data : zram_buffer, size);
+    slot->size = size;
+    slot->used = 1;
+    // Update the statistics.
+    if (size == PAGE_SIZE)
+        ++zram.info.huge_pages;
+    ++zram.info.pages_stored;
+    zram.info.orig_data_size += PAGE_SIZE;
+    zram.info.compr_data_size += size;
+    zram.info.mem_used += __zram_object_size(size);
+    return 0;
+}
+
+int zram_read_page(uint32_t index, void *data)
+{
+    assert((index < zram.nr_pages) && "The index is outside the compressed store.");
+    zram_slot_t *slot = &zram.table[index];
+    assert(slot->used && "The slot of the compressed store is empty.");
+    if (slot->data == NULL) {
+        memset(data, 0, PAGE_SIZE);
+    } else if (slot->size == PAGE_SIZE) {
+        memcpy(data, slot->data, PAGE_SIZE);
+    } else if (lzf_decompress(slot->data, slot->size, data, PAGE_SIZE) != PAGE_SIZE) {
+        pr_err("Failed to decompress the page %d.\n", index);
+        return -1;
+    }
+    return 0;
+}
+
+void zram_free_page(uint32_t index)
+{
+    assert((index < zram.nr_pages) && "The index is outside the compressed store.");
+    zram_slot_t *slot = &zram.table[index];
+    if (!slot->used)
+        return;
+    if (slot->data == NULL) {
+        --zram.info.zero_pages;
+    } else {
+        if (slot->size == PAGE_SIZE) {
+            free_pages_lowmem((uint32_t)slot->data);
+            --zram.info.huge_pages;
+        } else {
+            kfree(slot->data);
+        }
+        zram.info.compr_data_size -= slot->size;
+        zram.info.mem_used -= __zram_object_size(slot->size);
+    }
+    --zram.info.pages_stored;
+    zram.info.orig_data_size -= PAGE_SIZE;
+    slot->data = NULL;
+    slot->size = 0;
+    slot->used = 0;
+}
+
+void zram_get_info(zram_info_t *info)
+{
+    *info = zram.info;
+}
@@ -92,13 +92,8 @@ static int __reset_process(task_struct *task)
         return 0;
     }
 
-    // Save the current page directory.
-    page_directory_t *crtdir = paging_get_current_directory();
-    // FIXME: Now to clear the stack a pgdir switch is made, it should be a kernel mmapping.
-    paging_switch_directory_va(task->mm->pgd);
-
-    // Clean stack space.
-    memset((char *)task->mm->start_stack, 0, DEFAULT_STACK_SIZE);
+    // The stack is lazily allocated, and its pages are zeroed when they are
+    // first touched, so there is no need to clean it here.
     // Set the base address of the stack.
     task->thread.regs.ebp = (uintptr_t)(task->mm->start_stack + DEFAULT_STACK_SIZE);
     // Set the top address of the stack.
@@ -106,9 +101,6 @@ static int __reset_process(task_struct *task)
     // Enable the interrupts.
     task->thread.regs.eflags = task->thread.regs.eflags | EFLAG_IF;
 
-    // Restore previous pgdir
-    paging_switch_directory(crtdir);
-
     return 1;
 }
 
@@ -62,6 +62,11 @@ task_struct *scheduler_get_current_process()
     return runqueue.curr;
 }
 
+list_head *scheduler_get_process_list()
+{
+    return &runqueue.queue;
+}
+
 time_t scheduler_get_maximum_vruntime()
 {
     time_t vruntime = 0;
@@ -67,6 +67,22 @@ int relocate_modules()
     return 1;
 }
 
+void release_module(multiboot_module_t *module)
+{
+    // Find the module.
+    int i = 0;
+    while ((i < MAX_MODULES) && (&modules[i] != module))
+        ++i;
+    if ((i == MAX_MODULES) || !module->mod_start)
+        return;
+    // Free the relocated copy, with its command line.
+    kfree((void *)module->mod_start);
+    // Keep the remaining modules contiguous.
+    for (; i < (MAX_MODULES - 1); ++i)
+        memcpy(&modules[i], &modules[i + 1], sizeof(multiboot_module_t));
+    memset(&modules[MAX_MODULES - 1], 0, sizeof(multiboot_module_t));
+}
+
 uintptr_t get_address_after_modules()
 {
     // By default the first valid address is end.
@@ -91,6 +91,12 @@ void syscall_init()
     sys_call_table[__NR_time]           = (SystemCall)sys_time;
     sys_call_table[__NR_sigprocmask]    = (SystemCall)sys_sigprocmask;
     sys_call_table[__NR_brk]            = (SystemCall)sys_brk;
+    sys_call_table[__NR_madvise]        = (SystemCall)sys_madvise;
+    sys_call_table[__NR_mlock]          = (SystemCall)sys_mlock;
+    sys_call_table[__NR_munlock]        = (SystemCall)sys_munlock;
+    sys_call_table[__NR_sync]           = (SystemCall)sys_sync;
+    sys_call_table[__NR_fsync]          = (SystemCall)sys_fsync;
+    sys_call_table[__NR_fdatasync]      = (SystemCall)sys_fdatasync;
     sys_call_table[__NR_signal]         = (SystemCall)sys_signal;
     sys_call_table[__NR_ioctl]          = (SystemCall)sys_ioctl;
     sys_call_table[__NR_sched_setparam] = (SystemCall)sys_sched_setparam;
@@ -0,0 +1,78 @@
+/// @file t_blkdev.c
+/// @brief Tests writes which cover part of a sector of a disk.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#include <sys/unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strerror.h>
+
+/// The disk used by the test, a RAM disk, so the root disk is never touched.
+#define DEVICE "/dev/ram0"
+/// The size of a sector.
+#define SECTOR 512
+/// Size of the write, smaller than a sector.
+#define SIZE 100
+
+/// The original content of the first sector.
+static char original[SECTOR];
+/// The data written inside the sector.
+static char wbuffer[SIZE];
+/// The content of the sector read back.
+static char rbuffer[SECTOR];
+
+/// @brief Writes the buffer at the beginning of the disk.
+/// @param fd the disk.
+/// @param buffer the buffer.
+/// @param size the size of the buffer.
+/// @return 0 on success, 1 on failure.
+static int write_at_start(int fd, char *buffer, int size)
+{
+    if ((lseek(fd, 0, SEEK_SET) != 0) || (write(fd, buffer, size) != size)) {
+        printf("Failed to write `%s`: %s\n", DEVICE, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = open(DEVICE, O_RDWR, 0);
+    if (fd < 0) {
+        printf("Failed to open `%s`: %s\n", DEVICE, strerror(errno));
+        return 1;
+    }
+    if (read(fd, original, SECTOR) != SECTOR) {
+        printf("Failed to read `%s`: %s\n", DEVICE, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    for (int i = 0; i < SIZE; ++i)
+        wbuffer[i] = (char)~original[i];
+    // Starts at the beginning of a sector, and ends inside it.
+    if (write_at_start(fd, wbuffer, SIZE)) {
+        close(fd);
+        return 1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    int ret = 0;
+    if (read(fd, rbuffer, SECTOR) != SECTOR) {
+        printf("Failed to read `%s`: %s\n", DEVICE, strerror(errno));
+        ret = 1;
+    } else if (memcmp(rbuffer, wbuffer, SIZE) != 0) {
+        printf("The written bytes are wrong.\n");
+        ret = 1;
+    } else if (memcmp(rbuffer + SIZE, original + SIZE, SECTOR - SIZE) != 0) {
+        printf("The rest of the sector was not preserved.\n");
+        ret = 1;
+    }
+    // Put the sector back as it was.
+    if (write_at_start(fd, original, SECTOR))
+        ret = 1;
+    close(fd);
+    if (ret == 0)
+        printf("Partial writes of a sector work.\n");
+    return ret;
+}
@@ -0,0 +1,69 @@
+/// @file t_fsync.c
+/// @brief Tests the write back of modified files.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#include <sys/unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strerror.h>
+
+/// The file used by the test.
+#define FILENAME "/home/user/t_fsync.txt"
+/// Size of the data written inside the file.
+#define SIZE 8192
+
+/// The data written inside the file.
+static char wbuffer[SIZE];
+/// The data read back.
+static char rbuffer[SIZE];
+
+int main(int argc, char *argv[])
+{
+    for (int i = 0; i < SIZE; ++i)
+        wbuffer[i] = (char)('a' + (i % 26));
+    int fd = open(FILENAME, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        printf("Failed to create `%s`: %s\n", FILENAME, strerror(errno));
+        return 1;
+    }
+    if (write(fd, wbuffer, SIZE) != SIZE) {
+        printf("Failed to write `%s`: %s\n", FILENAME, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    if (fsync(fd) == -1) {
+        printf("fsync failed: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+    if (fdatasync(fd) == -1) {
+        printf("fdatasync failed: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    sync();
+    // Read the data back.
+    fd = open(FILENAME, O_RDONLY, 0);
+    if (fd < 0) {
+        printf("Failed to open `%s`: %s\n", FILENAME, strerror(errno));
+        return 1;
+    }
+    if ((read(fd, rbuffer, SIZE) != SIZE) || (memcmp(wbuffer, rbuffer, SIZE) != 0)) {
+        printf("The content of `%s` is wrong.\n", FILENAME);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    unlink(FILENAME);
+    // Closed and invalid file descriptors must be rejected.
+    if ((fsync(fd) != -1) || (errno != EBADF) || (fdatasync(-1) != -1) || (errno != EBADF)) {
+        printf("fsync accepted an invalid file descriptor.\n");
+        return 1;
+    }
+    printf("Write back of modified files works.\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+/// @file t_madvise.c
+/// @brief Tests memory advice and locking.
+/// @copyright (c) 2014-2022 This file is distributed under the MIT License.
+/// See LICENSE.md for details.
+
+#include <sys/unistd.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strerror.h>
+
+/// Number of pages of the buffer.
+#define PAGES 16
+/// The size of a page.
+#define PAGE 4096
+
+/// The buffer, inside the bss, which is lazily allocated.
+static char buffer[PAGES * PAGE] __attribute__((aligned(PAGE)));
+
+int main(int argc, char *argv[])
+{
+    if (madvise(buffer, sizeof(buffer), MADV_SEQUENTIAL) == -1) {
+        printf("madvise(MADV_SEQUENTIAL) failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (madvise(buffer, sizeof(buffer), MADV_WILLNEED) == -1) {
+        printf("madvise(MADV_WILLNEED) failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (mlock(buffer, sizeof(buffer)) == -1) {
+        printf("mlock failed: %s\n", strerror(errno));
+        return 1;
+    }
+    memset(buffer, 0xAA, sizeof(buffer));
+    if (munlock(buffer, sizeof(buffer)) == -1) {
+        printf("munlock failed: %s\n", strerror(errno));
+        return 1;
+    }
+    // Release the pages, the next access must find them zeroed.
+    if (madvise(buffer, sizeof(buffer), MADV_DONTNEED) == -1) {
+        printf("madvise(MADV_DONTNEED) failed: %s\n", strerror(errno));
+        return 1;
+    }
+    for (int i = 0; i < PAGES * PAGE; ++i) {
+        if (buffer[i] != 0) {
+            printf("Byte %d was not released (%d).\n", i, buffer[i]);
+            return 1;
+        }
+    }
+    // Heap pages belong to a larger block, they are cleared in place.
+    char *heap = malloc((PAGES + 1) * PAGE);
+    if (heap == NULL) {
+        printf("Failed to allocate the heap buffer.\n");
+        return 1;
+    }
+    char *pages = (char *)(((unsigned long)heap + PAGE - 1) & ~(PAGE - 1UL));
+    memset(heap, 0x55, (PAGES + 1) * PAGE);
+    if (madvise(pages, PAGES * PAGE, MADV_DONTNEED) == -1) {
+        printf("madvise(MADV_DONTNEED) failed on the heap: %s\n", strerror(errno));
+        return 1;
+    }
+    for (int i = 0; i < PAGES * PAGE; ++i) {
+        if (pages[i] != 0) {
+            printf("Byte %d of the heap was not released (%d).\n", i, pages[i]);
+            return 1;
+        }
+    }
+    free(heap);
+    // Locked pages cannot be released.
+    memset(buffer, 0xAA, PAGE);
+    if (mlock(buffer, PAGE) == -1) {
+        printf("mlock failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if ((madvise(buffer, PAGE, MADV_DONTNEED) != -1) || (errno != EINVAL) || (buffer[0] != (char)0xAA)) {
+        printf("madvise(MADV_DONTNEED) released a locked page.\n");
+        return 1;
+    }
+    munlock(buffer, PAGE);
+    // Unaligned addresses and unknown advice must be rejected.
+    if ((madvise(buffer + 1, PAGE, MADV_NORMAL) != -1) || (madvise(buffer, PAGE, 42) != -1)) {
+        printf("madvise accepted invalid arguments.\n");
+        return 1;
+    }
+    printf("Memory advice and locking work.\n");
+    return 0;
+}